@@ -0,0 +1,40 @@
+#!/bin/bash
+# Finds how many clients a hub sustains on this host: starts JACK with the
+# dummy driver, a hub in client echo mode, and ramps synthetic clients with
+# jacktrip-load until a quality threshold breaks. Extra arguments go to
+# jacktrip-load, e.g. --max-latency 30 --step 4.
+#
+#   hub_load.sh [path/to/jacktrip] [path/to/jacktrip-load] [jacktrip-load options]
+
+JACKTRIP=${1:-./jacktrip}
+LOAD=${2:-./jacktrip-load}
+shift $(( $# < 2 ? $# : 2 ))
+# Hub and clients on their own cores when there are two
+HUB_CPU=${HUB_CPU:-0}
+LOAD_CPU=${LOAD_CPU:-1}
+export JACK_DEFAULT_SERVER=jacktrip-load
+
+cleanup() {
+  kill $HUB_PID 2>/dev/null
+  wait $HUB_PID 2>/dev/null
+  kill $JACKD_PID 2>/dev/null
+}
+trap cleanup EXIT
+
+pin() {
+  if [ "$(nproc)" -gt 1 ]; then
+    taskset -c "$@"
+  else
+    shift
+    "$@"
+  fi
+}
+
+jackd -n jacktrip-load -d dummy -r 48000 -p 128 >/dev/null 2>&1 &
+JACKD_PID=$!
+sleep 2
+pin $HUB_CPU "$JACKTRIP" -S -p 1 --noshm >hub_load_server.log 2>&1 &
+HUB_PID=$!
+sleep 2
+
+pin $LOAD_CPU "$LOAD" --hub-pid $HUB_PID --srate 48000 --bufsize 128 "$@"
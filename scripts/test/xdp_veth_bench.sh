@@ -0,0 +1,55 @@
+#!/bin/bash
+# Compares the AF_XDP datagram path (--xdp) against the kernel UDP path on a
+# veth pair between two network namespaces. Needs root.
+#
+#   xdp_veth_bench.sh [path/to/jacktrip-xdp-bench] [seconds] [datagram size]
+
+BENCH=${1:-./jacktrip-xdp-bench}
+SECONDS_PER_RUN=${2:-5}
+SIZE=${3:-528}
+# Sender and receiver on their own core when there are two
+TX_CPU=${TX_CPU:-0}
+RX_CPU=${RX_CPU:-1}
+NS_A=jt-xdp-a
+NS_B=jt-xdp-b
+
+cleanup() {
+  ip netns del $NS_A 2>/dev/null
+  ip netns del $NS_B 2>/dev/null
+}
+trap cleanup EXIT
+
+cleanup
+ip netns add $NS_A || exit 1
+ip netns add $NS_B || exit 1
+ip link add veth-jt-a netns $NS_A type veth peer name veth-jt-b netns $NS_B || exit 1
+ip -n $NS_A addr add 10.77.0.1/24 dev veth-jt-a
+ip -n $NS_B addr add 10.77.0.2/24 dev veth-jt-b
+ip -n $NS_A link set veth-jt-a up
+ip -n $NS_B link set veth-jt-b up
+# Native XDP on veth only sees the frames while GRO or a program is on the peer
+ip netns exec $NS_A ethtool -K veth-jt-a gro on >/dev/null 2>&1
+ip netns exec $NS_B ethtool -K veth-jt-b gro on >/dev/null 2>&1
+
+pin() {
+  if [ "$(nproc)" -gt 1 ]; then
+    taskset -c "$@"
+  else
+    shift
+    "$@"
+  fi
+}
+
+run() {
+  local rx_opts=$1 tx_opts=$2
+  pin $RX_CPU ip netns exec $NS_B $BENCH recv 10.77.0.2 10.77.0.1 -t $SECONDS_PER_RUN -s $SIZE $rx_opts &
+  local rx_pid=$!
+  sleep 0.5
+  pin $TX_CPU ip netns exec $NS_A $BENCH send 10.77.0.1 10.77.0.2 -t $SECONDS_PER_RUN -s $SIZE $tx_opts
+  wait $rx_pid
+}
+
+echo "== kernel UDP path"
+run "" ""
+echo "== AF_XDP"
+run "-i veth-jt-b" "-i veth-jt-a"
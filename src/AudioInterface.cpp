@@ -37,9 +37,14 @@
 
 #include "AudioInterface.h"
 #include "JackTrip.h"
+#include "LatencyHistogram.h"
+#include "RtCheck.h"
 #include <iostream>
 #include <cmath>
 #include <assert.h>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
 
 using std::cout; using std::endl;
 
@@ -55,8 +60,9 @@ AudioInterface::AudioInterface(JackTrip* jacktrip,
     #ifdef WAIR // WAIR
     mNumNetRevChans(NumNetRevChans),
     #endif // endwhere
-    mAudioBitResolution(AudioBitResolution*8),
+    mAudioBitResolution(getSampleSize(AudioBitResolution)*8),
     mBitResolutionMode(AudioBitResolution),
+    mSampleSize(getSampleSize(AudioBitResolution)),
     mSampleRate(gDefaultSampleRate), mBufferSizeInSamples(gDefaultBufferSizeInSamples),
     mInputPacket(NULL), mOutputPacket(NULL), mLoopBack(false), mProcessingAudio(false)
 {
@@ -218,6 +224,9 @@ void AudioInterface::callback(QVarLengthArray<sample_t*>& in_buffer,
                               QVarLengthArray<sample_t*>& out_buffer,
                               unsigned int n_frames)
 {
+    RTCHECK_SCOPE();
+    const uint64_t start_us = (nullptr != mCallbackHistogram) ? LatencyHistogram::nowUs() : 0;
+
     // Allocate the Process Callback
     //-------------------------------------------------------------------
     // 1) First, process incoming packets
@@ -386,6 +395,9 @@ void AudioInterface::callback(QVarLengthArray<sample_t*>& in_buffer,
     ///********************************************************
     ///********************************************************
 
+    if (nullptr != mCallbackHistogram) {
+        mCallbackHistogram->record(LatencyHistogram::nowUs() - start_us);
+    }
 }
 
 //*******************************************************************************
@@ -405,7 +417,7 @@ void AudioInterface::broadcastCallback(QVarLengthArray<sample_t*>& mon_buffer,
                 fromBitToSampleConversion(
                             // use interleaved channel layout
                             //&mOutputPacket[(i*mSizeInBytesPerChannel) + (j*mBitResolutionMode)],
-                            &mOutputPacket[(j*mBitResolutionMode*mNumOutChans) + (i*mBitResolutionMode)],
+                            &mOutputPacket[(j*mSampleSize*mNumOutChans) + (i*mSampleSize)],
                         &tmp_sample[j], mBitResolutionMode );
             }
         }
@@ -422,7 +434,7 @@ void AudioInterface::computeProcessFromNetwork(QVarLengthArray<sample_t*>& out_b
     // Output Process (from NETWORK to JACK)
     // ----------------------------------------------------------------
     // Read Audio buffer from RingBuffer (read from incoming packets)
-    mJackTrip->receiveNetworkPacket( mOutputPacket );
+    bool silent = mJackTrip->receiveNetworkPacket( mOutputPacket );
 
 #ifdef WAIR // WAIR
     if (mNumNetRevChans)
@@ -434,13 +446,20 @@ void AudioInterface::computeProcessFromNetwork(QVarLengthArray<sample_t*>& out_b
                 fromBitToSampleConversion(
                             // use interleaved channel layout
                             //&mOutputPacket[(i*mSizeInBytesPerChannel) + (j*mBitResolutionMode)],
-                            &mOutputPacket[(j*mBitResolutionMode*mNumOutChans) + (i*mBitResolutionMode)],
+                            &mOutputPacket[(j*mSampleSize*mNumOutChans) + (i*mSampleSize)],
                         &tmp_sample[j], mBitResolutionMode );
             }
         }
     else // not wair
 #endif // endwhere
 
+    if (silent) {
+        // Peers that don't send their silence (--dtx) cost no conversion
+        for (int i = 0; i < mNumOutChans; i++) {
+            std::memset(out_buffer[i], 0, sizeof(sample_t) * n_frames);
+        }
+    }
+    else
         // Extract separate channels to send to Jack
         for (int i = 0; i < mNumOutChans; i++) {
             //--------
@@ -454,7 +473,7 @@ void AudioInterface::computeProcessFromNetwork(QVarLengthArray<sample_t*>& out_b
                 fromBitToSampleConversion(
                             // use interleaved channel layout
                             //&mOutputPacket[(i*mSizeInBytesPerChannel) + (j*mBitResolutionMode)],
-                            &mOutputPacket[(j*mBitResolutionMode*mNumOutChans) + (i*mBitResolutionMode)],
+                            &mOutputPacket[(j*mSampleSize*mNumOutChans) + (i*mSampleSize)],
                         &tmp_sample[j], mBitResolutionMode );
             }
         }
@@ -485,7 +504,7 @@ void AudioInterface::computeProcessToNetwork(QVarLengthArray<sample_t*>& in_buff
                             &tmp_result,
                             // use interleaved channel layout
                             //&mInputPacket[(i*mSizeInBytesPerChannel) + (j*mBitResolutionMode)],
-                            &mInputPacket[(j*mBitResolutionMode*mNumOutChans) + (i*mBitResolutionMode)],
+                            &mInputPacket[(j*mSampleSize*mNumOutChans) + (i*mSampleSize)],
                         mBitResolutionMode );
             }
         }
@@ -509,7 +528,7 @@ void AudioInterface::computeProcessToNetwork(QVarLengthArray<sample_t*>& in_buff
                             &tmp_result,
                             // use interleaved channel layout
                             //&mInputPacket[(i*mSizeInBytesPerChannel) + (j*mBitResolutionMode)],
-                            &mInputPacket[(j*mBitResolutionMode*mNumOutChans) + (i*mBitResolutionMode)],
+                            &mInputPacket[(j*mSampleSize*mNumOutChans) + (i*mSampleSize)],
                         mBitResolutionMode );
             }
         }
@@ -517,6 +536,85 @@ void AudioInterface::computeProcessToNetwork(QVarLengthArray<sample_t*>& in_buff
     mJackTrip->sendNetworkPacket( mInputPacket );
 } // /computeProcessToNetwork
 
+//*******************************************************************************
+// Half-precision float, with the F16C instructions when the compiler targets them
+static inline uint16_t floatToHalf(float value)
+{
+#ifdef __F16C__
+    return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t f;
+    std::memcpy(&f, &value, 4);
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t float_exp = (f >> 23) & 0xff;
+    uint32_t mant = f & 0x7fffff;
+    if (0xff == float_exp) { // inf and nan
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    }
+    int exp = static_cast<int>(float_exp) - 127 + 15;
+    if (31 <= exp) {
+        return sign | 0x7c00;
+    }
+    if (0 >= exp) {
+        // Subnormal, or too small for a half
+        if (-10 > exp) {
+            return sign;
+        }
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (half & 1))) {
+            ++half;
+        }
+        return sign | half;
+    }
+    // Round to nearest even, a carry correctly rounds up into the exponent
+    uint32_t half = (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return sign | half;
+#endif
+}
+
+
+//*******************************************************************************
+static inline float halfToFloat(uint16_t half)
+{
+#ifdef __F16C__
+    return _cvtsh_ss(half);
+#else
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exp = (half >> 10) & 0x1f;
+    uint32_t mant = half & 0x3ff;
+    uint32_t f;
+    if (0 == exp) {
+        if (0 == mant) {
+            f = sign;
+        } else {
+            // Subnormal, normalize it
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                --exp;
+            }
+            f = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else if (31 == exp) {
+        f = sign | 0x7f800000 | (mant << 13);
+    } else {
+        f = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float value;
+    std::memcpy(&value, &f, 4);
+    return value;
+#endif
+}
+
+
 //*******************************************************************************
 // This function quantize from 32 bit to a lower bit resolution
 // 24 bit is not working yet
@@ -528,6 +626,7 @@ void AudioInterface::fromSampleToBitConversion
     int8_t tmp_8;
     uint8_t tmp_u8; // unsigned to quantize the remainder in 24bits
     int16_t tmp_16;
+    uint16_t tmp_u16;
     double tmp_sample;
     sample_t tmp_sample16;
     sample_t tmp_sample8;
@@ -569,6 +668,11 @@ void AudioInterface::fromSampleToBitConversion
         // tmp_sample = std::max(-1.0, std::min(1.0, tmp_sample));
         std::memcpy(output, &tmp_sample, 4); // 32bit = 4 bytes
         break;
+    case FLOAT16 :
+        // No clipping, values over full scale go through to the limiter
+        tmp_u16 = floatToHalf(*input);
+        std::memcpy(output, &tmp_u16, 2); // 16bits = 2 bytes
+        break;
     }
 }
 
@@ -582,6 +686,7 @@ void AudioInterface::fromBitToSampleConversion
     int8_t tmp_8;
     uint8_t tmp_u8;
     int16_t tmp_16;
+    uint16_t tmp_u16;
     sample_t tmp_sample;
     sample_t tmp_sample16;
     sample_t tmp_sample8;
@@ -611,6 +716,11 @@ void AudioInterface::fromBitToSampleConversion
     case BIT32 :
         std::memcpy(output, input, 4); // 4 bytes
         break;
+    case FLOAT16 :
+        std::memcpy(&tmp_u16, input, 2);
+        tmp_sample = halfToFloat(tmp_u16);
+        std::memcpy(output, &tmp_sample, 4); // 4 bytes
+        break;
     }
 }
 
@@ -663,6 +773,18 @@ void AudioInterface::initPlugins()
   }
 }
 
+int AudioInterface::getPluginLatency() const
+{
+  int latency = 0;
+  for (ProcessPlugin* plugin : mProcessPluginsFromNetwork) {
+    latency += plugin->getLatency();
+  }
+  for (ProcessPlugin* plugin : mProcessPluginsToNetwork) {
+    latency += plugin->getLatency();
+  }
+  return latency;
+}
+
 //*******************************************************************************
 AudioInterface::samplingRateT AudioInterface::getSampleRateType() const
 {
@@ -48,6 +48,7 @@
 
 // Forward declarations
 class JackTrip;
+class LatencyHistogram;
 
 //using namespace JackTripNamespace;
 
@@ -63,7 +64,8 @@ public:
         BIT8  = 1, ///< 8 bits
         BIT16 = 2, ///< 16 bits (default)
         BIT24 = 3, ///< 24 bits
-        BIT32 = 4  ///< 32 bits
+        BIT32 = 4, ///< 32 bits
+        FLOAT16 = 0x12 ///< 16 bits half-precision float, the low bits give the size in bytes
     };
 
     /// \brief Sampling Rates supported by JACK
@@ -143,6 +145,8 @@ public:
    * The audio sampling rate (mSampleRate) must be set at this time.
    */
     void initPlugins();
+    /// \brief Latency of the plugins on both directions, in frames
+    int getPluginLatency() const;
     virtual void connectDefaultPorts() = 0;
     /** \brief Convert a 32bit number (sample_t) into one of the bit resolution
    * supported (audioBitResolutionT).
@@ -181,6 +185,8 @@ public:
     virtual void setLoopBack(bool b) { mLoopBack = b; }
     virtual void enableBroadcastOutput() {}
     virtual void setAudioTesterP(AudioTester* atp) { mAudioTesterP = atp; }
+    /// \brief Records the duration of each callback(), in microseconds, NULL to stop
+    void setCallbackHistogram(LatencyHistogram* histogram) { mCallbackHistogram = histogram; }
     //------------------------------------------------------------------
 
     //--------------GETTERS---------------------------------------------
@@ -204,6 +210,10 @@ public:
    * This is one of the audioBitResolutionT set in construction
    */
     virtual int getAudioBitResolution() const { return mAudioBitResolution; }
+    /** \brief Size in bytes of one sample
+     * \param bit_res audioBitResolutionT, or a packet header BitResolution divided by 8
+     */
+    static int getSampleSize(int bit_res) { return bit_res & 0x0f; }
     /** \brief Helper function to get the sample rate (in Hz) for a
    * JackAudioInterface::samplingRateT
    * \param rate_type  JackAudioInterface::samplingRateT enum type
@@ -233,6 +243,7 @@ private:
     QVarLengthArray<sample_t*> mInBufCopy; ///< needed in callback() to modify JACK audio input
     int mAudioBitResolution; ///< Bit resolution in audio samples
     AudioInterface::audioBitResolutionT mBitResolutionMode; ///< Bit resolution (audioBitResolutionT) mode
+    int mSampleSize; ///< Size in bytes of one sample
     uint32_t mSampleRate; ///< Sampling Rate
     uint32_t mDeviceID; ///< RTAudio DeviceID
     uint32_t mBufferSizeInSamples; ///< Buffer size in samples
@@ -245,6 +256,7 @@ private:
     int8_t* mOutputPacket;  ///< Packet containing all the channels to send to the RingBuffer
     bool mLoopBack;
     AudioTester* mAudioTesterP { nullptr };
+    LatencyHistogram* mCallbackHistogram { nullptr };
 protected:
     bool mProcessingAudio;  ///< Set when processing an audio callback buffer pair
     const uint32_t MAX_AUDIO_BUFFER_SIZE = 8192;
@@ -52,12 +52,17 @@
 
 #include <iostream>
 
+#include "NetworkImpairment.h"
+
+class LatencyHistogram; // forward declaration
+
 #include <QThread>
 #include <QHostAddress>
 #include <QMutex>
 #include <QMutexLocker>
 
 class JackTrip; // forward declaration
+class XdpSocket; // forward declaration
 
 
 /** \brief Base class that defines the transmission protocol.
@@ -101,7 +106,8 @@ public:
     enum packetHeaderTypeT {
         DEFAULT, ///< Default application header
         JAMLINK, ///< Header to use with Jamlinks
-        EMPTY    ///< Empty Header
+        EMPTY,   ///< Empty Header
+        COMPACT  ///< Default header, compacted on the wire
     };
 
     /// \brief Enum to define class modes, SENDER or RECEIVER
@@ -109,6 +115,13 @@ public:
         SENDER, ///< Set class as a Sender (send packets)
         RECEIVER ///< Set class as a Receiver (receives packets)
     };
+
+    /// \brief Enum to define how the sender spaces its datagrams
+    enum pacingModeT {
+        NOPACING,    ///< Send as soon as the audio is read
+        USERPACING,  ///< Sleep until the departure time
+        TXTIMEPACING ///< Let the kernel hold the datagrams (SO_TXTIME)
+    };
     //---------------------------------------------------------
 
 
@@ -176,11 +189,51 @@ public:
         uint32_t lost;
         uint32_t outOfOrder;
         uint32_t revived;
+        uint32_t partial; ///< Packets played with some of their fragments missing (--mtu)
         uint32_t statCount;
+        bool rxTimestamps; ///< The jitter fields below are measured
+        uint32_t netJitterUs; ///< Interarrival jitter of the kernel receive timestamps (RFC 3550)
+        uint32_t hostDelayAvgUs; ///< From the kernel receive timestamp to our read, since the last stats
+        uint32_t hostDelayMaxUs;
+        uint32_t roundTripUs; ///< Smoothed round trip time from the timestamp echoes, 0 until measured
     };
     virtual bool getStats(PktStat*) {return false;}
 
-    virtual void setIssueSimulation(double /*loss*/, double /*jitter*/, double /*max_delay*/) {}
+    /// \brief Cumulative network counters, sent back to the peer to adapt its redundancy
+    struct LossFeedback {
+        uint32_t tot;
+        uint32_t lost;
+        uint32_t outOfOrder;
+    };
+    virtual bool getLossFeedback(LossFeedback*) {return false;}
+    virtual void setPeerLossFeedback(const LossFeedback& /*feedback*/) {}
+    virtual void setAdaptiveRedundancy(unsigned int /*max_redundancy*/) {}
+    /// \brief headerCapabilityT bits the peer advertised, tells what we may send it
+    virtual void setPeerCapabilities(uint8_t /*capabilities*/) {}
+    /// \brief Sends timestamp echo requests to measure the round trip time
+    virtual void setLatencyProbe(bool /*enable*/) {}
+    /** \brief Queues the answer to an echo request of the peer
+     * \param orig_us Timestamp of the request, in the peer's clock
+     * \param rx_us When we received it, LatencyHistogram::nowUs()
+     */
+    virtual void setPeerEchoRequest(uint64_t /*orig_us*/, uint64_t /*rx_us*/) {}
+
+    virtual void setIssueSimulation(const NetworkImpairment::Model& /*model*/) {}
+    virtual void setFec(unsigned int /*group_size*/, unsigned int /*parity_count*/) {}
+    virtual void setAggregation(unsigned int /*periods*/) {}
+    virtual void setMtu(int /*mtu*/) {}
+    virtual void setLossless(bool /*lossless*/) {}
+    virtual void setOpus(int /*bitrate*/, int /*complexity*/) {}
+    virtual void setDtx(double /*level_db*/) {}
+    virtual void setPacing(pacingModeT /*mode*/) {}
+    virtual void setXdpSocket(XdpSocket* /*xdp*/) {}
+    virtual void setIoUring(bool /*enable*/) {}
+    virtual void setSharedMemory(bool /*enable*/) {}
+    virtual void setPacketTrace(const QString& /*path*/) {}
+    /** \brief Records the datagram inter-arrival times and the age of the
+     * packets at arrival (against the sender's clock), in microseconds
+     */
+    virtual void setTimingHistograms(LatencyHistogram* /*arrival*/, LatencyHistogram* /*age*/) {}
     void setUseRtPriority(bool use) {mUseRtPriority = use;}
 
 signals:
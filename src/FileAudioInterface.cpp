@@ -0,0 +1,244 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file FileAudioInterface.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "FileAudioInterface.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+static const uint16_t sWavePcm = 1;
+static const uint16_t sWaveFloat = 3;
+static const uint16_t sWaveExtensible = 0xfffe;
+
+//*******************************************************************************
+static inline uint32_t readLe(const unsigned char* p, int bytes)
+{
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+
+//*******************************************************************************
+static inline void writeLe(std::ofstream& file, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        file.put(static_cast<char>((value >> (8*i)) & 0xff));
+    }
+}
+
+
+//*******************************************************************************
+static inline float decodeSample(const unsigned char* p, uint16_t format, int bits)
+{
+    if (sWaveFloat == format) {
+        float sample;
+        std::memcpy(&sample, p, sizeof(sample));
+        return sample;
+    }
+    if (8 == bits) {
+        // 8 bit WAV is unsigned
+        return (int(p[0]) - 128) / 128.0f;
+    }
+    int bytes = bits / 8;
+    // Sign extend from the top byte
+    int32_t value = static_cast<int32_t>(readLe(p, bytes) << (32 - bits));
+    return value / 2147483648.0f;
+}
+
+
+//*******************************************************************************
+FileAudioInterface::FileAudioInterface(JackTrip* jacktrip, int NumChans,
+                                       AudioInterface::audioBitResolutionT AudioBitResolution) :
+    AudioInterface(jacktrip, NumChans, NumChans,
+               #ifdef WAIR // wair
+                   0,
+               #endif // endwhere
+                   AudioBitResolution),
+    mInputPosition(0), mInBuffer(NumChans), mOutBuffer(NumChans),
+    mRecordOutput(false)
+{
+}
+
+
+//*******************************************************************************
+void FileAudioInterface::openInput(const std::string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)),
+                                    std::istreambuf_iterator<char>());
+    if (12 > data.size() || 0 != std::memcmp(data.data(), "RIFF", 4)
+            || 0 != std::memcmp(data.data() + 8, "WAVE", 4)) {
+        throw std::runtime_error("Not a WAV file: " + path);
+    }
+
+    uint16_t format = 0;
+    int num_chans = 0;
+    uint32_t sample_rate = 0;
+    int bits = 0;
+    const unsigned char* samples = NULL;
+    size_t samples_size = 0;
+    size_t pos = 12;
+    while (pos + 8 <= data.size()) {
+        const unsigned char* chunk = data.data() + pos;
+        size_t size = std::min<size_t>(readLe(chunk + 4, 4), data.size() - pos - 8);
+        if (0 == std::memcmp(chunk, "fmt ", 4) && 16 <= size) {
+            format = readLe(chunk + 8, 2);
+            num_chans = readLe(chunk + 10, 2);
+            sample_rate = readLe(chunk + 12, 4);
+            bits = readLe(chunk + 22, 2);
+            if (sWaveExtensible == format && 26 <= size) {
+                format = readLe(chunk + 32, 2); // First bytes of the sub format GUID
+            }
+        } else if (0 == std::memcmp(chunk, "data", 4)) {
+            samples = chunk + 8;
+            samples_size = size;
+        }
+        pos += 8 + size + (size & 1); // Chunks are padded to an even size
+    }
+
+    if (NULL == samples || 0 == num_chans || 0 == sample_rate
+            || !((sWavePcm == format && 0 == bits % 8 && 8 <= bits && 32 >= bits)
+                 || (sWaveFloat == format && 32 == bits))) {
+        throw std::runtime_error("Unsupported WAV format, use PCM or 32 bit float: " + path);
+    }
+
+    int frame_size = num_chans * bits / 8;
+    size_t num_frames = samples_size / frame_size;
+    mInput.assign(num_chans, std::vector<float>(num_frames));
+    for (size_t n = 0; n < num_frames; ++n) {
+        for (int c = 0; c < num_chans; ++c) {
+            mInput[c][n] = decodeSample(samples + n*frame_size + c*bits/8, format, bits);
+        }
+    }
+    mInputPosition = 0;
+    setSampleRate(sample_rate);
+}
+
+
+//*******************************************************************************
+void FileAudioInterface::setup()
+{
+    AudioInterface::setup();
+    int num_chans = getNumInputChannels();
+    int nframes = getBufferSizeInSamples();
+    mInData.assign(num_chans * nframes, 0.0f);
+    mOutData.assign(num_chans * nframes, 0.0f);
+    for (int c = 0; c < num_chans; ++c) {
+        mInBuffer[c] = mInData.data() + c*nframes;
+        mOutBuffer[c] = mOutData.data() + c*nframes;
+    }
+}
+
+
+//*******************************************************************************
+bool FileAudioInterface::processPeriod()
+{
+    int num_chans = getNumInputChannels();
+    size_t nframes = getBufferSizeInSamples();
+    size_t available = getInputFramesLeft();
+    size_t count = std::min(nframes, available);
+    for (int c = 0; c < num_chans; ++c) {
+        if (0 < count) {
+            const std::vector<float>& channel = mInput[std::min<size_t>(c, mInput.size() - 1)];
+            std::copy(channel.begin() + mInputPosition,
+                      channel.begin() + mInputPosition + count, mInBuffer[c]);
+        }
+        std::fill(mInBuffer[c] + count, mInBuffer[c] + nframes, 0.0f);
+    }
+    mInputPosition += count;
+
+    callback(mInBuffer, mOutBuffer, nframes);
+
+    if (mRecordOutput) {
+        for (size_t n = 0; n < nframes; ++n) {
+            for (int c = 0; c < num_chans; ++c) {
+                mOutput.push_back(mOutBuffer[c][n]);
+            }
+        }
+    }
+    return 0 < available;
+}
+
+
+//*******************************************************************************
+size_t FileAudioInterface::getInputFramesLeft() const
+{
+    return mInput.empty() ? 0 : mInput[0].size() - mInputPosition;
+}
+
+
+//*******************************************************************************
+std::vector<float> FileAudioInterface::getInputMono() const
+{
+    std::vector<float> mono(mInput.empty() ? 0 : mInput[0].size(), 0.0f);
+    for (size_t c = 0; c < mInput.size(); ++c) {
+        for (size_t n = 0; n < mono.size(); ++n) {
+            mono[n] += mInput[c][n] / mInput.size();
+        }
+    }
+    return mono;
+}
+
+
+//*******************************************************************************
+void FileAudioInterface::writeOutput(const std::string& path) const
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    int num_chans = getNumOutputChannels();
+    uint32_t data_size = mOutput.size() * sizeof(float);
+    file.write("RIFF", 4);
+    writeLe(file, 36 + data_size, 4);
+    file.write("WAVEfmt ", 8);
+    writeLe(file, 16, 4);
+    writeLe(file, sWaveFloat, 2);
+    writeLe(file, num_chans, 2);
+    writeLe(file, getSampleRate(), 4);
+    writeLe(file, getSampleRate() * num_chans * sizeof(float), 4);
+    writeLe(file, num_chans * sizeof(float), 2);
+    writeLe(file, 32, 2);
+    file.write("data", 4);
+    writeLe(file, data_size, 4);
+    file.write(reinterpret_cast<const char*>(mOutput.data()), data_size);
+    if (!file) {
+        throw std::runtime_error("Could not write " + path);
+    }
+}
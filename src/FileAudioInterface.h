@@ -0,0 +1,109 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file FileAudioInterface.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __FILEAUDIOINTERFACE_H__
+#define __FILEAUDIOINTERFACE_H__
+
+#include <string>
+#include <vector>
+
+#include <QVarLengthArray>
+
+#include "AudioInterface.h"
+
+/** \brief Audio interface that reads its input from a WAV file and keeps its output
+ *
+ * There is no audio thread: whoever owns the interface calls processPeriod()
+ * once per period, so the audio can run on a virtual clock, faster than real
+ * time. The input is 8/16/24/32 bit PCM or 32 bit float, with any number of
+ * channels (missing ones repeat the last channel). The output can be written
+ * as a 32 bit float WAV.
+ */
+class FileAudioInterface : public AudioInterface
+{
+public:
+
+    /** \brief The class constructor
+     * \param jacktrip Pointer to the JackTrip class that connects all classes (mediator)
+     * \param NumChans Number of channels, inputs and outputs
+     * \param AudioBitResolution Audio Sample Resolutions in bits
+     */
+    FileAudioInterface(JackTrip* jacktrip, int NumChans,
+                       AudioInterface::audioBitResolutionT AudioBitResolution =
+            AudioInterface::BIT16);
+    virtual ~FileAudioInterface() {}
+
+    /** \brief Loads the input file, and sets the sample rate to the file's one
+     * \throw std::runtime_error if the file can't be read
+     */
+    void openInput(const std::string& path);
+    /// \brief Allocates the buffers, call it after openInput() and setBufferSizeInSamples()
+    virtual void setup();
+    virtual int startProcess() const { return 0; }
+    virtual int stopProcess() const { return 0; }
+    virtual void connectDefaultPorts() {}
+    virtual void setClientName(QString /*ClientName*/) {}
+
+    /** \brief Runs the callback for one period. Past the end of the input,
+     * or without input, the input is silence.
+     * \return false once the whole input has been played
+     */
+    bool processPeriod();
+    /// \brief Input frames not played yet
+    size_t getInputFramesLeft() const;
+    /// \brief Input of all channels mixed to mono, e.g., as a reference signal
+    std::vector<float> getInputMono() const;
+    /// \brief Output of the last period
+    const QVarLengthArray<sample_t*>& getOutputBuffer() const { return mOutBuffer; }
+
+    /// \brief Keeps the output of every period, for writeOutput()
+    void setRecordOutput(bool record) { mRecordOutput = record; }
+    /// \throw std::runtime_error if the file can't be written
+    void writeOutput(const std::string& path) const;
+
+private:
+    std::vector< std::vector<float> > mInput; ///< One vector per channel of the file
+    size_t mInputPosition;
+    std::vector<sample_t> mInData;
+    std::vector<sample_t> mOutData;
+    QVarLengthArray<sample_t*> mInBuffer;
+    QVarLengthArray<sample_t*> mOutBuffer;
+    bool mRecordOutput;
+    std::vector<float> mOutput; ///< Interleaved
+};
+
+#endif // __FILEAUDIOINTERFACE_H__
@@ -0,0 +1,530 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file IoUringSocket.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "IoUringSocket.h"
+
+#include <iostream>
+
+using std::cerr; using std::endl;
+
+#if defined (__LINUX__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+/// \brief Buffers and headers of one queued sendmsg
+struct IoUringSocket::SendSlot {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage name;
+    union {
+        char buf[64];
+        size_t align; ///< As struct cmsghdr
+    } control;
+    std::vector<char> data;
+};
+
+static const uint64_t sCancelUserData = ~1ULL;
+
+
+//*******************************************************************************
+IoUringSocket::IoUringSocket() :
+    mFd(-1), mSocket(-1), mReceiver(false), mMaxDatagram(0),
+    mRingMap(NULL), mRingMapSize(0), mCqMap(NULL), mCqMapSize(0),
+    mSqes(NULL), mSqesSize(0),
+    mSqTail(NULL), mSqArray(NULL), mSqMask(0), mSqLocalTail(0), mSqPending(0),
+    mCqHead(NULL), mCqTail(NULL), mCqMask(0), mCqes(NULL),
+    mRecvMsg(NULL), mBufRing(NULL), mBufRingSize(0), mBufTail(0),
+    mBuffers(NULL), mBufferSize(0), mArmed(false),
+    mSendErrors(0)
+{
+}
+
+
+//*******************************************************************************
+IoUringSocket* IoUringSocket::create(int udp_socket, bool receiver, size_t max_datagram,
+                                     size_t control_size)
+{
+    IoUringSocket* uring = new IoUringSocket();
+    if (!uring->open(udp_socket, receiver, max_datagram, control_size)) {
+        cerr << "Could not use io_uring, using the socket calls" << endl;
+        delete uring;
+        return NULL;
+    }
+    return uring;
+}
+
+
+//*******************************************************************************
+bool IoUringSocket::open(int udp_socket, bool receiver, size_t max_datagram, size_t control_size)
+{
+    mSocket = udp_socket;
+    mReceiver = receiver;
+    mMaxDatagram = max_datagram;
+
+    // Completions are only posted when the thread enters the kernel, which it
+    // does anyway to wait or submit, so it's never interrupted for them
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    mFd = ::syscall(__NR_io_uring_setup, sRingEntries, &params);
+    if (0 > mFd && EINVAL == errno) {
+        std::memset(&params, 0, sizeof(params));
+        mFd = ::syscall(__NR_io_uring_setup, sRingEntries, &params);
+    }
+    if (0 > mFd) {
+        cerr << "Could not create an io_uring: " << std::strerror(errno) << endl;
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        cerr << "io_uring needs Linux 5.11 or newer" << endl;
+        return false;
+    }
+
+    // Both queues share one mapping, the entries have their own
+    mRingMapSize = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                                    params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    mRingMap = ::mmap(NULL, mRingMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      mFd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == mRingMap) {
+        mRingMap = NULL;
+        return false;
+    }
+    mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    mSqes = ::mmap(NULL, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   mFd, IORING_OFF_SQES);
+    if (MAP_FAILED == mSqes) {
+        mSqes = NULL;
+        return false;
+    }
+    int8_t* base = static_cast<int8_t*>(mRingMap);
+    mSqTail = reinterpret_cast<uint32_t*>(base + params.sq_off.tail);
+    mSqArray = reinterpret_cast<uint32_t*>(base + params.sq_off.array);
+    mSqMask = *reinterpret_cast<uint32_t*>(base + params.sq_off.ring_mask);
+    mSqLocalTail = *mSqTail;
+    mCqHead = reinterpret_cast<uint32_t*>(base + params.cq_off.head);
+    mCqTail = reinterpret_cast<uint32_t*>(base + params.cq_off.tail);
+    mCqMask = *reinterpret_cast<uint32_t*>(base + params.cq_off.ring_mask);
+    mCqes = base + params.cq_off.cqes;
+    // Entry i always sits in slot i
+    for (uint32_t i = 0; i < params.sq_entries; ++i) {
+        mSqArray[i] = i;
+    }
+
+    if (!mReceiver) {
+        for (unsigned i = 0; i < sNumSendSlots; ++i) {
+            SendSlot* slot = new SendSlot;
+            slot->data.resize(mMaxDatagram);
+            mSendSlots.push_back(slot);
+            mFreeSendSlots.push_back(i);
+        }
+        return true;
+    }
+
+    // Each buffer holds the recvmsg header, the ancillary data and the datagram
+    mBufferSize = (sizeof(struct io_uring_recvmsg_out) + control_size + mMaxDatagram + 63) & ~size_t(63);
+    mBuffers = new int8_t[sNumBuffers * mBufferSize];
+    mBufRingSize = sNumBuffers * sizeof(struct io_uring_buf);
+    mBufRing = ::mmap(NULL, mBufRingSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (MAP_FAILED == mBufRing) {
+        mBufRing = NULL;
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(mBufRing);
+    reg.ring_entries = sNumBuffers;
+    reg.bgid = 0;
+    if (0 != ::syscall(__NR_io_uring_register, mFd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        cerr << "io_uring provided buffer rings need Linux 5.19 or newer" << endl;
+        return false;
+    }
+    for (unsigned bid = 0; bid < sNumBuffers; ++bid) {
+        recycleBuffer(bid);
+    }
+    mRecvMsg = new struct msghdr;
+    std::memset(mRecvMsg, 0, sizeof(*mRecvMsg));
+    mRecvMsg->msg_controllen = control_size;
+
+    // A kernel without multishot recvmsg fails the request right away
+    arm();
+    reap();
+    if (!mArmed) {
+        cerr << "io_uring multishot receive needs Linux 6.0 or newer" << endl;
+        return false;
+    }
+    return true;
+}
+
+
+//*******************************************************************************
+void IoUringSocket::close()
+{
+    if (0 <= mFd && NULL != mCqes) {
+        if (mReceiver && mArmed) {
+            // Stop the receive before its buffers go away
+            struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(nextSqe());
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = sRecvUserData;
+            sqe->user_data = sCancelUserData;
+            enter(mSqPending, 0, -1);
+        }
+        if (!mReceiver) {
+            flush();
+        }
+        // Wait for the requests in flight, at most 100 ms
+        for (int i = 0; i < 10 && (mArmed || mFreeSendSlots.size() < mSendSlots.size()); ++i) {
+            enter(0, 1, 10000);
+            uint32_t head = *mCqHead;
+            uint32_t tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const struct io_uring_cqe* cqe = static_cast<struct io_uring_cqe*>(mCqes) + (head & mCqMask);
+                if (sRecvUserData == cqe->user_data) {
+                    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                        mArmed = false;
+                    }
+                } else if (sCancelUserData != cqe->user_data) {
+                    mFreeSendSlots.push_back(cqe->user_data);
+                }
+            }
+            __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+
+//*******************************************************************************
+IoUringSocket::~IoUringSocket()
+{
+    // The kernel may still write into the buffers of a receive that wasn't
+    // cancelled, better leak them
+    bool in_flight = mArmed || mFreeSendSlots.size() < mSendSlots.size();
+    if (in_flight) {
+        cerr << "io_uring requests still in flight, leaking their buffers" << endl;
+    }
+    if (NULL != mSqes) {
+        ::munmap(mSqes, mSqesSize);
+    }
+    if (NULL != mRingMap) {
+        ::munmap(mRingMap, mRingMapSize);
+    }
+    if (0 <= mFd) {
+        ::close(mFd);
+    }
+    if (in_flight) {
+        return;
+    }
+    if (NULL != mBufRing) {
+        ::munmap(mBufRing, mBufRingSize);
+    }
+    delete[] mBuffers;
+    delete mRecvMsg;
+    for (SendSlot* slot : mSendSlots) {
+        delete slot;
+    }
+}
+
+
+//*******************************************************************************
+void* IoUringSocket::nextSqe()
+{
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(mSqes) + (mSqLocalTail & mSqMask);
+    std::memset(sqe, 0, sizeof(*sqe));
+    ++mSqLocalTail;
+    ++mSqPending;
+    return sqe;
+}
+
+
+//*******************************************************************************
+int IoUringSocket::enter(unsigned to_submit, unsigned min_complete, int timeout_usec)
+{
+    if (0 < to_submit) {
+        __atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+    }
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void* argp = NULL;
+    size_t argsz = 0;
+    if (0 < min_complete) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (0 <= timeout_usec) {
+            ts.tv_sec = timeout_usec / 1000000;
+            ts.tv_nsec = (timeout_usec % 1000000) * 1000LL;
+            std::memset(&arg, 0, sizeof(arg));
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    int ret = ::syscall(__NR_io_uring_enter, mFd, to_submit, min_complete, flags, argp, argsz);
+    if (0 < to_submit && 0 < ret) {
+        mSqPending -= std::min<unsigned>(ret, mSqPending);
+    }
+    return ret;
+}
+
+
+//*******************************************************************************
+void IoUringSocket::arm()
+{
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(nextSqe());
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = mSocket;
+    sqe->addr = reinterpret_cast<uint64_t>(mRecvMsg);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = sRecvUserData;
+    mArmed = true;
+    enter(mSqPending, 0, -1);
+}
+
+
+//*******************************************************************************
+void IoUringSocket::recycleBuffer(unsigned bid)
+{
+    // The ring tail is the reserved field of the first entry. The bufs member
+    // of io_uring_buf_ring can't be used, C++ moves its flexible array.
+    struct io_uring_buf* bufs = static_cast<struct io_uring_buf*>(mBufRing);
+    struct io_uring_buf* buf = &bufs[mBufTail & (sNumBuffers - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(mBuffers + bid * mBufferSize);
+    buf->len = mBufferSize;
+    buf->bid = bid;
+    ++mBufTail;
+    __atomic_store_n(&bufs[0].resv, mBufTail, __ATOMIC_RELEASE);
+}
+
+
+//*******************************************************************************
+void IoUringSocket::reap()
+{
+    uint32_t head = *mCqHead;
+    uint32_t tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe* cqe = static_cast<struct io_uring_cqe*>(mCqes) + (head & mCqMask);
+        if (sRecvUserData == cqe->user_data) {
+            if (0 <= cqe->res && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                break;
+            }
+            // Out of buffers or an error, either ends the receive
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                mArmed = false;
+            }
+        } else {
+            if (0 > cqe->res) {
+                ++mSendErrors;
+            }
+            mFreeSendSlots.push_back(cqe->user_data);
+        }
+    }
+    __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+}
+
+
+//*******************************************************************************
+bool IoUringSocket::available()
+{
+    reap();
+    if (*mCqHead != __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+    if (!mArmed) {
+        arm();
+    }
+    return false;
+}
+
+
+//*******************************************************************************
+bool IoUringSocket::wait(int timeout_usec)
+{
+    if (available()) {
+        return true;
+    }
+    enter(mSqPending, 1, timeout_usec);
+    return available();
+}
+
+
+//*******************************************************************************
+int IoUringSocket::receive(const Segment* segments, int count, bool peek, Segment* control)
+{
+    if (!available()) {
+        return -1;
+    }
+    uint32_t head = *mCqHead;
+    const struct io_uring_cqe* cqe = static_cast<struct io_uring_cqe*>(mCqes) + (head & mCqMask);
+    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    const int8_t* buf = mBuffers + bid * mBufferSize;
+    struct io_uring_recvmsg_out out;
+    std::memcpy(&out, buf, sizeof(out));
+    const int8_t* control_data = buf + sizeof(out) + mRecvMsg->msg_namelen;
+    const int8_t* payload = control_data + mRecvMsg->msg_controllen;
+    // A truncated datagram reports its full length
+    size_t offset = payload - buf;
+    size_t payload_size = (static_cast<size_t>(cqe->res) > offset)
+            ? std::min<size_t>(out.payloadlen, cqe->res - offset) : 0;
+
+    size_t copied = 0;
+    for (int i = 0; i < count && copied < payload_size; ++i) {
+        size_t n = std::min(segments[i].size, payload_size - copied);
+        std::memcpy(segments[i].data, payload + copied, n);
+        copied += n;
+    }
+    if (NULL != control) {
+        control->size = std::min<size_t>(control->size, out.controllen);
+        std::memcpy(control->data, control_data, control->size);
+    }
+
+    if (!peek) {
+        bool more = (cqe->flags & IORING_CQE_F_MORE);
+        recycleBuffer(bid);
+        __atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+        if (!more) {
+            arm();
+        }
+    }
+    return copied;
+}
+
+
+//*******************************************************************************
+int IoUringSocket::send(const Segment* segments, int count, const Segment* name,
+                        const Segment* control)
+{
+    size_t size = 0;
+    for (int i = 0; i < count; ++i) {
+        size += segments[i].size;
+    }
+    if (mReceiver || mMaxDatagram < size
+            || (NULL != name && sizeof(struct sockaddr_storage) < name->size)
+            || (NULL != control && sizeof(SendSlot().control) < control->size)) {
+        return -1;
+    }
+    if (mFreeSendSlots.empty()) {
+        reap();
+    }
+    if (mFreeSendSlots.empty()) {
+        // More in flight than a period ever sends, the socket must be stuck
+        flush();
+        enter(0, 1, 1000);
+        reap();
+        if (mFreeSendSlots.empty()) {
+            return -1;
+        }
+    }
+    unsigned index = mFreeSendSlots.back();
+    mFreeSendSlots.pop_back();
+    SendSlot* slot = mSendSlots[index];
+
+    size_t offset = 0;
+    for (int i = 0; i < count; ++i) {
+        std::memcpy(slot->data.data() + offset, segments[i].data, segments[i].size);
+        offset += segments[i].size;
+    }
+    std::memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->iov.iov_base = slot->data.data();
+    slot->iov.iov_len = size;
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+    if (NULL != name) {
+        std::memcpy(&slot->name, name->data, name->size);
+        slot->msg.msg_name = &slot->name;
+        slot->msg.msg_namelen = name->size;
+    }
+    if (NULL != control && 0 < control->size) {
+        std::memcpy(slot->control.buf, control->data, control->size);
+        slot->msg.msg_control = slot->control.buf;
+        slot->msg.msg_controllen = control->size;
+    }
+
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(nextSqe());
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = mSocket;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot->msg);
+    sqe->len = 1;
+    sqe->user_data = index;
+    return size;
+}
+
+
+//*******************************************************************************
+int IoUringSocket::flush()
+{
+    int submitted = 0;
+    if (0 < mSqPending) {
+        submitted = std::max(0, enter(mSqPending, 0, -1));
+    }
+    reap();
+    return submitted;
+}
+
+#else // __LINUX__
+
+//*******************************************************************************
+IoUringSocket* IoUringSocket::create(int /*udp_socket*/, bool /*receiver*/, size_t /*max_datagram*/,
+                                     size_t /*control_size*/)
+{
+    cerr << "io_uring is Linux only, using the socket calls" << endl;
+    return NULL;
+}
+
+IoUringSocket::~IoUringSocket() {}
+void IoUringSocket::close() {}
+bool IoUringSocket::available() { return false; }
+bool IoUringSocket::wait(int /*timeout_usec*/) { return false; }
+int IoUringSocket::receive(const Segment* /*segments*/, int /*count*/, bool /*peek*/,
+                           Segment* /*control*/) { return -1; }
+int IoUringSocket::send(const Segment* /*segments*/, int /*count*/, const Segment* /*name*/,
+                        const Segment* /*control*/) { return -1; }
+int IoUringSocket::flush() { return 0; }
+
+#endif // __LINUX__
@@ -0,0 +1,168 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file IoUringSocket.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __IOURINGSOCKET_H__
+#define __IOURINGSOCKET_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct msghdr;
+
+/** \brief io_uring instance that receives or sends the datagrams of a UDP
+ * socket (Linux only)
+ *
+ * A receiving ring keeps one multishot recvmsg armed on the socket. The kernel
+ * picks a buffer from a ring of provided buffers for each datagram and posts a
+ * completion, so available() only looks at shared memory and wait() is the
+ * only syscall left, one per wakeup instead of a poll every 100 us.
+ *
+ * A sending ring copies each datagram into a slot and queues a sendmsg for it.
+ * flush() submits all of them with one syscall and frees the slots of the
+ * ones that completed. The sends are not linked: they are submitted in order,
+ * and a failed one must not cancel the other datagrams of the period.
+ *
+ * Each ring belongs to the thread that created it (IORING_SETUP_SINGLE_ISSUER),
+ * which also has to close() it before deleting it.
+ */
+class IoUringSocket
+{
+public:
+
+    /// \brief Piece of a datagram, to gather or scatter it
+    struct Segment {
+        char* data;
+        size_t size;
+    };
+
+    /** \brief Sets up a ring for one direction of a UDP socket
+     * \param udp_socket Bound UDP socket
+     * \param receiver Receive from the socket, otherwise only send
+     * \param max_datagram Size of the largest datagram
+     * \param control_size Room for the ancillary data (e.g., timestamps) of each received datagram
+     * \return NULL if io_uring can't be used, the reason is printed
+     */
+    static IoUringSocket* create(int udp_socket, bool receiver, size_t max_datagram,
+                                 size_t control_size = 0);
+    /// \brief Frees the buffers, only once close() has stopped the kernel using them
+    virtual ~IoUringSocket();
+    /** \brief Cancels the receive, sends what is queued and waits for the
+     * requests in flight. Only the thread that created the ring can submit to it.
+     */
+    void close();
+
+    /// \brief True if a received datagram is waiting, without a syscall
+    bool available();
+    /// \brief Blocks until a datagram arrives or timeout_usec pass, returns available()
+    bool wait(int timeout_usec);
+    /** \brief Scatters the next received datagram into segments
+     * \param peek Leave the datagram for the next call
+     * \param control If not NULL, receives the ancillary data, its size is updated
+     * \return Bytes copied, -1 if there was no datagram
+     */
+    int receive(const Segment* segments, int count, bool peek = false, Segment* control = NULL);
+    int receive(char* buf, size_t n)
+    { Segment segment = {buf, n}; return receive(&segment, 1); }
+
+    /** \brief Gathers segments into a datagram and queues it, flush() sends it
+     * \param name Peer address for an unconnected socket, or NULL
+     * \param control Ancillary data (e.g., SCM_TXTIME), or NULL
+     * \return Bytes queued, -1 if it has to go through the socket instead
+     */
+    int send(const Segment* segments, int count, const Segment* name = NULL,
+             const Segment* control = NULL);
+    /// \brief Submits the queued datagrams, returns how many
+    int flush();
+    /// \brief Sends that failed
+    uint64_t getSendErrors() const { return mSendErrors; }
+
+private:
+    struct SendSlot;
+
+    static const unsigned sRingEntries = 64;
+    static const unsigned sNumBuffers = 32; ///< Provided buffers, a power of 2
+    static const unsigned sNumSendSlots = 32;
+    static const uint64_t sRecvUserData = ~0ULL;
+
+    IoUringSocket();
+    bool open(int udp_socket, bool receiver, size_t max_datagram, size_t control_size);
+    void* nextSqe();
+    int enter(unsigned to_submit, unsigned min_complete, int timeout_usec);
+    void arm();
+    void recycleBuffer(unsigned bid);
+    /// \brief Consumes the completions up to the first received datagram
+    void reap();
+
+    int mFd;
+    int mSocket;
+    bool mReceiver;
+    size_t mMaxDatagram;
+
+    // Submission and completion queues, mapped from the kernel
+    void* mRingMap;
+    size_t mRingMapSize;
+    void* mCqMap;
+    size_t mCqMapSize;
+    void* mSqes;
+    size_t mSqesSize;
+    uint32_t* mSqTail;
+    uint32_t* mSqArray;
+    uint32_t mSqMask;
+    uint32_t mSqLocalTail; ///< Our tail, published on submission
+    unsigned mSqPending;
+    uint32_t* mCqHead;
+    uint32_t* mCqTail;
+    uint32_t mCqMask;
+    void* mCqes;
+
+    // Receiving
+    struct msghdr* mRecvMsg; ///< Layout of the buffers for the multishot recvmsg
+    void* mBufRing;
+    size_t mBufRingSize;
+    uint16_t mBufTail;
+    int8_t* mBuffers;
+    size_t mBufferSize;
+    bool mArmed;
+
+    // Sending
+    std::vector<SendSlot*> mSendSlots;
+    std::vector<unsigned> mFreeSendSlots;
+    uint64_t mSendErrors;
+};
+
+#endif // __IOURINGSOCKET_H__
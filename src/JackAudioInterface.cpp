@@ -38,6 +38,7 @@
 #include "JackAudioInterface.h"
 #include "jacktrip_globals.h"
 #include "JackTrip.h"
+#include "RtCheck.h"
 
 #include <cstdlib>
 #include <cstring>
@@ -338,6 +339,7 @@ int JackAudioInterface::processCallback(jack_nframes_t nframes)
 //*******************************************************************************
 int JackAudioInterface::wrapperProcessCallback(jack_nframes_t nframes, void *arg)
 {
+    RTCHECK_SCOPE();
     return static_cast<JackAudioInterface*>(arg)->processCallback(nframes);
 }
 
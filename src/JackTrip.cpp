@@ -37,8 +37,11 @@
 
 #include "JackTrip.h"
 #include "UdpDataProtocol.h"
+#include "XdpSocket.h"
 #include "RingBufferWavetable.h"
 #include "JitterBuffer.h"
+#include "OpusCodec.h"
+#include "LosslessCodec.h"
 #include "jacktrip_globals.h"
 #include "JackAudioInterface.h"
 #ifdef __RT_AUDIO__
@@ -47,6 +50,8 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 #include <QHostAddress>
@@ -128,10 +133,31 @@ JackTrip::JackTrip(jacktripModeT JacktripMode,
     mConnectDefaultAudioPorts(true),
     mIOStatTimeout(0),
     mIOStatLogStream(std::cout.rdbuf()),
+    mMetricsPort(0),
+    mMetricsExporter(NULL),
+    mMetricsSession("0"),
+    mStatsShm(false),
+    mStatsSegment(NULL),
+    mOwnsStatsSegment(false),
+    mStatsSlot(-1),
+    mSessionMetrics(),
     mSimulatedLossRate(0.0),
     mSimulatedJitterRate(0.0),
     mSimulatedDelayRel(0.0),
     mUseRtUdpPriority(false),
+    mFecGroupSize(0),
+    mFecParityCount(0),
+    mAdaptiveRedundancyMax(0),
+    mAggregation(1),
+    mMtu(0),
+    mLossless(false),
+    mOpusBitrate(0),
+    mOpusComplexity(0),
+    mDtxLevel(0.0),
+    mPacing(DataProtocol::NOPACING),
+    mXdpQueue(0),
+    mXdpSocket(NULL),
+    mIoUring(false),
     mAudioTesterP(nullptr)
 {
     createHeader(mPacketHeaderType);
@@ -143,8 +169,18 @@ JackTrip::JackTrip(jacktripModeT JacktripMode,
 JackTrip::~JackTrip()
 {
     //wait();
+    if (NULL != mMetricsExporter) {
+        mMetricsExporter->removeSession(mMetricsSession);
+    }
+    if (NULL != mStatsSegment) {
+        mStatsSegment->releaseSlot(mStatsSlot);
+        if (mOwnsStatsSegment) {
+            delete mStatsSegment;
+        }
+    }
     delete mDataProtocolSender;
     delete mDataProtocolReceiver;
+    delete mXdpSocket;
     delete mAudioInterface;
     delete mPacketHeader;
     delete mSendRingBuffer;
@@ -266,6 +302,7 @@ void JackTrip::setupDataProtocol()
     // Create DataProtocol Objects
     switch (mDataProtocol) {
     case UDP:
+    case SHM:
         std::cout << "Using UDP Protocol" << std::endl;
         QThread::usleep(100);
         mDataProtocolSender = new UdpDataProtocol(this, DataProtocol::SENDER,
@@ -275,14 +312,86 @@ void JackTrip::setupDataProtocol()
         mDataProtocolReceiver =  new UdpDataProtocol(this, DataProtocol::RECEIVER,
                                                      mReceiverBindPort, mReceiverPeerPort,
                                                      mRedundancy);
-        if (0.0 < mSimulatedLossRate || 0.0 < mSimulatedJitterRate || 0.0 < simulated_max_delay) {
-            mDataProtocolReceiver->setIssueSimulation(mSimulatedLossRate, mSimulatedJitterRate, simulated_max_delay);
+        if (0.0 < mSimulatedLossRate || 0.0 < mSimulatedJitterRate || !mSimulatedModel.isEmpty()) {
+            NetworkImpairment::Model model;
+            NetworkImpairment::parseModel(mSimulatedModel.toStdString(), &model);
+            model.lossRate = mSimulatedLossRate;
+            model.jitterRate = mSimulatedJitterRate;
+            model.jitterMaxDelaySec = simulated_max_delay;
+            mDataProtocolReceiver->setIssueSimulation(model);
         }
         mDataProtocolSender->setUseRtPriority(mUseRtUdpPriority);
         mDataProtocolReceiver->setUseRtPriority(mUseRtUdpPriority);
         if (mUseRtUdpPriority) {
             cout << "Using RT thread priority for UDP data" << endl;
         }
+        if (0 < mFecGroupSize) {
+            mDataProtocolSender->setFec(mFecGroupSize, mFecParityCount);
+            mDataProtocolReceiver->setFec(mFecGroupSize, mFecParityCount);
+            // The receiver holds packets back for a whole group
+            cout << "Using parity FEC: " << mFecParityCount << " parity packet(s) every "
+                 << mFecGroupSize << " packets (+" << 100.0 * mFecParityCount / mFecGroupSize
+                 << "% bandwidth, +" << 1000.0 * mFecGroupSize * getBufferSizeInSamples() / getSampleRate()
+                 << " ms latency)" << endl;
+        }
+        if (0 < mAdaptiveRedundancyMax) {
+            // Call after setFec(), the limits depend on it
+            mDataProtocolSender->setAdaptiveRedundancy(mAdaptiveRedundancyMax);
+            mDataProtocolReceiver->setAdaptiveRedundancy(mAdaptiveRedundancyMax);
+            cout << "Adapting " << ((0 < mFecGroupSize) ? "FEC parity count" : "redundancy")
+                 << " to peer packet loss, up to " << mAdaptiveRedundancyMax << endl;
+        }
+        if (1 < mAggregation) {
+            mDataProtocolSender->setAggregation(mAggregation);
+            mDataProtocolReceiver->setAggregation(mAggregation);
+            // The oldest period of a datagram waits for the newest one
+            cout << "Sending " << mAggregation << " periods per datagram (1/" << mAggregation
+                 << " packet rate, +" << 1000.0 * (mAggregation - 1) * getBufferSizeInSamples() / getSampleRate()
+                 << " ms latency)" << endl;
+        }
+        if (0 < mMtu) {
+            mDataProtocolSender->setMtu(mMtu);
+            mDataProtocolReceiver->setMtu(mMtu);
+        }
+        if (mLossless) {
+            if (!LosslessCodec::isPacketSizeSupported(getTotalAudioPacketSizeInBytes(), getNumChannels())) {
+                throw std::invalid_argument("Lossless compression needs less than 64 KB of audio per period");
+            }
+            mDataProtocolSender->setLossless(mLossless);
+            mDataProtocolReceiver->setLossless(mLossless);
+            cout << "Compressing the audio losslessly" << endl;
+        }
+        if (0 < mOpusBitrate) {
+            // The period is only known once the audio interface is set up
+            if (!OpusCodec::isFrameSizeSupported(getSampleRate(), getBufferSizeInSamples())) {
+                throw std::invalid_argument("Opus needs an even period of 1 ms to 1024 samples");
+            }
+            mDataProtocolSender->setOpus(mOpusBitrate, mOpusComplexity);
+            mDataProtocolReceiver->setOpus(mOpusBitrate, mOpusComplexity);
+            cout << "Using Opus at " << mOpusBitrate / 1000 << " kbit/s, complexity "
+                 << mOpusComplexity << endl;
+        }
+        if (0.0 > mDtxLevel) {
+            // Receivers always understand the keep-alive markers
+            mDataProtocolSender->setDtx(mDtxLevel);
+            cout << "Not sending the packets under " << mDtxLevel << " dBFS" << endl;
+        }
+        if (DataProtocol::NOPACING != mPacing) {
+            mDataProtocolSender->setPacing(mPacing);
+            cout << "Pacing the datagrams to the audio period" << endl;
+        }
+        if (mIoUring) {
+            mDataProtocolSender->setIoUring(true);
+            mDataProtocolReceiver->setIoUring(true);
+        }
+        if (!mPacketTrace.isEmpty()) {
+            mDataProtocolReceiver->setPacketTrace(mPacketTrace);
+        }
+        if (SHM == mDataProtocol) {
+            // Negotiated with the peer once connected, UDP until then
+            mDataProtocolSender->setSharedMemory(true);
+            mDataProtocolReceiver->setSharedMemory(true);
+        }
         std::cout << gPrintSeparator << std::endl;
         break;
     case TCP:
@@ -426,6 +535,25 @@ void JackTrip::startProcess(
     createHeader(mPacketHeaderType);
     setupDataProtocol();
     setupRingBuffers();
+    if (0 < mMetricsPort && NULL == mMetricsExporter) {
+        mMetricsExporter = new MetricsExporter(this);
+        if (!mMetricsExporter->listen(mMetricsPort)) {
+            throw std::runtime_error(QString("Metrics server on port %1 ERROR: %2")
+                                     .arg(mMetricsPort).arg(mMetricsExporter->errorString())
+                                     .toStdString());
+        }
+    }
+    if (mStatsShm && NULL == mStatsSegment) {
+        mStatsSegment = StatsSegment::create();
+        mOwnsStatsSegment = true;
+        if (NULL == mStatsSegment) {
+            std::cerr << "WARNING: Couldn't create the shared memory statistics for jacktrip-top" << endl;
+        }
+    }
+    if (NULL != mStatsSegment && -1 == mStatsSlot) {
+        mStatsSlot = mStatsSegment->acquireSlot();
+    }
+    setupHistograms();
     // Connect Signals and Slots
     // -------------------------
     QObject::connect(mPacketHeader, &PacketHeader::signalError,
@@ -494,6 +622,20 @@ void JackTrip::completeConnection()
     mDataProtocolReceiver->setSocket(sock_fd);
     mDataProtocolSender->setSocket(sock_fd);
 
+#if defined (__LINUX__)
+    // The receiver has bound and connected the socket, so the addresses are known
+    if (!mXdpInterface.isEmpty() && -1 != sock_fd) {
+        mXdpSocket = XdpSocket::create(mXdpInterface.toStdString(), mXdpQueue, sock_fd);
+        if (NULL != mXdpSocket) {
+            mDataProtocolReceiver->setXdpSocket(mXdpSocket);
+            mDataProtocolSender->setXdpSocket(mXdpSocket);
+            cout << "Using AF_XDP on " << mXdpInterface.toStdString()
+                 << " queue " << mXdpSocket->getQueue()
+                 << (mXdpSocket->isZeroCopy() ? " (zero-copy mode)" : " (copy mode)") << endl;
+        }
+    }
+#endif
+
     // Start Threads
     if (gVerboseFlag) std::cout << "  JackTrip:startProcess before mDataProtocolReceiver->start" << std::endl;
     mDataProtocolReceiver->start();
@@ -521,18 +663,113 @@ void JackTrip::completeConnection()
 
     if (mConnectDefaultAudioPorts) {  mAudioInterface->connectDefaultPorts(); }
     
-    //Start our IO stat timer
-    if (mIOStatTimeout > 0) {
-        cout << "STATS" << mIOStatTimeout << endl;
+    //Start our IO stat timer, which also feeds the metrics server and jacktrip-top
+    if (hasStatConsumers()) {
+        if (mIOStatTimeout > 0) {
+            cout << "STATS" << mIOStatTimeout << endl;
+        }
         if (!mIOStatStream.isNull()) {
             mIOStatLogStream.rdbuf(((std::ostream *)mIOStatStream.data())->rdbuf());
         }
         QTimer *timer = new QTimer(this);
         connect(timer, SIGNAL(timeout()), this, SLOT(onStatTimer()));
-        timer->start(mIOStatTimeout*1000);
+        timer->start((mIOStatTimeout > 0) ? mIOStatTimeout*1000 : 1000);
     }
 }
 
+//*******************************************************************************
+void JackTrip::setupHistograms()
+{
+    // Only the stat timer reads them, the threads are not started yet
+    if (!hasStatConsumers()) {
+        return;
+    }
+    mAudioInterface->setCallbackHistogram(&mCallbackHistogram);
+    mReceiveRingBuffer->setLevelHistogram(&mLevelHistogram, mAudioBufferSize);
+    mSendRingBuffer->setWakeupHistogram(&mWakeupHistogram);
+    mDataProtocolReceiver->setTimingHistograms(&mArrivalHistogram, &mAgeHistogram);
+    mDataProtocolSender->setLatencyProbe(true);
+}
+
+
+//*******************************************************************************
+void JackTrip::updateLatencyBudget(const DataProtocol::PktStat& pkt_stat,
+                                   const LatencyHistogram::Summary& wakeup,
+                                   const LatencyHistogram::Summary& level)
+{
+    // Medians of the last interval; the network stage waits for the first echo
+    uint64_t rate = std::max(1, getSampleRate());
+    uint64_t period_us = (1000000ULL * getBufferSizeInSamples()) / rate;
+    uint64_t* budget = mSessionMetrics.budgetUs;
+    budget[MetricsExporter::PERIOD] = period_us;
+    budget[MetricsExporter::SEND_QUEUE] = wakeup.p50;
+    budget[MetricsExporter::NETWORK] = pkt_stat.roundTripUs / 2;
+    budget[MetricsExporter::JITTER_BUFFER] = (1000000ULL * level.p50) / rate;
+    // The receiver holds a whole FEC group back, the sender the aggregated periods
+    budget[MetricsExporter::FEC_HOLD] = (mFecGroupSize + std::max(1u, mAggregation) - 1) * period_us;
+    budget[MetricsExporter::PLUGIN] = (1000000ULL * mAudioInterface->getPluginLatency()) / rate;
+    mSessionMetrics.roundTripUs = pkt_stat.roundTripUs;
+}
+
+
+//*******************************************************************************
+static void printTails(std::ostream& out, const char* name, const LatencyHistogram::Summary& summary)
+{
+    out << " " << name << ": " << summary.p50
+        << "/" << summary.p99
+        << "/" << summary.p999
+        << "/" << summary.max;
+}
+
+
+//*******************************************************************************
+static void copyLabel(char* dst, size_t size, const QString& label)
+{
+    QByteArray utf8 = label.toUtf8();
+    size_t length = std::min(size - 1, static_cast<size_t>(utf8.size()));
+    std::memcpy(dst, utf8.constData(), length);
+    dst[length] = '\0';
+}
+
+
+//*******************************************************************************
+static StatsSegment::Tails toTails(const MetricsExporter::Tail& tail)
+{
+    StatsSegment::Tails tails = {tail.last.p50, tail.last.p99, tail.last.p999, tail.last.max};
+    return tails;
+}
+
+
+//*******************************************************************************
+void JackTrip::publishStats()
+{
+    StatsSegment::SessionStats stats;
+    std::memset(&stats, 0, sizeof(stats));
+    copyLabel(stats.session, sizeof(stats.session), mMetricsSession);
+    copyLabel(stats.peer, sizeof(stats.peer), mSessionMetrics.peer);
+    copyLabel(stats.client, sizeof(stats.client), mSessionMetrics.client);
+    stats.updatedUs = QDateTime::currentMSecsSinceEpoch() * 1000;
+    stats.packets = mSessionMetrics.packets;
+    stats.lost = mSessionMetrics.lost;
+    stats.outOfOrder = mSessionMetrics.outOfOrder;
+    stats.revived = mSessionMetrics.revived;
+    stats.underruns = mSessionMetrics.underruns;
+    stats.overflows = mSessionMetrics.overflows;
+    stats.bufIncUnderrun = mSessionMetrics.bufIncUnderrun;
+    stats.bufIncCompensate = mSessionMetrics.bufIncCompensate;
+    stats.bufDecOverflows = mSessionMetrics.bufDecOverflows;
+    stats.bufDecPktLoss = mSessionMetrics.bufDecPktLoss;
+    stats.queueLevel = mSessionMetrics.queueLevel;
+    stats.skew = mSessionMetrics.skew;
+    stats.callback = toTails(mSessionMetrics.callback);
+    stats.arrival = toTails(mSessionMetrics.arrival);
+    stats.level = toTails(mSessionMetrics.level);
+    stats.wakeup = toTails(mSessionMetrics.wakeup);
+    stats.age = toTails(mSessionMetrics.age);
+    mStatsSegment->publish(mStatsSlot, stats);
+}
+
+
 //*******************************************************************************
 void JackTrip::onStatTimer()
 {
@@ -549,6 +786,44 @@ void JackTrip::onStatTimer()
     if (!mSendRingBuffer->getStats(&send_io_stat, reset)) {
         return;
     }
+    LatencyHistogram::Summary cb = mCallbackHistogram.takeSummary();
+    LatencyHistogram::Summary arrival = mArrivalHistogram.takeSummary();
+    LatencyHistogram::Summary level = mLevelHistogram.takeSummary();
+    LatencyHistogram::Summary wakeup = mWakeupHistogram.takeSummary();
+    LatencyHistogram::Summary age = mAgeHistogram.takeSummary();
+    updateLatencyBudget(pkt_stat, wakeup, level);
+
+    if (NULL != mMetricsExporter || NULL != mStatsSegment) {
+        // The counters are totals once the first call has reset them
+        mSessionMetrics.peer = getPeerAddress();
+        mSessionMetrics.client = mJackClientName;
+        mSessionMetrics.packets = pkt_stat.tot;
+        mSessionMetrics.lost = pkt_stat.lost;
+        mSessionMetrics.outOfOrder = pkt_stat.outOfOrder;
+        mSessionMetrics.revived = pkt_stat.revived;
+        mSessionMetrics.underruns = recv_io_stat.underruns;
+        mSessionMetrics.overflows = recv_io_stat.overflows;
+        mSessionMetrics.bufIncUnderrun = recv_io_stat.buf_inc_underrun;
+        mSessionMetrics.bufIncCompensate = recv_io_stat.buf_inc_compensate;
+        mSessionMetrics.bufDecOverflows = recv_io_stat.buf_dec_overflows;
+        mSessionMetrics.bufDecPktLoss = recv_io_stat.buf_dec_pktloss;
+        mSessionMetrics.queueLevel = recv_io_stat.level;
+        mSessionMetrics.skew = recv_io_stat.skew;
+        mSessionMetrics.callback.add(cb);
+        mSessionMetrics.arrival.add(arrival);
+        mSessionMetrics.level.add(level);
+        mSessionMetrics.wakeup.add(wakeup);
+        mSessionMetrics.age.add(age);
+    }
+    if (NULL != mMetricsExporter) {
+        mMetricsExporter->updateSession(mMetricsSession, mSessionMetrics);
+    }
+    if (NULL != mStatsSegment && -1 != mStatsSlot) {
+        publishStats();
+    }
+    if (0 >= mIOStatTimeout) {
+        return;
+    }
     QString now = QDateTime::currentDateTime().toString(Qt::ISODate);
 
     static QMutex mutex;
@@ -567,8 +842,12 @@ void JackTrip::onStatTimer()
       << " prot: "
       << pkt_stat.lost
       << "/" << pkt_stat.outOfOrder
-      << "/" << pkt_stat.revived
-      << " tot: "
+      << "/" << pkt_stat.revived;
+    if (0 < mMtu) {
+      // Packets played with channels missing
+      mIOStatLogStream << " frag: " << pkt_stat.partial;
+    }
+    mIOStatLogStream << " tot: "
       << pkt_stat.tot
       << " sync: "
       << recv_io_stat.level
@@ -581,8 +860,31 @@ void JackTrip::onStatTimer()
       << " bcast: " << recv_io_stat.broadcast_skew
       << "/" << recv_io_stat.broadcast_delta
       << " autoq: " << 0.1*recv_io_stat.autoq_corr
-      << "/" << 0.1*recv_io_stat.autoq_rate
-      << endl;
+      << "/" << 0.1*recv_io_stat.autoq_rate;
+    if (pkt_stat.rxTimestamps) {
+      // Network jitter, then our own receive delay (average/max), in us
+      mIOStatLogStream << " jitter: " << pkt_stat.netJitterUs
+        << " host: " << pkt_stat.hostDelayAvgUs
+        << "/" << pkt_stat.hostDelayMaxUs;
+    }
+    // p50/p99/p99.9/max since the last line; the callback against its period in us,
+    // the level in frames, the age only makes sense with synchronized clocks
+    printTails(mIOStatLogStream, "cb", cb);
+    mIOStatLogStream << " of "
+      << (1000000ULL * getBufferSizeInSamples()) / std::max(1, getSampleRate());
+    printTails(mIOStatLogStream, "arrival", arrival);
+    printTails(mIOStatLogStream, "level", level);
+    printTails(mIOStatLogStream, "wakeup", wakeup);
+    printTails(mIOStatLogStream, "age", age);
+    // period/send queue/network/receive buffer/FEC hold/plugins = total, in us
+    uint64_t total_us = 0;
+    mIOStatLogStream << " budget: ";
+    for (int s = 0; s < MetricsExporter::NUM_LATENCY_STAGES; ++s) {
+        mIOStatLogStream << ((0 < s) ? "/" : "") << mSessionMetrics.budgetUs[s];
+        total_us += mSessionMetrics.budgetUs[s];
+    }
+    mIOStatLogStream << " = " << total_us;
+    mIOStatLogStream << endl;
 }
 
 void JackTrip::receivedConnectionTCP()
@@ -1019,6 +1321,9 @@ void JackTrip::createHeader(const DataProtocol::packetHeaderTypeT headertype)
     case DataProtocol::EMPTY :
         mPacketHeader = new EmptyHeader(this);
         break;
+    case DataProtocol::COMPACT :
+        mPacketHeader = new CompactHeader(this);
+        break;
     default :
         throw std::invalid_argument("Undefined Header Type");
         break;
@@ -58,6 +58,9 @@
 #include "PacketHeader.h"
 #include "RingBuffer.h"
 #include "AudioTester.h"
+#include "LatencyHistogram.h"
+#include "MetricsExporter.h"
+#include "StatsSegment.h"
 
 //#include <signal.h>
 /** \brief Main class to creates a SERVER (to listen) or a CLIENT (to connect
@@ -79,7 +82,8 @@ public:
     enum dataProtocolT {
         UDP, ///< Use UDP (User Datagram Protocol)
         TCP, ///< <B>NOT IMPLEMENTED</B>: Use TCP (Transmission Control Protocol)
-        SCTP ///< <B>NOT IMPLEMENTED</B>: Use SCTP (Stream Control Transmission Protocol)
+        SCTP, ///< <B>NOT IMPLEMENTED</B>: Use SCTP (Stream Control Transmission Protocol)
+        SHM ///< Use UDP, through shared memory when the peer is on the same host (Linux only)
     };
 
     /// \brief Enum for the JackTrip mode
@@ -201,6 +205,8 @@ public:
     virtual void setDataProtocoType(dataProtocolT DataProtocolType)
     { mDataProtocol = DataProtocolType; }
     /// \brief Sets the Packet header type
+    DataProtocol::packetHeaderTypeT getPacketHeaderType() const
+    { return mPacketHeaderType; }
     virtual void setPacketHeaderType(DataProtocol::packetHeaderTypeT PacketHeaderType)
     {
         mPacketHeaderType = PacketHeaderType;
@@ -254,6 +260,16 @@ public:
     
     virtual void setIOStatTimeout(int timeout) { mIOStatTimeout = timeout; }
     virtual void setIOStatStream(QSharedPointer<std::ofstream> statStream) { mIOStatStream = statStream; }
+    /// \brief Serves the session metrics on this localhost port, unless setMetricsExporter() is used
+    virtual void setMetricsPort(int port) { mMetricsPort = port; }
+    /// \brief Publishes the session metrics to a shared exporter (the hub's), under that session label
+    virtual void setMetricsExporter(MetricsExporter* exporter, const QString& session)
+    { mMetricsExporter = exporter; mMetricsSession = session; }
+    /// \brief Publishes the session statistics in this process' StatsSegment, for jacktrip-top
+    virtual void setStatsShm(bool enable) { mStatsShm = enable; }
+    /// \brief Publishes to a shared StatsSegment (the hub's), under that session label
+    virtual void setStatsSegment(StatsSegment* segment, const QString& session)
+    { mStatsSegment = segment; mMetricsSession = session; }
 
     /// Set to connect or not default audio ports (only implemented in Jack)
     virtual void setConnectDefaultAudioPorts(bool connect)
@@ -346,8 +362,9 @@ public:
     { mSendRingBuffer->insertSlotNonBlocking(ptrToSlot, 0, 0); }
     virtual void receiveBroadcastPacket(int8_t* ptrToReadSlot)
     { mReceiveRingBuffer->readBroadcastSlot(ptrToReadSlot); }
-    virtual void receiveNetworkPacket(int8_t* ptrToReadSlot)
-    { mReceiveRingBuffer->readSlotNonBlocking(ptrToReadSlot); }
+    /// \brief Returns true if the packet is known to be silent, see setDtx()
+    virtual bool receiveNetworkPacket(int8_t* ptrToReadSlot)
+    { return mReceiveRingBuffer->readSlotNonBlocking(ptrToReadSlot); }
     virtual void readAudioBuffer(int8_t* ptrToReadSlot)
     { mSendRingBuffer->readSlotBlocking(ptrToReadSlot); }
     virtual bool writeAudioBuffer(const int8_t* ptrToSlot, int len, int lostLen)
@@ -400,11 +417,31 @@ public:
 
     uint8_t  getPeerConnectionMode(int8_t* full_packet) const
     { return mPacketHeader->getPeerConnectionMode(full_packet); }
+    uint8_t getPeerCapabilities(int8_t* full_packet) const
+    { return mPacketHeader->getPeerCapabilities(full_packet); }
 
     size_t getSizeInBytesPerChannel() const
     { return mAudioInterface->getSizeInBytesPerChannel(); }
     int getHeaderSizeInBytes() const
     { return mPacketHeader->getHeaderSizeInBytes(); }
+    bool hasDatagramCodec() const
+    { return mPacketHeader->hasDatagramCodec(); }
+    int encodeDatagram(const int8_t* full_packets, int num_packets,
+                       int full_packet_size, int8_t* datagram)
+    { return mPacketHeader->encodeDatagram(full_packets, num_packets, full_packet_size, datagram); }
+    int decodeDatagram(const int8_t* datagram, int datagram_size,
+                       int8_t* full_packets, int max_size)
+    { return mPacketHeader->decodeDatagram(datagram, datagram_size, full_packets, max_size); }
+    int getMaxDatagramSize(int num_packets, int full_packet_size) const
+    { return mPacketHeader->getMaxDatagramSize(num_packets, full_packet_size); }
+    bool getLossFeedback(DataProtocol::LossFeedback* feedback)
+    { return mDataProtocolReceiver->getLossFeedback(feedback); }
+    void setPeerLossFeedback(const DataProtocol::LossFeedback& feedback)
+    { mDataProtocolSender->setPeerLossFeedback(feedback); }
+    void setPeerCapabilities(uint8_t capabilities)
+    { mDataProtocolSender->setPeerCapabilities(capabilities); }
+    void setPeerEchoRequest(uint64_t orig_us, uint64_t rx_us)
+    { mDataProtocolSender->setPeerEchoRequest(orig_us, rx_us); }
     virtual int getTotalAudioPacketSizeInBytes() const
     {
 #ifdef WAIR // WAIR
@@ -420,14 +457,83 @@ public:
     void printTextTest() {std::cout << "=== JackTrip PRINT ===" << std::endl;}
     void printTextTest2() {std::cout << "=== JackTrip PRINT2 ===" << std::endl;}
 
-    void setNetIssuesSimulation(double loss, double jitter, double delay_rel)
+    /** \brief Impairs the received datagrams, see NetworkImpairment
+     * \param model List of further impairments, as NetworkImpairment::parseModel()
+     */
+    void setNetIssuesSimulation(double loss, double jitter, double delay_rel,
+                                const QString& model = QString())
     {
         mSimulatedLossRate = loss;
         mSimulatedJitterRate = jitter;
         mSimulatedDelayRel = delay_rel;
+        mSimulatedModel = model;
     }
     void setBroadcast(int broadcast_queue) {mBroadcastQueueLength = broadcast_queue;}
     void setUseRtUdpPriority(bool use) {mUseRtUdpPriority = use;}
+    /** \brief Use parity FEC instead of redundancy
+     * \param group_size Number of packets in each FEC group, 0 to turn FEC off
+     * \param parity_count Number of parity packets sent after each group
+     */
+    void setFec(unsigned int group_size, unsigned int parity_count)
+    {
+        mFecGroupSize = group_size;
+        mFecParityCount = parity_count;
+    }
+    /** \brief Adapt redundancy (or the FEC parity count) to the loss the peer reports
+     * \param max_redundancy Upper limit, 0 to keep it fixed
+     */
+    void setAdaptiveRedundancy(unsigned int max_redundancy)
+    { mAdaptiveRedundancyMax = max_redundancy; }
+    unsigned int getAdaptiveRedundancy() const
+    { return mAdaptiveRedundancyMax; }
+    /** \brief Send several audio periods in each datagram
+     * \param periods Periods per datagram, 1 to send each period on its own,
+     * up to sMaxAggregation
+     */
+    void setAggregation(unsigned int periods)
+    { mAggregation = periods; }
+    unsigned int getAggregation() const
+    { return mAggregation; }
+    /// \brief Most periods per datagram, the header has 3 bits for them
+    static const unsigned int sMaxAggregation = 8;
+    /** \brief Fragment the packets that don't fit in the path MTU
+     * \param mtu Path MTU in bytes, 0 to let IP fragment them
+     */
+    void setMtu(int mtu)
+    { mMtu = mtu; }
+    /** \brief Compress the audio with LosslessCodec
+     * \param lossless true to code the integer resolutions, both ends have to set it
+     */
+    void setLossless(bool lossless)
+    { mLossless = lossless; }
+    /** \brief Code the audio with Opus
+     * \param bitrate Bitrate in bits/s for all the channels, 0 to send PCM
+     * \param complexity Encoder complexity, 0 to 10
+     */
+    void setOpus(int bitrate, int complexity)
+    { mOpusBitrate = bitrate; mOpusComplexity = complexity; }
+    /** \brief Send a keep-alive marker instead of the silent packets
+     * \param level_db Peak level in dBFS under which a packet is silent, 0 to send them all
+     */
+    void setDtx(double level_db)
+    { mDtxLevel = level_db; }
+    /** \brief Space the sent datagrams by the audio period
+     * \param mode DataProtocol::NOPACING to send them as soon as the audio is read
+     */
+    void setPacing(DataProtocol::pacingModeT mode)
+    { mPacing = mode; }
+    /** \brief Move the datagrams through an AF_XDP socket (Linux only)
+     * \param ifname Network interface, empty to use only the kernel UDP path
+     * \param queue First NIC queue to try
+     */
+    void setXdp(const QString& ifname, int queue)
+    { mXdpInterface = ifname; mXdpQueue = queue; }
+    /// \brief Receive and send the datagrams through io_uring (Linux only)
+    void setIoUring(bool enable)
+    { mIoUring = enable; }
+    /// \brief Records the received datagrams to a trace file, see PacketTrace
+    void setPacketTrace(const QString& path)
+    { mPacketTrace = path; }
 
 public slots:
     /// \brief Slot to stop all the processes and threads
@@ -492,6 +598,19 @@ public:
     virtual void setupDataProtocol();
     /// \brief Set the RingBuffer objects
     void setupRingBuffers();
+    /** \brief Hands the --iostat histograms to the audio, ring buffer and network objects,
+     * and starts the timestamp echoes that measure the round trip time
+     */
+    void setupHistograms();
+    /// \brief Fills the latency budget of mSessionMetrics from the last stat interval
+    void updateLatencyBudget(const DataProtocol::PktStat& pkt_stat,
+                             const LatencyHistogram::Summary& wakeup,
+                             const LatencyHistogram::Summary& level);
+    /// \brief Copies mSessionMetrics in our slot of mStatsSegment
+    void publishStats();
+    /// \brief True if onStatTimer() has anything to feed: --iostat, metrics or jacktrip-top
+    bool hasStatConsumers() const
+    { return 0 < mIOStatTimeout || NULL != mMetricsExporter || NULL != mStatsSegment; }
     /// \brief Starts for the CLIENT mode
     void clientStart();
     /// \brief Starts for the SERVER mode
@@ -574,10 +693,39 @@ private:
     QSharedPointer<std::ofstream> mIOStatStream;
     int mIOStatTimeout;
     std::ostream mIOStatLogStream;
+    LatencyHistogram mCallbackHistogram; ///< Audio callback duration, us
+    LatencyHistogram mArrivalHistogram; ///< Datagram inter-arrival time, us
+    LatencyHistogram mLevelHistogram; ///< Receive buffer level when read, frames
+    LatencyHistogram mWakeupHistogram; ///< Send thread wakeup latency, us
+    LatencyHistogram mAgeHistogram; ///< Packet age at arrival, us
+    int mMetricsPort;
+    MetricsExporter* mMetricsExporter; ///< Owned by the hub, or by this object with mMetricsPort
+    QString mMetricsSession; ///< Session label for the metrics and the StatsSegment
+    bool mStatsShm;
+    StatsSegment* mStatsSegment; ///< Owned by the hub, or by this object with mStatsShm
+    bool mOwnsStatsSegment;
+    int mStatsSlot; ///< -1 if the segment is full
+    MetricsExporter::SessionMetrics mSessionMetrics; ///< Totals published by onStatTimer()
     double mSimulatedLossRate;
     double mSimulatedJitterRate;
     double mSimulatedDelayRel;
+    QString mSimulatedModel; ///< See NetworkImpairment::parseModel()
     bool mUseRtUdpPriority;
+    unsigned int mFecGroupSize;
+    unsigned int mFecParityCount;
+    unsigned int mAdaptiveRedundancyMax;
+    unsigned int mAggregation;
+    int mMtu;
+    bool mLossless;
+    int mOpusBitrate;
+    int mOpusComplexity;
+    double mDtxLevel;
+    DataProtocol::pacingModeT mPacing;
+    QString mXdpInterface;
+    int mXdpQueue;
+    XdpSocket* mXdpSocket; ///< Shared by the sender and receiver, NULL if not used
+    bool mIoUring;
+    QString mPacketTrace; ///< Trace file of the received datagrams, empty if off
 
     AudioTester* mAudioTesterP;
 };
@@ -36,15 +36,22 @@
  */
 
 #include <iostream>
+#include <vector>
 #include <unistd.h>
 
 #include <QTimer>
 #include <QMutexLocker>
 #include <QWaitCondition>
+#include <QElapsedTimer>
 
 #include "JackTripWorker.h"
 #include "JackTrip.h"
 #include "UdpHubListener.h"
+#include "PacketFragments.h"
+#include "ParityFec.h"
+#include "LosslessCodec.h"
+#include "OpusCodec.h"
+#include "UdpDataProtocol.h"
 //#include "NetKS.h"
 #include "LoopBack.h"
 #include "Settings.h"
@@ -82,6 +89,22 @@ JackTripWorker::JackTripWorker(UdpHubListener* udphublistener, int BufferQueueLe
     mSimulatedJitterRate = 0.0;
     mSimulatedDelayRel = 0.0;
     mUseRtUdpPriority = false;
+    mFecGroupSize = 0;
+    mFecParityCount = 0;
+    mAdaptiveRedundancyMax = 0;
+    mCompactHeader = false;
+    mAggregation = 1;
+    mMtu = 0;
+    mLossless = false;
+    mOpusBitrate = 0;
+    mOpusComplexity = 0;
+    mDtxLevel = 0.0;
+    mPacing = DataProtocol::NOPACING;
+    mXdpQueue = 0;
+    mIoUring = false;
+    mSharedMemory = true;
+    mMetricsExporter = NULL;
+    mStatsSegment = NULL;
 }
 
 
@@ -223,10 +246,37 @@ void JackTripWorker::run()
         jacktrip.setBindPorts(mServerPort);
         //jacktrip.setPeerPorts(mClientPort);
         jacktrip.setBufferStrategy(mBufferStrategy);
+        // Every client gets its own impairments, with their own random sequence
         jacktrip.setNetIssuesSimulation(mSimulatedLossRate,
-            mSimulatedJitterRate, mSimulatedDelayRel);
+            mSimulatedJitterRate, mSimulatedDelayRel, mSimulatedModel);
         jacktrip.setBroadcast(mBroadcastQueue);
         jacktrip.setUseRtUdpPriority(mUseRtUdpPriority);
+        jacktrip.setFec(mFecGroupSize, mFecParityCount);
+        jacktrip.setAdaptiveRedundancy(mAdaptiveRedundancyMax);
+        jacktrip.setAggregation(mAggregation);
+        jacktrip.setMtu(mMtu);
+        jacktrip.setLossless(mLossless);
+        jacktrip.setOpus(mOpusBitrate, mOpusComplexity);
+        jacktrip.setDtx(mDtxLevel);
+        jacktrip.setPacing(mPacing);
+        jacktrip.setXdp(mXdpInterface, mXdpQueue);
+        jacktrip.setIoUring(mIoUring);
+        if (!mPacketTrace.isEmpty()) {
+            jacktrip.setPacketTrace(QString("%1.%2").arg(mPacketTrace).arg(mID));
+        }
+        if (NULL != mMetricsExporter) {
+            jacktrip.setMetricsExporter(mMetricsExporter, QString::number(mID));
+        }
+        if (NULL != mStatsSegment) {
+            jacktrip.setStatsSegment(mStatsSegment, QString::number(mID));
+        }
+        if (mSharedMemory) {
+            // Clients on this host get the shared memory ring
+            jacktrip.setDataProtocoType(JackTrip::SHM);
+        }
+        if (mCompactHeader) {
+            jacktrip.setPacketHeaderType(DataProtocol::COMPACT);
+        }
 
         if (gVerboseFlag) cout << "---> JackTripWorker: setJackTripFromClientHeader..." << endl;
         int PeerConnectionMode = setJackTripFromClientHeader(jacktrip);
@@ -304,26 +354,59 @@ int JackTripWorker::setJackTripFromClientHeader(JackTrip& jacktrip)
     QMutex mutex;
     int sleepTime = 100; // ms
     int udpTimeout = gTimeOutMultiThreadedServer; // gTimeOutMultiThreadedServer mseconds
-    int elapsedTime = 0;
-    {
-        QMutexLocker lock(&mutex);
-        while ( (!UdpSockTemp.hasPendingDatagrams()) && (elapsedTime <= udpTimeout) ) {
-            sleep.wait(&mutex,sleepTime);
-            elapsedTime += sleepTime;
-            if (gVerboseFlag) cout << "---------> ELAPSED TIME: " << elapsedTime << endl;
+    QElapsedTimer elapsedTime;
+    elapsedTime.start();
+    QByteArray packet;
+    // Keep-alive markers (--dtx), parity and control packets carry no header,
+    // skip them within the same deadline like UdpDataProtocol::run() does; even
+    // a silent client starts with audio datagrams
+    do {
+        {
+            QMutexLocker lock(&mutex);
+            while ( (!UdpSockTemp.hasPendingDatagrams()) && (elapsedTime.elapsed() <= udpTimeout) ) {
+                sleep.wait(&mutex,sleepTime);
+                if (gVerboseFlag) cout << "---------> ELAPSED TIME: " << elapsedTime.elapsed() << endl;
+            }
+        }
+        // Check if we time out or not
+        if (!UdpSockTemp.hasPendingDatagrams() || elapsedTime.elapsed() > udpTimeout) {
+            std::cerr << "--->JackTripWorker: is not receiving Datagrams (timeout)" << endl;
+            UdpSockTemp.close();
+            return -1;
         }
+        packet.resize(UdpSockTemp.pendingDatagramSize());
+        UdpSockTemp.readDatagram(packet.data(), packet.size());
+    } while (UdpDataProtocol::isDtxPacket(reinterpret_cast<int8_t*>(packet.data()), packet.size())
+             || UdpDataProtocol::isControlPacket(reinterpret_cast<int8_t*>(packet.data()), packet.size())
+             // The packet size isn't known yet, only the trailer can tell
+             || (0 < mFecGroupSize
+                 && ParityFec::hasParityTrailer(reinterpret_cast<int8_t*>(packet.data()), packet.size())));
+    UdpSockTemp.close(); // close the socket
+    int packet_size = packet.size();
+    int8_t* full_packet = reinterpret_cast<int8_t*>(packet.data());
+    // Fragments carry the uncompacted packet header after their own
+    bool fragment = PacketFragments::isFragment(full_packet, packet_size);
+    if (fragment) {
+        full_packet += sizeof(PacketFragments::FragmentHeader);
+    } else if (LosslessCodec::isLosslessDatagram(full_packet, packet_size)) {
+        // Lossless datagrams keep the packet headers uncoded
+        full_packet += LosslessCodec::sFirstHeaderOffset;
+    } else if (OpusCodec::isOpusDatagram(full_packet, packet_size)) {
+        // So do Opus datagrams
+        full_packet += OpusCodec::sFirstHeaderOffset;
     }
-    // Check if we time out or not
-    if (!UdpSockTemp.hasPendingDatagrams()) {
-        std::cerr << "--->JackTripWorker: is not receiving Datagrams (timeout)" << endl;
-        UdpSockTemp.close();
-        return -1;
+
+    // Expand compact datagrams to read the header fields
+    std::vector<int8_t> decoded_packet;
+    if (!fragment && jacktrip.hasDatagramCodec()) {
+        decoded_packet.resize(0x10000);
+        if (0 > jacktrip.decodeDatagram(full_packet, packet_size,
+                                        decoded_packet.data(), decoded_packet.size())) {
+            std::cerr << "--->JackTripWorker: first datagram can't be decoded" << endl;
+            return -1;
+        }
+        full_packet = decoded_packet.data();
     }
-    int packet_size = UdpSockTemp.pendingDatagramSize();
-    char packet[packet_size];
-    UdpSockTemp.readDatagram(packet, packet_size);
-    UdpSockTemp.close(); // close the socket
-    int8_t* full_packet = reinterpret_cast<int8_t*>(packet);
 
     int PeerBufferSize = jacktrip.getPeerBufferSize(full_packet);
     int PeerSamplingRate = jacktrip.getPeerSamplingRate(full_packet);
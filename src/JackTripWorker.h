@@ -98,14 +98,39 @@ public:
     }
 
     void setBufferStrategy(int BufferStrategy) { mBufferStrategy = BufferStrategy; }
-    void setNetIssuesSimulation(double loss, double jitter, double delay_rel)
+    void setNetIssuesSimulation(double loss, double jitter, double delay_rel,
+                                const QString& model = QString())
     {
         mSimulatedLossRate = loss;
         mSimulatedJitterRate = jitter;
         mSimulatedDelayRel = delay_rel;
+        mSimulatedModel = model;
     }
     void setBroadcast(int broadcast_queue) {mBroadcastQueue = broadcast_queue;}
     void setUseRtUdpPriority(bool use) {mUseRtUdpPriority = use;}
+    void setFec(unsigned int group_size, unsigned int parity_count)
+    {
+        mFecGroupSize = group_size;
+        mFecParityCount = parity_count;
+    }
+    void setAdaptiveRedundancy(unsigned int max_redundancy) { mAdaptiveRedundancyMax = max_redundancy; }
+    void setCompactHeader(bool compact) { mCompactHeader = compact; }
+    void setAggregation(unsigned int periods) { mAggregation = periods; }
+    void setMtu(int mtu) { mMtu = mtu; }
+    void setLossless(bool lossless) { mLossless = lossless; }
+    void setOpus(int bitrate, int complexity)
+    {
+        mOpusBitrate = bitrate;
+        mOpusComplexity = complexity;
+    }
+    void setDtx(double level_db) { mDtxLevel = level_db; }
+    void setPacing(DataProtocol::pacingModeT mode) { mPacing = mode; }
+    void setXdp(const QString& ifname, int queue) { mXdpInterface = ifname; mXdpQueue = queue; }
+    void setIoUring(bool enable) { mIoUring = enable; }
+    void setSharedMemory(bool enable) { mSharedMemory = enable; }
+    void setPacketTrace(const QString& path) { mPacketTrace = path; }
+    void setMetricsExporter(MetricsExporter* exporter) { mMetricsExporter = exporter; }
+    void setStatsSegment(StatsSegment* segment) { mStatsSegment = segment; }
     
     void setIOStatTimeout(int timeout) { mIOStatTimeout = timeout; }
     void setIOStatStream(QSharedPointer<std::ofstream> statStream) { mIOStatStream = statStream; }
@@ -148,7 +173,26 @@ private:
     double mSimulatedLossRate;
     double mSimulatedJitterRate;
     double mSimulatedDelayRel;
+    QString mSimulatedModel;
     bool mUseRtUdpPriority;
+    unsigned int mFecGroupSize;
+    unsigned int mFecParityCount;
+    unsigned int mAdaptiveRedundancyMax;
+    bool mCompactHeader;
+    unsigned int mAggregation;
+    int mMtu;
+    bool mLossless;
+    int mOpusBitrate;
+    int mOpusComplexity;
+    double mDtxLevel;
+    DataProtocol::pacingModeT mPacing;
+    QString mXdpInterface;
+    int mXdpQueue;
+    bool mIoUring;
+    bool mSharedMemory;
+    QString mPacketTrace; ///< Base name of the trace file, the ID is appended
+    MetricsExporter* mMetricsExporter; ///< The hub's, the session is labeled with the ID
+    StatsSegment* mStatsSegment; ///< The hub's, for jacktrip-top
     
     int mIOStatTimeout;
     QSharedPointer<std::ofstream> mIOStatStream;
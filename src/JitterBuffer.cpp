@@ -37,6 +37,8 @@
 
 
 #include "JitterBuffer.h"
+#include "AudioInterface.h"
+#include "LatencyHistogram.h"
 
 #include <iostream>
 #include <cstring>
@@ -52,8 +54,9 @@ JitterBuffer::JitterBuffer(int buf_samples, int qlen, int sample_rate, int strat
                                           int bcast_qlen, int channels, int bit_res) :
     RingBuffer(0, 0)
 {
-    int total_size = sample_rate * channels * bit_res * 2; // 2 secs of audio
-    int slot_size = buf_samples * channels * bit_res;
+    int sample_size = AudioInterface::getSampleSize(bit_res);
+    int total_size = sample_rate * channels * sample_size * 2; // 2 secs of audio
+    int slot_size = buf_samples * channels * sample_size;
     mSlotSize = slot_size;
     mInSlotSize = slot_size;
     if (0 < qlen) {
@@ -69,7 +72,7 @@ JitterBuffer::JitterBuffer(int buf_samples, int qlen, int sample_rate, int strat
     mBroadcastLatency = bcast_qlen * mSlotSize;
     mNumChannels = channels;
     mAudioBitRes = bit_res;
-    mMinStepSize = channels * bit_res;
+    mMinStepSize = channels * sample_size;
     mFPP = buf_samples;
     mSampleRate = sample_rate;
     mActive = false;
@@ -87,6 +90,8 @@ JitterBuffer::JitterBuffer(int buf_samples, int qlen, int sample_rate, int strat
     mMinLevelThreshold = 1.9 * mSlotSize;
     mBroadcastPosition = 0;
     mBroadcastPositionCorr = 0.0;
+    mSilenceStart = 0;
+    mSilenceEnd = 0;
     mLastCorrCounter = 0;
     mLastCorrDirection = 0;
 
@@ -179,10 +184,23 @@ bool JitterBuffer::insertSlotNonBlocking(const int8_t* ptrToSlot, int len, int l
 
     int wpos = mWritePosition % mTotalSize;
     int n = std::min(mTotalSize - wpos, len);
-    std::memcpy(mRingBuffer+wpos, ptrToSlot, n);
-    if (n < len) {
-        //cout << "split write: " << len << "-" << n << endl;
-        std::memcpy(mRingBuffer, ptrToSlot+n, len-n);
+    if (NULL == ptrToSlot) {
+        // Known silence, extends the run if it follows it
+        std::memset(mRingBuffer+wpos, 0, n);
+        if (n < len) {
+            std::memset(mRingBuffer, 0, len-n);
+        }
+        if (mSilenceEnd != mWritePosition) {
+            mSilenceStart = mWritePosition;
+        }
+        mSilenceEnd = mWritePosition + len;
+    }
+    else {
+        std::memcpy(mRingBuffer+wpos, ptrToSlot, n);
+        if (n < len) {
+            //cout << "split write: " << len << "-" << n << endl;
+            std::memcpy(mRingBuffer, ptrToSlot+n, len-n);
+        }
     }
     mWritePosition += len;
 
@@ -190,13 +208,13 @@ bool JitterBuffer::insertSlotNonBlocking(const int8_t* ptrToSlot, int len, int l
 }
 
 //*******************************************************************************
-void JitterBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
+bool JitterBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
 {
     int len = mSlotSize;
     QMutexLocker locker(&mMutex);
     if (!mActive) {
         std::memset(ptrToReadSlot, 0, len);
-        return;
+        return false;
     }
     mReadsNew += len;
     int32_t available = mWritePosition - mReadPosition;
@@ -206,6 +224,9 @@ void JitterBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
     else {
         mLevelCur = available;
     }
+    if (NULL != mLevelHistogram) {
+        mLevelHistogram->record(std::max(0, available) * mLevelFramesPerSlot / mSlotSize);
+    }
 
     // auto queue correction
     if (0 > available + mAutoQueueCorr - mLevelCur) {
@@ -241,7 +262,10 @@ void JitterBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
         std::memset(ptrToReadSlot+read_len, 0, len-read_len);
         mUnderrunsNew += len-read_len;
     }
+    bool silent = 0 < read_len && 0 <= (int32_t)(mReadPosition - mSilenceStart)
+            && 0 <= (int32_t)(mSilenceEnd - mReadPosition - read_len);
     mReadPosition += len;
+    return silent;
 }
 
 //*******************************************************************************
@@ -265,7 +289,8 @@ void JitterBuffer::readBroadcastSlot(int8_t* ptrToReadSlot)
         int delta = mBroadcastPositionCorr / mMinStepSize;
         if (0 != delta) {
             mBroadcastPositionCorr -= delta * mMinStepSize;
-            if (2 == mAudioBitRes && (int32_t)(mWritePosition - mBroadcastPosition) > len) {
+            if ((AudioInterface::BIT16 == mAudioBitRes || AudioInterface::FLOAT16 == mAudioBitRes)
+                    && (int32_t)(mWritePosition - mBroadcastPosition) > len) {
                 // interpolate
                 len += delta * mMinStepSize;
             }
@@ -299,10 +324,22 @@ void JitterBuffer::readBroadcastSlot(int8_t* ptrToReadSlot)
                 int j1 = std::floor(j*K);
                 double a = j*K - j1;
                 int rpos = (mBroadcastPosition + j1*mMinStepSize + c) % mTotalSize;
+                int8_t* dst = ptrToReadSlot + j*mMinStepSize + c;
+                if (AudioInterface::FLOAT16 == mAudioBitRes) {
+                    sample_t v1, v2;
+                    AudioInterface::fromBitToSampleConversion(mRingBuffer + rpos, &v1,
+                                                              AudioInterface::FLOAT16);
+                    rpos = (rpos + mMinStepSize) % mTotalSize;
+                    AudioInterface::fromBitToSampleConversion(mRingBuffer + rpos, &v2,
+                                                              AudioInterface::FLOAT16);
+                    sample_t v = (1-a)*v1 + a*v2;
+                    AudioInterface::fromSampleToBitConversion(&v, dst, AudioInterface::FLOAT16);
+                    continue;
+                }
                 int16_t v1 = *(int16_t*)(mRingBuffer + rpos);
                 rpos = (rpos + mMinStepSize) % mTotalSize;
                 int16_t v2 = *(int16_t*)(mRingBuffer + rpos);
-                *(int16_t*)(ptrToReadSlot + j*mMinStepSize + c) = std::round((1-a)*v1 + a*v2);
+                *(int16_t*)dst = std::round((1-a)*v1 + a*v2);
             }
         }
     }
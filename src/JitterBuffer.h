@@ -48,7 +48,7 @@ public:
     virtual ~JitterBuffer() {}
 
     virtual bool insertSlotNonBlocking(const int8_t* ptrToSlot, int len, int lostLen);
-    virtual void readSlotNonBlocking(int8_t* ptrToReadSlot);
+    virtual bool readSlotNonBlocking(int8_t* ptrToReadSlot);
     virtual void readBroadcastSlot(int8_t* ptrToReadSlot);
 
     virtual bool getStats(IOStat* stat, bool reset);
@@ -65,6 +65,8 @@ protected:
     int mSampleRate;
     int mInSlotSize;
     bool mActive;
+    uint32_t mSilenceStart; ///< Run of known silence inserted last, in write positions
+    uint32_t mSilenceEnd;
     uint32_t mBroadcastLatency;
     uint32_t mBroadcastPosition;
     double  mBroadcastPositionCorr;
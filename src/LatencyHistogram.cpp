@@ -0,0 +1,92 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file LatencyHistogram.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+
+//*******************************************************************************
+LatencyHistogram::LatencyHistogram() :
+    mSum(0),
+    mMax(0)
+{
+    for (int i = 0; i < sNumBuckets; ++i) {
+        mCounts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+
+//*******************************************************************************
+uint64_t LatencyHistogram::getBucketHighest(int bucket)
+{
+    if (bucket < 2 * sSubBuckets) {
+        return bucket;
+    }
+    int shift = bucket / sSubBuckets - 1;
+    uint64_t top = bucket % sSubBuckets + sSubBuckets;
+    return ((top + 1) << shift) - 1;
+}
+
+
+//*******************************************************************************
+LatencyHistogram::Summary LatencyHistogram::takeSummary()
+{
+    uint32_t counts[sNumBuckets];
+    Summary summary = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < sNumBuckets; ++i) {
+        counts[i] = mCounts[i].exchange(0, std::memory_order_relaxed);
+        summary.count += counts[i];
+    }
+    summary.sum = mSum.exchange(0, std::memory_order_relaxed);
+    summary.max = mMax.exchange(0, std::memory_order_relaxed);
+    if (0 == summary.count) {
+        return summary;
+    }
+
+    // Smallest value with at least that share of the samples at or below it
+    const double quantiles[3] = {0.5, 0.99, 0.999};
+    uint64_t* results[3] = {&summary.p50, &summary.p99, &summary.p999};
+    uint64_t seen = 0;
+    int q = 0;
+    for (int i = 0; i < sNumBuckets && q < 3; ++i) {
+        seen += counts[i];
+        while (q < 3 && seen >= quantiles[q] * summary.count) {
+            *results[q++] = std::min(getBucketHighest(i), summary.max);
+        }
+    }
+    return summary;
+}
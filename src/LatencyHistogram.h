@@ -0,0 +1,112 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file LatencyHistogram.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __LATENCYHISTOGRAM_H__
+#define __LATENCYHISTOGRAM_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/** \brief Log-linear histogram in the style of HdrHistogram, for the --iostat tails
+ *
+ * Values under 2*sSubBuckets have a bucket each, above that every power of 2
+ * is split into sSubBuckets buckets, so a percentile is off by at most
+ * 1/sSubBuckets (about 3%). Values are usually microseconds, up to 2^32.
+ *
+ * record() is called from one thread (the audio callback or a network
+ * thread) and only does a relaxed atomic increment, no lock and no allocation.
+ * takeSummary() runs in any other thread and empties the histogram as it reads
+ * it, so each summary covers the time since the previous one.
+ */
+class LatencyHistogram
+{
+public:
+
+    struct Summary {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t p50;
+        uint64_t p99;
+        uint64_t p999;
+        uint64_t max;
+    };
+
+    static const int sSubBuckets = 32;
+    static const int sNumBuckets = (32 - 5) * sSubBuckets + sSubBuckets;
+
+    LatencyHistogram();
+
+    /// \brief Real-time safe
+    void record(uint64_t value)
+    {
+        mCounts[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = mMax.load(std::memory_order_relaxed);
+        while (value > max && !mMax.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+    }
+    /// \brief Percentiles since the last call, the bucket's highest value, capped to the max
+    Summary takeSummary();
+
+    /// \brief Steady clock in microseconds, for the durations passed to record()
+    static uint64_t nowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    static int getBucket(uint64_t value)
+    {
+        if (value < 2 * sSubBuckets) {
+            return static_cast<int>(value);
+        }
+        if (0xffffffffULL < value) {
+            value = 0xffffffffULL;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - 5; // Keeps the top 6 bits, of which the first is 1
+        return shift * sSubBuckets + static_cast<int>(value >> shift);
+    }
+    static uint64_t getBucketHighest(int bucket);
+
+    std::atomic<uint32_t> mCounts[sNumBuckets];
+    std::atomic<uint64_t> mSum;
+    std::atomic<uint64_t> mMax;
+};
+
+#endif // __LATENCYHISTOGRAM_H__
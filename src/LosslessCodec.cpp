@@ -0,0 +1,429 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file LosslessCodec.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "LosslessCodec.h"
+#include "PacketHeader.h"
+#include "AudioInterface.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static const int sEscapeQuotient = 16; ///< Unary prefix of residuals written in 32 bits
+
+//*******************************************************************************
+static inline uint64_t bitMask(int count)
+{
+    return (static_cast<uint64_t>(1) << count) - 1;
+}
+
+
+/// \brief MSB first bit writer
+struct BitWriter
+{
+    uint8_t* out;
+    int size;
+    uint64_t acc;
+    int nbits;
+
+    void put(uint32_t value, int count)
+    {
+        acc = (acc << count) | (value & bitMask(count));
+        nbits += count;
+        while (8 <= nbits) {
+            nbits -= 8;
+            out[size++] = static_cast<uint8_t>(acc >> nbits);
+        }
+    }
+    void flush()
+    {
+        if (0 < nbits) {
+            out[size++] = static_cast<uint8_t>(acc << (8 - nbits));
+            nbits = 0;
+        }
+    }
+};
+
+
+/// \brief MSB first bit reader, sets error instead of reading past the end
+struct BitReader
+{
+    const uint8_t* in;
+    int size;
+    int pos;
+    uint64_t acc;
+    int nbits;
+    bool error;
+
+    uint32_t get(int count)
+    {
+        if (0 == count) {
+            return 0;
+        }
+        while (nbits < count) {
+            if (pos >= size) {
+                error = true;
+                return 0;
+            }
+            acc = (acc << 8) | in[pos++];
+            nbits += 8;
+        }
+        nbits -= count;
+        return static_cast<uint32_t>((acc >> nbits) & bitMask(count));
+    }
+};
+
+
+//*******************************************************************************
+static inline int32_t readSample(const int8_t* p, int sample_size)
+{
+    int16_t tmp_16;
+    switch (sample_size) {
+    case 1 :
+        return p[0];
+    case 2 :
+        std::memcpy(&tmp_16, p, 2);
+        return tmp_16;
+    default :
+        // BIT24 is a 16bit number followed by an unsigned 8bit remainder
+        std::memcpy(&tmp_16, p, 2);
+        return static_cast<int32_t>(tmp_16) * 256 + static_cast<uint8_t>(p[2]);
+    }
+}
+
+
+//*******************************************************************************
+static inline void writeSample(int8_t* p, int sample_size, int32_t value)
+{
+    int16_t tmp_16;
+    switch (sample_size) {
+    case 1 :
+        p[0] = static_cast<int8_t>(value);
+        break;
+    case 2 :
+        tmp_16 = static_cast<int16_t>(value);
+        std::memcpy(p, &tmp_16, 2);
+        break;
+    default :
+        tmp_16 = static_cast<int16_t>((value - (value & 0xff)) / 256);
+        std::memcpy(p, &tmp_16, 2);
+        p[2] = static_cast<int8_t>(value & 0xff);
+        break;
+    }
+}
+
+
+//*******************************************************************************
+/// \brief Fixed predictor of the given order from the previous three samples
+static inline int32_t predict(int order, int32_t x1, int32_t x2, int32_t x3)
+{
+    switch (order) {
+    case 0 : return 0;
+    case 1 : return x1;
+    case 2 : return 2*x1 - x2;
+    default : return 3*x1 - 3*x2 + x3;
+    }
+}
+
+//*******************************************************************************
+LosslessCodec::LosslessCodec() :
+    mCodedPacketCapacity(0)
+{}
+
+
+//*******************************************************************************
+void LosslessCodec::reserve(int num_packets, int full_packet_size, int num_channels)
+{
+    // Consecutive packets go to distinct num_slots
+    int num_slots = 1;
+    while (num_slots < num_packets) {
+        num_slots *= 2;
+    }
+    int capacity = sizeof(uint16_t) + full_packet_size + num_channels;
+    if (static_cast<int>(mCodedPackets.size()) >= num_slots && mCodedPacketCapacity >= capacity) {
+        return;
+    }
+    mCodedPacketCapacity = std::max(mCodedPacketCapacity, capacity);
+    mCodedPackets.resize(std::max(num_slots, static_cast<int>(mCodedPackets.size())));
+    for (size_t i = 0; i < mCodedPackets.size(); ++i) {
+        mCodedPackets[i].data.resize(mCodedPacketCapacity);
+        mCodedPackets[i].size = 0;
+    }
+}
+
+
+//*******************************************************************************
+bool LosslessCodec::isLosslessDatagram(const int8_t* buf, int len)
+{
+    if (4 > len) {
+        return false;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, buf, sizeof(magic));
+    return sLosslessMagic == magic;
+}
+
+
+//*******************************************************************************
+int LosslessCodec::getMaxDatagramSize(int num_packets, int full_packet_size, int num_channels)
+{
+    // Raw channels cost one mode byte more than uncoded ones
+    return sizeof(uint32_t) + num_packets * (sizeof(uint16_t) + full_packet_size + num_channels);
+}
+
+
+//*******************************************************************************
+int LosslessCodec::encodeDatagram(const int8_t* full_packets, int num_packets,
+                                  int full_packet_size, int8_t* datagram)
+{
+    const int header_size = sizeof(DefaultHeaderStruct);
+    const uint32_t magic = sLosslessMagic;
+    int8_t* pos = datagram;
+    std::memcpy(pos, &magic, sizeof(magic));
+    pos += sizeof(magic);
+
+    for (int i = 0; i < num_packets; ++i) {
+        const int8_t* full_packet = full_packets + i*full_packet_size;
+        DefaultHeaderStruct header;
+        std::memcpy(&header, full_packet, header_size);
+        reserve(num_packets, full_packet_size, header.NumChannels);
+
+        // Redundant copies were coded when they were new, the header (sequence
+        // number and time stamp) tells them apart
+        CodedPacket& coded = mCodedPackets[header.SeqNumber & (mCodedPackets.size() - 1)];
+        if (0 == coded.size
+                || 0 != std::memcmp(coded.data.data() + sizeof(uint16_t), full_packet, header_size)) {
+            int sample_size = AudioInterface::getSampleSize(header.BitResolution / 8);
+            int channel_size = header.BufferSize * sample_size;
+            int8_t* out = coded.data.data() + sizeof(uint16_t);
+            std::memcpy(out, full_packet, header_size);
+            out += header_size;
+            int8_t* coded_audio = out;
+            for (int c = 0; c < header.NumChannels; ++c) {
+                out += encodeChannel(full_packet + header_size + c*channel_size,
+                                     header.BufferSize, sample_size, out);
+            }
+            // isPacketSizeSupported() was checked when the session started
+            uint16_t coded_size = out - coded_audio;
+            std::memcpy(coded.data.data(), &coded_size, sizeof(coded_size));
+            coded.size = out - coded.data.data();
+        }
+        std::memcpy(pos, coded.data.data(), coded.size);
+        pos += coded.size;
+    }
+    return pos - datagram;
+}
+
+
+//*******************************************************************************
+int LosslessCodec::encodeChannel(const int8_t* audio, int num_samples, int sample_size,
+                                 int8_t* out)
+{
+    int channel_size = num_samples * sample_size;
+    if (1 > sample_size || 3 < sample_size || 1 > num_samples) {
+        out[0] = static_cast<int8_t>(sRawChannel);
+        std::memcpy(out + 1, audio, channel_size);
+        return 1 + channel_size;
+    }
+    if (static_cast<int>(mSamples.size()) < num_samples) {
+        mSamples.resize(num_samples);
+        mResidual.resize(num_samples);
+        // Escaped residuals take 48 bits
+        mBits.resize(6*num_samples + 8);
+    }
+    int32_t* x = mSamples.data();
+    for (int n = 0; n < num_samples; ++n) {
+        x[n] = readSample(audio + n*sample_size, sample_size);
+    }
+
+    // Residual size of each predictor order. Separate plain loops so that the
+    // compiler vectorizes them.
+    uint64_t cost[sMaxOrder+1] = {0, 0, 0, 0};
+    for (int n = sMaxOrder; n < num_samples; ++n) {
+        cost[0] += std::abs(x[n]);
+    }
+    for (int n = sMaxOrder; n < num_samples; ++n) {
+        cost[1] += std::abs(x[n] - x[n-1]);
+    }
+    for (int n = sMaxOrder; n < num_samples; ++n) {
+        cost[2] += std::abs(x[n] - 2*x[n-1] + x[n-2]);
+    }
+    for (int n = sMaxOrder; n < num_samples; ++n) {
+        cost[3] += std::abs(x[n] - 3*x[n-1] + 3*x[n-2] - x[n-3]);
+    }
+    int order = std::min_element(cost, cost + sMaxOrder + 1) - cost;
+
+    // The first samples use the orders their history allows
+    int32_t* e = mResidual.data();
+    uint64_t sum = 0;
+    for (int n = 0; n < num_samples; ++n) {
+        int m = std::min(n, order);
+        e[n] = x[n] - predict(m, (0 < n) ? x[n-1] : 0, (1 < n) ? x[n-2] : 0, (2 < n) ? x[n-3] : 0);
+        sum += std::abs(e[n]);
+    }
+    int k = 0;
+    while (30 > k && (static_cast<uint64_t>(num_samples) << k) < sum) {
+        ++k;
+    }
+
+    BitWriter writer = {mBits.data(), 0, 0, 0};
+    for (int n = 0; n < num_samples; ++n) {
+        // Zigzag, so that small negative residuals stay small
+        uint32_t u = (static_cast<uint32_t>(e[n]) << 1) ^ static_cast<uint32_t>(e[n] >> 31);
+        uint32_t q = u >> k;
+        if (sEscapeQuotient > static_cast<int>(q)) {
+            writer.put((1u << (q + 1)) - 2, q + 1);
+            writer.put(u, k);
+        } else {
+            writer.put(bitMask(sEscapeQuotient), sEscapeQuotient);
+            writer.put(u, 32);
+        }
+    }
+    writer.flush();
+
+    if (writer.size >= channel_size) {
+        out[0] = static_cast<int8_t>(sRawChannel);
+        std::memcpy(out + 1, audio, channel_size);
+        return 1 + channel_size;
+    }
+    out[0] = static_cast<int8_t>((order << 5) | k);
+    std::memcpy(out + 1, mBits.data(), writer.size);
+    return 1 + writer.size;
+}
+
+
+//*******************************************************************************
+int LosslessCodec::decodeDatagram(const int8_t* datagram, int datagram_size,
+                                  int8_t* full_packets, int max_size)
+{
+    const int header_size = sizeof(DefaultHeaderStruct);
+    if (!isLosslessDatagram(datagram, datagram_size)) {
+        return -1;
+    }
+    const int8_t* pos = datagram + sizeof(uint32_t);
+    const int8_t* end = datagram + datagram_size;
+    int out_size = 0;
+
+    while (pos < end) {
+        if (end - pos < static_cast<int>(sizeof(uint16_t)) + header_size) {
+            return -1;
+        }
+        uint16_t coded_size;
+        std::memcpy(&coded_size, pos, sizeof(coded_size));
+        pos += sizeof(coded_size);
+        DefaultHeaderStruct header;
+        std::memcpy(&header, pos, header_size);
+        int sample_size = AudioInterface::getSampleSize(header.BitResolution / 8);
+        int channel_size = header.BufferSize * sample_size;
+        int full_packet_size = header_size + header.NumChannels * channel_size;
+        if (out_size + full_packet_size > max_size || end - pos - header_size < coded_size) {
+            return -1;
+        }
+
+        int8_t* full_packet = full_packets + out_size;
+        std::memcpy(full_packet, pos, header_size);
+        pos += header_size;
+        const int8_t* in = pos;
+        int remaining = coded_size;
+        for (int c = 0; c < header.NumChannels; ++c) {
+            int n = decodeChannel(in, remaining, header.BufferSize, sample_size,
+                                  full_packet + header_size + c*channel_size);
+            if (0 > n) {
+                return -1;
+            }
+            in += n;
+            remaining -= n;
+        }
+        pos += coded_size;
+        out_size += full_packet_size;
+    }
+    return out_size;
+}
+
+
+//*******************************************************************************
+int LosslessCodec::decodeChannel(const int8_t* in, int in_size, int num_samples,
+                                 int sample_size, int8_t* audio)
+{
+    int channel_size = num_samples * sample_size;
+    if (1 > in_size) {
+        return -1;
+    }
+    uint8_t mode = static_cast<uint8_t>(in[0]);
+    if (sRawChannel == mode) {
+        if (1 + channel_size > in_size) {
+            return -1;
+        }
+        std::memcpy(audio, in + 1, channel_size);
+        return 1 + channel_size;
+    }
+    if (1 > sample_size || 3 < sample_size) {
+        return -1;
+    }
+
+    int order = mode >> 5;
+    int k = mode & 0x1f;
+    BitReader reader = {reinterpret_cast<const uint8_t*>(in + 1), in_size - 1, 0, 0, 0, false};
+    int32_t x1 = 0;
+    int32_t x2 = 0;
+    int32_t x3 = 0;
+    for (int n = 0; n < num_samples && !reader.error; ++n) {
+        uint32_t q = 0;
+        while (sEscapeQuotient > static_cast<int>(q) && 1 == reader.get(1)) {
+            ++q;
+        }
+        uint32_t u;
+        if (sEscapeQuotient == static_cast<int>(q)) {
+            u = reader.get(32);
+        } else {
+            u = (q << k) | reader.get(k);
+        }
+        int32_t e = static_cast<int32_t>(u >> 1) ^ -static_cast<int32_t>(u & 1);
+        // Clamped, so that a corrupt stream can't overflow the predictor
+        int64_t value = static_cast<int64_t>(e) + predict(std::min(n, order), x1, x2, x3);
+        value = std::max<int64_t>(-0x800000, std::min<int64_t>(0x7fffff, value));
+        writeSample(audio + n*sample_size, sample_size, static_cast<int32_t>(value));
+        x3 = x2;
+        x2 = x1;
+        x1 = static_cast<int32_t>(value);
+    }
+    if (reader.error) {
+        return -1;
+    }
+    return 1 + reader.pos;
+}
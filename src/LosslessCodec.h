@@ -0,0 +1,120 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file LosslessCodec.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __LOSSLESSCODEC_H__
+#define __LOSSLESSCODEC_H__
+
+#include <vector>
+
+#include "jacktrip_types.h"
+
+/** \brief Sample-exact audio compression of the packets on the wire
+ *
+ * Each channel of each packet is coded on its own, so there is no algorithmic
+ * latency and a lost packet doesn't affect the next ones. The encoder picks
+ * the fixed linear predictor (order 0 to 3, i.e., the n-th difference of the
+ * signal) with the smallest residual, and Rice codes the residual. Channels
+ * that don't compress are sent as they are.
+ *
+ * Works on the integer resolutions (8, 16 and 24 bits). Datagram layout:
+ * <pre>
+ *   uint32_t Magic
+ *   for each packet (newest first, as in redundant datagrams):
+ *     uint16_t EncodedSize     size of the coded audio, see isPacketSizeSupported()
+ *     packet header            DefaultHeader, unchanged
+ *     coded audio              for each channel: mode byte, then data
+ * </pre>
+ * The mode byte is sRawChannel, or (order << 5 | rice parameter).
+ *
+ * Each packet is coded once and kept until it is no longer resent as
+ * redundancy. Datagrams that don't get smaller are sent uncoded, without the
+ * magic.
+ */
+class LosslessCodec
+{
+public:
+
+    static const uint32_t sLosslessMagic = 0x4c4c544a; ///< "JTLL"
+    static const uint8_t sRawChannel = 0xff;
+    static const int sMaxOrder = 3;
+    /// Offset of the first (newest) packet header in a datagram
+    static const int sFirstHeaderOffset = sizeof(uint32_t) + sizeof(uint16_t);
+
+    LosslessCodec();
+
+    /// \brief Checks the magic at the start of a datagram
+    static bool isLosslessDatagram(const int8_t* buf, int len);
+    /// \brief Upper bound of the coded size of num_packets packets
+    static int getMaxDatagramSize(int num_packets, int full_packet_size, int num_channels);
+    /// \brief False if the coded audio of a packet may not fit in EncodedSize
+    static bool isPacketSizeSupported(int audio_packet_size, int num_channels)
+    { return 0xffff >= audio_packet_size + num_channels; }
+    /// \brief Allocates the coded packets, so that encodeDatagram() doesn't
+    void reserve(int num_packets, int full_packet_size, int num_channels);
+
+    /** \brief Codes consecutive full packets (header+audio) into one datagram
+     * \return Size of the datagram
+     */
+    int encodeDatagram(const int8_t* full_packets, int num_packets,
+                       int full_packet_size, int8_t* datagram);
+    /** \brief Decodes a datagram back into consecutive full packets
+     * \return Size of the full packets, or -1 if the datagram is corrupt
+     */
+    int decodeDatagram(const int8_t* datagram, int datagram_size,
+                       int8_t* full_packets, int max_size);
+
+private:
+    int encodeChannel(const int8_t* audio, int num_samples, int sample_size, int8_t* out);
+    int decodeChannel(const int8_t* in, int in_size, int num_samples, int sample_size,
+                      int8_t* audio);
+
+    std::vector<int32_t> mSamples;
+    std::vector<int32_t> mResidual;
+    std::vector<uint8_t> mBits; ///< Coded channel, before checking it is smaller than raw
+
+    /// \brief Coded form of a packet: EncodedSize, header and coded audio
+    struct CodedPacket {
+        std::vector<int8_t> data;
+        int size; ///< 0 if empty
+    };
+    /// Indexed by sequence number modulo its size, a power of 2
+    std::vector<CodedPacket> mCodedPackets;
+    int mCodedPacketCapacity;
+};
+
+#endif // __LOSSLESSCODEC_H__
@@ -0,0 +1,312 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file MetricsExporter.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "MetricsExporter.h"
+
+#include <QTcpSocket>
+#include <QMutexLocker>
+#include <ctime>
+
+namespace {
+
+const int sMaxRequestSize = 8192;
+
+/// \brief Session counters, exposed as jacktrip_session_<name>_total
+struct CounterFamily {
+    const char* name;
+    const char* help;
+    uint64_t MetricsExporter::SessionMetrics::* field;
+};
+
+const CounterFamily sCounters[] = {
+    {"packets", "Audio packets received", &MetricsExporter::SessionMetrics::packets},
+    {"lost_packets", "Packets lost on the network", &MetricsExporter::SessionMetrics::lost},
+    {"out_of_order_packets", "Packets received out of order", &MetricsExporter::SessionMetrics::outOfOrder},
+    {"revived_packets", "Lost packets rebuilt from redundancy or parity", &MetricsExporter::SessionMetrics::revived},
+    {"underruns", "Receive buffer underruns", &MetricsExporter::SessionMetrics::underruns},
+    {"overflows", "Receive buffer overflows", &MetricsExporter::SessionMetrics::overflows},
+    {"buffer_increases_underrun", "Buffer corrections after an underrun", &MetricsExporter::SessionMetrics::bufIncUnderrun},
+    {"buffer_increases_compensate", "Buffer corrections for clock skew", &MetricsExporter::SessionMetrics::bufIncCompensate},
+    {"buffer_decreases_overflow", "Buffer corrections after an overflow", &MetricsExporter::SessionMetrics::bufDecOverflows},
+    {"buffer_decreases_loss", "Buffer corrections after a packet loss", &MetricsExporter::SessionMetrics::bufDecPktLoss},
+};
+
+/// \brief Session tails, exposed as summaries with the max as quantile 1
+struct SummaryFamily {
+    const char* name;
+    const char* help;
+    MetricsExporter::Tail MetricsExporter::SessionMetrics::* field;
+};
+
+const SummaryFamily sSummaries[] = {
+    {"callback_microseconds", "Audio callback duration", &MetricsExporter::SessionMetrics::callback},
+    {"arrival_interval_microseconds", "Time between received datagrams", &MetricsExporter::SessionMetrics::arrival},
+    {"queue_level_frames", "Receive buffer level when read", &MetricsExporter::SessionMetrics::level},
+    {"send_wakeup_microseconds", "Send thread wakeup latency", &MetricsExporter::SessionMetrics::wakeup},
+    {"packet_age_microseconds", "Packet age at arrival, with synchronized clocks", &MetricsExporter::SessionMetrics::age},
+};
+
+/// \brief Label values of the latency budget, indexed by latencyStageT
+const char* const sLatencyStages[MetricsExporter::NUM_LATENCY_STAGES] = {
+    "period", "send_queue", "network", "jitter_buffer", "fec_hold", "plugin",
+};
+
+//*******************************************************************************
+QByteArray escapeLabel(const QString& value)
+{
+    QByteArray escaped;
+    QByteArray utf8 = value.toUtf8();
+    for (int i = 0; i < utf8.size(); ++i) {
+        char c = utf8.at(i);
+        if ('\\' == c || '"' == c) {
+            escaped += '\\';
+            escaped += c;
+        } else if ('\n' == c) {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+//*******************************************************************************
+void appendFamily(QByteArray& out, const char* name, const char* type, const char* help)
+{
+    out += QByteArray("# TYPE ") + name + " " + type + "\n";
+    out += QByteArray("# HELP ") + name + " " + help + "\n";
+}
+
+} // namespace
+
+
+//*******************************************************************************
+MetricsExporter::MetricsExporter(QObject* parent) :
+    QObject(parent),
+    mIsHub(false),
+    mHubSessions(0),
+    mHubThreads(0),
+    mHubAdmissionSec(0.0)
+{
+    QObject::connect(&mTcpServer, &QTcpServer::newConnection,
+                     this, &MetricsExporter::receivedNewConnection);
+}
+
+
+//*******************************************************************************
+bool MetricsExporter::listen(quint16 port)
+{
+    return mTcpServer.listen(QHostAddress::LocalHost, port);
+}
+
+
+//*******************************************************************************
+void MetricsExporter::updateSession(const QString& session, const SessionMetrics& metrics)
+{
+    QMutexLocker locker(&mMutex);
+    mSessions[session] = metrics;
+}
+
+
+//*******************************************************************************
+void MetricsExporter::removeSession(const QString& session)
+{
+    QMutexLocker locker(&mMutex);
+    mSessions.remove(session);
+}
+
+
+//*******************************************************************************
+void MetricsExporter::setHubGauges(int sessions, int threads, double admission_sec)
+{
+    QMutexLocker locker(&mMutex);
+    mIsHub = true;
+    mHubSessions = sessions;
+    mHubThreads = threads;
+    if (0.0 <= admission_sec) {
+        mHubAdmissionSec = admission_sec;
+    }
+}
+
+
+//*******************************************************************************
+QByteArray MetricsExporter::render(bool openmetrics)
+{
+    QByteArray out;
+    // The older format names the counter family after its sample
+    const char* total = openmetrics ? "" : "_total";
+
+    appendFamily(out, (QByteArray("process_cpu_seconds") + total).constData(), "counter",
+                 "CPU time of the whole process");
+    out += "process_cpu_seconds_total " + QByteArray::number(
+               static_cast<double>(std::clock()) / CLOCKS_PER_SEC) + "\n";
+
+    QMutexLocker locker(&mMutex);
+    if (mIsHub) {
+        appendFamily(out, "jacktrip_hub_sessions", "gauge", "Connected clients");
+        out += "jacktrip_hub_sessions " + QByteArray::number(mHubSessions) + "\n";
+        appendFamily(out, "jacktrip_hub_threads", "gauge", "Active threads in the pool");
+        out += "jacktrip_hub_threads " + QByteArray::number(mHubThreads) + "\n";
+        appendFamily(out, "jacktrip_hub_admission_seconds", "gauge",
+                     "Time it took to admit the last client");
+        out += "jacktrip_hub_admission_seconds " + QByteArray::number(mHubAdmissionSec) + "\n";
+    }
+
+    QMap<QString, QByteArray> labels;
+    for (QMap<QString, SessionMetrics>::const_iterator it = mSessions.constBegin();
+         it != mSessions.constEnd(); ++it) {
+        labels[it.key()] = "session=\"" + escapeLabel(it.key())
+                + "\",peer=\"" + escapeLabel(it.value().peer)
+                + "\",client=\"" + escapeLabel(it.value().client) + "\"";
+    }
+
+    for (size_t f = 0; f < sizeof(sCounters) / sizeof(sCounters[0]); ++f) {
+        QByteArray name = QByteArray("jacktrip_session_") + sCounters[f].name;
+        appendFamily(out, (name + total).constData(), "counter", sCounters[f].help);
+        for (QMap<QString, SessionMetrics>::const_iterator it = mSessions.constBegin();
+             it != mSessions.constEnd(); ++it) {
+            out += name + "_total{" + labels[it.key()] + "} "
+                    + QByteArray::number((qulonglong)(it.value().*sCounters[f].field)) + "\n";
+        }
+    }
+
+    appendFamily(out, "jacktrip_session_queue_level", "gauge", "Receive buffer level, in slots");
+    for (QMap<QString, SessionMetrics>::const_iterator it = mSessions.constBegin();
+         it != mSessions.constEnd(); ++it) {
+        out += "jacktrip_session_queue_level{" + labels[it.key()] + "} "
+                + QByteArray::number((qlonglong)it.value().queueLevel) + "\n";
+    }
+    appendFamily(out, "jacktrip_session_skew", "gauge", "Receive buffer clock skew, in slots");
+    for (QMap<QString, SessionMetrics>::const_iterator it = mSessions.constBegin();
+         it != mSessions.constEnd(); ++it) {
+        out += "jacktrip_session_skew{" + labels[it.key()] + "} "
+                + QByteArray::number((qlonglong)it.value().skew) + "\n";
+    }
+    appendFamily(out, "jacktrip_session_round_trip_microseconds", "gauge",
+                 "Smoothed round trip time from the timestamp echoes, 0 until measured");
+    for (QMap<QString, SessionMetrics>::const_iterator it = mSessions.constBegin();
+         it != mSessions.constEnd(); ++it) {
+        out += "jacktrip_session_round_trip_microseconds{" + labels[it.key()] + "} "
+                + QByteArray::number((qulonglong)it.value().roundTripUs) + "\n";
+    }
+    // Summed over the stages, an estimate of the one-way latency of the session
+    appendFamily(out, "jacktrip_session_latency_budget_microseconds", "gauge",
+                 "Latency of each stage of the audio path");
+    for (QMap<QString, SessionMetrics>::const_iterator it = mSessions.constBegin();
+         it != mSessions.constEnd(); ++it) {
+        for (int s = 0; s < NUM_LATENCY_STAGES; ++s) {
+            out += "jacktrip_session_latency_budget_microseconds{" + labels[it.key()]
+                    + ",stage=\"" + sLatencyStages[s] + "\"} "
+                    + QByteArray::number((qulonglong)it.value().budgetUs[s]) + "\n";
+        }
+    }
+
+    // The quantiles cover the last stat interval, count and sum the whole session
+    for (size_t f = 0; f < sizeof(sSummaries) / sizeof(sSummaries[0]); ++f) {
+        QByteArray name = QByteArray("jacktrip_session_") + sSummaries[f].name;
+        appendFamily(out, name.constData(), "summary", sSummaries[f].help);
+        for (QMap<QString, SessionMetrics>::const_iterator it = mSessions.constBegin();
+             it != mSessions.constEnd(); ++it) {
+            const Tail& tail = it.value().*sSummaries[f].field;
+            const QByteArray& l = labels[it.key()];
+            out += name + "{" + l + ",quantile=\"0.5\"} " + QByteArray::number((qulonglong)tail.last.p50) + "\n";
+            out += name + "{" + l + ",quantile=\"0.99\"} " + QByteArray::number((qulonglong)tail.last.p99) + "\n";
+            out += name + "{" + l + ",quantile=\"0.999\"} " + QByteArray::number((qulonglong)tail.last.p999) + "\n";
+            out += name + "{" + l + ",quantile=\"1\"} " + QByteArray::number((qulonglong)tail.last.max) + "\n";
+            out += name + "_count{" + l + "} " + QByteArray::number((qulonglong)tail.count) + "\n";
+            out += name + "_sum{" + l + "} " + QByteArray::number((qulonglong)tail.sum) + "\n";
+        }
+    }
+
+    if (openmetrics) {
+        out += "# EOF\n";
+    }
+    return out;
+}
+
+
+//*******************************************************************************
+void MetricsExporter::receivedNewConnection()
+{
+    while (mTcpServer.hasPendingConnections()) {
+        QTcpSocket* socket = mTcpServer.nextPendingConnection();
+        QObject::connect(socket, &QAbstractSocket::disconnected, socket, &QObject::deleteLater);
+        QObject::connect(socket, &QAbstractSocket::readyRead, this, [=]{
+            receivedRequest(socket);
+        });
+    }
+}
+
+
+//*******************************************************************************
+void MetricsExporter::receivedRequest(QTcpSocket* socket)
+{
+    // Wait for the whole request header, the body (if any) is ignored
+    QByteArray request = socket->peek(sMaxRequestSize);
+    int end = request.indexOf("\r\n\r\n");
+    if (-1 == end) {
+        if (sMaxRequestSize <= request.size()) {
+            socket->abort();
+        }
+        return;
+    }
+    socket->read(end + 4);
+    QObject::disconnect(socket, &QAbstractSocket::readyRead, this, NULL);
+
+    QList<QByteArray> request_line = request.left(request.indexOf("\r\n")).split(' ');
+    QByteArray path = (1 < request_line.size()) ? request_line.at(1) : QByteArray();
+    QByteArray response;
+    if ("GET" != request_line.at(0)) {
+        response = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\n"
+                   "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    } else if ("/metrics" != path && "/" != path) {
+        response = "HTTP/1.1 404 Not Found\r\n"
+                   "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    } else {
+        bool openmetrics = request.left(end).toLower().contains("application/openmetrics-text");
+        QByteArray body = render(openmetrics);
+        response = "HTTP/1.1 200 OK\r\nContent-Type: ";
+        response += openmetrics
+                ? "application/openmetrics-text; version=1.0.0; charset=utf-8"
+                : "text/plain; version=0.0.4; charset=utf-8";
+        response += "\r\nContent-Length: " + QByteArray::number(body.size())
+                + "\r\nConnection: close\r\n\r\n" + body;
+    }
+    socket->write(response);
+    socket->disconnectFromHost();
+}
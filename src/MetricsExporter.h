@@ -0,0 +1,150 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file MetricsExporter.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __METRICSEXPORTER_H__
+#define __METRICSEXPORTER_H__
+
+#include <QObject>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+#include <QTcpServer>
+
+#include "LatencyHistogram.h"
+
+/** \brief Embedded HTTP endpoint with the session and hub statistics in
+ * OpenMetrics text format, for Prometheus
+ *
+ * It listens on localhost only. The JackTrip objects push a snapshot of their
+ * counters from their stat timer with updateSession(), and the hub its gauges
+ * with setHubGauges(); a scrape only reads those snapshots under mMutex, so it
+ * never touches the audio or network threads.
+ *
+ * Scrapers that don't ask for application/openmetrics-text get the older
+ * Prometheus text format, which only differs in the counter TYPE lines and
+ * the missing EOF marker.
+ */
+class MetricsExporter : public QObject
+{
+    Q_OBJECT;
+
+public:
+
+    /// \brief Cumulative count and sum of a LatencyHistogram, with the tails of the last interval
+    struct Tail {
+        LatencyHistogram::Summary last;
+        uint64_t count;
+        uint64_t sum;
+        void add(const LatencyHistogram::Summary& summary)
+        { last = summary; count += summary.count; sum += summary.sum; }
+    };
+
+    /// \brief Stages of the latency budget, in the order the audio goes through them
+    enum latencyStageT {
+        PERIOD, ///< One audio period
+        SEND_QUEUE, ///< Residence in the send buffer, before the send thread picks it up
+        NETWORK, ///< Half the round trip time
+        JITTER_BUFFER, ///< Residence in the receive buffer
+        FEC_HOLD, ///< Periods held back for the parity or the aggregation
+        PLUGIN, ///< Process plugins
+        NUM_LATENCY_STAGES
+    };
+
+    /// \brief Snapshot of one session, the counters are totals since the start
+    struct SessionMetrics {
+        QString peer;
+        QString client;
+        uint64_t packets;
+        uint64_t lost;
+        uint64_t outOfOrder;
+        uint64_t revived;
+        uint64_t underruns;
+        uint64_t overflows;
+        uint64_t bufIncUnderrun;
+        uint64_t bufIncCompensate;
+        uint64_t bufDecOverflows;
+        uint64_t bufDecPktLoss;
+        int64_t queueLevel; ///< Receive buffer level, in slots
+        int64_t skew;
+        Tail callback; ///< Audio callback duration, us; its sum is the callback CPU time
+        Tail arrival; ///< Datagram inter-arrival time, us
+        Tail level; ///< Receive buffer level when read, frames
+        Tail wakeup; ///< Send thread wakeup latency, us
+        Tail age; ///< Packet age at arrival, us
+        uint64_t roundTripUs; ///< Smoothed, 0 until the peer answers our timestamp echoes
+        uint64_t budgetUs[NUM_LATENCY_STAGES]; ///< Latency of each stage, see latencyStageT
+    };
+
+    explicit MetricsExporter(QObject* parent = NULL);
+    virtual ~MetricsExporter() {}
+
+    /// \brief Starts serving on localhost, returns false if the port can't be bound
+    bool listen(quint16 port);
+    QString errorString() const { return mTcpServer.errorString(); }
+
+    /// \brief Adds or replaces the snapshot of a session, thread safe
+    void updateSession(const QString& session, const SessionMetrics& metrics);
+    /// \brief Thread safe
+    void removeSession(const QString& session);
+    /** \brief Hub wide gauges, thread safe
+     * \param sessions Connected clients
+     * \param threads Active threads in the pool
+     * \param admission_sec Time it took to admit the last client
+     */
+    void setHubGauges(int sessions, int threads, double admission_sec);
+
+    /// \brief The whole exposition, in OpenMetrics or in the Prometheus text format
+    QByteArray render(bool openmetrics);
+
+private slots:
+    void receivedNewConnection();
+
+private:
+    void receivedRequest(QTcpSocket* socket);
+
+    QTcpServer mTcpServer;
+    QMutex mMutex; ///< Guards the snapshots below
+    QMap<QString, SessionMetrics> mSessions;
+    bool mIsHub;
+    int mHubSessions;
+    int mHubThreads;
+    double mHubAdmissionSec;
+};
+
+#endif // __METRICSEXPORTER_H__
@@ -0,0 +1,293 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file NetworkImpairment.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "NetworkImpairment.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+//*******************************************************************************
+// Splits "a:b:c" into numbers, all of them must parse
+static std::vector<double> parseNumbers(const std::string& key, const std::string& value)
+{
+    std::vector<double> numbers;
+    std::istringstream fields(value);
+    std::string field;
+    while (std::getline(fields, field, ':')) {
+        char* endp;
+        double number = std::strtod(field.c_str(), &endp);
+        if (field.empty() || 0 != *endp || !std::isfinite(number) || 0.0 > number) {
+            throw std::invalid_argument("Bad value " + value + " for " + key);
+        }
+        numbers.push_back(number);
+    }
+    return numbers;
+}
+
+
+//*******************************************************************************
+static inline void checkProbability(const std::string& key, double p)
+{
+    if (1.0 < p) {
+        throw std::invalid_argument("Probabilities of " + key + " must be 0 to 1");
+    }
+}
+
+
+//*******************************************************************************
+NetworkImpairment::Model::Model() :
+    lossRate(0.0),
+    geGoodToBad(0.0),
+    geBadToGood(1.0),
+    geLossGood(0.0),
+    geLossBad(1.0),
+    jitterRate(0.0),
+    jitterMaxDelaySec(0.0),
+    paretoMinDelaySec(0.0),
+    paretoShape(0.0),
+    reorderRate(0.0),
+    duplicateRate(0.0),
+    rateBitsPerSec(0.0)
+{}
+
+
+//*******************************************************************************
+bool NetworkImpairment::Model::isEnabled() const
+{
+    return 0.0 < lossRate || 0.0 < geGoodToBad || 0.0 < jitterRate
+            || 0.0 < paretoMinDelaySec || !traceDelaysSec.empty()
+            || 0.0 < reorderRate || 0.0 < duplicateRate || 0.0 < rateBitsPerSec;
+}
+
+
+//*******************************************************************************
+void NetworkImpairment::parseModel(const std::string& spec, Model* model)
+{
+    std::istringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t equal = item.find('=');
+        if (std::string::npos == equal) {
+            throw std::invalid_argument("Expected <impairment>=<value>, got " + item);
+        }
+        std::string key = item.substr(0, equal);
+        std::string value = item.substr(equal + 1);
+        if ("trace" == key) {
+            // File names are taken as they are
+            model->traceDelaysSec = readDelayTrace(value);
+            continue;
+        }
+        std::vector<double> numbers = parseNumbers(key, value);
+        if ("ge" == key) {
+            if (2 != numbers.size() && 4 != numbers.size()) {
+                throw std::invalid_argument("ge needs <p>:<r>[:<loss good>:<loss bad>]");
+            }
+            for (double p : numbers) {
+                checkProbability(key, p);
+            }
+            model->geGoodToBad = numbers[0];
+            model->geBadToGood = numbers[1];
+            if (4 == numbers.size()) {
+                model->geLossGood = numbers[2];
+                model->geLossBad = numbers[3];
+            }
+        } else if ("pareto" == key) {
+            if (2 != numbers.size() || 0.0 >= numbers[0] || 0.0 >= numbers[1]) {
+                throw std::invalid_argument("pareto needs <min ms>:<shape>, both positive");
+            }
+            model->paretoMinDelaySec = numbers[0] * 1e-3;
+            model->paretoShape = numbers[1];
+        } else if (1 != numbers.size()) {
+            throw std::invalid_argument("Expected a single value for " + key);
+        } else if ("reorder" == key) {
+            checkProbability(key, numbers[0]);
+            model->reorderRate = numbers[0];
+        } else if ("duplicate" == key) {
+            checkProbability(key, numbers[0]);
+            model->duplicateRate = numbers[0];
+        } else if ("rate" == key) {
+            model->rateBitsPerSec = numbers[0] * 1e3;
+        } else {
+            throw std::invalid_argument("Unknown impairment " + key);
+        }
+    }
+}
+
+
+//*******************************************************************************
+std::vector<double> NetworkImpairment::readDelayTrace(const std::string& path)
+{
+    std::vector<double> trace;
+    std::ifstream file(path.c_str());
+    if (!file) {
+        throw std::invalid_argument("Could not open trace " + path);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string field;
+        if (!(fields >> field) || '#' == field[0]) {
+            continue;
+        }
+        trace.push_back(("-" == field) ? -1.0 : std::atof(field.c_str()) * 1e-3);
+    }
+    if (trace.empty()) {
+        throw std::invalid_argument("Empty trace " + path);
+    }
+    return trace;
+}
+
+
+//*******************************************************************************
+NetworkImpairment::NetworkImpairment(const Model& model, unsigned int seed) :
+    mModel(model),
+    mRndEngine(seed),
+    mUniformDist(0.0, 1.0),
+    mGeBad(false),
+    mTraceIndex(0),
+    mLinkFreeNs(0),
+    mLastReleaseNs(0),
+    mOrder(0),
+    mDropped(0)
+{}
+
+
+//*******************************************************************************
+bool NetworkImpairment::isLost()
+{
+    bool lost = 0.0 < mModel.lossRate && mUniformDist(mRndEngine) < mModel.lossRate;
+    if (0.0 < mModel.geGoodToBad) {
+        double x = mUniformDist(mRndEngine);
+        mGeBad = mGeBad ? (x >= mModel.geBadToGood) : (x < mModel.geGoodToBad);
+        double loss = mGeBad ? mModel.geLossBad : mModel.geLossGood;
+        lost = (mUniformDist(mRndEngine) < loss) || lost;
+    }
+    return lost;
+}
+
+
+//*******************************************************************************
+int64_t NetworkImpairment::getDelayNs(bool* lost)
+{
+    double delay = 0.0;
+    if (!mModel.traceDelaysSec.empty()) {
+        double trace_delay = mModel.traceDelaysSec[mTraceIndex++ % mModel.traceDelaysSec.size()];
+        if (0.0 > trace_delay) {
+            *lost = true;
+        } else {
+            delay += trace_delay;
+        }
+    }
+    if (0.0 < mModel.paretoMinDelaySec) {
+        // Inverse of the CDF, 1-u is in (0, 1]
+        double u = 1.0 - mUniformDist(mRndEngine);
+        delay += mModel.paretoMinDelaySec / std::pow(u, 1.0 / mModel.paretoShape);
+    }
+    if (0.0 < mModel.jitterRate && mUniformDist(mRndEngine) < mModel.jitterRate) {
+        delay += mUniformDist(mRndEngine) * mModel.jitterMaxDelaySec;
+    }
+    return std::min<int64_t>(sMaxDelayNs, static_cast<int64_t>(delay * 1e9));
+}
+
+
+//*******************************************************************************
+void NetworkImpairment::push(const char* buf, size_t n, int64_t now_ns, bool can_drop)
+{
+    if (sQueueLimit <= mQueue.size()) {
+        ++mDropped;
+        return;
+    }
+    int64_t depart_ns = now_ns;
+    if (0.0 < mModel.rateBitsPerSec) {
+        depart_ns = std::max(now_ns, mLinkFreeNs) + static_cast<int64_t>(n * 8e9 / mModel.rateBitsPerSec);
+        mLinkFreeNs = depart_ns;
+    }
+    bool lost = isLost();
+    int64_t delay_ns = getDelayNs(&lost);
+    if (lost && can_drop) {
+        ++mDropped;
+        return;
+    }
+
+    int64_t release_ns;
+    if (0.0 < mModel.reorderRate && mUniformDist(mRndEngine) < mModel.reorderRate) {
+        // Overtakes the delayed datagrams ahead of it
+        release_ns = depart_ns;
+    } else {
+        release_ns = std::max(depart_ns + delay_ns, mLastReleaseNs);
+        mLastReleaseNs = release_ns;
+    }
+    hold(buf, n, release_ns);
+    if (can_drop && 0.0 < mModel.duplicateRate && mUniformDist(mRndEngine) < mModel.duplicateRate) {
+        hold(buf, n, release_ns);
+    }
+}
+
+
+//*******************************************************************************
+void NetworkImpairment::hold(const char* buf, size_t n, int64_t release_ns)
+{
+    Held held;
+    held.releaseNs = release_ns;
+    held.order = mOrder++;
+    held.data.assign(buf, buf + n);
+    mQueue.push(std::move(held));
+}
+
+
+//*******************************************************************************
+int NetworkImpairment::receive(const Segment* segments, int count, bool peek)
+{
+    if (mQueue.empty()) {
+        return -1;
+    }
+    const std::vector<char>& data = mQueue.top().data;
+    size_t copied = 0;
+    for (int i = 0; i < count && copied < data.size(); ++i) {
+        size_t n = std::min(segments[i].size, data.size() - copied);
+        std::memcpy(segments[i].data, data.data() + copied, n);
+        copied += n;
+    }
+    if (!peek) {
+        mQueue.pop();
+    }
+    return copied;
+}
@@ -0,0 +1,158 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file NetworkImpairment.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __NETWORKIMPAIRMENT_H__
+#define __NETWORKIMPAIRMENT_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+/** \brief Simulated network between the socket and the packet parser
+ *
+ * The receive thread pushes every datagram it reads and takes back the ones
+ * whose release time has come, so nothing sleeps on the thread being
+ * measured. A datagram goes through, in order:
+ * - a bottleneck of the given rate, whose queue delays it by the bytes ahead;
+ * - independent loss (--simloss) and Gilbert-Elliott bursty loss;
+ * - a delay from a looped trace, a Pareto distribution and the uniform
+ *   jitter of --simjitter, added up;
+ * - reordering: some datagrams skip the delay, the others are released in
+ *   the order they came, as from a queue;
+ * - duplication.
+ *
+ * Times are CLOCK_MONOTONIC nanoseconds passed by the caller, so the same
+ * model can run on a virtual clock.
+ */
+class NetworkImpairment
+{
+public:
+
+    /// \brief Same as ShmChannel::Segment
+    struct Segment {
+        char* data;
+        size_t size;
+    };
+
+    /// \brief Parameters of the impairments, all off by default
+    struct Model {
+        double lossRate; ///< Independent loss probability
+        double geGoodToBad; ///< Gilbert-Elliott transition probabilities per datagram, 0 if off
+        double geBadToGood;
+        double geLossGood; ///< Loss probability in each Gilbert-Elliott state
+        double geLossBad;
+        double jitterRate; ///< Share of datagrams delayed by up to jitterMaxDelaySec
+        double jitterMaxDelaySec;
+        double paretoMinDelaySec; ///< Scale of the Pareto delay, 0 if off
+        double paretoShape;
+        std::vector<double> traceDelaysSec; ///< Looped one way delays, negative if lost
+        double reorderRate; ///< Share of datagrams released at once, ahead of the delayed ones
+        double duplicateRate;
+        double rateBitsPerSec; ///< Bottleneck rate, 0 if unlimited
+
+        Model();
+        bool isEnabled() const;
+    };
+
+    static const size_t sQueueLimit = 1000; ///< Datagrams held, as the netem default
+    static const int64_t sMaxDelayNs = 2000000000; ///< Cap of the Pareto tail
+
+    /** \brief Parses a comma separated list of impairments, see --simnet
+     *
+     * ge=<p>:<r>[:<loss good>:<loss bad>], pareto=<min ms>:<shape>,
+     * trace=<file>, reorder=<rate>, duplicate=<rate>, rate=<kbit/s>
+     * \throw std::invalid_argument if the list can't be parsed
+     */
+    static void parseModel(const std::string& spec, Model* model);
+    /** \brief Reads one way delays in ms, one per line, "-" for a lost datagram, # for comments
+     * \throw std::invalid_argument if the file can't be read or is empty
+     */
+    static std::vector<double> readDelayTrace(const std::string& path);
+
+    NetworkImpairment(const Model& model, unsigned int seed);
+
+    /** \brief Takes a datagram that has just arrived
+     * \param can_drop False for control packets, which are only delayed
+     */
+    void push(const char* buf, size_t n, int64_t now_ns, bool can_drop = true);
+    /// \brief True if a datagram is due
+    bool available(int64_t now_ns) const
+    { return !mQueue.empty() && mQueue.top().releaseNs <= now_ns; }
+    /// \brief Nanoseconds until the next datagram is due, negative if none is held
+    int64_t getWaitNs(int64_t now_ns) const
+    { return mQueue.empty() ? -1 : std::max<int64_t>(0, mQueue.top().releaseNs - now_ns); }
+    /// \brief Release time of the next datagram, to use as its arrival time
+    int64_t getReleaseNs() const { return mQueue.empty() ? 0 : mQueue.top().releaseNs; }
+    /** \brief Copies the next datagram, due or not, into the segments
+     * \return Bytes copied, -1 if none is held
+     */
+    int receive(const Segment* segments, int count, bool peek = false);
+    int receive(char* buf, size_t n)
+    { Segment segment = {buf, n}; return receive(&segment, 1); }
+    /// \brief Datagrams lost so far, on purpose or because the queue was full
+    uint64_t getDropped() const { return mDropped; }
+
+private:
+    struct Held {
+        int64_t releaseNs;
+        uint64_t order; ///< Keeps datagrams due at the same time in order
+        std::vector<char> data;
+        bool operator<(const Held& other) const
+        { return releaseNs > other.releaseNs || (releaseNs == other.releaseNs && order > other.order); }
+    };
+
+    bool isLost();
+    int64_t getDelayNs(bool* lost);
+    void hold(const char* buf, size_t n, int64_t release_ns);
+
+    Model mModel;
+    std::default_random_engine mRndEngine;
+    std::uniform_real_distribution<double> mUniformDist;
+    bool mGeBad; ///< Gilbert-Elliott state
+    size_t mTraceIndex;
+    int64_t mLinkFreeNs; ///< When the bottleneck has sent what it holds
+    int64_t mLastReleaseNs; ///< Of the last datagram that kept its place
+    uint64_t mOrder;
+    uint64_t mDropped;
+    std::priority_queue<Held> mQueue;
+};
+
+#endif // __NETWORKIMPAIRMENT_H__
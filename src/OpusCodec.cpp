@@ -0,0 +1,420 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file OpusCodec.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "OpusCodec.h"
+#include "AudioInterface.h"
+#include "PacketHeader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#ifdef __OPUS__
+#include <opus_custom.h>
+#endif
+
+static const int sMaxPooledCodecs = 32;
+static std::vector<OpusCodec*> sCodecPool;
+static QMutex sCodecPoolMutex;
+
+//*******************************************************************************
+static inline float toFloat(const int8_t* p, int bit_res)
+{
+    sample_t value;
+    if (AudioInterface::BIT32 == bit_res) {
+        std::memcpy(&value, p, sizeof(value));
+    } else {
+        AudioInterface::fromBitToSampleConversion(
+                    p, &value, static_cast<AudioInterface::audioBitResolutionT>(bit_res));
+    }
+    return value;
+}
+
+
+//*******************************************************************************
+static inline void fromFloat(float value, int8_t* p, int bit_res)
+{
+    if (AudioInterface::BIT32 == bit_res) {
+        std::memcpy(p, &value, sizeof(value));
+        return;
+    }
+    // The decoder may overshoot full scale, which only the float formats can carry
+    sample_t clamped = value;
+    if (AudioInterface::FLOAT16 != bit_res) {
+        clamped = std::max(-1.0f, std::min(32767.0f / 32768.0f, value));
+    }
+    AudioInterface::fromSampleToBitConversion(
+                &clamped, p, static_cast<AudioInterface::audioBitResolutionT>(bit_res));
+}
+
+
+//*******************************************************************************
+OpusCodec::OpusCodec(int sample_rate, int num_channels, int frame_size,
+                     int bitrate, int complexity) :
+    mSampleRate(sample_rate),
+    mNumChannels(num_channels),
+    mFrameSize(frame_size),
+    mBitrate(bitrate),
+    mComplexity(complexity),
+    mMode(NULL),
+    mHistoryHead(0),
+    mHistoryCount(0)
+{
+#ifdef __OPUS__
+    if (1 > mNumChannels || !isFrameSizeSupported(mSampleRate, mFrameSize)) {
+        throw std::invalid_argument("Opus can't code this sampling rate, period or number of channels");
+    }
+    int error = OPUS_OK;
+    mMode = opus_custom_mode_create(mSampleRate, mFrameSize, &error);
+    if (OPUS_OK != error) {
+        throw std::runtime_error(std::string("Opus custom mode error: ") + opus_strerror(error));
+    }
+    int num_pairs = (mNumChannels + 1) / 2;
+    for (int s = 0; s < num_pairs && OPUS_OK == error; ++s) {
+        int n = std::min(2, mNumChannels - 2*s);
+        OpusCustomEncoder* encoder = opus_custom_encoder_create(mMode, n, &error);
+        if (OPUS_OK != error) {
+            break;
+        }
+        mEncoders.push_back(encoder);
+        // Each pair gets its share of the bitrate
+        opus_custom_encoder_ctl(encoder, OPUS_SET_BITRATE(mBitrate * n / mNumChannels));
+        opus_custom_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(mComplexity));
+        OpusCustomDecoder* decoder = opus_custom_decoder_create(mMode, n, &error);
+        if (OPUS_OK != error) {
+            break;
+        }
+        mDecoders.push_back(decoder);
+    }
+    if (OPUS_OK != error) {
+        destroy();
+        throw std::runtime_error(std::string("Opus coder error: ") + opus_strerror(error));
+    }
+#else
+    throw std::runtime_error("JackTrip was built without Opus support");
+#endif
+    mPcm.resize(2 * mFrameSize);
+    mHistory.resize(sMaxPackets);
+}
+
+
+//*******************************************************************************
+OpusCodec::~OpusCodec()
+{
+    destroy();
+}
+
+
+//*******************************************************************************
+void OpusCodec::destroy()
+{
+#ifdef __OPUS__
+    for (size_t s = 0; s < mEncoders.size(); ++s) {
+        opus_custom_encoder_destroy(mEncoders[s]);
+    }
+    for (size_t s = 0; s < mDecoders.size(); ++s) {
+        opus_custom_decoder_destroy(mDecoders[s]);
+    }
+    mEncoders.clear();
+    mDecoders.clear();
+    if (NULL != mMode) {
+        opus_custom_mode_destroy(mMode);
+        mMode = NULL;
+    }
+#endif
+}
+
+
+//*******************************************************************************
+OpusCodec* OpusCodec::acquire(int sample_rate, int num_channels, int frame_size,
+                              int bitrate, int complexity)
+{
+    {
+        QMutexLocker locker(&sCodecPoolMutex);
+        for (size_t i = 0; i < sCodecPool.size(); ++i) {
+            OpusCodec* codec = sCodecPool[i];
+            if (codec->mSampleRate == sample_rate && codec->mNumChannels == num_channels
+                    && codec->mFrameSize == frame_size && codec->mBitrate == bitrate
+                    && codec->mComplexity == complexity) {
+                sCodecPool.erase(sCodecPool.begin() + i);
+                return codec;
+            }
+        }
+    }
+    return new OpusCodec(sample_rate, num_channels, frame_size, bitrate, complexity);
+}
+
+
+//*******************************************************************************
+void OpusCodec::release(OpusCodec* codec)
+{
+    if (NULL == codec) {
+        return;
+    }
+    codec->reset();
+    QMutexLocker locker(&sCodecPoolMutex);
+    if (sMaxPooledCodecs > static_cast<int>(sCodecPool.size())) {
+        sCodecPool.push_back(codec);
+    } else {
+        delete codec;
+    }
+}
+
+
+//*******************************************************************************
+void OpusCodec::reset()
+{
+#ifdef __OPUS__
+    for (size_t s = 0; s < mEncoders.size(); ++s) {
+        opus_custom_encoder_ctl(mEncoders[s], OPUS_RESET_STATE);
+    }
+    for (size_t s = 0; s < mDecoders.size(); ++s) {
+        opus_custom_decoder_ctl(mDecoders[s], OPUS_RESET_STATE);
+    }
+#endif
+    mHistoryHead = 0;
+    mHistoryCount = 0;
+}
+
+
+//*******************************************************************************
+bool OpusCodec::isAvailable()
+{
+#ifdef __OPUS__
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+//*******************************************************************************
+bool OpusCodec::isFrameSizeSupported(int sample_rate, int frame_size)
+{
+    // Same limits as opus_custom_mode_create(), frames of at least 1 ms
+    return 8000 <= sample_rate && 96000 >= sample_rate
+            && 40 <= frame_size && 1024 >= frame_size && 0 == frame_size % 2
+            && frame_size * 1000 >= sample_rate;
+}
+
+
+//*******************************************************************************
+bool OpusCodec::isOpusDatagram(const int8_t* buf, int len)
+{
+    if (4 > len) {
+        return false;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, buf, sizeof(magic));
+    return sOpusMagic == magic;
+}
+
+
+//*******************************************************************************
+int OpusCodec::getMaxDatagramSize(int num_packets, int num_channels)
+{
+    int num_pairs = (num_channels + 1) / 2;
+    return sizeof(uint32_t) + std::min(num_packets, static_cast<int>(sMaxPackets))
+            * (sizeof(uint16_t) + sizeof(DefaultHeaderStruct)
+               + num_pairs * (sizeof(uint16_t) + sMaxFrameBytes));
+}
+
+
+//*******************************************************************************
+void OpusCodec::encodePacket(const int8_t* full_packet)
+{
+    const int header_size = sizeof(DefaultHeaderStruct);
+    DefaultHeaderStruct header;
+    std::memcpy(&header, full_packet, header_size);
+    int bit_res = header.BitResolution / 8;
+    int sample_size = AudioInterface::getSampleSize(bit_res);
+    bool matches = (mFrameSize == header.BufferSize && mNumChannels == header.NumChannels
+                    && 1 <= sample_size && 4 >= sample_size);
+
+    mHistoryHead = (mHistoryHead + 1) % sMaxPackets;
+    mHistoryCount = std::min(mHistoryCount + 1, static_cast<int>(sMaxPackets));
+    std::vector<int8_t>& coded = mHistory[mHistoryHead];
+    coded.resize(sizeof(uint16_t) + header_size
+                 + mEncoders.size() * (sizeof(uint16_t) + sMaxFrameBytes));
+    int8_t* pos = coded.data() + sizeof(uint16_t);
+    std::memcpy(pos, full_packet, header_size);
+    pos += header_size;
+
+    const int8_t* audio = full_packet + header_size;
+    for (size_t s = 0; s < mEncoders.size(); ++s) {
+        int first = 2*s;
+        int n = std::min(2, mNumChannels - first);
+        int len = 0;
+#ifdef __OPUS__
+        if (matches) {
+            // Non-interleaved packet channels to the interleaved pair
+            for (int i = 0; i < mFrameSize; ++i) {
+                for (int c = 0; c < n; ++c) {
+                    mPcm[i*n + c] = toFloat(audio + ((first + c)*mFrameSize + i)*sample_size,
+                                            bit_res);
+                }
+            }
+            len = opus_custom_encode_float(mEncoders[s], mPcm.data(), mFrameSize,
+                                           reinterpret_cast<unsigned char*>(pos + sizeof(uint16_t)),
+                                           sMaxFrameBytes);
+        }
+#else
+        Q_UNUSED(matches);
+        Q_UNUSED(audio);
+        Q_UNUSED(n);
+#endif
+        // An empty frame is concealed by the receiver
+        uint16_t frame_size = std::max(0, len);
+        std::memcpy(pos, &frame_size, sizeof(frame_size));
+        pos += sizeof(frame_size) + frame_size;
+    }
+    uint16_t coded_size = pos - coded.data() - sizeof(uint16_t);
+    std::memcpy(coded.data(), &coded_size, sizeof(coded_size));
+    coded.resize(pos - coded.data());
+}
+
+
+//*******************************************************************************
+int OpusCodec::encodeDatagram(const int8_t* full_packet, int num_packets, int8_t* datagram)
+{
+    encodePacket(full_packet);
+
+    const uint32_t magic = sOpusMagic;
+    int8_t* pos = datagram;
+    std::memcpy(pos, &magic, sizeof(magic));
+    pos += sizeof(magic);
+    int count = std::min(num_packets, mHistoryCount);
+    for (int i = 0; i < count; ++i) {
+        const std::vector<int8_t>& coded = mHistory[(mHistoryHead - i + sMaxPackets) % sMaxPackets];
+        std::memcpy(pos, coded.data(), coded.size());
+        pos += coded.size();
+    }
+    return pos - datagram;
+}
+
+
+//*******************************************************************************
+int OpusCodec::parseDatagram(const int8_t* datagram, int datagram_size,
+                             const int8_t** packets, int max_packets)
+{
+    const int header_size = sizeof(DefaultHeaderStruct);
+    if (!isOpusDatagram(datagram, datagram_size)) {
+        return -1;
+    }
+    const int8_t* pos = datagram + sizeof(uint32_t);
+    const int8_t* end = datagram + datagram_size;
+    int num_packets = 0;
+    while (pos < end && num_packets < max_packets) {
+        if (end - pos < static_cast<int>(sizeof(uint16_t)) + header_size) {
+            return -1;
+        }
+        uint16_t coded_size;
+        std::memcpy(&coded_size, pos, sizeof(coded_size));
+        if (header_size > coded_size || end - pos - static_cast<int>(sizeof(uint16_t)) < coded_size) {
+            return -1;
+        }
+        packets[num_packets++] = pos;
+        pos += sizeof(uint16_t) + coded_size;
+    }
+    return num_packets;
+}
+
+
+//*******************************************************************************
+bool OpusCodec::decodePacket(const int8_t* packet, int8_t* full_packet)
+{
+    const int header_size = sizeof(DefaultHeaderStruct);
+    const int8_t* pos = NULL;
+    const int8_t* end = NULL;
+    if (NULL != packet) {
+        uint16_t coded_size;
+        std::memcpy(&coded_size, packet, sizeof(coded_size));
+        std::memcpy(full_packet, getPacketHeader(packet), header_size);
+        pos = getPacketHeader(packet) + header_size;
+        end = packet + sizeof(uint16_t) + coded_size;
+    }
+    DefaultHeaderStruct header;
+    std::memcpy(&header, full_packet, header_size);
+    int bit_res = header.BitResolution / 8;
+    int sample_size = AudioInterface::getSampleSize(bit_res);
+    if (mFrameSize != header.BufferSize || mNumChannels != header.NumChannels
+            || 1 > sample_size || 4 < sample_size) {
+        return false;
+    }
+
+    int8_t* audio = full_packet + header_size;
+    for (size_t s = 0; s < mDecoders.size(); ++s) {
+        int first = 2*s;
+        int n = std::min(2, mNumChannels - first);
+        // A missing or truncated frame is concealed
+        const unsigned char* data = NULL;
+        int len = 0;
+        if (NULL != pos && static_cast<int>(sizeof(uint16_t)) <= end - pos) {
+            uint16_t frame_size;
+            std::memcpy(&frame_size, pos, sizeof(frame_size));
+            pos += sizeof(frame_size);
+            if (0 < frame_size && frame_size <= end - pos) {
+                data = reinterpret_cast<const unsigned char*>(pos);
+                len = frame_size;
+                pos += frame_size;
+            } else {
+                pos = end;
+            }
+        }
+        int decoded = -1;
+#ifdef __OPUS__
+        decoded = opus_custom_decode_float(mDecoders[s], data, len, mPcm.data(), mFrameSize);
+#else
+        Q_UNUSED(data);
+        Q_UNUSED(len);
+#endif
+        if (0 > decoded) {
+            std::fill(mPcm.begin(), mPcm.end(), 0.0f);
+        }
+        for (int i = 0; i < mFrameSize; ++i) {
+            for (int c = 0; c < n; ++c) {
+                fromFloat(mPcm[i*n + c], audio + ((first + c)*mFrameSize + i)*sample_size,
+                          bit_res);
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,157 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file OpusCodec.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __OPUSCODEC_H__
+#define __OPUSCODEC_H__
+
+#include <vector>
+
+#include "jacktrip_types.h"
+
+// Opaque libopus types, see opus_custom.h
+struct OpusCustomMode;
+struct OpusCustomEncoder;
+struct OpusCustomDecoder;
+
+/** \brief Opus (CELT low delay) coding of the packets on the wire
+ *
+ * Uses the Opus custom modes, so that any even period of 64 to 1024 samples
+ * can be coded as one frame, without buffering and with no algorithmic delay
+ * besides the codec's own. Channels are coded in pairs, each pair by its own
+ * encoder. Lost packets are filled with the decoder packet loss concealment.
+ * CELT has no in-band FEC, the sender keeps the last coded packets so that
+ * redundancy (-r) costs only the coded size.
+ *
+ * Needs a libopus built with custom modes, JackTrip has to be built with
+ * __OPUS__ defined. Datagram layout:
+ * <pre>
+ *   uint32_t Magic
+ *   for each packet (newest first, as in redundant datagrams):
+ *     uint16_t CodedSize       size of the coded streams
+ *     packet header            DefaultHeader, unchanged
+ *     for each channel pair:   uint16_t size, then the Opus frame
+ * </pre>
+ */
+class OpusCodec
+{
+public:
+
+    static const uint32_t sOpusMagic = 0x504f544a; ///< "JTOP"
+    /// Offset of the first (newest) packet header in a datagram
+    static const int sFirstHeaderOffset = sizeof(uint32_t) + sizeof(uint16_t);
+    static const int sMaxFrameBytes = 1275; ///< Largest Opus frame
+    static const int sMaxPackets = 16; ///< Coded packets kept for redundancy
+    /// Lost packets concealed in a row, longer gaps are left to the jitter buffer
+    static const int sMaxConcealed = 8;
+
+    /** \brief The class constructor
+     * \param sample_rate Sampling rate in Hz
+     * \param num_channels Number of audio channels
+     * \param frame_size Period in samples, one frame per packet
+     * \param bitrate Total bitrate in bits/s, split among the channel pairs
+     * \param complexity Encoder complexity, 0 to 10
+     * \throw std::runtime_error if Opus isn't available or rejects the settings
+     */
+    OpusCodec(int sample_rate, int num_channels, int frame_size, int bitrate, int complexity);
+    ~OpusCodec();
+
+    /** \brief Gets a codec from the pool shared by the hub sessions, or makes one
+     *
+     * Codecs are expensive to set up, a pooled one is reset instead.
+     */
+    static OpusCodec* acquire(int sample_rate, int num_channels, int frame_size,
+                              int bitrate, int complexity);
+    /// \brief Gives a codec back to the pool, NULL is ignored
+    static void release(OpusCodec* codec);
+
+    /// \brief True if this build can code Opus
+    static bool isAvailable();
+    /// \brief True if the period can be coded as one frame at this rate
+    static bool isFrameSizeSupported(int sample_rate, int frame_size);
+
+    /// \brief Checks the magic at the start of a datagram
+    static bool isOpusDatagram(const int8_t* buf, int len);
+    /// \brief Upper bound of the coded size of num_packets packets
+    static int getMaxDatagramSize(int num_packets, int num_channels);
+
+    /** \brief Codes the newest full packet and sends it with the last
+     * num_packets-1 coded ones, which are never coded twice
+     * \return Size of the datagram
+     */
+    int encodeDatagram(const int8_t* full_packet, int num_packets, int8_t* datagram);
+
+    /** \brief Splits a datagram into its coded packets
+     * \return Number of packets, or -1 if the datagram is corrupt
+     */
+    static int parseDatagram(const int8_t* datagram, int datagram_size,
+                             const int8_t** packets, int max_packets);
+    /// \brief Header of a coded packet returned by parseDatagram()
+    static const int8_t* getPacketHeader(const int8_t* packet)
+    { return packet + sizeof(uint16_t); }
+    /** \brief Decodes a coded packet into a full packet (header+audio)
+     *
+     * Decode packets in sequence order, the decoder keeps state between them.
+     * \param packet Coded packet from parseDatagram(), or NULL to conceal a lost
+     * packet; the header already in full_packet is then kept
+     * \return false if the packet doesn't match the codec settings
+     */
+    bool decodePacket(const int8_t* packet, int8_t* full_packet);
+
+private:
+    /// \brief Codes one full packet at the head of the history
+    void encodePacket(const int8_t* full_packet);
+    void reset();
+    void destroy();
+
+    int mSampleRate;
+    int mNumChannels;
+    int mFrameSize;
+    int mBitrate;
+    int mComplexity;
+
+    OpusCustomMode* mMode;
+    std::vector<OpusCustomEncoder*> mEncoders; ///< One per channel pair
+    std::vector<OpusCustomDecoder*> mDecoders;
+    std::vector<float> mPcm; ///< Interleaved samples of one channel pair
+
+    std::vector< std::vector<int8_t> > mHistory; ///< Last coded packets, see sMaxPackets
+    int mHistoryHead;
+    int mHistoryCount;
+};
+
+#endif // __OPUSCODEC_H__
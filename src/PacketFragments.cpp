@@ -0,0 +1,200 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file PacketFragments.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "PacketFragments.h"
+
+#include <algorithm>
+#include <cstring>
+
+static_assert(sizeof(PacketFragments::FragmentHeader) == 12, "FragmentHeader must not be padded");
+static_assert(65536 % PacketFragments::sHistoryLength == 0, "History must wrap with the sequence number");
+
+
+//*******************************************************************************
+PacketFragments::PacketFragments(int full_packet_size, int header_size,
+                                 int channel_size, int max_payload) :
+    mFullPacketSize(full_packet_size),
+    mHeaderSize(header_size),
+    mAudioSize(full_packet_size - header_size),
+    mStarted(false),
+    mNextSeq(0),
+    mNewestSeq(0),
+    mWindow(1),
+    mRxFragmentLength(0)
+{
+    if (0 < max_payload) {
+        int budget = max_payload - static_cast<int>(sizeof(FragmentHeader)) - mHeaderSize;
+        int length;
+        if (0 < channel_size && channel_size <= budget) {
+            // Whole channels
+            length = (budget / channel_size) * channel_size;
+        } else {
+            // Whole samples (up to 32 bits)
+            length = std::max(4, budget / 4 * 4);
+        }
+        // Never more than sMaxFragments, even if they get IP-fragmented
+        while ((mAudioSize + length - 1) / length > sMaxFragments) {
+            length += (0 < channel_size && channel_size <= length) ? channel_size : 4;
+        }
+        int offset = 0;
+        do {
+            mFragmentOffsets.push_back(offset);
+            mFragmentLengths.push_back(std::min(length, mAudioSize - offset));
+            offset += length;
+        } while (offset < mAudioSize);
+    } else {
+        Slot empty = {false, 0, 0, 0, 0};
+        mBuffer.resize(sHistoryLength * mFullPacketSize, 0);
+        mSlots.resize(sHistoryLength, empty);
+    }
+}
+
+
+//*******************************************************************************
+bool PacketFragments::isFragment(const int8_t* buf, int len)
+{
+    if ((int)sizeof(FragmentHeader) > len) {
+        return false;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, buf, sizeof(magic));
+    return sFragmentMagic == magic;
+}
+
+
+//*******************************************************************************
+int8_t* PacketFragments::getFragmentDestination(const FragmentHeader& fragment,
+                                                uint16_t seq_num,
+                                                const int8_t* packet_header)
+{
+    if (1 > fragment.Count || sMaxFragments < fragment.Count
+            || fragment.Index >= fragment.Count
+            || static_cast<int>(fragment.Offset) >= mAudioSize) {
+        return NULL;
+    }
+    if (!mStarted) {
+        mStarted = true;
+        mNextSeq = seq_num;
+        mNewestSeq = seq_num;
+    }
+    int16_t ahead = seq_num - mNextSeq;
+    if (0 > ahead) {
+        // Already played
+        return NULL;
+    }
+    if (sHistoryLength <= ahead) {
+        // Lost track of the stream, start over from this packet
+        for (int i = 0; i < sHistoryLength; ++i) {
+            mSlots[i].valid = false;
+        }
+        mNextSeq = seq_num;
+        mNewestSeq = seq_num;
+    }
+
+    int index = seq_num % sHistoryLength;
+    Slot& slot = mSlots[index];
+    int8_t* full_packet = mBuffer.data() + index*mFullPacketSize;
+    if (!slot.valid || seq_num != slot.seq) {
+        // Missing fragments leave their channels silent
+        slot.valid = true;
+        slot.seq = seq_num;
+        slot.received = 0;
+        slot.received_count = 0;
+        slot.count = fragment.Count;
+        std::memcpy(full_packet, packet_header, mHeaderSize);
+        std::memset(full_packet + mHeaderSize, 0, mAudioSize);
+    }
+    if (fragment.Count != slot.count || (slot.received & (1ULL << fragment.Index))) {
+        return NULL;
+    }
+    if (0 < static_cast<int16_t>(seq_num - mNewestSeq)) {
+        mNewestSeq = seq_num;
+    }
+    mWindow = std::max(1, static_cast<int>(fragment.Window));
+    return full_packet + mHeaderSize + fragment.Offset;
+}
+
+
+//*******************************************************************************
+int PacketFragments::getExpectedLength(const FragmentHeader& fragment)
+{
+    if (fragment.Index + 1 == fragment.Count) {
+        return mAudioSize - static_cast<int>(fragment.Offset);
+    }
+    if (0 < fragment.Index) {
+        if (0 != fragment.Offset % fragment.Index) {
+            return -1;
+        }
+        mRxFragmentLength = fragment.Offset / fragment.Index;
+    }
+    return mRxFragmentLength;
+}
+
+
+//*******************************************************************************
+void PacketFragments::addFragment(const FragmentHeader& fragment, uint16_t seq_num)
+{
+    Slot& slot = mSlots[seq_num % sHistoryLength];
+    if (slot.valid && seq_num == slot.seq && !(slot.received & (1ULL << fragment.Index))) {
+        slot.received |= (1ULL << fragment.Index);
+        ++slot.received_count;
+    }
+}
+
+
+//*******************************************************************************
+bool PacketFragments::popPacket(int8_t** full_packet, bool* partial)
+{
+    int16_t pending = mNewestSeq - mNextSeq;
+    if (!mStarted || 0 > pending) {
+        return false;
+    }
+    int index = mNextSeq % sHistoryLength;
+    Slot& slot = mSlots[index];
+    bool present = slot.valid && mNextSeq == slot.seq;
+    bool complete = present && slot.count == slot.received_count;
+    // Fragments of the packet can still come with the next Window-1 packets
+    if (!complete && pending < mWindow) {
+        return false;
+    }
+    *full_packet = present ? mBuffer.data() + index*mFullPacketSize : NULL;
+    *partial = present && !complete;
+    slot.valid = false;
+    ++mNextSeq;
+    return true;
+}
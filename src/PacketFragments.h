@@ -0,0 +1,151 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file PacketFragments.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __PACKETFRAGMENTS_H__
+#define __PACKETFRAGMENTS_H__
+
+#include <vector>
+
+#include "jacktrip_types.h"
+
+/** \brief Splits packets larger than the path MTU into several datagrams,
+ * and puts them back together on the receiving end
+ *
+ * Each fragment is sent as
+ * <pre>
+ *   FragmentHeader | packet header | audio bytes [Offset, Offset+length)
+ * </pre>
+ * The audio is non-interleaved, so fragments are cut on channel boundaries
+ * whenever a channel fits in one: losing a fragment only silences the
+ * channels it carries. A packet is played once all its fragments have
+ * arrived, or once a fragment of a packet FragmentHeader::Window packets newer
+ * arrives (the sender repeats the fragments of the last Window packets when
+ * redundancy is on).
+ *
+ * The receiver writes each fragment straight into its place in the
+ * reassembly buffer, see getFragmentDestination().
+ */
+class PacketFragments
+{
+public:
+
+    /// \brief Header at the start of each fragment datagram
+    struct FragmentHeader {
+        uint32_t Magic; ///< Always sFragmentMagic
+        uint32_t Offset; ///< Offset of this fragment in the audio part of the packet
+        uint8_t  Index; ///< Index of this fragment, 0 to Count-1
+        uint8_t  Count; ///< Number of fragments of the packet
+        uint8_t  Window; ///< Number of packets the sender repeats the fragments of
+        uint8_t  Reserved;
+    };
+
+    static const uint32_t sFragmentMagic = 0x5246544a; ///< "JTFR"
+    static const int sMaxFragments = 64;
+    static const int sHistoryLength = 64; ///< Must divide 65536
+
+    /** \brief The class constructor
+     * \param full_packet_size Size of one packet, header included
+     * \param header_size Size of the packet header
+     * \param channel_size Size of the audio of one channel
+     * \param max_payload Largest datagram the path carries without IP
+     * fragmentation, 0 on the receiving end
+     */
+    PacketFragments(int full_packet_size, int header_size, int channel_size, int max_payload);
+
+    /// \brief Checks the header of a datagram to see if it is a fragment
+    static bool isFragment(const int8_t* buf, int len);
+
+    // Sender
+    int getNumFragments() const { return mFragmentOffsets.size(); }
+    int getFragmentOffset(int index) const { return mFragmentOffsets[index]; }
+    int getFragmentLength(int index) const { return mFragmentLengths[index]; }
+
+    // Receiver
+    /** \brief Finds where the audio of a received fragment goes
+     * \param fragment Header of the fragment
+     * \param seq_num Sequence number of its packet
+     * \param packet_header Header of its packet, copied with the first fragment
+     * \return Destination of the fragment audio, getFragmentCapacity() bytes
+     * long, or NULL if the fragment is a duplicate, too old or invalid
+     */
+    int8_t* getFragmentDestination(const FragmentHeader& fragment, uint16_t seq_num,
+                                   const int8_t* packet_header);
+    int getFragmentCapacity(const FragmentHeader& fragment) const
+    { return mAudioSize - fragment.Offset; }
+    /** \brief Audio length a received fragment must have. The sender cuts
+     * all but the last fragment to the same length, learnt from the offsets.
+     * \return The length, 0 if not known yet, or -1 if the header is inconsistent
+     */
+    int getExpectedLength(const FragmentHeader& fragment);
+    /// \brief Marks a fragment as received, once its audio is in place
+    void addFragment(const FragmentHeader& fragment, uint16_t seq_num);
+    /** \brief Takes the next packet in sequence order, if it is due
+     * \param full_packet Set to the packet, or to NULL if none of its fragments arrived
+     * \param partial Set to true if some of its fragments are missing
+     * \return false if the next packet is not due yet
+     */
+    bool popPacket(int8_t** full_packet, bool* partial);
+
+private:
+    struct Slot {
+        bool valid;
+        uint16_t seq;
+        uint64_t received; ///< One bit per fragment index
+        uint8_t received_count;
+        uint8_t count;
+    };
+
+    int mFullPacketSize;
+    int mHeaderSize;
+    int mAudioSize;
+
+    // Sender
+    std::vector<int> mFragmentOffsets;
+    std::vector<int> mFragmentLengths;
+
+    // Receiver, slots are indexed by sequence number modulo sHistoryLength
+    std::vector<int8_t> mBuffer;
+    std::vector<Slot> mSlots;
+    bool mStarted;
+    uint16_t mNextSeq; ///< Next packet to play
+    uint16_t mNewestSeq; ///< Newest packet a fragment arrived for
+    int mWindow;
+    int mRxFragmentLength; ///< Length of all but the last fragment, 0 until known
+};
+
+#endif // __PACKETFRAGMENTS_H__
@@ -39,9 +39,11 @@
 #include "JackTrip.h"
 
 #include <sys/time.h>
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
 using std::cout; using std::endl;
 
@@ -69,6 +71,17 @@ int gettimeofday(struct timeval* p, void* tz /* IGNORED */);
 #endif
 
 
+//***********************************************************************
+// Header BitResolution is the audioBitResolutionT times 8
+static inline std::string bitResolutionName(uint8_t bit_resolution)
+{
+    if (AudioInterface::FLOAT16*8 == bit_resolution) {
+        return "16 (half-precision float)";
+    }
+    return std::to_string(static_cast<int>(bit_resolution));
+}
+
+
 //#######################################################################
 //####################### PacketHeader ##################################
 //#######################################################################
@@ -117,7 +130,7 @@ void DefaultHeader::fillHeaderCommonFromAudio()
     mHeader.SamplingRate = mJackTrip->getSampleRateType ();
     mHeader.BitResolution = mJackTrip->getAudioBitResolution();
     mHeader.NumChannels = mJackTrip->getNumChannels();
-    mHeader.ConnectionMode = static_cast<int>(mJackTrip->getConnectionMode());
+    mHeader.ConnectionMode = static_cast<int>(mJackTrip->getConnectionMode()) | getCapabilities();
     //printHeader();
 }
 
@@ -158,14 +171,27 @@ void DefaultHeader::checkPeerSettings(int8_t* full_packet)
     if ( peer_header->BitResolution != mHeader.BitResolution )
     {
         std::cerr << "ERROR: Peer Audio Bit Resolution is  : "
-                  << static_cast<int>(peer_header->BitResolution) << endl;
+                  << bitResolutionName(peer_header->BitResolution) << endl;
         std::cerr << "       Local Audio Bit Resolution is : "
-                  << static_cast<int>(mHeader.BitResolution) << endl;
+                  << bitResolutionName(mHeader.BitResolution) << endl;
         std::cerr << "Make sure both machines use the same Bit Resolution" << endl;
         std::cerr << gPrintSeparator << endl;
         error = true;
     }
 
+    // Check Aggregation, an aggregated datagram looks like redundant packets
+    int peer_aggregation = ((peer_header->ConnectionMode & HEADER_AGGREGATION_MASK)
+                            >> HEADER_AGGREGATION_SHIFT) + 1;
+    int aggregation = mJackTrip->getAggregation();
+    if ( peer_aggregation != aggregation )
+    {
+        std::cerr << "ERROR: Peer sends " << peer_aggregation << " periods per datagram" << endl;
+        std::cerr << "       Local --aggregate is " << aggregation << endl;
+        std::cerr << "Make sure both machines use the same --aggregate" << endl;
+        std::cerr << gPrintSeparator << endl;
+        error = true;
+    }
+
     // Exit program if error
     if (error)
     {
@@ -178,6 +204,19 @@ void DefaultHeader::checkPeerSettings(int8_t* full_packet)
 }
 
 
+//***********************************************************************
+uint8_t DefaultHeader::getCapabilities() const
+{
+    uint8_t capabilities = HEADER_CAP_TIMESTAMP_ECHO
+            | (((mJackTrip->getAggregation() - 1) << HEADER_AGGREGATION_SHIFT)
+               & HEADER_AGGREGATION_MASK);
+    if (0 < mJackTrip->getAdaptiveRedundancy()) {
+        capabilities |= HEADER_CAP_LOSS_FEEDBACK;
+    }
+    return capabilities;
+}
+
+
 //***********************************************************************
 void DefaultHeader::printHeader() const
 {
@@ -188,13 +227,13 @@ void DefaultHeader::printHeader() const
             AudioInterface::getSampleRateFromType
             ( static_cast<AudioInterface::samplingRateT>(mHeader.SamplingRate) );
     cout << "Sampling Rate             = " << sample_rate << endl;
-    cout << "Audio Bit Resolutions     = " << static_cast<int>(mHeader.BitResolution) << endl;
+    cout << "Audio Bit Resolutions     = " << bitResolutionName(mHeader.BitResolution) << endl;
     //cout << "Number of Input Channels  = " << static_cast<int>(mHeader.NumInChannels) << endl;
     //cout << "Number of Output Channels = " << static_cast<int>(mHeader.NumOutChannels) << endl;
     cout << "Number of Channels        = " << static_cast<int>(mHeader.NumChannels) << endl;
     cout << "Sequence Number           = " << static_cast<int>(mHeader.SeqNumber) << endl;
     cout << "Time Stamp                = " << mHeader.TimeStamp << endl;
-    cout << "Connection Mode           = " << static_cast<int>(mHeader.ConnectionMode) << endl;
+    cout << "Connection Mode           = " << (mHeader.ConnectionMode & HEADER_MODE_MASK) << endl;
     cout << gPrintSeparator << endl;
     //cout << sizeof(mHeader) << endl;
 }
@@ -260,7 +299,279 @@ uint8_t DefaultHeader::getPeerConnectionMode(int8_t* full_packet) const
 {
     DefaultHeaderStruct* peer_header;
     peer_header =  reinterpret_cast<DefaultHeaderStruct*>(full_packet);
-    return static_cast<uint8_t>(peer_header->ConnectionMode);
+    return static_cast<uint8_t>(peer_header->ConnectionMode & HEADER_MODE_MASK);
+}
+
+
+//***********************************************************************
+uint8_t DefaultHeader::getPeerCapabilities(int8_t* full_packet) const
+{
+    DefaultHeaderStruct* peer_header;
+    peer_header =  reinterpret_cast<DefaultHeaderStruct*>(full_packet);
+    return static_cast<uint8_t>(peer_header->ConnectionMode & ~HEADER_MODE_MASK);
+}
+
+
+
+
+
+
+//#######################################################################
+//####################### CompactHeader #################################
+//#######################################################################
+static_assert(sizeof(CompactStaticStruct) == 16, "CompactStaticStruct must not be padded");
+static_assert(sizeof(DefaultHeaderStruct) == 16, "DefaultHeaderStruct must not be padded");
+
+//***********************************************************************
+CompactHeader::CompactHeader(JackTrip* jacktrip) :
+    DefaultHeader(jacktrip),
+    mPeerCompact(false),
+    mTxStaticId(0),
+    mTxStaticCount(0),
+    mTxDatagramCount(0),
+    mRxPacketSize(0)
+{
+    std::memset(&mTxStatic, 0, sizeof(mTxStatic));
+    std::memset(mRxStatic, 0, sizeof(mRxStatic));
+    for (int i = 0; i < sNumStaticIds; ++i) {
+        mRxStaticValid[i] = false;
+    }
+}
+
+
+//***********************************************************************
+int CompactHeader::putVarint(uint64_t value, int8_t* buf, bool pad)
+{
+    int n = 0;
+    while (0x80 <= value) {
+        buf[n++] = static_cast<int8_t>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    if (pad) {
+        // A continuation with no more bits decodes to the same value
+        buf[n++] = static_cast<int8_t>(value | 0x80);
+        value = 0;
+    }
+    buf[n++] = static_cast<int8_t>(value);
+    return n;
+}
+
+
+//***********************************************************************
+int CompactHeader::getVarint(const int8_t* buf, int size, uint64_t* value)
+{
+    *value = 0;
+    for (int n = 0; n < size && n < 10; ++n) {
+        uint8_t byte = static_cast<uint8_t>(buf[n]);
+        *value |= static_cast<uint64_t>(byte & 0x7f) << (7*n);
+        if (0 == (byte & 0x80)) {
+            return n + 1;
+        }
+    }
+    return -1;
+}
+
+
+//***********************************************************************
+int CompactHeader::getFullPacketSize(uint16_t buffer_size, uint8_t sampling_rate,
+                                     uint8_t bit_resolution, uint8_t num_channels)
+{
+    int sample_rate = AudioInterface::getSampleRateFromType
+            ( static_cast<AudioInterface::samplingRateT>(sampling_rate) );
+    int audio_size = buffer_size * num_channels * AudioInterface::getSampleSize(bit_resolution / 8);
+    if (0 >= sample_rate || 0 >= audio_size) {
+        return 0;
+    }
+    return sizeof(DefaultHeaderStruct) + audio_size;
+}
+
+
+//***********************************************************************
+bool CompactHeader::isPlainDatagram(const int8_t* datagram, int datagram_size) const
+{
+    if (0 < mRxPacketSize) {
+        return 0 == datagram_size % mRxPacketSize;
+    }
+    // Nothing told the peer's packet size yet, which is the case for its
+    // first datagrams; those are plain, it hasn't seen our headers
+    if (datagram_size < static_cast<int>(sizeof(DefaultHeaderStruct))) {
+        return false;
+    }
+    DefaultHeaderStruct header;
+    std::memcpy(&header, datagram, sizeof(header));
+    int full_packet_size = getFullPacketSize(header.BufferSize, header.SamplingRate,
+                                             header.BitResolution, header.NumChannels);
+    return 0 < full_packet_size && 0 == datagram_size % full_packet_size;
+}
+
+
+//***********************************************************************
+void CompactHeader::setPeerHeader(int full_packet_size, uint8_t connection_mode)
+{
+    mRxPacketSize = full_packet_size;
+    if (connection_mode & HEADER_CAP_COMPACT) {
+        mPeerCompact = true;
+    }
+}
+
+
+//***********************************************************************
+int CompactHeader::getMaxDatagramSize(int num_packets, int full_packet_size) const
+{
+    // flags + static block + two 64bit varints (the padding byte fits, the
+    // sequence number delta takes 3 at most), or plain packets
+    return std::max<int>(1 + sizeof(CompactStaticStruct) + 2*10
+                         + num_packets * (full_packet_size - sizeof(DefaultHeaderStruct)),
+                         num_packets * full_packet_size);
+}
+
+
+//***********************************************************************
+int CompactHeader::encodeDatagram(const int8_t* full_packets, int num_packets,
+                                  int full_packet_size, int8_t* datagram)
+{
+    // The peer gets the default header until it advertises that it can
+    // expand the datagrams
+    if (!mPeerCompact) {
+        std::memcpy(datagram, full_packets, num_packets * full_packet_size);
+        return num_packets * full_packet_size;
+    }
+
+    DefaultHeaderStruct newest;
+    std::memcpy(&newest, full_packets, sizeof(newest));
+    int audio_size = full_packet_size - sizeof(DefaultHeaderStruct);
+
+    bool changed = ( newest.BufferSize != mTxStatic.BufferSize
+                     || newest.SamplingRate != mTxStatic.SamplingRate
+                     || newest.BitResolution != mTxStatic.BitResolution
+                     || newest.NumChannels != mTxStatic.NumChannels
+                     || newest.ConnectionMode != mTxStatic.ConnectionMode );
+    int8_t* pos = datagram;
+    if (changed || sStaticRepeat > mTxStaticCount || sStaticInterval <= mTxDatagramCount) {
+        mTxStaticId = (mTxStaticId + 1) % sNumStaticIds;
+        mTxStatic.BaseTimeStamp = newest.TimeStamp;
+        mTxStatic.BaseSeqNumber = newest.SeqNumber;
+        mTxStatic.BufferSize = newest.BufferSize;
+        mTxStatic.SamplingRate = newest.SamplingRate;
+        mTxStatic.BitResolution = newest.BitResolution;
+        mTxStatic.NumChannels = newest.NumChannels;
+        mTxStatic.ConnectionMode = newest.ConnectionMode;
+        ++mTxStaticCount;
+        mTxDatagramCount = 0;
+        *pos++ = static_cast<int8_t>(0x80 | mTxStaticId);
+        std::memcpy(pos, &mTxStatic, sizeof(mTxStatic));
+        pos += sizeof(mTxStatic);
+    } else {
+        *pos++ = static_cast<int8_t>(mTxStaticId);
+    }
+    ++mTxDatagramCount;
+
+    uint16_t seq_delta = newest.SeqNumber - mTxStatic.BaseSeqNumber;
+    uint64_t time_delta = newest.TimeStamp - mTxStatic.BaseTimeStamp;
+    int8_t* deltas = pos;
+    pos += putVarint(seq_delta, pos);
+    pos += putVarint(time_delta, pos);
+    // Plain datagrams are whole packets, this one must not look like them
+    if (0 == (pos - datagram + num_packets * audio_size) % full_packet_size) {
+        pos = deltas;
+        pos += putVarint(seq_delta, pos, true);
+        pos += putVarint(time_delta, pos);
+    }
+    for (int i = 0; i < num_packets; ++i) {
+        std::memcpy(pos, full_packets + i*full_packet_size + sizeof(DefaultHeaderStruct),
+                    audio_size);
+        pos += audio_size;
+    }
+    return pos - datagram;
+}
+
+
+//***********************************************************************
+int CompactHeader::decodeDatagram(const int8_t* datagram, int datagram_size,
+                                  int8_t* full_packets, int max_size)
+{
+    if (isPlainDatagram(datagram, datagram_size)) {
+        if (datagram_size > max_size) {
+            return -1;
+        }
+        DefaultHeaderStruct header;
+        std::memcpy(&header, datagram, sizeof(header));
+        int full_packet_size = (0 < mRxPacketSize) ? mRxPacketSize
+                : getFullPacketSize(header.BufferSize, header.SamplingRate,
+                                    header.BitResolution, header.NumChannels);
+        setPeerHeader(full_packet_size, header.ConnectionMode);
+        std::memcpy(full_packets, datagram, datagram_size);
+        return datagram_size;
+    }
+
+    const int8_t* pos = datagram;
+    const int8_t* end = datagram + datagram_size;
+    if (pos >= end) {
+        return -1;
+    }
+    uint8_t flags = static_cast<uint8_t>(*pos++);
+    int id = flags & 0x7f;
+    if (flags & 0x80) {
+        if (end - pos < static_cast<int>(sizeof(CompactStaticStruct))) {
+            return -1;
+        }
+        std::memcpy(&mRxStatic[id], pos, sizeof(CompactStaticStruct));
+        pos += sizeof(CompactStaticStruct);
+        mRxStaticValid[id] = true;
+        // Forget blocks old enough to be confused with a lost new one
+        mRxStaticValid[(id + sNumStaticIds/2) % sNumStaticIds] = false;
+        const CompactStaticStruct& block = mRxStatic[id];
+        int full_packet_size = getFullPacketSize(block.BufferSize, block.SamplingRate,
+                                                 block.BitResolution, block.NumChannels);
+        if (0 < full_packet_size) {
+            setPeerHeader(full_packet_size, block.ConnectionMode);
+        }
+    }
+    if (!mRxStaticValid[id]) {
+        return -1;
+    }
+    const CompactStaticStruct& base = mRxStatic[id];
+
+    uint64_t seq_delta;
+    uint64_t time_delta;
+    int n = getVarint(pos, end - pos, &seq_delta);
+    if (0 > n) { return -1; }
+    pos += n;
+    n = getVarint(pos, end - pos, &time_delta);
+    if (0 > n) { return -1; }
+    pos += n;
+
+    int audio_size = base.BufferSize * base.NumChannels * AudioInterface::getSampleSize(base.BitResolution / 8);
+    if (0 >= audio_size || 0 != (end - pos) % audio_size) {
+        return -1;
+    }
+    int num_packets = (end - pos) / audio_size;
+    int full_packet_size = sizeof(DefaultHeaderStruct) + audio_size;
+    if (num_packets * full_packet_size > max_size) {
+        return -1;
+    }
+
+    int sample_rate = AudioInterface::getSampleRateFromType
+            ( static_cast<AudioInterface::samplingRateT>(base.SamplingRate) );
+    uint64_t period = (0 < sample_rate) ?
+                (static_cast<uint64_t>(base.BufferSize) * 1000000) / sample_rate : 0;
+
+    DefaultHeaderStruct header;
+    header.TimeStamp = base.BaseTimeStamp + time_delta;
+    header.SeqNumber = base.BaseSeqNumber + static_cast<uint16_t>(seq_delta);
+    header.BufferSize = base.BufferSize;
+    header.SamplingRate = base.SamplingRate;
+    header.BitResolution = base.BitResolution;
+    header.NumChannels = base.NumChannels;
+    header.ConnectionMode = base.ConnectionMode;
+    for (int i = 0; i < num_packets; ++i) {
+        int8_t* full_packet = full_packets + i*full_packet_size;
+        std::memcpy(full_packet, &header, sizeof(header));
+        std::memcpy(full_packet + sizeof(header), pos + i*audio_size, audio_size);
+        header.SeqNumber--;
+        header.TimeStamp -= period;
+    }
+    return num_packets * full_packet_size;
 }
 
 
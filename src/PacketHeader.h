@@ -41,6 +41,7 @@
 #include <iostream>
 //#include <tr1/memory> // for shared_ptr
 #include <cstring>
+#include <atomic>
 
 #include <QObject>
 #include <QString>
@@ -66,7 +67,21 @@ public:
     //uint8_t  NumInChannels; ///< Number of Input Channels
     //uint8_t  NumOutChannels; ///<  Number of Output Channels
     uint8_t  NumChannels; ///< Number of Channels, we assume input and outputs are the same
-    uint8_t  ConnectionMode;
+    uint8_t  ConnectionMode; ///< JackTrip::connectionModeT and headerCapabilityT bits
+};
+
+/** \brief Bits above the JackTrip::connectionModeT in DefaultHeaderStruct::ConnectionMode
+ *
+ * They advertise what the sender of the header can receive. Older versions
+ * leave them 0 and don't look past the connection mode.
+ */
+enum headerCapabilityT {
+    HEADER_MODE_MASK = 0x03, ///< JackTrip::connectionModeT
+    HEADER_AGGREGATION_MASK = 0x1c, ///< Audio periods per datagram - 1, see JackTrip::setAggregation()
+    HEADER_AGGREGATION_SHIFT = 2,
+    HEADER_CAP_TIMESTAMP_ECHO = 0x20, ///< Answers timestamp echo requests
+    HEADER_CAP_LOSS_FEEDBACK = 0x40, ///< Adapts its redundancy to loss feedback, send it
+    HEADER_CAP_COMPACT = 0x80 ///< Expands CompactHeader datagrams
 };
 
 //---------------------------------------------------------
@@ -142,6 +157,8 @@ public:
     virtual uint8_t getPeerBitResolution(int8_t* full_packet) const = 0;
     virtual uint8_t  getPeerNumChannels(int8_t* full_packet) const = 0;
     virtual uint8_t  getPeerConnectionMode(int8_t* full_packet) const = 0;
+    /// \brief headerCapabilityT bits of the peer, 0 for headers that have none
+    virtual uint8_t getPeerCapabilities(int8_t* /*full_packet*/) const { return 0; }
 
     /// \brief Increase sequence number for counter, a 16bit number
     virtual void increaseSequenceNumber()
@@ -163,6 +180,30 @@ public:
     /// sizeof(header part) + sizeof(audio part)
     virtual void putHeaderInPacket(int8_t* full_packet) = 0;
 
+    /// \brief Returns true if datagrams on the wire differ from the
+    /// (header+audio) packets in memory, see encodeDatagram()
+    virtual bool hasDatagramCodec() const { return false; }
+    /** \brief Encode redundant full packets (newest first) into one datagram
+     * \param full_packets Consecutive full packets (header+audio)
+     * \param num_packets Number of full packets
+     * \param full_packet_size Size of each full packet
+     * \param datagram Output buffer, at least getMaxDatagramSize() bytes
+     * \return Size of the datagram in bytes
+     */
+    virtual int encodeDatagram(const int8_t* /*full_packets*/, int /*num_packets*/,
+                               int /*full_packet_size*/, int8_t* /*datagram*/)
+    { return -1; }
+    /** \brief Expand a received datagram back into full packets (newest first)
+     * \return Size of the full packets in bytes, or -1 if the datagram can't
+     * be decoded (yet)
+     */
+    virtual int decodeDatagram(const int8_t* /*datagram*/, int /*datagram_size*/,
+                               int8_t* /*full_packets*/, int /*max_size*/)
+    { return -1; }
+    /// \brief Upper bound of the encoded size of num_packets full packets
+    virtual int getMaxDatagramSize(int num_packets, int full_packet_size) const
+    { return num_packets * full_packet_size; }
+
 
 signals:
     void signalError(const QString &error_message);
@@ -212,6 +253,12 @@ public:
     virtual uint8_t getPeerBitResolution(int8_t* full_packet) const;
     virtual uint8_t  getPeerNumChannels(int8_t* full_packet) const;
     virtual uint8_t  getPeerConnectionMode(int8_t* full_packet) const;
+    virtual uint8_t getPeerCapabilities(int8_t* full_packet) const;
+
+
+protected:
+    /// \brief headerCapabilityT bits advertised in our headers
+    virtual uint8_t getCapabilities() const;
 
 
 private:
@@ -222,6 +269,96 @@ private:
 
 
 
+//#######################################################################
+//####################### CompactHeader #################################
+//#######################################################################
+
+/// \brief Static part of the compact header, only sent on change or periodically
+struct CompactStaticStruct
+{
+    uint64_t BaseTimeStamp; ///< Time Stamp the deltas refer to
+    uint16_t BaseSeqNumber; ///< Sequence Number the deltas refer to
+    uint16_t BufferSize; ///< Buffer Size in Samples
+    uint8_t  SamplingRate; ///< Sampling Rate in JackAudioInterface::samplingRateT
+    uint8_t  BitResolution; ///< Audio Bit Resolution
+    uint8_t  NumChannels; ///< Number of Channels
+    uint8_t  ConnectionMode;
+};
+
+/** \brief Compact (v2) wire format
+ *
+ * In memory the packets keep the DefaultHeader layout, only the datagrams
+ * on the wire are different. Each datagram has a single header for all its
+ * redundant packets:
+ * <pre>
+ *   uint8_t Flags                  bit 7: CompactStaticStruct follows
+ *                                  bits 0-6: id of the static block in use
+ *   [CompactStaticStruct]          when the fields change, and periodically
+ *   varint  SeqNumber delta        newest packet, from BaseSeqNumber
+ *   varint  TimeStamp delta        newest packet, from BaseTimeStamp (usec)
+ *   audio * num_packets            newest first
+ * </pre>
+ * The older packets in the datagram get consecutive sequence numbers and
+ * time stamps one period apart. A datagram that refers to a static block
+ * the receiver didn't get is dropped.
+ *
+ * The packets are sent as they are until a header of the peer advertises
+ * HEADER_CAP_COMPACT, so a peer without --compactheader still gets the
+ * default header. Such plain datagrams are whole packets; a compacted one
+ * is padded by a byte when it would be, so the receiver tells them apart
+ * by their size.
+ */
+class CompactHeader : public DefaultHeader
+{
+public:
+
+    CompactHeader(JackTrip* jacktrip);
+    virtual ~CompactHeader() {}
+
+    virtual bool hasDatagramCodec() const { return true; }
+    virtual int encodeDatagram(const int8_t* full_packets, int num_packets,
+                               int full_packet_size, int8_t* datagram);
+    virtual int decodeDatagram(const int8_t* datagram, int datagram_size,
+                               int8_t* full_packets, int max_size);
+    virtual int getMaxDatagramSize(int num_packets, int full_packet_size) const;
+
+    static const int sStaticInterval = 32; ///< Datagrams between static blocks
+    static const int sStaticRepeat = 4; ///< Static blocks sent at start, in case some are lost
+    static const int sNumStaticIds = 128;
+
+protected:
+    virtual uint8_t getCapabilities() const
+    { return DefaultHeader::getCapabilities() | HEADER_CAP_COMPACT; }
+
+private:
+    /// \brief Writes value, with one more byte than needed if pad is true
+    static int putVarint(uint64_t value, int8_t* buf, bool pad = false);
+    static int getVarint(const int8_t* buf, int size, uint64_t* value);
+    /// \brief Size of the full packets described by a header, 0 if it makes no sense
+    static int getFullPacketSize(uint16_t buffer_size, uint8_t sampling_rate,
+                                 uint8_t bit_resolution, uint8_t num_channels);
+    /// \brief True if the datagram holds whole packets with the default header
+    bool isPlainDatagram(const int8_t* datagram, int datagram_size) const;
+    /// \brief Takes note of the peer's packet size and capabilities
+    void setPeerHeader(int full_packet_size, uint8_t connection_mode);
+
+    std::atomic<bool> mPeerCompact; ///< Set by the receiver thread, read by the sender's
+
+    // Encoder, used only by the sender thread
+    CompactStaticStruct mTxStatic;
+    int mTxStaticId;
+    int mTxStaticCount; ///< Number of static blocks sent
+    int mTxDatagramCount; ///< Datagrams since the last static block
+
+    // Decoder, used only by the receiver thread
+    CompactStaticStruct mRxStatic[sNumStaticIds];
+    bool mRxStaticValid[sNumStaticIds];
+    int mRxPacketSize; ///< Full packet size of the peer, 0 until a header tells it
+};
+
+
+
+
 //#######################################################################
 //####################### JamLinkHeader #################################
 //#######################################################################
@@ -0,0 +1,101 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file PacketHeaderCodec.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __PACKETHEADERCODEC_H__
+#define __PACKETHEADERCODEC_H__
+
+#include "DataProtocol.h"
+#include "PacketHeader.h"
+
+/** \brief Statically typed access to the fields of received packets
+ *
+ * Same results as the getPeer*() methods of the PacketHeader subclasses,
+ * without going through the JackTrip mediator and a virtual call for each
+ * field. The header type is resolved once per session, and the per-packet
+ * receive code is instantiated for it, see UdpDataProtocol::receiveLoop().
+ */
+template <DataProtocol::packetHeaderTypeT HeaderType>
+struct PacketHeaderCodec;
+
+
+/// \brief Codec for the DefaultHeaderStruct layout
+struct DefaultHeaderCodec
+{
+    static const int sHeaderSize = sizeof(DefaultHeaderStruct);
+
+    static inline const DefaultHeaderStruct* header(const int8_t* full_packet)
+    { return reinterpret_cast<const DefaultHeaderStruct*>(full_packet); }
+    static inline uint16_t getPeerSequenceNumber(const int8_t* full_packet)
+    { return header(full_packet)->SeqNumber; }
+    static inline uint64_t getPeerTimeStamp(const int8_t* full_packet)
+    { return header(full_packet)->TimeStamp; }
+    static inline uint16_t getPeerBufferSize(const int8_t* full_packet)
+    { return header(full_packet)->BufferSize; }
+    static inline uint8_t getPeerNumChannels(const int8_t* full_packet)
+    { return header(full_packet)->NumChannels; }
+};
+
+
+/// \brief Codec for headers that don't carry the peer settings
+template <int HeaderSize>
+struct NoPeerFieldsCodec
+{
+    static const int sHeaderSize = HeaderSize;
+
+    static inline uint16_t getPeerSequenceNumber(const int8_t* /*full_packet*/) { return 0; }
+    static inline uint64_t getPeerTimeStamp(const int8_t* /*full_packet*/) { return 0; }
+    static inline uint16_t getPeerBufferSize(const int8_t* /*full_packet*/) { return 0; }
+    static inline uint8_t getPeerNumChannels(const int8_t* /*full_packet*/) { return 0; }
+};
+
+
+template <>
+struct PacketHeaderCodec<DataProtocol::DEFAULT> : public DefaultHeaderCodec {};
+
+/// \brief CompactHeader datagrams are expanded to the default layout on reception
+template <>
+struct PacketHeaderCodec<DataProtocol::COMPACT> : public DefaultHeaderCodec {};
+
+template <>
+struct PacketHeaderCodec<DataProtocol::JAMLINK>
+        : public NoPeerFieldsCodec<sizeof(JamLinkHeaderStuct)> {};
+
+template <>
+struct PacketHeaderCodec<DataProtocol::EMPTY> : public NoPeerFieldsCodec<0> {};
+
+#endif // __PACKETHEADERCODEC_H__
@@ -0,0 +1,151 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file PacketTrace.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "PacketTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static_assert(sizeof(PacketTrace::FileHeader) == 24, "FileHeader must not be padded");
+static_assert(sizeof(PacketTrace::Record) == 24, "Record must not be padded");
+
+//*******************************************************************************
+PacketTrace* PacketTrace::create(const std::string& path, const FileHeader& header)
+{
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (NULL == file) {
+        std::cerr << "Could not open packet trace " << path << std::endl;
+        return NULL;
+    }
+    FileHeader file_header = header;
+    std::memcpy(file_header.Magic, "JTPT", 4);
+    file_header.Version = sVersion;
+    file_header.RecordSize = sizeof(Record);
+    std::fwrite(&file_header, sizeof(file_header), 1, file);
+    return new PacketTrace(file);
+}
+
+
+//*******************************************************************************
+PacketTrace::PacketTrace(FILE* file) :
+    mFile(file),
+    mRing(sRingSize),
+    mHead(0), mTail(0), mDropped(0),
+    mStop(false)
+{
+    mWriter = std::thread(&PacketTrace::writerLoop, this);
+}
+
+
+//*******************************************************************************
+PacketTrace::~PacketTrace()
+{
+    mStop = true;
+    mWriter.join();
+    std::fclose(mFile);
+    if (0 < mDropped) {
+        std::cout << "Packet trace: " << mDropped << " records dropped" << std::endl;
+    }
+}
+
+
+//*******************************************************************************
+void PacketTrace::record(const Record& record)
+{
+    uint64_t head = mHead.load(std::memory_order_relaxed);
+    if (sRingSize <= head - mTail.load(std::memory_order_acquire)) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    mRing[head % sRingSize] = record;
+    mHead.store(head + 1, std::memory_order_release);
+}
+
+
+//*******************************************************************************
+void PacketTrace::writerLoop()
+{
+    while (!mStop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(sWriteIntervalMs));
+        drain();
+    }
+    drain();
+    std::fflush(mFile);
+}
+
+
+//*******************************************************************************
+void PacketTrace::drain()
+{
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    uint64_t head = mHead.load(std::memory_order_acquire);
+    while (tail != head) {
+        // Up to the end of the ring, then from its start
+        size_t start = tail % sRingSize;
+        size_t count = std::min<uint64_t>(head - tail, sRingSize - start);
+        std::fwrite(&mRing[start], sizeof(Record), count, mFile);
+        tail += count;
+        mTail.store(tail, std::memory_order_release);
+    }
+}
+
+
+//*******************************************************************************
+void PacketTrace::read(const std::string& path, FileHeader* header, std::vector<Record>* records)
+{
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (NULL == file) {
+        throw std::runtime_error("Could not open packet trace " + path);
+    }
+    if (1 != std::fread(header, sizeof(*header), 1, file)
+            || 0 != std::memcmp(header->Magic, "JTPT", 4)
+            || sizeof(Record) > header->RecordSize) {
+        std::fclose(file);
+        throw std::runtime_error("Not a packet trace: " + path);
+    }
+    records->clear();
+    std::vector<char> buf(header->RecordSize);
+    while (1 == std::fread(buf.data(), buf.size(), 1, file)) {
+        Record record;
+        std::memcpy(&record, buf.data(), sizeof(record));
+        records->push_back(record);
+    }
+    std::fclose(file);
+}
@@ -0,0 +1,127 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file PacketTrace.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __PACKETTRACE_H__
+#define __PACKETTRACE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** \brief Binary trace of the datagrams a receiver gets, see --packettrace
+ *
+ * The file is a FileHeader followed by one Record per datagram, little endian.
+ * The receive thread only copies the record into a single-producer
+ * single-consumer ring. A writer thread empties the ring into the file every
+ * sWriteIntervalMs, so the receive thread never waits for the disk. If the
+ * ring is full the record is dropped and counted instead.
+ *
+ * jacktrip-sim --replay plays a trace back through the receive path.
+ */
+class PacketTrace
+{
+public:
+
+    /// \brief Settings of the session, at the start of the file
+    struct FileHeader {
+        char     Magic[4]; ///< Always "JTPT"
+        uint16_t Version; ///< sVersion
+        uint16_t RecordSize; ///< sizeof(Record), to skip fields added later
+        uint32_t SampleRate;
+        uint16_t BufferSize; ///< Frames per packet
+        uint8_t  NumChannels;
+        uint8_t  BitResolution; ///< AudioInterface::audioBitResolutionT
+        uint32_t FullPacketSize; ///< Header and audio of one packet
+        uint16_t Aggregation; ///< Packets per datagram before redundancy
+        uint8_t  HeaderType; ///< DataProtocol::packetHeaderTypeT
+        uint8_t  Reserved;
+    };
+
+    /// \brief One received datagram
+    struct Record {
+        int64_t  MonotonicNs; ///< When the receive thread got it, CLOCK_MONOTONIC
+        int64_t  KernelNs; ///< Kernel (or NIC) receive timestamp, 0 without one
+        uint16_t SeqNumber; ///< Newest packet in the datagram
+        uint16_t Size; ///< Datagram bytes
+        uint8_t  Redundancy; ///< Packets in the datagram
+        uint8_t  Index; ///< Oldest packet taken from it, 0 if only the newest one
+        uint8_t  Flags; ///< sOutOfOrder, sHardwareTimestamp
+        uint8_t  Reserved;
+    };
+
+    static const uint16_t sVersion = 1;
+    static const uint8_t sOutOfOrder = 0x01; ///< Ignored by the receiver
+    static const uint8_t sHardwareTimestamp = 0x02; ///< KernelNs is from the NIC clock
+
+    /** \brief Opens the file, writes the header and starts the writer thread
+     * \return NULL if the file can't be opened
+     */
+    static PacketTrace* create(const std::string& path, const FileHeader& header);
+    /// \brief Writes what is left in the ring and closes the file
+    virtual ~PacketTrace();
+
+    /// \brief Called from the receive thread only, never blocks
+    void record(const Record& record);
+    /// \brief Records dropped because the writer didn't keep up
+    uint64_t getDropped() const { return mDropped; }
+
+    /** \brief Reads a whole trace file
+     * \throw std::runtime_error if it is not a trace
+     */
+    static void read(const std::string& path, FileHeader* header, std::vector<Record>* records);
+
+private:
+    static const size_t sRingSize = 1 << 13; ///< Records, a power of 2, about 20 s at 48 kHz/128
+    static const int sWriteIntervalMs = 100;
+
+    PacketTrace(FILE* file);
+    void writerLoop();
+    void drain();
+
+    FILE* mFile;
+    std::vector<Record> mRing;
+    std::atomic<uint64_t> mHead; ///< Written by record()
+    std::atomic<uint64_t> mTail; ///< Written by the writer thread
+    std::atomic<uint64_t> mDropped;
+    std::atomic<bool> mStop;
+    std::thread mWriter;
+};
+
+#endif // __PACKETTRACE_H__
@@ -0,0 +1,222 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file ParityFec.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "ParityFec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(sizeof(ParityFec::ParityTrailer) == 12, "ParityTrailer must not be padded");
+static_assert(65536 % ParityFec::sHistoryLength == 0, "History must wrap with the sequence number");
+
+//*******************************************************************************
+static inline void xorPacket(int8_t* dst, const int8_t* src, int size)
+{
+    for (int i = 0; i < size; ++i) {
+        dst[i] ^= src[i];
+    }
+}
+
+
+//*******************************************************************************
+ParityFec::ParityFec(int group_size, int parity_count, int full_packet_size) :
+    mGroupSize(group_size),
+    mParityCount(parity_count),
+    mNextParityCount(parity_count),
+    mFullPacketSize(full_packet_size),
+    mEncodeCount(0),
+    mEncodeBaseSeq(0)
+{
+    if (1 > mGroupSize || sMaxGroupSize < mGroupSize
+            || 1 > mParityCount || mGroupSize < mParityCount) {
+        throw std::invalid_argument("Invalid FEC group size or parity count");
+    }
+    HistorySlot empty = {false, 0, 0};
+
+    // Room for the largest parity count setParityCount() accepts
+    mEncodeParity.resize(mGroupSize);
+    for (int i = 0; i < mGroupSize; ++i) {
+        mEncodeParity[i].resize(getParityPacketSize(), 0);
+    }
+
+    mDataHistory.resize(sHistoryLength * mFullPacketSize, 0);
+    mDataSlots.resize(sHistoryLength, empty);
+    mParityHistory.resize(sHistoryLength * mFullPacketSize, 0);
+    mParitySlots.resize(sHistoryLength, empty);
+    mParityTrailers.resize(sHistoryLength);
+    mCoveringParity.resize(sHistoryLength, empty);
+}
+
+
+//*******************************************************************************
+bool ParityFec::encodePacket(const int8_t* full_packet, uint16_t seq_num)
+{
+    if (0 == mEncodeCount) {
+        mParityCount = mNextParityCount;
+        mEncodeBaseSeq = seq_num;
+        for (int i = 0; i < mParityCount; ++i) {
+            std::memset(mEncodeParity[i].data(), 0, mFullPacketSize);
+        }
+    }
+    xorPacket(mEncodeParity[mEncodeCount % mParityCount].data(), full_packet, mFullPacketSize);
+
+    if (mGroupSize > ++mEncodeCount) {
+        return false;
+    }
+    mEncodeCount = 0;
+    for (int i = 0; i < mParityCount; ++i) {
+        ParityTrailer trailer;
+        std::memset(&trailer, 0, sizeof(trailer));
+        trailer.Magic = sParityMagic;
+        trailer.BaseSeqNumber = mEncodeBaseSeq;
+        trailer.GroupSize = mGroupSize;
+        trailer.ParityCount = mParityCount;
+        trailer.Index = i;
+        std::memcpy(mEncodeParity[i].data() + mFullPacketSize, &trailer, sizeof(trailer));
+    }
+    return true;
+}
+
+
+//*******************************************************************************
+void ParityFec::setParityCount(int parity_count)
+{
+    mNextParityCount = std::max(1, std::min(parity_count, mGroupSize));
+}
+
+
+//*******************************************************************************
+bool ParityFec::hasParityTrailer(const int8_t* buf, int len)
+{
+    if ((int)sizeof(ParityTrailer) > len) {
+        return false;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, buf + len - sizeof(ParityTrailer), sizeof(magic));
+    return sParityMagic == magic;
+}
+
+
+//*******************************************************************************
+bool ParityFec::storeParityPacket(const int8_t* buf, int len)
+{
+    if (getParityPacketSize() != len) {
+        return false;
+    }
+    ParityTrailer trailer;
+    std::memcpy(&trailer, buf + mFullPacketSize, sizeof(trailer));
+    if (1 > trailer.GroupSize || sMaxGroupSize < trailer.GroupSize
+            || trailer.Index >= trailer.ParityCount
+            || trailer.ParityCount > trailer.GroupSize) {
+        return false;
+    }
+
+    uint16_t parity_seq = trailer.BaseSeqNumber + trailer.Index;
+    int slot = parity_seq % sHistoryLength;
+    std::memcpy(mParityHistory.data() + slot*mFullPacketSize, buf, mFullPacketSize);
+    mParitySlots[slot].valid = true;
+    mParitySlots[slot].seq = parity_seq;
+    mParityTrailers[slot] = trailer;
+
+    // Remember which packets this parity covers
+    for (int o = trailer.Index; o < trailer.GroupSize; o += trailer.ParityCount) {
+        uint16_t seq = trailer.BaseSeqNumber + o;
+        HistorySlot& cover = mCoveringParity[seq % sHistoryLength];
+        cover.valid = true;
+        cover.seq = seq;
+        cover.parity_seq = parity_seq;
+    }
+    return true;
+}
+
+
+//*******************************************************************************
+void ParityFec::storeDataPacket(const int8_t* full_packet, uint16_t seq_num)
+{
+    int slot = seq_num % sHistoryLength;
+    std::memcpy(mDataHistory.data() + slot*mFullPacketSize, full_packet, mFullPacketSize);
+    mDataSlots[slot].valid = true;
+    mDataSlots[slot].seq = seq_num;
+}
+
+
+//*******************************************************************************
+int8_t* ParityFec::getDataPacket(uint16_t seq_num)
+{
+    int slot = seq_num % sHistoryLength;
+    if (!mDataSlots[slot].valid || seq_num != mDataSlots[slot].seq) {
+        return NULL;
+    }
+    return mDataHistory.data() + slot*mFullPacketSize;
+}
+
+
+//*******************************************************************************
+int8_t* ParityFec::recoverPacket(uint16_t seq_num)
+{
+    const HistorySlot& cover = mCoveringParity[seq_num % sHistoryLength];
+    if (!cover.valid || seq_num != cover.seq) {
+        return NULL;
+    }
+    int parity_slot = cover.parity_seq % sHistoryLength;
+    if (!mParitySlots[parity_slot].valid || cover.parity_seq != mParitySlots[parity_slot].seq) {
+        return NULL;
+    }
+    const ParityTrailer& trailer = mParityTrailers[parity_slot];
+
+    // All the other packets in the stripe are needed
+    for (int o = trailer.Index; o < trailer.GroupSize; o += trailer.ParityCount) {
+        uint16_t seq = trailer.BaseSeqNumber + o;
+        if (seq != seq_num && NULL == getDataPacket(seq)) {
+            return NULL;
+        }
+    }
+
+    int slot = seq_num % sHistoryLength;
+    int8_t* dst = mDataHistory.data() + slot*mFullPacketSize;
+    std::memcpy(dst, mParityHistory.data() + parity_slot*mFullPacketSize, mFullPacketSize);
+    for (int o = trailer.Index; o < trailer.GroupSize; o += trailer.ParityCount) {
+        uint16_t seq = trailer.BaseSeqNumber + o;
+        if (seq != seq_num) {
+            xorPacket(dst, getDataPacket(seq), mFullPacketSize);
+        }
+    }
+    mDataSlots[slot].valid = true;
+    mDataSlots[slot].seq = seq_num;
+    return dst;
+}
@@ -0,0 +1,149 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file ParityFec.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __PARITYFEC_H__
+#define __PARITYFEC_H__
+
+#include <vector>
+
+#include "jacktrip_types.h"
+
+/** \brief XOR parity forward error correction over groups of packets
+ *
+ * The sender XORs every group of <tt>k</tt> full packets (header+audio) into
+ * <tt>m</tt> parity packets. Parity packet <tt>j</tt> covers the packets of the
+ * group whose offset <tt>o</tt> satisfies <tt>o % m == j</tt>, so the group is
+ * interleaved over <tt>m</tt> stripes and any burst of up to <tt>m</tt>
+ * consecutive losses can be rebuilt, at a bandwidth cost of <tt>m/k</tt>.
+ *
+ * Parity packets are sent as separate datagrams with a ParityTrailer appended,
+ * which carries the group layout so the receiver doesn't need to know the
+ * sender settings in advance. Since the headers are XORed too, a recovered packet
+ * also gets its original header back.
+ *
+ * The receiver keeps the last sHistoryLength packets, indexed by sequence number.
+ */
+class ParityFec
+{
+public:
+
+    /// \brief Trailer appended at the end of each parity packet
+    struct ParityTrailer {
+        uint32_t Magic; ///< Always sParityMagic
+        uint16_t BaseSeqNumber; ///< Sequence number of the first packet in the group
+        uint8_t  GroupSize; ///< Number of data packets in the group (k)
+        uint8_t  ParityCount; ///< Number of parity packets in the group (m)
+        uint8_t  Index; ///< Index of this parity packet, 0 to m-1
+        uint8_t  Reserved[3];
+    };
+
+    static const uint32_t sParityMagic = 0x4346544a; ///< "JTFC"
+    static const int sMaxGroupSize = 64;
+    static const int sHistoryLength = 256; ///< Must divide 65536 and exceed 2*sMaxGroupSize
+
+    /** \brief The class constructor
+     * \param group_size Number of data packets per group (k)
+     * \param parity_count Number of parity packets per group (m), 1 to group_size
+     * \param full_packet_size Size of one data packet, header included
+     */
+    ParityFec(int group_size, int parity_count, int full_packet_size);
+
+    /// \brief Size of a parity packet on the wire, trailer included
+    int getParityPacketSize() const { return mFullPacketSize + sizeof(ParityTrailer); }
+    int getGroupSize() const { return mGroupSize; }
+    int getParityCount() const { return mParityCount; }
+    /** \brief Changes the number of parity packets, from the next group on.
+     * The receiver reads it from the ParityTrailer, so no renegotiation is needed.
+     */
+    void setParityCount(int parity_count);
+
+    /** \brief Adds a packet that has just been sent to the running parity
+     * \return true when the group is complete and the parity packets are ready
+     * to be sent with getParityPacket()
+     */
+    bool encodePacket(const int8_t* full_packet, uint16_t seq_num);
+    const int8_t* getParityPacket(int index) const
+    { return mEncodeParity[index].data(); }
+
+    /// \brief Checks the size and the trailer of a datagram to see if it is one of our parity packets
+    bool isParityPacket(const int8_t* buf, int len) const
+    { return getParityPacketSize() == len && hasParityTrailer(buf, len); }
+    /** \brief Only checks the trailer, for when the packet size isn't known yet.
+     * Audio that happens to end with the magic passes too.
+     */
+    static bool hasParityTrailer(const int8_t* buf, int len);
+
+    /// \brief Stores a received parity packet, returns false if it doesn't fit
+    bool storeParityPacket(const int8_t* buf, int len);
+    /// \brief Stores a received data packet
+    void storeDataPacket(const int8_t* full_packet, uint16_t seq_num);
+    /// \brief Returns the stored data packet, or NULL if it wasn't received
+    int8_t* getDataPacket(uint16_t seq_num);
+    /** \brief Tries to rebuild a lost data packet from its parity stripe
+     * \return Pointer to the rebuilt packet (also stored in the history),
+     * or NULL if the stripe is missing more than that packet
+     */
+    int8_t* recoverPacket(uint16_t seq_num);
+
+private:
+    struct HistorySlot {
+        bool valid;
+        uint16_t seq;
+        uint16_t parity_seq; ///< BaseSeqNumber + Index of the covering parity packet
+    };
+
+    int mGroupSize;
+    int mParityCount;
+    int mNextParityCount;
+    int mFullPacketSize;
+
+    // Encoder
+    int mEncodeCount;
+    uint16_t mEncodeBaseSeq;
+    std::vector< std::vector<int8_t> > mEncodeParity;
+
+    // Decoder, slots are indexed by sequence number modulo sHistoryLength
+    std::vector<int8_t> mDataHistory;
+    std::vector<HistorySlot> mDataSlots;
+    std::vector<int8_t> mParityHistory; ///< Indexed by (BaseSeqNumber + Index)
+    std::vector<HistorySlot> mParitySlots;
+    std::vector<ParityTrailer> mParityTrailers;
+    /// For each data sequence number, the parity slot that covers it
+    std::vector<HistorySlot> mCoveringParity;
+};
+
+#endif // __PARITYFEC_H__
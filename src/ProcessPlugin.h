@@ -83,6 +83,8 @@ public:
       }
     }
     virtual bool getInited() { return inited; }
+    /// \brief Delay the plugin adds to the audio, in frames (lookahead, linear phase filters)
+    virtual int getLatency() { return 0; }
     virtual void setVerbose(bool v) { verbose = v; }
 
     /// \brief Compute process
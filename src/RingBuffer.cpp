@@ -44,6 +44,7 @@
 #include <stdexcept>
 #include <cmath>
 #include "JackTrip.h"
+#include "LatencyHistogram.h"
 
 using std::cout; using std::endl;
 
@@ -105,6 +106,9 @@ RingBuffer::RingBuffer(int SlotSize, int NumSlots) :
     mBufIncCompensate = 0;
     mBroadcastSkew = 0;
     mBroadcastDelta = 0;
+    mLevelHistogram = NULL;
+    mLevelFramesPerSlot = 0;
+    mWakeupHistogram = NULL;
 }
 
 
@@ -156,6 +160,9 @@ void RingBuffer::readSlotBlocking(int8_t* ptrToReadSlot)
             return;
         }
     }
+    if (NULL != mWakeupHistogram && 0 != mSlotWriteUs[mReadPosition / mSlotSize]) {
+        mWakeupHistogram->record(LatencyHistogram::nowUs() - mSlotWriteUs[mReadPosition / mSlotSize]);
+    }
 
     // Copy mSlotSize bytes to ReadSlot
     std::memcpy(ptrToReadSlot, mRingBuffer+mReadPosition, mSlotSize);
@@ -197,7 +204,14 @@ bool RingBuffer::insertSlotNonBlocking(const int8_t* ptrToSlot, int len, int los
     }
 
     // Copy mSlotSize bytes to mRingBuffer
-    std::memcpy(mRingBuffer+mWritePosition, ptrToSlot, mSlotSize);
+    if (NULL == ptrToSlot) {
+        std::memset(mRingBuffer+mWritePosition, 0, mSlotSize);
+    } else {
+        std::memcpy(mRingBuffer+mWritePosition, ptrToSlot, mSlotSize);
+    }
+    if (NULL != mWakeupHistogram) {
+        mSlotWriteUs[mWritePosition / mSlotSize] = LatencyHistogram::nowUs();
+    }
     // Update write position
     mWritePosition = (mWritePosition+mSlotSize) % mTotalSize;
     mFullSlots++; //update full slots
@@ -208,7 +222,7 @@ bool RingBuffer::insertSlotNonBlocking(const int8_t* ptrToSlot, int len, int los
 
 
 //*******************************************************************************
-void RingBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
+bool RingBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
 {
     QMutexLocker locker(&mMutex); // lock the mutex
     ++mReadsNew;
@@ -218,6 +232,9 @@ void RingBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
     else {
         mLevelCur = mFullSlots;
     }
+    if (NULL != mLevelHistogram) {
+        mLevelHistogram->record(std::max(0, mFullSlots) * mLevelFramesPerSlot);
+    }
 
     // Check if there are slots available to read
     // If the Ringbuffer is empty, it returns a buffer of zeros and rests the buffer
@@ -227,7 +244,7 @@ void RingBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
         //std::memset(ptrToReadSlot, 0, mSlotSize);
         setUnderrunReadSlot(ptrToReadSlot);
         underrunReset();
-        return;
+        return false;
     }
 
     // Copy mSlotSize bytes to ReadSlot
@@ -239,6 +256,16 @@ void RingBuffer::readSlotNonBlocking(int8_t* ptrToReadSlot)
     mFullSlots--; //update full slots
     // Wake threads waitng for bufferIsNotFull condition
     mBufferIsNotFull.wakeAll();
+    return false;
+}
+
+
+//*******************************************************************************
+void RingBuffer::setWakeupHistogram(LatencyHistogram* histogram)
+{
+    QMutexLocker locker(&mMutex);
+    mSlotWriteUs.assign(mNumSlots, 0);
+    mWakeupHistogram = histogram;
 }
 
 
@@ -45,6 +45,9 @@
 #include "jacktrip_types.h"
 
 #include <atomic>
+#include <vector>
+
+class LatencyHistogram; // forward declaration
 
 //using namespace JackTripNamespace;
 
@@ -93,14 +96,16 @@ public:
     void readSlotBlocking(int8_t* ptrToReadSlot);
 
     /** \brief Same as insertSlotBlocking but non-blocking (asynchronous)
-   * \param ptrToSlot Pointer to slot to insert into the RingBuffer
+   * \param ptrToSlot Pointer to slot to insert into the RingBuffer, NULL to insert
+   * a slot that is known to be silent
    */
     virtual bool insertSlotNonBlocking(const int8_t* ptrToSlot, int len, int lostLen);
 
     /** \brief Same as readSlotBlocking but non-blocking (asynchronous)
    * \param ptrToReadSlot Pointer to read slot from the RingBuffer
+   * \return true if the slot is known to be silent, the caller can skip its processing
    */
-    virtual void readSlotNonBlocking(int8_t* ptrToReadSlot);
+    virtual bool readSlotNonBlocking(int8_t* ptrToReadSlot);
     virtual void readBroadcastSlot(int8_t* ptrToReadSlot);
 
     struct IOStat {
@@ -121,6 +126,15 @@ public:
     };
     virtual bool getStats(IOStat* stat, bool reset);
 
+    /// \brief Records the fill level at each readSlotNonBlocking(), in frames, NULL to stop
+    void setLevelHistogram(LatencyHistogram* histogram, int frames_per_slot)
+    { mLevelHistogram = histogram; mLevelFramesPerSlot = frames_per_slot; }
+    /** \brief Records the time from the insertSlotNonBlocking() of each slot to
+     * the readSlotBlocking() that takes it, in microseconds. Call before the
+     * threads start.
+     */
+    void setWakeupHistogram(LatencyHistogram* histogram);
+
 protected:
 
     /** \brief Sets the memory in the Read Slot when uderrun occurs. By default,
@@ -181,6 +195,12 @@ protected:
     // broadcast counters
     int32_t mBroadcastSkew;
     int32_t mBroadcastDelta;
+
+    // --iostat histograms, NULL if off
+    LatencyHistogram* mLevelHistogram;
+    int mLevelFramesPerSlot;
+    LatencyHistogram* mWakeupHistogram;
+    std::vector<uint64_t> mSlotWriteUs; ///< When each slot was written, 0 if never
 };
 
 #endif
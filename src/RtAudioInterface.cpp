@@ -38,6 +38,7 @@
 #include "RtAudioInterface.h"
 #include "JackTrip.h"
 #include "jacktrip_globals.h"
+#include "RtCheck.h"
 
 #include <cstdlib>
 
@@ -203,6 +204,7 @@ int RtAudioInterface::wrapperRtAudioCallback(void *outputBuffer, void *inputBuff
                                              unsigned int nFrames, double streamTime,
                                              RtAudioStreamStatus status, void *userData)
 {
+    RTCHECK_SCOPE();
     return static_cast<RtAudioInterface*>(userData)->RtAudioCallback(outputBuffer,inputBuffer,
                                                                      nFrames,
                                                                      streamTime, status);
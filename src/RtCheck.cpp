@@ -0,0 +1,435 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file RtCheck.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "RtCheck.h"
+
+#if defined (__RTCHECK__) && defined (__LINUX__)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // RTLD_NEXT
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace {
+
+const int sRingSize = 1024;
+const int sMaxFrames = 24;
+const int sReportIntervalSec = 5;
+const char* sNames[RtCheck::NUM_VIOLATIONS] = {"malloc", "free", "lock", "sleep", "syscall", "exit"};
+
+struct Violation {
+    std::atomic<int> ready; ///< Set by the RT thread once the rest is written
+    int kind;
+    int frames;
+    void* stack[sMaxFrames];
+};
+
+// Written from any RT thread, drained by report()
+Violation sRing[sRingSize];
+std::atomic<uint32_t> sWriteIndex(0);
+std::atomic<uint32_t> sReadIndex(0);
+std::atomic<uint64_t> sCounts[RtCheck::NUM_VIOLATIONS];
+std::atomic<uint64_t> sDropped(0);
+
+// Initial-exec TLS in the executable, safe to touch from malloc()
+__thread int tRtDepth = 0;
+__thread int tInChecker = 0;
+
+//*******************************************************************************
+void record(RtCheck::violationT kind)
+{
+    if (0 == tRtDepth || 0 != tInChecker) {
+        return;
+    }
+    tInChecker = 1;
+    sCounts[kind].fetch_add(1, std::memory_order_relaxed);
+    uint32_t index = sWriteIndex.load(std::memory_order_relaxed);
+    do {
+        if (sRingSize <= index - sReadIndex.load(std::memory_order_acquire)) {
+            sDropped.fetch_add(1, std::memory_order_relaxed);
+            tInChecker = 0;
+            return;
+        }
+    } while (!sWriteIndex.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+    Violation& violation = sRing[index % sRingSize];
+    violation.kind = kind;
+    violation.frames = ::backtrace(violation.stack, sMaxFrames);
+    violation.ready.store(1, std::memory_order_release);
+    tInChecker = 0;
+}
+
+
+//*******************************************************************************
+template<typename F>
+F next(const char* name)
+{
+    return reinterpret_cast<F>(::dlsym(RTLD_NEXT, name));
+}
+
+} // namespace
+
+
+//*******************************************************************************
+RtCheck::Scope::Scope() { ++tRtDepth; }
+RtCheck::Scope::~Scope() { --tRtDepth; }
+
+
+//*******************************************************************************
+void RtCheck::report()
+{
+    static std::mutex mutex;
+    static std::map<uint64_t, uint64_t> seen; // Backtrace hash, times seen
+    static uint64_t reported[NUM_VIOLATIONS];
+    static uint64_t dropped = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t index = sReadIndex.load(std::memory_order_relaxed);
+    for (;;) {
+        Violation& violation = sRing[index % sRingSize];
+        if (!violation.ready.load(std::memory_order_acquire)) {
+            break;
+        }
+        uint64_t hash = violation.kind;
+        for (int i = 0; i < violation.frames; ++i) {
+            hash = hash * 1099511628211ULL ^ reinterpret_cast<uintptr_t>(violation.stack[i]);
+        }
+        if (0 == seen[hash]++) {
+            std::fprintf(stderr, "RTCHECK: %s in RT context, first seen at:\n", sNames[violation.kind]);
+            // Skip record() itself and the interposed call
+            int skip = std::min(2, violation.frames);
+            ::backtrace_symbols_fd(violation.stack + skip, violation.frames - skip, STDERR_FILENO);
+        }
+        violation.ready.store(0, std::memory_order_relaxed);
+        sReadIndex.store(++index, std::memory_order_release);
+    }
+
+    bool changed = (sDropped.load() != dropped);
+    for (int i = 0; i < NUM_VIOLATIONS; ++i) {
+        changed |= (sCounts[i].load() != reported[i]);
+    }
+    if (!changed) {
+        return;
+    }
+    std::fprintf(stderr, "RTCHECK: totals");
+    for (int i = 0; i < NUM_VIOLATIONS; ++i) {
+        reported[i] = sCounts[i].load();
+        std::fprintf(stderr, " %s: %llu", sNames[i], (unsigned long long)reported[i]);
+    }
+    dropped = sDropped.load();
+    std::fprintf(stderr, " (backtraces dropped: %llu, distinct: %llu)\n",
+                 (unsigned long long)dropped, (unsigned long long)seen.size());
+}
+
+
+//*******************************************************************************
+void RtCheck::install()
+{
+    // The first backtrace() loads libgcc, do it here rather than in RT context
+    void* stack[2];
+    ::backtrace(stack, 2);
+    std::atexit(&RtCheck::report);
+    std::thread([] {
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::seconds(sReportIntervalSec));
+            RtCheck::report();
+        }
+    }).detach();
+    std::fprintf(stderr, "RTCHECK: checking the audio callbacks for real-time safety\n");
+}
+
+
+//*******************************************************************************
+// Interposed functions. The executable is linked with -rdynamic so they take
+// precedence over libc's for every library too.
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size)
+{
+    record(RtCheck::MALLOC);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    record(RtCheck::MALLOC);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    record(RtCheck::MALLOC);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    record(RtCheck::MALLOC);
+    *ptr = __libc_memalign(alignment, size);
+    return (NULL != *ptr) ? 0 : ENOMEM;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    record(RtCheck::MALLOC);
+    return __libc_memalign(alignment, size);
+}
+
+void free(void* ptr)
+{
+    if (NULL != ptr) {
+        record(RtCheck::FREE);
+    }
+    __libc_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    record(RtCheck::LOCK);
+    static int (*real)(pthread_mutex_t*) = next<int (*)(pthread_mutex_t*)>("pthread_mutex_lock");
+    return real(mutex);
+}
+
+// QMutex::lock(), out of line in Qt 5, where QMutexLocker and the ring buffers end up
+void rtcheckQMutexLock(void* mutex) __asm__("_ZN6QMutex4lockEv");
+void rtcheckQMutexLock(void* mutex)
+{
+    record(RtCheck::LOCK);
+    static void (*real)(void*) = next<void (*)(void*)>("_ZN6QMutex4lockEv");
+    real(mutex);
+}
+
+int nanosleep(const struct timespec* request, struct timespec* remain)
+{
+    record(RtCheck::SLEEP);
+    static int (*real)(const struct timespec*, struct timespec*) =
+            next<int (*)(const struct timespec*, struct timespec*)>("nanosleep");
+    return real(request, remain);
+}
+
+int usleep(useconds_t usec)
+{
+    record(RtCheck::SLEEP);
+    static int (*real)(useconds_t) = next<int (*)(useconds_t)>("usleep");
+    return real(usec);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+    record(RtCheck::SLEEP);
+    static unsigned int (*real)(unsigned int) = next<unsigned int (*)(unsigned int)>("sleep");
+    return real(seconds);
+}
+
+ssize_t read(int fd, void* buf, size_t count)
+{
+    record(RtCheck::SYSCALL);
+    static ssize_t (*real)(int, void*, size_t) = next<ssize_t (*)(int, void*, size_t)>("read");
+    return real(fd, buf, count);
+}
+
+ssize_t write(int fd, const void* buf, size_t count)
+{
+    record(RtCheck::SYSCALL);
+    static ssize_t (*real)(int, const void*, size_t) = next<ssize_t (*)(int, const void*, size_t)>("write");
+    return real(fd, buf, count);
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt)
+{
+    record(RtCheck::SYSCALL);
+    static ssize_t (*real)(int, const struct iovec*, int) =
+            next<ssize_t (*)(int, const struct iovec*, int)>("writev");
+    return real(fd, iov, iovcnt);
+}
+
+// stdio (so std::cerr and std::cout) writes with libc's internal write()
+size_t fwrite(const void* ptr, size_t size, size_t count, FILE* stream)
+{
+    record(RtCheck::SYSCALL);
+    static size_t (*real)(const void*, size_t, size_t, FILE*) =
+            next<size_t (*)(const void*, size_t, size_t, FILE*)>("fwrite");
+    return real(ptr, size, count, stream);
+}
+
+int fputs(const char* str, FILE* stream)
+{
+    record(RtCheck::SYSCALL);
+    static int (*real)(const char*, FILE*) = next<int (*)(const char*, FILE*)>("fputs");
+    return real(str, stream);
+}
+
+int putc(int c, FILE* stream)
+{
+    record(RtCheck::SYSCALL);
+    static int (*real)(int, FILE*) = next<int (*)(int, FILE*)>("putc");
+    return real(c, stream);
+}
+
+int fflush(FILE* stream)
+{
+    record(RtCheck::SYSCALL);
+    static int (*real)(FILE*) = next<int (*)(FILE*)>("fflush");
+    return real(stream);
+}
+
+int vfprintf(FILE* stream, const char* format, va_list args)
+{
+    record(RtCheck::SYSCALL);
+    static int (*real)(FILE*, const char*, va_list) =
+            next<int (*)(FILE*, const char*, va_list)>("vfprintf");
+    return real(stream, format, args);
+}
+
+int fprintf(FILE* stream, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int result = vfprintf(stream, format, args);
+    va_end(args);
+    return result;
+}
+
+int printf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int result = vfprintf(stdout, format, args);
+    va_end(args);
+    return result;
+}
+
+int open(const char* path, int flags, ...)
+{
+    record(RtCheck::SYSCALL);
+    mode_t mode = 0;
+    if (0 != (flags & (O_CREAT | O_TMPFILE))) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    static int (*real)(const char*, int, ...) = next<int (*)(const char*, int, ...)>("open");
+    return real(path, flags, mode);
+}
+
+int close(int fd)
+{
+    record(RtCheck::SYSCALL);
+    static int (*real)(int) = next<int (*)(int)>("close");
+    return real(fd);
+}
+
+int poll(struct pollfd* fds, nfds_t nfds, int timeout)
+{
+    record(RtCheck::SYSCALL);
+    static int (*real)(struct pollfd*, nfds_t, int) = next<int (*)(struct pollfd*, nfds_t, int)>("poll");
+    return real(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds, struct timeval* timeout)
+{
+    record(RtCheck::SYSCALL);
+    static int (*real)(int, fd_set*, fd_set*, fd_set*, struct timeval*) =
+            next<int (*)(int, fd_set*, fd_set*, fd_set*, struct timeval*)>("select");
+    return real(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+ssize_t sendto(int fd, const void* buf, size_t len, int flags,
+               const struct sockaddr* addr, socklen_t addrlen)
+{
+    record(RtCheck::SYSCALL);
+    static ssize_t (*real)(int, const void*, size_t, int, const struct sockaddr*, socklen_t) =
+            next<ssize_t (*)(int, const void*, size_t, int, const struct sockaddr*, socklen_t)>("sendto");
+    return real(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t recvfrom(int fd, void* buf, size_t len, int flags,
+                 struct sockaddr* addr, socklen_t* addrlen)
+{
+    record(RtCheck::SYSCALL);
+    static ssize_t (*real)(int, void*, size_t, int, struct sockaddr*, socklen_t*) =
+            next<ssize_t (*)(int, void*, size_t, int, struct sockaddr*, socklen_t*)>("recvfrom");
+    return real(fd, buf, len, flags, addr, addrlen);
+}
+
+void exit(int status)
+{
+    record(RtCheck::EXIT);
+    static void (*real)(int) = next<void (*)(int)>("exit");
+    real(status);
+    __builtin_unreachable();
+}
+
+} // extern "C"
+
+#else // __RTCHECK__ && __LINUX__
+
+//*******************************************************************************
+RtCheck::Scope::Scope() {}
+RtCheck::Scope::~Scope() {}
+void RtCheck::install() {}
+void RtCheck::report() {}
+
+#endif // __RTCHECK__ && __LINUX__
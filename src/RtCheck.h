@@ -0,0 +1,90 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file RtCheck.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __RTCHECK_H__
+#define __RTCHECK_H__
+
+/** \brief Real-time safety checker for the audio callbacks, for debug builds
+ * with __RTCHECK__ defined (qmake CONFIG+=rtcheck, meson -Drtcheck=true),
+ * Linux with glibc only
+ *
+ * The audio callbacks mark their thread as in RT context with a Scope. The
+ * checker interposes malloc and its friends, pthread and QMutex locks, the
+ * sleeps, the file and socket system calls and exit(). When one of them runs
+ * in RT context, it counts a violation and saves its backtrace in a
+ * preallocated ring, with none of the operations it checks, and then lets the
+ * call through. A background thread prints the new violations every few
+ * seconds and at exit, each distinct backtrace once.
+ *
+ * Without __RTCHECK__ everything here compiles to nothing.
+ */
+class RtCheck
+{
+public:
+
+    enum violationT {
+        MALLOC, ///< malloc(), calloc(), realloc(), aligned allocation (so new)
+        FREE, ///< free() of a non NULL pointer (so delete)
+        LOCK, ///< pthread_mutex_lock(), QMutex::lock()
+        SLEEP, ///< nanosleep(), usleep(), sleep()
+        SYSCALL, ///< stdio (so std::cerr), read(), write(), open(), close(), poll(), socket I/O
+        EXIT, ///< exit()
+        NUM_VIOLATIONS
+    };
+
+    /// \brief Starts the reporting thread, call once at the start of main()
+    static void install();
+    /// \brief Prints the violations since the last report to stderr, never from RT context
+    static void report();
+
+    /// \brief Marks the current thread as in RT context for its lifetime, nests
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+    };
+};
+
+#ifdef __RTCHECK__
+#define RTCHECK_SCOPE() RtCheck::Scope rtcheck_scope
+#else
+#define RTCHECK_SCOPE() do {} while (0)
+#endif
+
+#endif // __RTCHECK_H__
@@ -39,6 +39,9 @@
 #include "LoopBack.h"
 //#include "NetKS.h"
 #include "Effects.h"
+#include "ParityFec.h"
+#include "OpusCodec.h"
+#include "NetworkImpairment.h"
 
 #ifdef WAIR // wair
 #include "ap8x2.dsp.h"
@@ -64,14 +67,30 @@ enum JTLongOptIDS {
   OPT_BUFSTRATEGY = 1001,
   OPT_SIMLOSS,
   OPT_SIMJITTER,
+  OPT_SIMNET,
   OPT_BROADCAST,
   OPT_RTUDPPRIORITY,
+  OPT_FEC,
+  OPT_ADAPTREDUNDANCY,
+  OPT_COMPACTHEADER,
+  OPT_AGGREGATE,
+  OPT_MTU,
+  OPT_LOSSLESS,
+  OPT_OPUS,
+  OPT_DTX,
+  OPT_PACING,
+  OPT_XDP,
+  OPT_IOURING,
+  OPT_NOSHM,
+  OPT_PACKETTRACE,
+  OPT_METRICSPORT,
+  OPT_STATSSHM,
 };
 
 //*******************************************************************************
 Settings::Settings() :
     mJackTripMode(JackTrip::SERVER),
-    mDataProtocol(JackTrip::UDP),
+    mDataProtocol(JackTrip::SHM),
     mNumChans(2),
     mBufferQueueLength(gDefaultQueueLength),
     mAudioBitResolution(AudioInterface::BIT16),
@@ -87,6 +106,7 @@ Settings::Settings() :
     #endif // endwhere
     mJamLink(false),
     mEmptyHeader(false),
+    mCompactHeader(false),
     mJackTripServer(false),
     mLocalAddress(gDefaultLocalAddress),
     mRedundancy(1),
@@ -102,7 +122,21 @@ Settings::Settings() :
     mSimulatedJitterRate(0.0),
     mSimulatedDelayRel(0.0),
     mBroadcastQueue(0),
-    mUseRtUdpPriority(false)
+    mUseRtUdpPriority(false),
+    mFecGroupSize(0),
+    mFecParityCount(0),
+    mAdaptiveRedundancyMax(0),
+    mAggregation(1),
+    mMtu(0),
+    mLossless(false),
+    mOpusBitrate(0),
+    mOpusComplexity(5),
+    mDtxLevel(0.0),
+    mPacing(DataProtocol::NOPACING),
+    mXdpQueue(0),
+    mIoUring(false),
+    mMetricsPort(0),
+    mStatsShm(false)
 {}
 
 //*******************************************************************************
@@ -148,6 +182,7 @@ void Settings::parseInput(int argc, char** argv)
         { "loopback", no_argument, NULL, 'l' }, // Run in loopback mode
         { "jamlink", no_argument, NULL, 'j' }, // Run in JamLink mode
         { "emptyheader", no_argument, NULL, 'e' }, // Run in JamLink mode
+        { "compactheader", no_argument, NULL, OPT_COMPACTHEADER }, // One compact header per datagram
         { "clientname", required_argument, NULL, 'J' }, // Run in JamLink mode
         { "remotename", required_argument, NULL, 'K' }, // Client name on hub server
         { "rtaudio", no_argument, NULL, 'R' }, // Run in JamLink mode
@@ -166,8 +201,23 @@ void Settings::parseInput(int argc, char** argv)
         { "bufstrategy", required_argument, NULL, OPT_BUFSTRATEGY }, // Set bufstrategy
         { "simloss", required_argument, NULL, OPT_SIMLOSS },
         { "simjitter", required_argument, NULL, OPT_SIMJITTER },
+        { "simnet", required_argument, NULL, OPT_SIMNET },
         { "broadcast", required_argument, NULL, OPT_BROADCAST },
         { "udprt", no_argument, NULL, OPT_RTUDPPRIORITY },
+        { "fec", required_argument, NULL, OPT_FEC }, // Parity FEC group size and parity count
+        { "adaptredundancy", required_argument, NULL, OPT_ADAPTREDUNDANCY }, // Adaptive redundancy upper limit
+        { "aggregate", required_argument, NULL, OPT_AGGREGATE }, // Audio periods per datagram
+        { "mtu", required_argument, NULL, OPT_MTU }, // Path MTU for fragmentation
+        { "lossless", no_argument, NULL, OPT_LOSSLESS }, // Lossless audio compression
+        { "opus", required_argument, NULL, OPT_OPUS }, // Opus bitrate and complexity
+        { "dtx", required_argument, NULL, OPT_DTX }, // Discontinuous transmission level
+        { "pacing", required_argument, NULL, OPT_PACING }, // Paced sending (user or txtime)
+        { "xdp", required_argument, NULL, OPT_XDP }, // AF_XDP interface and queue
+        { "iouring", no_argument, NULL, OPT_IOURING }, // Datagrams through io_uring
+        { "noshm", no_argument, NULL, OPT_NOSHM }, // Stay on UDP with a peer on this host
+        { "packettrace", required_argument, NULL, OPT_PACKETTRACE }, // Record the received datagrams
+        { "metricsport", required_argument, NULL, OPT_METRICSPORT }, // Serve OpenMetrics on localhost
+        { "statsshm", no_argument, NULL, OPT_STATSSHM }, // Statistics for jacktrip-top
         { "help", no_argument, NULL, 'h' }, // Print Help
         { "examine-audio-delay", required_argument, NULL, 'x' }, // test mode - measure audio round-trip latency statistics
         { NULL, 0, NULL, 0 }
@@ -244,7 +294,9 @@ void Settings::parseInput(int argc, char** argv)
             break;
         case 'b':
             //-------------------------------------------------------
-            if (atoi(optarg) == 8) {
+            if (0 == strcmp(optarg, "16f")) {
+                mAudioBitResolution = AudioInterface::FLOAT16;
+            } else if (atoi(optarg) == 8) {
                 mAudioBitResolution = AudioInterface::BIT8;
             } else if (atoi(optarg) == 16) {
                 mAudioBitResolution = AudioInterface::BIT16;
@@ -255,7 +307,7 @@ void Settings::parseInput(int argc, char** argv)
             } else {
                 printUsage();
                 std::cerr << "--bitres ERROR: Bit resolution: "
-                          << atoi(optarg) << " is not supported." << endl;
+                          << optarg << " is not supported." << endl;
                 std::exit(1);
             }
             break;
@@ -304,6 +356,10 @@ void Settings::parseInput(int argc, char** argv)
             //-------------------------------------------------------
             mJamLink = true;
             break;
+        case OPT_COMPACTHEADER: // compact header
+            //-------------------------------------------------------
+            mCompactHeader = true;
+            break;
         case 'J': // Set client Name
             //-------------------------------------------------------
             mClientName = optarg;
@@ -410,12 +466,141 @@ void Settings::parseInput(int argc, char** argv)
                 mSimulatedDelayRel = atof(endp+1);
             }
             break;
+        case OPT_SIMNET: { // Simulate bursty loss, delay, reordering...
+            NetworkImpairment::Model model;
+            try {
+                NetworkImpairment::parseModel(optarg, &model);
+            } catch (const std::invalid_argument& e) {
+                printUsage();
+                std::cerr << "--simnet ERROR: " << e.what() << endl;
+                std::exit(1);
+            }
+            mSimulatedModel = optarg;
+            break; }
         case OPT_BROADCAST: // Broadcast output
             mBroadcastQueue = atoi(optarg);
             break;
         case OPT_RTUDPPRIORITY: // Use RT priority for UDPDataProtocol thread
             mUseRtUdpPriority = true;
             break;
+        case OPT_FEC: { // Parity FEC
+            char* endp;
+            int group_size = strtol(optarg, &endp, 10);
+            int parity_count = (0 == *endp) ? 1 : atoi(endp+1);
+            if (1 > group_size || ParityFec::sMaxGroupSize < group_size
+                    || 1 > parity_count || group_size < parity_count) {
+                printUsage();
+                std::cerr << "--fec ERROR: The group size has to be between 1 and " << ParityFec::sMaxGroupSize
+                          << ", and the parity count between 1 and the group size" << endl;
+                std::exit(1);
+            }
+            mFecGroupSize = group_size;
+            mFecParityCount = parity_count;
+            break; }
+        case OPT_ADAPTREDUNDANCY: // Adaptive redundancy
+            if ( atoi(optarg) <= 1 ) {
+                printUsage();
+                std::cerr << "--adaptredundancy ERROR: The maximum redundancy has to be greater than 1" << endl;
+                std::exit(1); }
+            else {
+                mAdaptiveRedundancyMax = atoi(optarg);
+            }
+            break;
+        case OPT_AGGREGATE: // Periods per datagram
+            if ( atoi(optarg) < 1 || atoi(optarg) > static_cast<int>(JackTrip::sMaxAggregation) ) {
+                printUsage();
+                std::cerr << "--aggregate ERROR: The number of periods per datagram has to be 1 to "
+                          << JackTrip::sMaxAggregation << endl;
+                std::exit(1); }
+            else {
+                mAggregation = atoi(optarg);
+            }
+            break;
+        case OPT_MTU: // Path MTU
+            if ( atoi(optarg) < 576 || atoi(optarg) > 65535 ) {
+                printUsage();
+                std::cerr << "--mtu ERROR: The MTU has to be between 576 and 65535 bytes" << endl;
+                std::exit(1); }
+            else {
+                mMtu = atoi(optarg);
+            }
+            break;
+        case OPT_LOSSLESS: // Lossless audio compression
+            //-------------------------------------------------------
+            mLossless = true;
+            break;
+        case OPT_OPUS: { // Opus
+            char* endp;
+            int bitrate = strtol(optarg, &endp, 10);
+            int complexity = (0 == *endp) ? mOpusComplexity : atoi(endp+1);
+            if (6 > bitrate || 1024 < bitrate || 0 > complexity || 10 < complexity) {
+                printUsage();
+                std::cerr << "--opus ERROR: The bitrate has to be between 6 and 1024 kbit/s, "
+                          << "and the complexity between 0 and 10" << endl;
+                std::exit(1);
+            }
+            mOpusBitrate = bitrate * 1000;
+            mOpusComplexity = complexity;
+            break; }
+        case OPT_DTX: // Discontinuous transmission
+            //-------------------------------------------------------
+            if ( atof(optarg) >= 0.0 || atof(optarg) < -200.0 ) {
+                printUsage();
+                std::cerr << "--dtx ERROR: The silence level has to be between -200 and 0 dBFS (excluded)" << endl;
+                std::exit(1); }
+            else {
+                mDtxLevel = atof(optarg);
+            }
+            break;
+        case OPT_PACING: // Paced sending
+            //-------------------------------------------------------
+            if (0 == strcmp(optarg, "user")) {
+                mPacing = DataProtocol::USERPACING;
+            } else if (0 == strcmp(optarg, "txtime")) {
+                mPacing = DataProtocol::TXTIMEPACING;
+            } else {
+                printUsage();
+                std::cerr << "--pacing ERROR: The pacing mode has to be user or txtime" << endl;
+                std::exit(1);
+            }
+            break;
+        case OPT_XDP: { // AF_XDP interface[:queue]
+            //-------------------------------------------------------
+            QString arg = optarg;
+            int colon = arg.indexOf(':');
+            mXdpInterface = (-1 == colon) ? arg : arg.left(colon);
+            mXdpQueue = (-1 == colon) ? 0 : arg.mid(colon + 1).toInt();
+            if (mXdpInterface.isEmpty() || 0 > mXdpQueue) {
+                printUsage();
+                std::cerr << "--xdp ERROR: Give a network interface and optionally a queue, e.g. eth0:2" << endl;
+                std::exit(1);
+            }
+            break; }
+        case OPT_IOURING: // Datagrams through io_uring
+            //-------------------------------------------------------
+            mIoUring = true;
+            break;
+        case OPT_NOSHM: // Stay on UDP with a peer on this host
+            //-------------------------------------------------------
+            mDataProtocol = JackTrip::UDP;
+            break;
+        case OPT_PACKETTRACE: // Record the received datagrams
+            //-------------------------------------------------------
+            mPacketTrace = optarg;
+            break;
+        case OPT_METRICSPORT: // Serve OpenMetrics on localhost
+            //-------------------------------------------------------
+            mMetricsPort = atoi(optarg);
+            if (1 > mMetricsPort || 65535 < mMetricsPort) {
+                printUsage();
+                std::cerr << "--metricsport ERROR: port must be between 1 and 65535." << endl;
+                std::exit(1);
+            }
+            break;
+        case OPT_STATSSHM: // Statistics for jacktrip-top
+            //-------------------------------------------------------
+            mStatsShm = true;
+            break;
         case 'h':
             //-------------------------------------------------------
             printUsage();
@@ -544,6 +729,82 @@ void Settings::parseInput(int argc, char** argv)
       std::cerr << "*** --examine-audio-delay (-x) ERROR: Only --bitres (-b) 16 and 32 presently supported for audio latency measurement.\n\n";
       std::exit(1);
     }
+    if (0 < mFecGroupSize && 1 < mRedundancy) {
+      std::cerr << "*** --fec ERROR: Parity FEC replaces --redundancy (-r), use only one of them.\n\n";
+      std::exit(1);
+    }
+    if (0 < mFecGroupSize && (mJamLink || mEmptyHeader)) {
+      std::cerr << "*** --fec ERROR: Parity FEC needs the sequence numbers of the default header.\n\n";
+      std::exit(1);
+    }
+    if (1 < mAggregation && 0 < mFecGroupSize) {
+      std::cerr << "*** --aggregate ERROR: Parity FEC needs one period per datagram.\n\n";
+      std::exit(1);
+    }
+    if (1 < mAggregation && (mJamLink || mEmptyHeader)) {
+      std::cerr << "*** --aggregate ERROR: Aggregation needs the sequence numbers of the default header.\n\n";
+      std::exit(1);
+    }
+    if (0 < mMtu && (0 < mFecGroupSize || 1 < mAggregation)) {
+      std::cerr << "*** --mtu ERROR: Fragmentation can't be combined with --fec or --aggregate.\n\n";
+      std::exit(1);
+    }
+    if (0 < mMtu && (mJamLink || mEmptyHeader)) {
+      std::cerr << "*** --mtu ERROR: Fragmentation needs the sequence numbers of the default header.\n\n";
+      std::exit(1);
+    }
+    if (mCompactHeader && (mJamLink || mEmptyHeader)) {
+      std::cerr << "*** --compactheader ERROR: Use only one of --compactheader, --jamlink (-j) and --emptyheader (-e).\n\n";
+      std::exit(1);
+    }
+    if (mLossless && (AudioInterface::BIT32 == mAudioBitResolution
+                      || AudioInterface::FLOAT16 == mAudioBitResolution)) {
+      std::cerr << "*** --lossless ERROR: Lossless compression needs an integer --bitres (-b) (8, 16 or 24).\n\n";
+      std::exit(1);
+    }
+    if (mLossless && (mCompactHeader || 0 < mMtu)) {
+      std::cerr << "*** --lossless ERROR: Lossless compression can't be combined with --compactheader or --mtu.\n\n";
+      std::exit(1);
+    }
+    if (mLossless && (mJamLink || mEmptyHeader)) {
+      std::cerr << "*** --lossless ERROR: Lossless compression needs the fields of the default header.\n\n";
+      std::exit(1);
+    }
+    if (0 < mOpusBitrate && !OpusCodec::isAvailable()) {
+      std::cerr << "*** --opus ERROR: This JackTrip was built without Opus support.\n\n";
+      std::exit(1);
+    }
+    if (0 < mOpusBitrate && (0 < mFecGroupSize || 1 < mAggregation || 0 < mMtu
+                             || mLossless || mCompactHeader)) {
+      std::cerr << "*** --opus ERROR: Opus can't be combined with --fec, --aggregate, --mtu, --lossless or --compactheader.\n\n";
+      std::exit(1);
+    }
+    if (0 < mOpusBitrate && (mJamLink || mEmptyHeader)) {
+      std::cerr << "*** --opus ERROR: Opus needs the fields of the default header.\n\n";
+      std::exit(1);
+    }
+    if (0.0 > mDtxLevel && (0 < mFecGroupSize || 0 < mMtu || 0 < mOpusBitrate)) {
+      std::cerr << "*** --dtx ERROR: Discontinuous transmission can't be combined with --fec, --mtu or --opus.\n\n";
+      std::exit(1);
+    }
+    if (0.0 > mDtxLevel && (mJamLink || mEmptyHeader)) {
+      std::cerr << "*** --dtx ERROR: Discontinuous transmission needs the sequence numbers of the header.\n\n";
+      std::exit(1);
+    }
+#if !defined (__LINUX__)
+    if (!mXdpInterface.isEmpty()) {
+      std::cerr << "*** --xdp ERROR: AF_XDP is Linux only.\n\n";
+      std::exit(1);
+    }
+    if (mIoUring) {
+      std::cerr << "*** --iouring ERROR: io_uring is Linux only.\n\n";
+      std::exit(1);
+    }
+#endif
+    if (mIoUring && !mXdpInterface.isEmpty()) {
+      std::cerr << "*** --iouring ERROR: Use only one of --iouring and --xdp.\n\n";
+      std::exit(1);
+    }
 }
 
 //*******************************************************************************
@@ -583,12 +844,13 @@ void Settings::printUsage()
     cout << " -B, --bindport        #                  Set only the bind port number (default: " << gDefaultPort << ")" << endl;
     cout << " -P, --peerport        #                  Set only the peer port number (default: " << gDefaultPort << ")" << endl;
     cout << " -U, --udpbaseport                        Set only the server udp base port number (default: 61002)" << endl;
-    cout << " -b, --bitres      # (8, 16, 24, 32)      Audio Bit Rate Resolutions (default: 16, 32 uses floating-point)" << endl;
+    cout << " -b, --bitres      # (8, 16, 16f, 24, 32) Audio Bit Rate Resolutions (default: 16, 32 uses floating-point, 16f uses half-precision floating-point)" << endl;
     cout << " -p, --hubpatch    # (0, 1, 2, 3, 4, 5)   Hub auto audio patch, only has effect if running HUB SERVER mode, 0=server-to-clients, 1=client loopback, 2=client fan out/in but not loopback, 3=reserved for TUB, 4=full mix, 5=no auto patching (default: 0)" << endl;
     cout << " -z, --zerounderrun                       Set buffer to zeros when underrun occurs (default: wavetable)" << endl;
     cout << " -t, --timeout                            Quit after 10 seconds of no network activity" << endl;
     cout << " -l, --loopback                           Run in Loop-Back Mode" << endl;
     cout << " -j, --jamlink                            Run in JamLink Mode (Connect to a JamLink Box)" << endl;
+    cout << " --compactheader                          Send one compact header per datagram instead of one per packet, saves bandwidth at small buffer sizes (the default header is sent until the peer shows it uses it too)" << endl;
     cout << " -J, --clientname                         Change default client name (default: JackTrip)" << endl;
     cout << " -K, --remotename                         Change default remote client name when connecting to a hub server (the default is derived from this computer's external facing IP address)" << endl;
     cout << " -L, --localaddress                       Change default local host IP address (default: 127.0.0.1)" << endl;
@@ -596,6 +858,23 @@ void Settings::printUsage()
     cout << " --bufstrategy     # (0, 1, 2)            Use alternative jitter buffer" << endl;
     cout << " --broadcast <broadcast_queue>            Turn on broadcast output ports with extra queue (requires new jitter buffer)" << endl;
     cout << " --udprt                                  Use RT thread priority for network I/O" << endl;
+    cout << " --fec <k>[,<m>]                          Use parity FEC instead of redundancy, m parity packets every k packets (default m: 1)." << endl;
+    cout << "                                          Rebuilds up to m consecutive lost packets for m/k more bandwidth, adds k packets of latency" << endl;
+    cout << " --adaptredundancy <max>                  Raise redundancy (or FEC parity count) up to max when the peer reports losses, lower it when they stop (the peer reports losses once our headers ask for them)" << endl;
+    cout << " --mtu <bytes>                            Split packets that don't fit in the path MTU, a lost fragment only silences the channels it carries (use on both ends)" << endl;
+    cout << " --aggregate <periods>                    Send up to 8 audio periods per datagram, cuts the packet rate for (periods-1) periods of latency (use on both ends, a receiver stops when they differ)" << endl;
+    cout << " --lossless                               Compress the audio without loss and without added latency, bandwidth savings depend on the signal (use on both ends)" << endl;
+    cout << " --opus <kbps>[,<complexity>]             Code the audio with Opus (CELT low delay) at kbps per direction, complexity 0 to 10 (default: 5)." << endl;
+    cout << "                                          Needs an even period of 1 ms to 1024 samples, lost packets are concealed (use on both ends)" << endl;
+    cout << " --dtx <dBFS>                             Send a small keep-alive instead of the packets whose peak stays under dBFS (e.g. -60), the peer plays them as silence. The first packets and one a second are still sent whole" << endl;
+    cout << " --pacing user|txtime                     Space the sent datagrams by the audio period so bursts don't overflow the peer's buffer." << endl;
+    cout << "                                          user sleeps in the network thread, txtime lets the kernel hold them (SO_TXTIME, needs the fq qdisc, Linux only)" << endl;
+    cout << " --xdp <interface>[:<queue>]              Move the IPv4 datagrams through an AF_XDP socket on that NIC queue, falling back to the kernel path (Linux 5.9+)." << endl;
+    cout << "                                          Steer the UDP port to the queue first, e.g. ethtool -N eth0 flow-type udp4 dst-port 4464 action 2" << endl;
+    cout << " --iouring                                Receive with a multishot io_uring receive and send each period's datagrams with one syscall (Linux 6.0+). Each session keeps its own rings, the hub server does not share one per core" << endl;
+    cout << " --noshm                                  Keep using UDP when the peer runs on the same host, instead of moving the datagrams through shared memory" << endl;
+    cout << " --packettrace <file>                     Record the arrival time, sequence number and size of every received datagram, to replay with jacktrip-sim --replay." << endl;
+    cout << "                                          The hub server writes one file per client, <file>.<client id>" << endl;
     cout << endl;
     cout << "OPTIONAL SIGNAL PROCESSING: " << endl;
     cout << " -f, --effects # | paramString | help     Turn on incoming and/or outgoing compressor and/or reverb in Client - see `-f help' for details" << endl;
@@ -612,12 +891,23 @@ void Settings::printUsage()
     cout << "ARGUMENTS TO DISPLAY IO STATISTICS:" << endl;
     cout << " -I, --iostat <time_in_secs>              Turn on IO stat reporting with specified interval (in seconds)" << endl;
     cout << " -G, --iostatlog <log_file>               Save stat log into a file (default: print in stdout)" << endl;
+    cout << " --metricsport <port>                     Serve the session (and hub) statistics in OpenMetrics format on http://localhost:<port>/metrics" << endl;
+    cout << " --statsshm                               Publish the session statistics in shared memory, to watch them with jacktrip-top (Linux only)" << endl;
     cout << " -x, --examine-audio-delay <print_interval_in_secs> | help\n";
     cout << "                                          Print round-trip audio delay statistics. See `-x help' for details." << endl;
     cout << endl;
     cout << "ARGUMENTS TO SIMULATE NETWORK ISSUES:" << endl;
     cout << " --simloss <rate>                         Simulate packet loss" << endl;
     cout << " --simjitter <rate>,<d>                   Simulate jitter, d is max delay in packets" << endl;
+    cout << " --simnet <impairment>=<value>[,...]      Simulate more network issues, applied to each client of a hub server separately:" << endl;
+    cout << "                                          ge=<p>:<r>[:<loss good>:<loss bad>] Gilbert-Elliott bursty loss, p and r are the" << endl;
+    cout << "                                            probabilities of going to the bad and back to the good state (loss 0 and 1 by default)" << endl;
+    cout << "                                          pareto=<min ms>:<shape> Pareto distributed delay" << endl;
+    cout << "                                          trace=<file> One way delay in ms per packet, '-' if lost, looped" << endl;
+    cout << "                                          reorder=<rate> Share of packets that skip the delay and overtake the others" << endl;
+    cout << "                                          duplicate=<rate> Share of packets received twice" << endl;
+    cout << "                                          rate=<kbit/s> Bottleneck rate, holding up to 1000 packets" << endl;
+    cout << "                                          e.g. --simnet ge=0.01:0.25,pareto=2:2.5,reorder=0.01" << endl;
     cout << endl;
     cout << "HELP ARGUMENTS: " << endl;
     cout << " -v, --version                            Prints Version Number" << endl;
@@ -655,9 +945,24 @@ UdpHubListener *Settings::getConfiguredHubServer()
 
     udpHub->setBufferStrategy(mBufferStrategy);
     udpHub->setNetIssuesSimulation(mSimulatedLossRate,
-        mSimulatedJitterRate, mSimulatedDelayRel);
+        mSimulatedJitterRate, mSimulatedDelayRel, mSimulatedModel);
     udpHub->setBroadcast(mBroadcastQueue);
     udpHub->setUseRtUdpPriority(mUseRtUdpPriority);
+    udpHub->setFec(mFecGroupSize, mFecParityCount);
+    udpHub->setAdaptiveRedundancy(mAdaptiveRedundancyMax);
+    udpHub->setCompactHeader(mCompactHeader);
+    udpHub->setAggregation(mAggregation);
+    udpHub->setMtu(mMtu);
+    udpHub->setLossless(mLossless);
+    udpHub->setOpus(mOpusBitrate, mOpusComplexity);
+    udpHub->setDtx(mDtxLevel);
+    udpHub->setPacing(mPacing);
+    udpHub->setXdp(mXdpInterface, mXdpQueue);
+    udpHub->setIoUring(mIoUring);
+    udpHub->setSharedMemory(JackTrip::SHM == mDataProtocol);
+    udpHub->setPacketTrace(mPacketTrace);
+    udpHub->setMetricsPort(mMetricsPort);
+    udpHub->setStatsShm(mStatsShm);
     
     if (mIOStatTimeout > 0) {
         udpHub->setIOStatTimeout(mIOStatTimeout);
@@ -735,6 +1040,13 @@ JackTrip *Settings::getConfiguredJackTrip()
         jackTrip->setPacketHeaderType(DataProtocol::EMPTY);
     }
 
+    // Set in CompactHeader Mode
+    if (mCompactHeader) {
+        cout << "Running in CompactHeader Mode..." << endl;
+        cout << gPrintSeparator << std::endl;
+        jackTrip->setPacketHeaderType(DataProtocol::COMPACT);
+    }
+
     // Set RtAudio
 #ifdef __RT_AUDIO__
     if (!mUseJack) {
@@ -758,9 +1070,22 @@ JackTrip *Settings::getConfiguredJackTrip()
     }
     jackTrip->setBufferStrategy(mBufferStrategy);
     jackTrip->setNetIssuesSimulation(mSimulatedLossRate,
-        mSimulatedJitterRate, mSimulatedDelayRel);
+        mSimulatedJitterRate, mSimulatedDelayRel, mSimulatedModel);
     jackTrip->setBroadcast(mBroadcastQueue);
     jackTrip->setUseRtUdpPriority(mUseRtUdpPriority);
+    jackTrip->setFec(mFecGroupSize, mFecParityCount);
+    jackTrip->setAdaptiveRedundancy(mAdaptiveRedundancyMax);
+    jackTrip->setAggregation(mAggregation);
+    jackTrip->setMtu(mMtu);
+    jackTrip->setLossless(mLossless);
+    jackTrip->setOpus(mOpusBitrate, mOpusComplexity);
+    jackTrip->setDtx(mDtxLevel);
+    jackTrip->setPacing(mPacing);
+    jackTrip->setXdp(mXdpInterface, mXdpQueue);
+    jackTrip->setIoUring(mIoUring);
+    jackTrip->setPacketTrace(mPacketTrace);
+    jackTrip->setMetricsPort(mMetricsPort);
+    jackTrip->setStatsShm(mStatsShm);
 
     // Add Plugins
     if (mLoopBack) {
@@ -103,6 +103,7 @@ private:
     bool mLoopBack; ///< Loop-back mode
     bool mJamLink; ///< JamLink mode
     bool mEmptyHeader; ///< EmptyHeader mode
+    bool mCompactHeader; ///< CompactHeader mode
     bool mJackTripServer; ///< JackTrip Server mode
     QString mLocalAddress; ///< Local Address
     unsigned int mRedundancy; ///< Redundancy factor for data in the network
@@ -121,8 +122,25 @@ private:
     double mSimulatedLossRate;
     double mSimulatedJitterRate;
     double mSimulatedDelayRel;
+    QString mSimulatedModel; ///< --simnet impairments
     int mBroadcastQueue;
     bool mUseRtUdpPriority;
+    unsigned int mFecGroupSize; ///< Parity FEC group size, 0 if FEC is off
+    unsigned int mFecParityCount; ///< Parity packets per FEC group
+    unsigned int mAdaptiveRedundancyMax; ///< Redundancy upper limit, 0 if it is fixed
+    unsigned int mAggregation; ///< Audio periods per datagram
+    int mMtu; ///< Path MTU, 0 to let IP fragment large packets
+    bool mLossless; ///< Lossless audio compression
+    int mOpusBitrate; ///< Opus bitrate in bits/s, 0 if Opus is off
+    int mOpusComplexity; ///< Opus encoder complexity, 0 to 10
+    double mDtxLevel; ///< Peak level of silent packets in dBFS, 0 if DTX is off
+    DataProtocol::pacingModeT mPacing; ///< How the sent datagrams are spaced
+    QString mXdpInterface; ///< AF_XDP network interface, empty if not used
+    int mXdpQueue; ///< First NIC queue to try for AF_XDP
+    bool mIoUring; ///< Datagrams through io_uring
+    QString mPacketTrace; ///< Trace file of the received datagrams, empty if off
+    int mMetricsPort; ///< Localhost port of the OpenMetrics endpoint, 0 if off
+    bool mStatsShm; ///< Publish the statistics in shared memory for jacktrip-top
     AudioTester mAudioTester;
 };
 
@@ -0,0 +1,554 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file ShmChannel.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "ShmChannel.h"
+
+#include <iostream>
+
+using std::cout; using std::cerr; using std::endl;
+
+#if defined (__LINUX__)
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+/// \brief Start of the memfd, the ring follows it
+struct ShmChannel::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; ///< Bytes in the ring
+    uint32_t state;
+    alignas(64) uint64_t head; ///< Written by the sender
+    uint32_t wake; ///< Futex, bumped by the sender to wake the receiver
+    uint32_t waiting; ///< Set by the receiver before it sleeps
+    alignas(64) uint64_t tail; ///< Written by the receiver
+};
+
+static const uint32_t sShmMagic = 0x4d53544a; ///< "JTSM"
+static const uint32_t sShmVersion = 1;
+static const uint32_t sWrapLength = 0xffffffff; ///< Rest of the ring is unused
+enum {sOffered = 1, sAttached, sClosed};
+
+
+//*******************************************************************************
+static inline size_t recordSize(size_t size)
+{
+    // Length, then the datagram, keeping the lengths aligned
+    return (sizeof(uint32_t) + size + 7) & ~size_t(7);
+}
+
+
+//*******************************************************************************
+static inline int64_t monotonicNs()
+{
+    struct timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+
+//*******************************************************************************
+static inline std::string endpointName(const struct sockaddr_in& addr)
+{
+    char ip[INET_ADDRSTRLEN];
+    ::inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+
+//*******************************************************************************
+static inline socklen_t abstractAddress(const std::string& name, struct sockaddr_un* addr)
+{
+    std::memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    size_t length = std::min(name.size(), sizeof(addr->sun_path) - 1);
+    // Leading NUL: no file, the name goes away with the socket
+    std::memcpy(addr->sun_path + 1, name.data(), length);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+
+//*******************************************************************************
+static inline bool trustedPeer(int unix_socket, int* pid)
+{
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    if (0 != ::getsockopt(unix_socket, SOL_SOCKET, SO_PEERCRED, &cred, &length)) {
+        return false;
+    }
+    *pid = cred.pid;
+    // The ring carries the audio, only share it with the same user
+    return ::getuid() == cred.uid || 0 == cred.uid;
+}
+
+
+//*******************************************************************************
+ShmChannel::ShmChannel() :
+    mReceiver(false), mListener(-1), mMemfd(-1), mConnection(-1),
+    mPeerPid(0), mPeerGone(false), mCorrupt(false), mAnnounced(false),
+    mHeader(NULL), mRing(NULL), mPosition(0),
+    mServeCount(0), mNextAttachNs(0), mFullSends(0), mDropped(0)
+{
+}
+
+
+//*******************************************************************************
+ShmChannel* ShmChannel::create(int udp_socket, bool receiver)
+{
+    struct sockaddr_in local;
+    struct sockaddr_in peer;
+    socklen_t local_length = sizeof(local);
+    socklen_t peer_length = sizeof(peer);
+    if (0 != ::getsockname(udp_socket, (struct sockaddr *) &local, &local_length)
+            || 0 != ::getpeername(udp_socket, (struct sockaddr *) &peer, &peer_length)
+            || AF_INET != local.sin_family || AF_INET != peer.sin_family) {
+        return NULL;
+    }
+    // Loopback, or our own address
+    if (127 != (ntohl(peer.sin_addr.s_addr) >> 24)
+            && local.sin_addr.s_addr != peer.sin_addr.s_addr) {
+        return NULL;
+    }
+
+    // Both ends name the ring after its sender, then its receiver
+    ShmChannel* channel = new ShmChannel();
+    channel->mReceiver = receiver;
+    channel->mName = "jacktrip-shm/" + (receiver ? endpointName(peer) + "/" + endpointName(local)
+                                                 : endpointName(local) + "/" + endpointName(peer));
+    if (!receiver && !channel->offer(channel->mName)) {
+        cerr << "Could not offer shared memory to the local peer, using UDP" << endl;
+        delete channel;
+        return NULL;
+    }
+    return channel;
+}
+
+
+//*******************************************************************************
+bool ShmChannel::offer(const std::string& name)
+{
+    size_t map_size = sizeof(Header) + sRingSize;
+    mMemfd = ::memfd_create("jacktrip-shm", MFD_CLOEXEC);
+    if (0 > mMemfd || 0 != ::ftruncate(mMemfd, map_size)) {
+        return false;
+    }
+    void* map = ::mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mMemfd, 0);
+    if (MAP_FAILED == map) {
+        return false;
+    }
+    mHeader = static_cast<Header*>(map);
+    mRing = reinterpret_cast<char*>(mHeader + 1);
+    mHeader->magic = sShmMagic;
+    mHeader->version = sShmVersion;
+    mHeader->size = sRingSize;
+    __atomic_store_n(&mHeader->state, sOffered, __ATOMIC_RELEASE);
+
+    mListener = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (0 > mListener) {
+        return false;
+    }
+    struct sockaddr_un addr;
+    socklen_t addr_length = abstractAddress(name, &addr);
+    if (0 != ::bind(mListener, (struct sockaddr *) &addr, addr_length)
+            || 0 != ::listen(mListener, 1)) {
+        return false;
+    }
+    return true;
+}
+
+
+//*******************************************************************************
+ShmChannel::~ShmChannel()
+{
+    if (NULL != mHeader) {
+        if (mReceiver) {
+            uint32_t expected = sAttached;
+            __atomic_compare_exchange_n(&mHeader->state, &expected, sOffered, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        } else {
+            // Wake the receiver so it sees the ring closed
+            __atomic_store_n(&mHeader->state, sClosed, __ATOMIC_SEQ_CST);
+            __atomic_fetch_add(&mHeader->wake, 1, __ATOMIC_SEQ_CST);
+            ::syscall(SYS_futex, &mHeader->wake, FUTEX_WAKE, 1, NULL, NULL, 0);
+        }
+        ::munmap(mHeader, sizeof(Header) + sRingSize);
+    }
+    if (0 <= mListener) { ::close(mListener); }
+    if (0 <= mMemfd) { ::close(mMemfd); }
+    if (0 <= mConnection) { ::close(mConnection); }
+}
+
+
+//*******************************************************************************
+bool ShmChannel::isAttached() const
+{
+    return NULL != mHeader && !mPeerGone
+            && sAttached == __atomic_load_n(&mHeader->state, __ATOMIC_ACQUIRE);
+}
+
+
+//*******************************************************************************
+void ShmChannel::serve()
+{
+    if (isAttached()) {
+        if (!mAnnounced) {
+            cout << "Sending to the local peer through shared memory" << endl;
+            mAnnounced = true;
+        }
+        return;
+    }
+    if (mAnnounced) {
+        cout << "Sending to the local peer through UDP again" << endl;
+        mAnnounced = false;
+    }
+    if (0 != mServeCount++ % sServeInterval) {
+        return;
+    }
+    int connection = ::accept4(mListener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (0 > connection) {
+        return;
+    }
+    int pid;
+    if (trustedPeer(connection, &pid)) {
+        char byte = 0;
+        struct iovec iov = {&byte, sizeof(byte)};
+        union {
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        std::memset(&control, 0, sizeof(control));
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &mMemfd, sizeof(int));
+        ::sendmsg(connection, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    ::close(connection);
+}
+
+
+//*******************************************************************************
+int ShmChannel::send(const Segment* segments, int count)
+{
+    if (!isAttached()) {
+        return -1;
+    }
+    size_t size = 0;
+    for (int i = 0; i < count; ++i) {
+        size += segments[i].size;
+    }
+    if (sMaxDatagram < size) {
+        return -1;
+    }
+    // Records never wrap, the end of the ring is skipped instead
+    size_t record = recordSize(size);
+    size_t offset = mPosition & (sRingSize - 1);
+    size_t skip = (sRingSize - offset < record) ? sRingSize - offset : 0;
+    uint64_t tail = __atomic_load_n(&mHeader->tail, __ATOMIC_ACQUIRE);
+    if (sRingSize < mPosition + skip + record - tail) {
+        ++mDropped;
+        if (sMaxFullSends <= ++mFullSends) {
+            // The receiver is gone or stuck, it can attach again later
+            uint32_t expected = sAttached;
+            __atomic_compare_exchange_n(&mHeader->state, &expected, sOffered, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+            mFullSends = 0;
+            return -1;
+        }
+        return size;
+    }
+    mFullSends = 0;
+    if (0 < skip) {
+        std::memcpy(mRing + offset, &sWrapLength, sizeof(uint32_t));
+        offset = 0;
+    }
+    uint32_t length = size;
+    std::memcpy(mRing + offset, &length, sizeof(length));
+    char* dst = mRing + offset + sizeof(length);
+    for (int i = 0; i < count; ++i) {
+        std::memcpy(dst, segments[i].data, segments[i].size);
+        dst += segments[i].size;
+    }
+    mPosition += skip + record;
+
+    // Paired with wait(): either the receiver sees the new head, or we see it waiting
+    __atomic_store_n(&mHeader->head, mPosition, __ATOMIC_SEQ_CST);
+    if (0 != __atomic_load_n(&mHeader->waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&mHeader->wake, 1, __ATOMIC_SEQ_CST);
+        ::syscall(SYS_futex, &mHeader->wake, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+    return size;
+}
+
+
+//*******************************************************************************
+bool ShmChannel::attach()
+{
+    if (NULL != mHeader) {
+        if (isAttached()) {
+            return false;
+        }
+        detach();
+    }
+    if (mCorrupt) {
+        return false;
+    }
+    int64_t now = monotonicNs();
+    if (now < mNextAttachNs) {
+        return false;
+    }
+    mNextAttachNs = now + sAttachIntervalNs;
+
+    if (0 > mConnection) {
+        // Refused right away if the peer offers no ring, e.g., an older JackTrip
+        mConnection = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (0 > mConnection) {
+            return false;
+        }
+        struct sockaddr_un addr;
+        socklen_t addr_length = abstractAddress(mName, &addr);
+        if (0 != ::connect(mConnection, (struct sockaddr *) &addr, addr_length)
+                || !trustedPeer(mConnection, &mPeerPid)) {
+            ::close(mConnection);
+            mConnection = -1;
+            return false;
+        }
+    }
+
+    // The sender answers within a few periods
+    char byte;
+    struct iovec iov = {&byte, sizeof(byte)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t n = ::recvmsg(mConnection, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (0 > n && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+        return false;
+    }
+    int fd = -1;
+    struct cmsghdr* cmsg = (0 < n) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (NULL != cmsg && SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+        std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    ::close(mConnection);
+    mConnection = -1;
+    if (0 > fd) {
+        return false;
+    }
+
+    size_t map_size = sizeof(Header) + sRingSize;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (0 == ::fstat(fd, &st) && map_size == static_cast<size_t>(st.st_size)) {
+        map = ::mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    ::close(fd);
+    if (MAP_FAILED == map) {
+        cerr << "The shared memory of the local peer doesn't match, using UDP" << endl;
+        return false;
+    }
+    Header* header = static_cast<Header*>(map);
+    if (sShmMagic != header->magic || sShmVersion != header->version || sRingSize != header->size) {
+        cerr << "The shared memory of the local peer doesn't match, using UDP" << endl;
+        ::munmap(map, map_size);
+        return false;
+    }
+
+    // Skip whatever a previous receiver left, the sender only writes once attached
+    mPosition = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&header->tail, mPosition, __ATOMIC_RELEASE);
+    uint32_t expected = sOffered;
+    if (!__atomic_compare_exchange_n(&header->state, &expected, sAttached, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        ::munmap(map, map_size);
+        return false;
+    }
+    mHeader = header;
+    mRing = reinterpret_cast<char*>(header + 1);
+    mPeerGone = false;
+    cout << "Receiving from the local peer through shared memory" << endl;
+    return true;
+}
+
+
+//*******************************************************************************
+void ShmChannel::detach()
+{
+    uint32_t expected = sAttached;
+    __atomic_compare_exchange_n(&mHeader->state, &expected, sOffered, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    ::munmap(mHeader, sizeof(Header) + sRingSize);
+    mHeader = NULL;
+    mRing = NULL;
+    mPeerGone = false;
+    cout << "Receiving from the local peer through UDP again" << endl;
+}
+
+
+//*******************************************************************************
+bool ShmChannel::available() const
+{
+    return NULL != mHeader && !mPeerGone
+            && mPosition != __atomic_load_n(&mHeader->head, __ATOMIC_ACQUIRE);
+}
+
+
+//*******************************************************************************
+bool ShmChannel::wait(int timeout_usec)
+{
+    if (NULL == mHeader || available()) {
+        return available();
+    }
+    // Paired with send(): either we see the new head, or it sees us waiting
+    uint32_t wake = __atomic_load_n(&mHeader->wake, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&mHeader->waiting, 1, __ATOMIC_SEQ_CST);
+    if (mPosition == __atomic_load_n(&mHeader->head, __ATOMIC_SEQ_CST)
+            && sClosed != __atomic_load_n(&mHeader->state, __ATOMIC_ACQUIRE)) {
+        struct timespec timeout;
+        timeout.tv_sec = timeout_usec / 1000000;
+        timeout.tv_nsec = (timeout_usec % 1000000) * 1000;
+        ::syscall(SYS_futex, &mHeader->wake, FUTEX_WAIT, wake, &timeout, NULL, 0);
+    }
+    __atomic_store_n(&mHeader->waiting, 0, __ATOMIC_RELAXED);
+    if (available()) {
+        return true;
+    }
+    // A sender that crashed never closes the ring
+    if (0 < mPeerPid && 0 != ::kill(mPeerPid, 0) && ESRCH == errno) {
+        mPeerGone = true;
+    }
+    return false;
+}
+
+
+//*******************************************************************************
+int ShmChannel::receive(const Segment* segments, int count, bool peek)
+{
+    if (!available()) {
+        return -1;
+    }
+    // The peer process can write anything in the ring, check the record
+    // before trusting its length
+    uint64_t head = __atomic_load_n(&mHeader->head, __ATOMIC_ACQUIRE);
+    uint64_t position = mPosition;
+    if (sRingSize < head - position) {
+        return fail("head out of the ring");
+    }
+    uint32_t length;
+    std::memcpy(&length, mRing + (position & (sRingSize - 1)), sizeof(length));
+    if (sWrapLength == length) {
+        position += sRingSize - (position & (sRingSize - 1));
+        if (head - mPosition < position - mPosition) {
+            return fail("wrap past the head");
+        }
+        std::memcpy(&length, mRing, sizeof(length));
+    }
+    size_t offset = position & (sRingSize - 1);
+    if (sMaxDatagram < length || sRingSize - offset < recordSize(length)
+            || head - position < recordSize(length)) {
+        return fail("bad datagram length");
+    }
+    const char* src = mRing + offset + sizeof(length);
+    size_t copied = 0;
+    for (int i = 0; i < count && copied < length; ++i) {
+        size_t n = std::min<size_t>(segments[i].size, length - copied);
+        std::memcpy(segments[i].data, src + copied, n);
+        copied += n;
+    }
+    if (!peek) {
+        mPosition = position + recordSize(length);
+        __atomic_store_n(&mHeader->tail, mPosition, __ATOMIC_RELEASE);
+    }
+    return copied;
+}
+
+
+//*******************************************************************************
+int ShmChannel::fail(const char* reason)
+{
+    cerr << "The shared memory of the local peer is corrupt (" << reason << ")" << endl;
+    mCorrupt = true;
+    detach();
+    return -1;
+}
+
+#else // __LINUX__
+
+//*******************************************************************************
+ShmChannel* ShmChannel::create(int /*udp_socket*/, bool /*receiver*/)
+{
+    // Nothing to negotiate, the session stays on UDP
+    return NULL;
+}
+
+ShmChannel::~ShmChannel() {}
+bool ShmChannel::isAttached() const { return false; }
+void ShmChannel::serve() {}
+int ShmChannel::send(const Segment* /*segments*/, int /*count*/) { return -1; }
+bool ShmChannel::attach() { return false; }
+bool ShmChannel::available() const { return false; }
+bool ShmChannel::wait(int /*timeout_usec*/) { return false; }
+int ShmChannel::receive(const Segment* /*segments*/, int /*count*/, bool /*peek*/) { return -1; }
+
+#endif // __LINUX__
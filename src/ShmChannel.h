@@ -0,0 +1,144 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file ShmChannel.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __SHMCHANNEL_H__
+#define __SHMCHANNEL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/** \brief Shared memory ring that carries the datagrams of one direction of a
+ * UDP session when both peers run on the same host (Linux only)
+ *
+ * The sender creates a memfd with a single-producer single-consumer ring and
+ * offers it on an abstract Unix socket named after the two UDP endpoints.
+ * The receiver of the other instance, once it gets datagrams through the
+ * socket, connects to that name and gets the memfd with SCM_RIGHTS. When it
+ * marks the ring attached, the sender writes the datagrams there instead of
+ * the socket: one copy in, one copy out, no network stack in between. A peer
+ * without shared memory never connects, so the session just stays on UDP.
+ *
+ * The receiver sleeps on a futex in the ring, which the sender only wakes when
+ * the receiver said it was about to sleep. If either end goes away the ring is
+ * given up and the datagrams go back to the socket.
+ *
+ * Each end of the ring belongs to the thread that uses it.
+ */
+class ShmChannel
+{
+public:
+
+    /// \brief Piece of a datagram, to gather or scatter it
+    struct Segment {
+        char* data;
+        size_t size;
+    };
+
+    /** \brief Sets up one end of the ring for a connected UDP socket
+     * \param udp_socket Connected IPv4 UDP socket
+     * \param receiver Attach to the peer's ring, otherwise offer one
+     * \return NULL if the peer is not on this host, or if the ring can't be set up
+     */
+    static ShmChannel* create(int udp_socket, bool receiver);
+    virtual ~ShmChannel();
+
+    /// \brief True while the datagrams go through the ring
+    bool isAttached() const;
+
+    /// \brief Hands the ring to a waiting receiver, call once per period
+    void serve();
+    /** \brief Gathers segments into the ring
+     * \return Bytes written (also when the ring is full and the datagram is
+     * dropped), -1 if it has to go through the socket instead
+     */
+    int send(const Segment* segments, int count);
+    /// \brief Datagrams dropped because the receiver didn't keep up
+    uint64_t getDropped() const { return mDropped; }
+
+    /** \brief Tries to attach to the peer's ring, at most every sAttachIntervalNs
+     * \return true when it has just been attached
+     */
+    bool attach();
+    /// \brief True if a datagram is waiting in the ring, without a syscall
+    bool available() const;
+    /// \brief Blocks until a datagram is written or timeout_usec pass, returns available()
+    bool wait(int timeout_usec);
+    /** \brief Scatters the next datagram of the ring into segments
+     * \param peek Leave the datagram for the next call
+     * \return Bytes copied, -1 if there was no datagram
+     */
+    int receive(const Segment* segments, int count, bool peek = false);
+    int receive(char* buf, size_t n)
+    { Segment segment = {buf, n}; return receive(&segment, 1); }
+
+private:
+    struct Header;
+
+    static const size_t sRingSize = 1 << 20; ///< Bytes, a power of 2
+    static const size_t sMaxDatagram = 0x10000;
+    static const int sServeInterval = 64; ///< Periods between looking for a receiver
+    static const int64_t sAttachIntervalNs = 200000000;
+    static const int sMaxFullSends = 256; ///< Drops in a row before giving up on the receiver
+
+    ShmChannel();
+    bool offer(const std::string& name);
+    void detach();
+    /// \brief Gives up on a ring with a bad record, returns -1 for receive()
+    int fail(const char* reason);
+
+    bool mReceiver;
+    std::string mName; ///< Abstract socket name, without the leading NUL
+    int mListener; ///< Sender: socket that offers the ring
+    int mMemfd; ///< Sender: the ring, handed to the receiver
+    int mConnection; ///< Receiver: connection waiting for the ring
+    int mPeerPid;
+    bool mPeerGone;
+    bool mCorrupt; ///< The peer wrote a bad record, stay on UDP for the rest of the session
+    bool mAnnounced;
+
+    Header* mHeader;
+    char* mRing;
+    uint64_t mPosition; ///< Head for the sender, tail for the receiver
+
+    int mServeCount;
+    int64_t mNextAttachNs;
+    int mFullSends;
+    uint64_t mDropped;
+};
+
+#endif // __SHMCHANNEL_H__
@@ -0,0 +1,260 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file StatsSegment.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "StatsSegment.h"
+
+#include <cstring>
+
+static_assert(sizeof(StatsSegment::Header) <= 64, "Header must fit before the slots");
+
+#if defined (__LINUX__)
+
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char* sDirectory = "/dev/shm";
+static const char* sPrefix = "jacktrip-stats.";
+static const size_t sSlotsOffset = 64;
+
+//*******************************************************************************
+static std::string segmentPath(int pid)
+{
+    return std::string(sDirectory) + "/" + sPrefix + std::to_string(pid);
+}
+
+
+//*******************************************************************************
+static size_t segmentSize()
+{
+    return sSlotsOffset + StatsSegment::sMaxSessions * sizeof(StatsSegment::Slot);
+}
+
+
+//*******************************************************************************
+StatsSegment* StatsSegment::create()
+{
+    std::string path = segmentPath(::getpid());
+    size_t size = segmentSize();
+    // Left over by a crashed process with the same pid
+    ::unlink(path.c_str());
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+    if (0 > fd) {
+        return NULL;
+    }
+    void* mapping = MAP_FAILED;
+    if (0 == ::ftruncate(fd, size)) {
+        mapping = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (MAP_FAILED == mapping) {
+        ::unlink(path.c_str());
+        return NULL;
+    }
+
+    // ftruncate() zeroed the slots, so they are all free with an even sequence
+    StatsSegment* segment = new StatsSegment(mapping, size, path, true);
+    Header* header = segment->mHeader;
+    header->version = sVersion;
+    header->maxSessions = sMaxSessions;
+    header->slotSize = sizeof(Slot);
+    header->pid = ::getpid();
+    // Readers check the magic last
+    __atomic_store_n(&header->magic, sMagic, __ATOMIC_RELEASE);
+    return segment;
+}
+
+
+//*******************************************************************************
+StatsSegment* StatsSegment::open(int pid)
+{
+    std::string path = segmentPath(pid);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (0 > fd) {
+        return NULL;
+    }
+    struct stat st;
+    size_t size = segmentSize();
+    void* mapping = MAP_FAILED;
+    if (0 == ::fstat(fd, &st) && size == static_cast<size_t>(st.st_size)) {
+        mapping = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (MAP_FAILED == mapping) {
+        return NULL;
+    }
+    const Header* header = static_cast<const Header*>(mapping);
+    if (sMagic != __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)
+            || sVersion != header->version || sMaxSessions != (int)header->maxSessions
+            || sizeof(Slot) != header->slotSize) {
+        ::munmap(mapping, size);
+        return NULL;
+    }
+    return new StatsSegment(mapping, size, path, false);
+}
+
+
+//*******************************************************************************
+std::vector<int> StatsSegment::list()
+{
+    std::vector<int> pids;
+    DIR* dir = ::opendir(sDirectory);
+    if (NULL == dir) {
+        return pids;
+    }
+    size_t prefix_length = std::strlen(sPrefix);
+    while (struct dirent* entry = ::readdir(dir)) {
+        if (0 == std::strncmp(entry->d_name, sPrefix, prefix_length)) {
+            int pid = std::atoi(entry->d_name + prefix_length);
+            if (0 < pid) {
+                pids.push_back(pid);
+            }
+        }
+    }
+    ::closedir(dir);
+    return pids;
+}
+
+
+//*******************************************************************************
+StatsSegment::StatsSegment(void* mapping, size_t size, const std::string& path, bool owner) :
+    mMapping(mapping),
+    mSize(size),
+    mPath(path),
+    mOwner(owner),
+    mHeader(static_cast<Header*>(mapping))
+{
+}
+
+
+//*******************************************************************************
+StatsSegment::~StatsSegment()
+{
+    ::munmap(mMapping, mSize);
+    if (mOwner) {
+        ::unlink(mPath.c_str());
+    }
+}
+
+#else // __LINUX__
+
+//*******************************************************************************
+StatsSegment* StatsSegment::create() { return NULL; }
+StatsSegment* StatsSegment::open(int /*pid*/) { return NULL; }
+std::vector<int> StatsSegment::list() { return std::vector<int>(); }
+
+StatsSegment::StatsSegment(void* mapping, size_t size, const std::string& path, bool owner) :
+    mMapping(mapping), mSize(size), mPath(path), mOwner(owner),
+    mHeader(static_cast<Header*>(mapping)) {}
+StatsSegment::~StatsSegment() {}
+
+static const size_t sSlotsOffset = 64;
+
+#endif // __LINUX__
+
+
+//*******************************************************************************
+StatsSegment::Slot* StatsSegment::getSlot(int slot) const
+{
+    return reinterpret_cast<Slot*>(static_cast<char*>(mMapping) + sSlotsOffset) + slot;
+}
+
+
+//*******************************************************************************
+int StatsSegment::acquireSlot()
+{
+    for (int i = 0; i < sMaxSessions; ++i) {
+        uint32_t free_slot = 0;
+        if (getSlot(i)->inUse.compare_exchange_strong(free_slot, 1)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+//*******************************************************************************
+void StatsSegment::releaseSlot(int slot)
+{
+    if (0 <= slot && sMaxSessions > slot) {
+        // So that the next session doesn't show our numbers before its first publish()
+        SessionStats empty;
+        std::memset(&empty, 0, sizeof(empty));
+        publish(slot, empty);
+        getSlot(slot)->inUse.store(0, std::memory_order_release);
+    }
+}
+
+
+//*******************************************************************************
+void StatsSegment::publish(int slot, const SessionStats& stats)
+{
+    Slot* s = getSlot(slot);
+    uint32_t sequence = s->sequence.load(std::memory_order_relaxed);
+    s->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&s->stats, &stats, sizeof(stats));
+    s->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+//*******************************************************************************
+bool StatsSegment::read(int slot, SessionStats* stats) const
+{
+    const Slot* s = getSlot(slot);
+    for (int tries = 0; tries < 100; ++tries) {
+        if (0 == s->inUse.load(std::memory_order_acquire)) {
+            return false;
+        }
+        uint32_t before = s->sequence.load(std::memory_order_acquire);
+        if (0 != (before & 1)) {
+            continue;
+        }
+        std::memcpy(stats, &s->stats, sizeof(*stats));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (before == s->sequence.load(std::memory_order_relaxed)) {
+            // Not published yet
+            return 0 != stats->updatedUs;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,147 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file StatsSegment.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __STATSSEGMENT_H__
+#define __STATSSEGMENT_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** \brief Shared memory segment with the live statistics of every session of
+ * a process, for jacktrip-top (Linux only)
+ *
+ * The segment is a file in /dev/shm named after the process id, made of a
+ * Header and sMaxSessions slots. Each session takes a slot with
+ * acquireSlot(), and its stat timer (never the audio thread) copies a snapshot
+ * in with publish(), under a seqlock: the sequence number is odd while the
+ * slot is being written, and readers retry until they see the same even number
+ * before and after their copy. Writers never wait for readers, and there is
+ * no lock, no system call and no formatting on the write path.
+ *
+ * Bump sVersion whenever the layout changes, readers skip the other versions.
+ */
+class StatsSegment
+{
+public:
+
+    static const uint32_t sMagic = 0x5453544a; ///< "JTST"
+    static const uint32_t sVersion = 1;
+    static const int sMaxSessions = 256;
+
+    /// \brief p50/p99/p99.9/max of a LatencyHistogram over the last stat interval
+    struct Tails {
+        uint64_t p50;
+        uint64_t p99;
+        uint64_t p999;
+        uint64_t max;
+    };
+
+    /// \brief Plain copy of the statistics of one session, the counters are totals
+    struct SessionStats {
+        char session[16];
+        char peer[64];
+        char client[64];
+        uint64_t updatedUs; ///< Wall clock of the last publish(), in us since the epoch
+        uint64_t packets;
+        uint64_t lost;
+        uint64_t outOfOrder;
+        uint64_t revived;
+        uint64_t underruns;
+        uint64_t overflows;
+        uint64_t bufIncUnderrun;
+        uint64_t bufIncCompensate;
+        uint64_t bufDecOverflows;
+        uint64_t bufDecPktLoss;
+        int64_t queueLevel; ///< Receive buffer level, in slots
+        int64_t skew;
+        Tails callback; ///< Audio callback duration, us
+        Tails arrival; ///< Datagram inter-arrival time, us
+        Tails level; ///< Receive buffer level when read, frames
+        Tails wakeup; ///< Send thread wakeup latency, us
+        Tails age; ///< Packet age at arrival, us
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t maxSessions;
+        uint32_t slotSize; ///< sizeof(Slot), as a second check of the layout
+        int32_t pid;
+        uint32_t reserved;
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> sequence; ///< Odd while publish() writes the slot
+        std::atomic<uint32_t> inUse;
+        SessionStats stats;
+    };
+
+    /// \brief Creates the segment of this process, returns NULL if it can't
+    static StatsSegment* create();
+    /// \brief Maps the segment of another process read-only, returns NULL if
+    /// it doesn't exist or has another layout version
+    static StatsSegment* open(int pid);
+    /// \brief Process ids that have a segment, dead or alive
+    static std::vector<int> list();
+    /// \brief Unmaps the segment, and removes it if this process created it
+    virtual ~StatsSegment();
+
+    int getPid() const { return mHeader->pid; }
+
+    /// \brief Takes a free slot for a session, -1 if they are all in use, thread safe
+    int acquireSlot();
+    void releaseSlot(int slot);
+    /// \brief Copies a snapshot in the slot, only from the thread that owns it
+    void publish(int slot, const SessionStats& stats);
+    /// \brief Consistent copy of a slot, false if it is free, not published yet or keeps changing
+    bool read(int slot, SessionStats* stats) const;
+
+private:
+    StatsSegment(void* mapping, size_t size, const std::string& path, bool owner);
+    Slot* getSlot(int slot) const;
+
+    void* mMapping;
+    size_t mSize;
+    std::string mPath;
+    bool mOwner;
+    Header* mHeader;
+};
+
+#endif // __STATSSEGMENT_H__
@@ -38,14 +38,28 @@
 #include "UdpDataProtocol.h"
 #include "jacktrip_globals.h"
 #include "JackTrip.h"
+#include "ParityFec.h"
+#include "PacketHeaderCodec.h"
+#include "PacketFragments.h"
+#include "LosslessCodec.h"
+#include "OpusCodec.h"
+#include "XdpSocket.h"
+#include "IoUringSocket.h"
+#include "ShmChannel.h"
+#include "PacketTrace.h"
+#include "LatencyHistogram.h"
 
 #include <QHostInfo>
 
 #include <cstring>
+#include <cassert>
 #include <iostream>
 #include <cstdlib>
 #include <cerrno>
+#include <cmath>
 #include <stdexcept>
+#include <chrono>
+#include <thread>
 #ifdef __WIN_32__
 //#include <winsock.h>
 #include <winsock2.h> //cc need SD_SEND
@@ -53,12 +67,45 @@
 #endif
 #if defined (__LINUX__) || (__MAC_OSX__)
 #include <sys/socket.h> // for POSIX Sockets
+#include <sys/uio.h> // for scattered I/O
 #include <unistd.h>
 #include <sys/fcntl.h>
 #endif
+#if defined (__LINUX__)
+#include <time.h>
+#include <linux/errqueue.h> // for scm_timestamping
+#include <linux/net_tstamp.h>
+#ifndef SO_TXTIME // Older C library headers
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+#endif
 
 using std::cout; using std::endl;
 
+//*******************************************************************************
+// True if no sample of the audio goes over the threshold
+static inline bool isSilentAudio(const int8_t* audio, int num_samples, int sample_size,
+                                 AudioInterface::audioBitResolutionT bit_res, sample_t threshold)
+{
+    for (int i = 0; i < num_samples; ++i) {
+        sample_t value;
+        AudioInterface::fromBitToSampleConversion(audio + i*sample_size, &value, bit_res);
+        if (std::fabs(value) > threshold) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//*******************************************************************************
+// steady_clock is CLOCK_MONOTONIC on Linux, the clock SO_TXTIME is set to
+static inline int64_t monotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 // NOTE: It's better not to use
 // using namespace std;
 // because some functions (like exit()) get confused with QT functions
@@ -75,8 +122,30 @@ UdpDataProtocol::UdpDataProtocol(JackTrip* jacktrip, const runModeT runmode,
     mRunMode(runmode),
     mAudioPacket(NULL), mFullPacket(NULL),
     mUdpRedundancyFactor(udp_redundancy_factor),
+    mFecGroupSize(0), mFecParityCount(0),
+    mFec(NULL), mFecNextSeq(0), mFecPendingGap(0),
+    mAggregation(1), mAggregateCount(0),
+    mMtu(0), mFragments(NULL), mFragmentPendingGap(0),
+    mLossless(false), mLosslessCodec(NULL),
+    mOpusBitrate(0), mOpusComplexity(0), mOpus(NULL),
+    mDtxThreshold(-1.0), mDtxSilentCount(0),
+    mDtxAudioCount(0), mDtxMarkerCount(0), mDtxMaxMarkers(1), mSilentSlotSize(0),
+    mRxTimestamps(false), mRxHwTimestamps(false), mRxTimestampValid(false),
+    mRxNetworkTime(0), mRxPeriodNs(0.0),
+    mJitterStarted(false), mJitterLastTime(0), mJitterLastSeq(0), mNetJitterNs(0.0),
+    mPacing(NOPACING), mPacingIntervalNs(0.0), mPacingLastNs(0), mTxTimeNs(0),
+    mXdp(NULL), mIoUring(false), mUring(NULL),
+    mSharedMemory(false), mShm(NULL), mShmIdle(false),
+    mPacketTrace(NULL),
+    mArrivalHistogram(NULL), mAgeHistogram(NULL), mLastArrivalUs(0),
+    mAdaptiveMin(udp_redundancy_factor), mAdaptiveMax(0),
+    mAdaptiveRedundancy(udp_redundancy_factor),
+    mHavePeerFeedback(false), mQuietFeedbackCount(0),
+    mLatencyProbe(false),
+    mDatagramCodec(false),
     mControlPacketSize(63),
-    mStopSignalSent(false)
+    mStopSignalSent(false),
+    mImpairment(NULL)
 {
     mStopped = false;
     mIPv6 = false;
@@ -89,9 +158,17 @@ UdpDataProtocol::UdpDataProtocol(JackTrip* jacktrip, const runModeT runmode,
         QObject::connect(this, SIGNAL(signalWaitingTooLong(int)),
                          jacktrip, SLOT(slotUdpWaitingTooLongClientGoneProbably(int)), Qt::QueuedConnection);
     }
-    mSimulatedLossRate = 0.0;
-    mSimulatedJitterRate = 0.0;
-    mSimulatedJitterMaxDelay = 0.0;
+    mNetTotCount = 0;
+    mNetLostCount = 0;
+    mNetOutOfOrderCount = 0;
+    mPeerCapabilities = 0;
+    mEchoOrigUs = 0;
+    mEchoRxUs = 0;
+    mRoundTripUs = 0;
+    mNetJitterUs = 0;
+    mHostDelaySumNs = 0;
+    mHostDelayCount = 0;
+    mHostDelayMaxNs = 0;
 }
 
 
@@ -100,6 +177,13 @@ UdpDataProtocol::~UdpDataProtocol()
 {
     delete[] mAudioPacket;
     delete[] mFullPacket;
+    delete mFec;
+    delete mFragments;
+    delete mLosslessCodec;
+    OpusCodec::release(mOpus);
+    delete mShm;
+    delete mPacketTrace;
+    delete mImpairment;
     if (mRunMode == RECEIVER) {
 #ifdef __WIN_32__
         closesocket(mSocket);
@@ -108,6 +192,8 @@ UdpDataProtocol::~UdpDataProtocol()
 #endif
     }
     wait();
+    // run() closes it on its own thread, the only one that can submit to it
+    assert(NULL == mUring);
 }
 
 
@@ -334,14 +420,40 @@ int UdpDataProtocol::receivePacket(char* buf, const size_t n)
 {
     // Block until There's something to read
     while ( !datagramAvailable() && !mStopped ) {
-        QThread::usleep(100);
+        waitForDatagram(10000);
+    }
+    // Header types with a datagram codec and lossless datagrams are received
+    // in mDatagram and expanded into buf below
+    char* recv_buf = buf;
+    size_t recv_size = n;
+    if (mDatagramCodec || mLossless) {
+        recv_buf = reinterpret_cast<char*>(mDatagram.data());
+        recv_size = mDatagram.size();
+    }
+    int n_bytes;
+    if (NULL != mImpairment) {
+        if (mStopped) {
+            return 0;
+        }
+        // The release time stands for the arrival time in the jitter statistics
+        mRxNetworkTime = mImpairment->getReleaseNs();
+        mRxTimestampValid = mRxTimestamps;
+        n_bytes = mImpairment->receive(recv_buf, recv_size);
+    } else {
+        n_bytes = receiveDatagram(recv_buf, recv_size);
+    }
+    if (NULL != mArrivalHistogram && 0 < n_bytes) {
+        uint64_t now_us = LatencyHistogram::nowUs();
+        if (0 != mLastArrivalUs) {
+            mArrivalHistogram->record(now_us - mLastArrivalUs);
+        }
+        mLastArrivalUs = now_us;
     }
-    int n_bytes = ::recv(mSocket, buf, n, 0);
     if (n_bytes == mControlPacketSize) {
         //Control signal (currently just check for exit packet);
         bool exit = true;
         for (int i = 0; i < mControlPacketSize; i++) {
-            if (buf[i] != char(0xff)) {
+            if (recv_buf[i] != char(0xff)) {
                 exit = false;
                 i = mControlPacketSize;
             }
@@ -351,12 +463,356 @@ int UdpDataProtocol::receivePacket(char* buf, const size_t n)
             emit signalCeaseTransmission("Peer Stopped");
             std::cout << "Peer Stopped" <<std::endl;
         }
-        return 0;
+        // Compact, lossless and Opus datagrams can have the size of a control packet
+        if (exit || !(mDatagramCodec || mLossless || 0 < mOpusBitrate)) {
+            return 0;
+        }
+    }
+    if (0 < mAdaptiveMax && n_bytes == sizeof(LossFeedbackPacket)) {
+        LossFeedbackPacket packet;
+        std::memcpy(&packet, recv_buf, sizeof(packet));
+        if (sLossFeedbackMagic == packet.Magic) {
+            LossFeedback feedback = {packet.Tot, packet.Lost, packet.OutOfOrder};
+            mJackTrip->setPeerLossFeedback(feedback);
+            return 0;
+        }
+    }
+    if (n_bytes == sizeof(TimestampEchoPacket)) {
+        TimestampEchoPacket packet;
+        std::memcpy(&packet, recv_buf, sizeof(packet));
+        if (sEchoRequestMagic == packet.Magic) {
+            // Answered by our send thread, which owns the socket for sending
+            mJackTrip->setPeerEchoRequest(packet.OrigUs, LatencyHistogram::nowUs());
+            return 0;
+        }
+        if (sEchoReplyMagic == packet.Magic) {
+            uint64_t now_us = LatencyHistogram::nowUs();
+            // Drop nonsense, e.g. the answer to a request of an earlier session
+            if (packet.OrigUs + packet.HoldUs <= now_us
+                    && now_us - packet.OrigUs - packet.HoldUs < 10000000) {
+                uint32_t rtt = now_us - packet.OrigUs - packet.HoldUs;
+                uint32_t srtt = mRoundTripUs;
+                // Same smoothing as the TCP round trip estimate (RFC 6298)
+                mRoundTripUs = (0 == srtt) ? rtt : srtt + (int32_t(rtt - srtt) / 8);
+            }
+            return 0;
+        }
+    }
+    if (isDtxPacket(reinterpret_cast<int8_t*>(recv_buf), n_bytes)) {
+        // Only the redundancy algorithm plays them, the others can't be
+        // combined with --dtx
+        if (NULL != mFec || NULL != mOpus || NULL != mFragments) {
+            return 0;
+        }
+        if (recv_buf != buf) {
+            std::memcpy(buf, recv_buf, n_bytes);
+        }
+        return n_bytes;
+    }
+    if (mDatagramCodec && 0 < n_bytes) {
+        // Parity packets are XORs of the expanded packets and fragments are
+        // cut from them, they are not compacted
+        if (isParityDatagram(mDatagram.data(), n_bytes)
+                || (0 < mMtu && PacketFragments::isFragment(mDatagram.data(), n_bytes))) {
+            std::memcpy(buf, recv_buf, qMin(static_cast<size_t>(n_bytes), n));
+            return n_bytes;
+        }
+        n_bytes = mJackTrip->decodeDatagram(mDatagram.data(), n_bytes,
+                                            reinterpret_cast<int8_t*>(buf), n);
+        // Not decodable (yet), e.g., its static block was lost
+        if (0 > n_bytes) {
+            return 0;
+        }
+    } else if (mLossless && 0 < n_bytes) {
+        // Parity packets are XORs of the uncoded packets; the sender also
+        // sends the datagrams that don't compress uncoded, so anything without
+        // the magic is taken as it is
+        if (isParityDatagram(mDatagram.data(), n_bytes)
+                || !LosslessCodec::isLosslessDatagram(mDatagram.data(), n_bytes)) {
+            std::memcpy(buf, recv_buf, qMin(static_cast<size_t>(n_bytes), n));
+            return n_bytes;
+        }
+        n_bytes = mLosslessCodec->decodeDatagram(mDatagram.data(), n_bytes,
+                                                 reinterpret_cast<int8_t*>(buf), n);
+        if (0 > n_bytes) {
+            return 0;
+        }
+    }
+    return n_bytes;
+}
+
+
+//*******************************************************************************
+int UdpDataProtocol::receiveDatagram(char* buf, size_t n)
+{
+    if (NULL != mShm && mShm->available()) {
+        return mShm->receive(buf, n);
+    }
+    if (NULL != mXdp && mXdp->available()) {
+        return mXdp->receive(buf, n);
+    }
+#if defined (__LINUX__)
+    if (NULL != mUring) {
+        return receiveUring(buf, n);
+    }
+    return mRxTimestamps ? receiveTimestamped(buf, n) : ::recv(mSocket, buf, n, 0);
+#else
+    return ::recv(mSocket, buf, n, 0);
+#endif
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::impairArrivals()
+{
+    while (transportAvailable()) {
+        int n_bytes = receiveDatagram(mImpairmentBuffer.data(), mImpairmentBuffer.size());
+        if (0 >= n_bytes) {
+            return;
+        }
+        bool control = (n_bytes == mControlPacketSize);
+        for (int i = 0; control && i < n_bytes; ++i) {
+            control = (char(0xff) == mImpairmentBuffer[i]);
+        }
+        mImpairment->push(mImpairmentBuffer.data(), n_bytes, monotonicNs(), !control);
+    }
+}
+
+
+#if defined (__LINUX__)
+//*******************************************************************************
+static inline int64_t timespecToNs(const struct timespec& ts)
+{
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+//*******************************************************************************
+union TxTimeControl {
+    char buf[CMSG_SPACE(sizeof(uint64_t))];
+    struct cmsghdr align;
+};
+
+static inline void addTxTime(struct msghdr* msg, TxTimeControl* control, int64_t txtime)
+{
+    msg->msg_control = control->buf;
+    msg->msg_controllen = sizeof(control->buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    uint64_t time = txtime;
+    std::memcpy(CMSG_DATA(cmsg), &time, sizeof(time));
+}
+
+
+//*******************************************************************************
+// Queues a datagram on the io_uring, with its departure time if txtime isn't negative
+static inline int sendUring(IoUringSocket* uring, const IoUringSocket::Segment* segments, int count,
+                            struct sockaddr_in6* peer_addr6, int64_t txtime)
+{
+    IoUringSocket::Segment name = {reinterpret_cast<char*>(peer_addr6), sizeof(*peer_addr6)};
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    TxTimeControl control;
+    IoUringSocket::Segment control_segment = {control.buf, 0};
+    if (0 <= txtime) {
+        addTxTime(&msg, &control, txtime);
+        control_segment.size = msg.msg_controllen;
+    }
+    return uring->send(segments, count, (NULL == peer_addr6) ? NULL : &name, &control_segment);
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::enableRxTimestamps()
+{
+    // The NIC only stamps the datagrams once its filter is on (SIOCSHWTSTAMP,
+    // e.g., hwstamp_ctl -r 1), we get software timestamps until then
+    int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE
+            | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (0 == ::setsockopt(mSocket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags))) {
+        mRxTimestamps = true;
+    } else {
+        int one = 1;
+        mRxTimestamps = (0 == ::setsockopt(mSocket, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)));
+    }
+    if (!mRxTimestamps) {
+        cout << "Kernel receive timestamps are not available, no jitter measurements" << endl;
+    }
+}
+
+
+//*******************************************************************************
+union RxTimestampControl {
+    char buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct cmsghdr align;
+};
+
+
+//*******************************************************************************
+int UdpDataProtocol::receiveTimestamped(char* buf, size_t n)
+{
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = n;
+    RxTimestampControl control;
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    int n_bytes = ::recvmsg(mSocket, &msg, 0);
+    if (0 < n_bytes) {
+        readRxTimestamps(&msg);
+    }
+    return n_bytes;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::readRxTimestamps(struct msghdr* msg)
+{
+    int64_t software = 0;
+    int64_t hardware = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); NULL != cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (SOL_SOCKET != cmsg->cmsg_level) {
+            continue;
+        }
+        if (SCM_TIMESTAMPING == cmsg->cmsg_type) {
+            struct scm_timestamping stamps;
+            std::memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            software = timespecToNs(stamps.ts[0]);
+            hardware = timespecToNs(stamps.ts[2]);
+        } else if (SCM_TIMESTAMPNS == cmsg->cmsg_type) {
+            struct timespec stamp;
+            std::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            software = timespecToNs(stamp);
+        }
+    }
+
+    // The software timestamp shares our clock, the delay until now is our own
+    if (0 != software) {
+        struct timespec now;
+        ::clock_gettime(CLOCK_REALTIME, &now);
+        int64_t delay = timespecToNs(now) - software;
+        if (0 <= delay && 0xffffffff > delay) {
+            mHostDelaySumNs += delay;
+            ++mHostDelayCount;
+            if (mHostDelayMaxNs < delay) {
+                mHostDelayMaxNs = delay;
+            }
+        }
+    }
+    // The hardware timestamp leaves out the interrupt and softirq delays too,
+    // don't mix it with software ones once the NIC has sent one
+    if (0 != hardware && !mRxHwTimestamps) {
+        mRxHwTimestamps = true;
+        mJitterStarted = false;
+        cout << "Using hardware receive timestamps" << endl;
+    }
+    mRxNetworkTime = mRxHwTimestamps ? hardware : software;
+    mRxTimestampValid = (0 != mRxNetworkTime);
+}
+
+
+//*******************************************************************************
+int UdpDataProtocol::receiveUring(char* buf, size_t n)
+{
+    IoUringSocket::Segment segment = {buf, n};
+    if (!mRxTimestamps) {
+        return mUring->receive(&segment, 1);
+    }
+    RxTimestampControl control;
+    IoUringSocket::Segment control_segment = {control.buf, sizeof(control.buf)};
+    int n_bytes = mUring->receive(&segment, 1, false, &control_segment);
+    if (0 < n_bytes) {
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = control_segment.size;
+        readRxTimestamps(&msg);
     }
     return n_bytes;
 }
 
 
+//*******************************************************************************
+bool UdpDataProtocol::enableTxTime()
+{
+    // Only the fq and etf qdiscs hold the datagrams, the others send them right away
+    struct sock_txtime config;
+    std::memset(&config, 0, sizeof(config));
+    config.clockid = CLOCK_MONOTONIC;
+    return (0 == ::setsockopt(mSocket, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)));
+}
+
+
+//*******************************************************************************
+int UdpDataProtocol::sendTxTime(const char* buf, size_t n)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(buf);
+    iov.iov_len = n;
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    if (mIPv6) {
+        msg.msg_name = &mPeerAddr6;
+        msg.msg_namelen = sizeof(mPeerAddr6);
+    }
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    TxTimeControl control;
+    addTxTime(&msg, &control, mTxTimeNs);
+    return ::sendmsg(mSocket, &msg, 0);
+}
+#endif // __LINUX__
+
+
+//*******************************************************************************
+void UdpDataProtocol::updateNetworkJitter(uint16_t seq_num)
+{
+    if (!mRxTimestampValid) {
+        return;
+    }
+    mRxTimestampValid = false;
+    if (mJitterStarted) {
+        // Arrival spacing against the sending spacing, as in RFC 3550
+        int16_t seq_diff = seq_num - mJitterLastSeq;
+        double d = (mRxNetworkTime - mJitterLastTime) - seq_diff * mRxPeriodNs;
+        mNetJitterNs += (std::fabs(d) - mNetJitterNs) / 16.0;
+        mNetJitterUs = static_cast<uint32_t>(mNetJitterNs / 1000.0);
+    }
+    mJitterStarted = true;
+    mJitterLastSeq = seq_num;
+    mJitterLastTime = mRxNetworkTime;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::tracePacket(int64_t arrival_ns, int64_t kernel_ns, uint16_t seq_num,
+                                  int n_bytes, int full_packet_size, int index, uint8_t flags)
+{
+    if (NULL == mPacketTrace) {
+        return;
+    }
+    PacketTrace::Record record;
+    std::memset(&record, 0, sizeof(record));
+    record.MonotonicNs = arrival_ns;
+    record.KernelNs = kernel_ns;
+    record.SeqNumber = seq_num;
+    record.Size = n_bytes;
+    record.Redundancy = qMax(1, n_bytes / full_packet_size);
+    record.Index = index;
+    record.Flags = flags;
+    if (0 != kernel_ns && mRxHwTimestamps) {
+        record.Flags |= PacketTrace::sHardwareTimestamp;
+    }
+    mPacketTrace->record(record);
+}
+
+
 //*******************************************************************************
 int UdpDataProtocol::sendPacket(const char* buf, const size_t n)
 {
@@ -379,6 +835,33 @@ int UdpDataProtocol::sendPacket(const char* buf, const size_t n)
     return (int)n_bytes;
 #else*/
     int n_bytes;
+    if (NULL != mShm) {
+        ShmChannel::Segment segment = {const_cast<char*>(buf), n};
+        n_bytes = mShm->send(&segment, 1);
+        if (0 <= n_bytes) {
+            return n_bytes;
+        }
+    }
+    if (NULL != mXdp) {
+        XdpSocket::Segment segment = {const_cast<char*>(buf), n};
+        n_bytes = mXdp->send(&segment, 1);
+        if (0 <= n_bytes) {
+            return n_bytes;
+        }
+    }
+#if defined (__LINUX__)
+    if (NULL != mUring) {
+        IoUringSocket::Segment segment = {const_cast<char*>(buf), n};
+        n_bytes = sendUring(mUring, &segment, 1, mIPv6 ? &mPeerAddr6 : NULL,
+                            (TXTIMEPACING == mPacing) ? mTxTimeNs : -1);
+        if (0 <= n_bytes) {
+            return n_bytes;
+        }
+    }
+    if (TXTIMEPACING == mPacing) {
+        return sendTxTime(buf, n);
+    }
+#endif
     if (mIPv6) {
         n_bytes = ::sendto(mSocket, buf, n, 0, (struct sockaddr *) &mPeerAddr6, sizeof(mPeerAddr6));
     } else {
@@ -393,7 +876,8 @@ int UdpDataProtocol::sendPacket(const char* buf, const size_t n)
 void UdpDataProtocol::getPeerAddressFromFirstPacket(QHostAddress& peerHostAddress,
                                                     uint16_t& port)
 {
-    while ( !datagramAvailable() ) {
+    // Peeks at the socket, not at what mImpairment holds
+    while ( !transportAvailable() ) {
         msleep(100);
     }
     char buf[1];
@@ -432,6 +916,10 @@ void UdpDataProtocol::run()
     if (mRunMode == RECEIVER) {
         cout << "UDP Socket Receiving in Port: " << mBindPort << endl;
         cout << gPrintSeparator << endl;
+        mRxPeriodNs = 1e9 * mJackTrip->getBufferSizeInSamples() / mJackTrip->getSampleRate();
+#if defined (__LINUX__)
+        enableRxTimestamps();
+#endif
         //Make sure our socket is in non-blocking mode.
 #ifdef __WIN_32__
         u_long nonblock = 1;
@@ -440,35 +928,103 @@ void UdpDataProtocol::run()
         int flags = ::fcntl(mSocket, F_GETFL, 0);
         ::fcntl(mSocket, F_SETFL, flags | O_NONBLOCK);
 #endif
+    } else if (NOPACING != mPacing) {
+        mPacingIntervalNs = 1e9 * mJackTrip->getBufferSizeInSamples() * mAggregation
+                / mJackTrip->getSampleRate();
+        if (TXTIMEPACING == mPacing && NULL != mXdp) {
+            // The frames go straight to the driver, past the qdisc
+            cout << "SO_TXTIME doesn't apply to AF_XDP, pacing in the network thread" << endl;
+            mPacing = USERPACING;
+        } else if (TXTIMEPACING == mPacing) {
+#if defined (__LINUX__)
+            if (!enableTxTime()) {
+                cout << "SO_TXTIME is not available, pacing in the network thread" << endl;
+                mPacing = USERPACING;
+            }
+#else
+            cout << "SO_TXTIME is Linux only, pacing in the network thread" << endl;
+            mPacing = USERPACING;
+#endif
+        }
+    }
+#if defined (__LINUX__)
+    if (mIoUring && NULL == mUring) {
+        // Room for the largest datagram and, when receiving, its timestamps
+        mUring = IoUringSocket::create(mSocket, RECEIVER == mRunMode, 0x10000,
+                                       mRxTimestamps ? CMSG_SPACE(sizeof(struct scm_timestamping)) : 0);
+        if (NULL != mUring) {
+            cout << ((RECEIVER == mRunMode) ? "Receiving" : "Sending") << " through io_uring" << endl;
+        }
+    }
+#endif
+    if (mSharedMemory && NULL == mShm) {
+        // Only when the peer is on this host, it takes over once the peer attaches
+        mShm = ShmChannel::create(mSocket, RECEIVER == mRunMode);
+        if (NULL != mShm && SENDER == mRunMode) {
+            cout << "Offering shared memory to the local peer" << endl;
+        }
     }
 
     if (gVerboseFlag) std::cout << "    UdpDataProtocol:run" << mRunMode << " before Setup Audio Packet buffer, Full Packet buffer, Redundancy Variables" << std::endl;
-    // Setup Audio Packet buffer
-    size_t audio_packet_size = getAudioPacketSizeInBites();
-    //cout << "audio_packet_size: " << audio_packet_size << endl;
-    mAudioPacket = new int8_t[audio_packet_size];
-    std::memset(mAudioPacket, 0, audio_packet_size); // set buffer to 0
-    mBuffer.resize(audio_packet_size, 0);
-    mChans = mJackTrip->getNumChannels();
-    mSmplSize = mJackTrip->getAudioBitResolution() / 8;
-
-    // Setup Full Packet buffer
-    int full_packet_size = mJackTrip->getPacketSizeInBytes();
-    //cout << "full_packet_size: " << full_packet_size << endl;
-    mFullPacket = new int8_t[full_packet_size];
-    std::memset(mFullPacket, 0, full_packet_size); // set buffer to 0
+    int full_packet_size = setupPacketBuffers();
+
+    if (mRunMode == RECEIVER && !mPacketTracePath.isEmpty() && NULL == mPacketTrace) {
+        PacketTrace::FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.SampleRate = mJackTrip->getSampleRate();
+        header.BufferSize = mJackTrip->getBufferSizeInSamples();
+        header.NumChannels = mChans;
+        header.BitResolution = mJackTrip->getAudioBitResolution() / 8;
+        header.FullPacketSize = full_packet_size;
+        header.Aggregation = mAggregation;
+        header.HeaderType = mJackTrip->getPacketHeaderType();
+        mPacketTrace = PacketTrace::create(mPacketTracePath.toStdString(), header);
+        if (NULL != mPacketTrace) {
+            cout << "Recording the received datagrams to " << mPacketTracePath.toStdString() << endl;
+        }
+    }
 
     //  bool timeout = false; // Time out flag for packets that arrive too late
 
-    // Put header in first packet
-    mJackTrip->putHeaderInPacket(mFullPacket, mAudioPacket);
-
     // Redundancy Variables
     // (Algorithm explained at the end of this file)
     // ---------------------------------------------
-    int full_redundant_packet_size = full_packet_size * mUdpRedundancyFactor;
+    unsigned int max_redundancy = mUdpRedundancyFactor;
+    if (0 < mAdaptiveMax && 0 == mFecGroupSize) {
+        max_redundancy = mAdaptiveMax;
+    }
+    // Each datagram carries the last mAggregation periods, times the redundancy
+    int full_redundant_packet_size = full_packet_size * max_redundancy * mAggregation;
     int8_t* full_redundant_packet = NULL;
 
+    // Wire buffer for header types that encode the datagrams
+    mDatagramCodec = mJackTrip->hasDatagramCodec();
+    if (mDatagramCodec) {
+        if (mRunMode == RECEIVER) {
+            mDatagram.resize(0x10000);  // max UDP datagram size
+        } else {
+            mDatagram.resize(mJackTrip->getMaxDatagramSize(max_redundancy * mAggregation,
+                                                           full_packet_size));
+        }
+    } else if (mLossless) {
+        mLosslessCodec = new LosslessCodec();
+        if (mRunMode == RECEIVER) {
+            mDatagram.resize(0x10000);  // max UDP datagram size
+        } else {
+            mDatagram.resize(LosslessCodec::getMaxDatagramSize(max_redundancy * mAggregation,
+                                                               full_packet_size,
+                                                               mJackTrip->getNumChannels()));
+            mLosslessCodec->reserve(max_redundancy * mAggregation, full_packet_size,
+                                    mJackTrip->getNumChannels());
+        }
+    } else if (0 < mOpusBitrate) {
+        // Receivers size it once they know the peer channels
+        if (mRunMode == SENDER) {
+            mDatagram.resize(OpusCodec::getMaxDatagramSize(max_redundancy,
+                                                           mJackTrip->getNumChannels()));
+        }
+    }
+
     // Set realtime priority (function in jacktrip_globals.h)
     if (gVerboseFlag) std::cout << "    UdpDataProtocol:run" << mRunMode << " before setRealtimeProcessPriority()" << std::endl;
     //std::cout << "Experimental version -- not using setRealtimeProcessPriority()" << std::endl;
@@ -551,84 +1107,126 @@ void UdpDataProtocol::run()
         std::cout << "Waiting for Peer..." << std::endl;
         // This blocks waiting for the first packet
         while ( !datagramAvailable() ) {
-            if (mStopped) { return; }
+            if (mStopped) { releaseUring(); return; }
             QThread::msleep(100);
             if (gVerboseFlag) std::cout << "100ms  " << std::flush;
         }
+        // The peer may change its redundancy, so always receive into a buffer
+        // that can hold any datagram
         full_redundant_packet_size = 0x10000;  // max UDP datagram size
         full_redundant_packet = new int8_t[full_redundant_packet_size];
-        full_redundant_packet_size = receivePacket(reinterpret_cast<char*>(full_redundant_packet), full_redundant_packet_size);
+        int first_packet_size = receivePacket(reinterpret_cast<char*>(full_redundant_packet), full_redundant_packet_size);
+        // Control, parity and keep-alive packets carry no usable header, wait for
+        // an audio packet
+        while ( !mStopped && (0 >= first_packet_size
+                || isParityDatagram(full_redundant_packet, first_packet_size)
+                || isDtxPacket(full_redundant_packet, first_packet_size)
+                || isControlPacket(full_redundant_packet, first_packet_size)) ) {
+            first_packet_size = receivePacket(reinterpret_cast<char*>(full_redundant_packet), full_redundant_packet_size);
+        }
+        if (mStopped) {
+            delete[] full_redundant_packet;
+            releaseUring();
+            return;
+        }
         // Check that peer has the same audio settings
         if (gVerboseFlag) std::cout << std::endl << "    UdpDataProtocol:run" << mRunMode << " before mJackTrip->checkPeerSettings()" << std::endl;
-        mJackTrip->checkPeerSettings(full_redundant_packet);
+        // Fragments carry the packet header after their own
+        int8_t* peer_header = full_redundant_packet;
+        if (0 < mMtu && PacketFragments::isFragment(full_redundant_packet, first_packet_size)) {
+            peer_header += sizeof(PacketFragments::FragmentHeader);
+        }
+        // So do Opus datagrams, after their magic
+        if (0 < mOpusBitrate && OpusCodec::isOpusDatagram(full_redundant_packet, first_packet_size)) {
+            peer_header += OpusCodec::sFirstHeaderOffset;
+        }
+        mJackTrip->checkPeerSettings(peer_header);
+        // Our sender only sends the peer what it advertised it understands
+        mJackTrip->setPeerCapabilities(mJackTrip->getPeerCapabilities(peer_header));
 
-        int peer_chans = mJackTrip->getPeerNumChannels(full_redundant_packet);
+        int peer_chans = mJackTrip->getPeerNumChannels(peer_header);
+        int peer_buffer_size = mJackTrip->getPeerBufferSize(peer_header);
         full_packet_size = mJackTrip->getHeaderSizeInBytes()
-                           + mJackTrip->getPeerBufferSize(full_redundant_packet) * peer_chans * mSmplSize;
+                           + peer_buffer_size * peer_chans * mSmplSize;
+        mSilentSlotSize = peer_buffer_size * mChans * mSmplSize;
         /*
         cout << "peer sizes: " << mJackTrip->getHeaderSizeInBytes()
              << " + " << mJackTrip->getPeerBufferSize(full_redundant_packet)
-             << " * " << mJackTrip->getNumChannels() << " * " << (int)mJackTrip->getAudioBitResolution()/8 << endl;
+             << " * " << mJackTrip->getNumChannels() << " * " << AudioInterface::getSampleSize(mJackTrip->getAudioBitResolution() / 8) << endl;
         cout << "full_packet_size: " << full_packet_size << " / " << mJackTrip->getPacketSizeInBytes() << endl;
         cout << "full_redundant_packet_size: " << full_redundant_packet_size << endl;
         // */
+        if (0 < mFecGroupSize) {
+            mFec = new ParityFec(mFecGroupSize, mFecParityCount, full_packet_size);
+        }
+        if (0 < mMtu) {
+            mFragments = new PacketFragments(full_packet_size, mJackTrip->getHeaderSizeInBytes(),
+                                             peer_buffer_size * mSmplSize, 0);
+        }
+        if (0 < mOpusBitrate) {
+            mOpus = OpusCodec::acquire(mJackTrip->getSampleRate(), peer_chans, peer_buffer_size,
+                                       mOpusBitrate, mOpusComplexity);
+            mDatagram.resize(0x10000);  // max UDP datagram size
+        }
 
         if (gVerboseFlag) std::cout << "step 7" << std::endl;
         if (gVerboseFlag) std::cout << "    UdpDataProtocol:run" << mRunMode << " before mJackTrip->parseAudioPacket()" << std::endl;
         std::cout << "Received Connection from Peer!" << std::endl;
         emit signalReceivedConnectionFromPeer();
 
-        // Redundancy Variables
-        // --------------------
-        // NOTE: These types need to be the same unsigned integer as the sequence
-        // number in the header. That way, they wrap around in the "same place"
-        uint16_t current_seq_num = 0; // Store current sequence number
-        uint16_t last_seq_num = 0;    // Store last package sequence number
-        uint16_t newer_seq_num = 0;   // Store newer sequence number
-        mTotCount = 0;
-        mLostCount = 0;
-        mOutOfOrderCount = 0;
-        mLastOutOfOrderCount = 0;
-        mInitialState = true;
-        mRevivedCount = 0;
-        mStatCount = 0;
-
-        if (gVerboseFlag) std::cout << "step 8" << std::endl;
-        while ( !mStopped )
-        {
-            // Timer to report packets arriving too late
-            // This QT method gave me a lot of trouble, so I replaced it with my own 'waitForReady'
-            // that uses signals and slots and can also report with packets have not
-            // arrive for a longer time
-            //timeout = UdpSocket.waitForReadyRead(30);
-            //        timeout = cc unused!
-            waitForReady(60000); //60 seconds
-
-            // OLD CODE WITHOUT REDUNDANCY----------------------------------------------------
-            /*
-        // This is blocking until we get a packet...
-        receivePacket( UdpSocket, reinterpret_cast<char*>(mFullPacket), full_packet_size);
-
-        mJackTrip->parseAudioPacket(mFullPacket, mAudioPacket);
-
-        // ...so we want to send the packet to the buffer as soon as we get in from
-        // the socket, i.e., non-blocking
-        //mRingBuffer->insertSlotNonBlocking(mAudioPacket);
-        mJackTrip->writeAudioBuffer(mAudioPacket);
-        */
-            //----------------------------------------------------------------------------------
-            receivePacketRedundancy(full_redundant_packet,
-                                    full_redundant_packet_size,
-                                    full_packet_size,
-                                    current_seq_num,
-                                    last_seq_num,
-                                    newer_seq_num);
+        // The header type doesn't change during the session, pick the
+        // receiving loop compiled for it
+        switch (mJackTrip->getPacketHeaderType()) {
+        case DataProtocol::DEFAULT :
+            receiveLoop<DataProtocol::DEFAULT>(full_redundant_packet,
+                                               full_redundant_packet_size, full_packet_size);
+            break;
+        case DataProtocol::JAMLINK :
+            receiveLoop<DataProtocol::JAMLINK>(full_redundant_packet,
+                                               full_redundant_packet_size, full_packet_size);
+            break;
+        case DataProtocol::EMPTY :
+            receiveLoop<DataProtocol::EMPTY>(full_redundant_packet,
+                                             full_redundant_packet_size, full_packet_size);
+            break;
+        case DataProtocol::COMPACT :
+            receiveLoop<DataProtocol::COMPACT>(full_redundant_packet,
+                                               full_redundant_packet_size, full_packet_size);
+            break;
         }
         break; }
 
     case SENDER : {
         full_redundant_packet = new int8_t[full_redundant_packet_size];
         std::memset(full_redundant_packet, 0, full_redundant_packet_size); // Initialize to 0
+        if (0 < mOpusBitrate) {
+            mOpus = OpusCodec::acquire(mJackTrip->getSampleRate(), mJackTrip->getNumChannels(),
+                                       mJackTrip->getBufferSizeInSamples(),
+                                       mOpusBitrate, mOpusComplexity);
+        }
+        if (0 < mFecGroupSize) {
+            mFec = new ParityFec(mFecGroupSize, mFecParityCount, full_packet_size);
+        }
+        if (0 < mMtu) {
+            // Largest datagram that doesn't get IP-fragmented
+            int max_payload = mMtu - (mIPv6 ? 40 : 20) - 8;
+            if (full_redundant_packet_size > max_payload) {
+                mFragments = new PacketFragments(full_packet_size, mJackTrip->getHeaderSizeInBytes(),
+                                                 mJackTrip->getBufferSizeInSamples() * mSmplSize,
+                                                 max_payload);
+                cout << "Sending each packet in " << mFragments->getNumFragments()
+                     << " fragments to fit the " << mMtu << " bytes MTU" << endl;
+            }
+        }
+        if (0.0 <= mDtxThreshold) {
+            const double dtx_refresh_period = 1.0; // seconds
+            mDtxMaxMarkers = qMax(1, int(dtx_refresh_period * mJackTrip->getSampleRate()
+                                         / (mJackTrip->getBufferSizeInSamples() * mAggregation)));
+        }
+        const double feedback_period = 0.2; // seconds
+        int feedback_interval = qMax(1, int(feedback_period * mJackTrip->getSampleRate()
+                                            / mJackTrip->getBufferSizeInSamples()));
+        int feedback_count = 0;
         while ( !mStopped && !JackTrip::sSigInt && !JackTrip::sJackStopped )
         {
             // OLD CODE WITHOUT REDUNDANCY -----------------------------------------------------
@@ -644,6 +1242,28 @@ void UdpDataProtocol::run()
             sendPacketRedundancy(full_redundant_packet,
                                  full_redundant_packet_size,
                                  full_packet_size);
+            if (NULL != mFec) {
+                sendPacketParity();
+            }
+            bool feedback = (feedback_interval <= ++feedback_count);
+            if (feedback) {
+                // Whoever adapts its redundancy asks for the feedback in its
+                // headers, older versions would take it for audio
+                if (mPeerCapabilities & HEADER_CAP_LOSS_FEEDBACK) {
+                    sendLossFeedback();
+                }
+                feedback_count = 0;
+            }
+            // Replies only go to a peer that sent a request
+            sendTimestampEcho(feedback && mLatencyProbe
+                              && (mPeerCapabilities & HEADER_CAP_TIMESTAMP_ECHO));
+            if (NULL != mUring) {
+                // One syscall for all the datagrams of the period
+                mUring->flush();
+            }
+            if (NULL != mShm) {
+                mShm->serve();
+            }
         }
         
         // Send exit packet (with 1 redundant packet).
@@ -651,6 +1271,9 @@ void UdpDataProtocol::run()
         QByteArray exitPacket = QByteArray(mControlPacketSize, 0xff);
         sendPacket(exitPacket.constData(), mControlPacketSize);
         sendPacket(exitPacket.constData(), mControlPacketSize);
+        if (NULL != mUring) {
+            mUring->flush();
+        }
         emit signalCeaseTransmission();
         break; }
     }
@@ -659,6 +1282,56 @@ void UdpDataProtocol::run()
         delete[] full_redundant_packet;
         full_redundant_packet = NULL;
     }
+    releaseUring();
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::releaseUring()
+{
+    if (NULL != mUring) {
+        mUring->close();
+        delete mUring;
+        mUring = NULL;
+    }
+}
+
+
+//*******************************************************************************
+int UdpDataProtocol::setupPacketBuffers()
+{
+    // Setup Audio Packet buffer
+    size_t audio_packet_size = getAudioPacketSizeInBites();
+    //cout << "audio_packet_size: " << audio_packet_size << endl;
+    mAudioPacket = new int8_t[audio_packet_size];
+    std::memset(mAudioPacket, 0, audio_packet_size); // set buffer to 0
+    mBuffer.resize(audio_packet_size, 0);
+    mChans = mJackTrip->getNumChannels();
+    mSmplSize = AudioInterface::getSampleSize(mJackTrip->getAudioBitResolution() / 8);
+
+    // Setup Full Packet buffer
+    int full_packet_size = mJackTrip->getPacketSizeInBytes();
+    //cout << "full_packet_size: " << full_packet_size << endl;
+    mFullPacket = new int8_t[full_packet_size];
+    std::memset(mFullPacket, 0, full_packet_size); // set buffer to 0
+
+    // Put header in first packet
+    mJackTrip->putHeaderInPacket(mFullPacket, mAudioPacket);
+    return full_packet_size;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::resetPacketCounters()
+{
+    mTotCount = 0;
+    mLostCount = 0;
+    mOutOfOrderCount = 0;
+    mLastOutOfOrderCount = 0;
+    mInitialState = true;
+    mRevivedCount = 0;
+    mPartialCount = 0;
+    mStatCount = 0;
 }
 
 
@@ -666,7 +1339,6 @@ void UdpDataProtocol::run()
 //bool
 void UdpDataProtocol::waitForReady(int timeout_msec)
 {
-    int loop_resolution_usec = 100; // usecs to wait on each loop
     int emit_resolution_usec = 10000; // 10 milliseconds
     int timeout_usec = timeout_msec * 1000;
     int elapsed_time_usec = 0; // Ellapsed time in milliseconds
@@ -675,8 +1347,7 @@ void UdpDataProtocol::waitForReady(int timeout_msec)
             && (elapsed_time_usec <= timeout_usec)
             && !mStopped ){
         //    if (mStopped) { return false; }
-        QThread::usleep(loop_resolution_usec);
-        elapsed_time_usec += loop_resolution_usec;
+        elapsed_time_usec += waitForDatagram(emit_resolution_usec);
 
         if ( !(elapsed_time_usec % emit_resolution_usec) ) {
             emit signalWaitingTooLong(static_cast<int>(elapsed_time_usec/1000));
@@ -693,17 +1364,101 @@ void UdpDataProtocol::waitForReady(int timeout_msec)
 
 
 //*******************************************************************************
-void UdpDataProtocol::printUdpWaitedTooLong(int wait_msec)
+int UdpDataProtocol::waitForDatagram(int timeout_usec)
 {
-    int wait_time = 30; // msec
-    if ( !(wait_msec%wait_time) ) {
-        std::cerr << "UDP waiting too long (more than " << wait_time << "ms) for " << mPeerAddress.toString().toStdString() << "..." << endl;
-        emit signalUdpWaitingTooLong();
+    if (NULL != mImpairment) {
+        // Wake up in time for the next held datagram
+        int64_t wait_ns = mImpairment->getWaitNs(monotonicNs());
+        if (0 <= wait_ns) {
+            timeout_usec = static_cast<int>(std::min<int64_t>(timeout_usec, wait_ns / 1000 + 1));
+        }
+    }
+    if (NULL != mShm) {
+        if (!mShm->isAttached() && mShm->attach()) {
+            // Take what was sent to the socket before the peer moved to the ring
+            mShmIdle = true;
+            return 0;
+        }
+        if (mShm->isAttached()) {
+            mShmIdle = !mShm->wait(timeout_usec);
+            return timeout_usec;
+        }
+    }
+    // The io_uring wakes up as soon as a datagram arrives, no need to poll
+    if (NULL != mUring) {
+        mUring->wait(timeout_usec);
+        return timeout_usec;
     }
+    QThread::usleep(100);
+    return 100;
 }
 
 
 //*******************************************************************************
+void UdpDataProtocol::printUdpWaitedTooLong(int wait_msec)
+{
+    int wait_time = 30; // msec
+    if ( !(wait_msec%wait_time) ) {
+        std::cerr << "UDP waiting too long (more than " << wait_time << "ms) for " << mPeerAddress.toString().toStdString() << "..." << endl;
+        emit signalUdpWaitingTooLong();
+    }
+}
+
+
+//*******************************************************************************
+template <DataProtocol::packetHeaderTypeT HeaderType>
+void UdpDataProtocol::receiveLoop(int8_t* full_redundant_packet,
+                                  int full_redundant_packet_size,
+                                  int full_packet_size)
+{
+    // Redundancy Variables
+    // --------------------
+    // NOTE: These types need to be the same unsigned integer as the sequence
+    // number in the header. That way, they wrap around in the "same place"
+    uint16_t current_seq_num = 0; // Store current sequence number
+    uint16_t last_seq_num = 0;    // Store last package sequence number
+    uint16_t newer_seq_num = 0;   // Store newer sequence number
+    resetPacketCounters();
+
+    if (gVerboseFlag) std::cout << "step 8" << std::endl;
+    while ( !mStopped )
+    {
+        // Timer to report packets arriving too late
+        // This QT method gave me a lot of trouble, so I replaced it with my own 'waitForReady'
+        // that uses signals and slots and can also report with packets have not
+        // arrive for a longer time
+        //timeout = UdpSocket.waitForReadyRead(30);
+        //        timeout = cc unused!
+        waitForReady(60000); //60 seconds
+
+        if (NULL != mFec) {
+            receivePacketFec<HeaderType>(full_redundant_packet,
+                                         full_redundant_packet_size,
+                                         full_packet_size,
+                                         last_seq_num);
+        } else if (NULL != mOpus) {
+            receivePacketOpus<HeaderType>(full_redundant_packet, last_seq_num);
+        } else if (NULL != mFragments) {
+            receivePacketFragments<HeaderType>(full_redundant_packet,
+                                               full_redundant_packet_size,
+                                               full_packet_size,
+                                               current_seq_num,
+                                               last_seq_num,
+                                               newer_seq_num);
+        } else {
+            receivePacketRedundancy<HeaderType>(full_redundant_packet,
+                                                full_redundant_packet_size,
+                                                full_packet_size,
+                                                current_seq_num,
+                                                last_seq_num,
+                                                newer_seq_num);
+        }
+    }
+}
+
+
+//*******************************************************************************
+template <DataProtocol::packetHeaderTypeT HeaderType>
 void UdpDataProtocol::receivePacketRedundancy(int8_t* full_redundant_packet,
                                               int full_redundant_packet_size,
                                               int full_packet_size,
@@ -712,54 +1467,51 @@ void UdpDataProtocol::receivePacketRedundancy(int8_t* full_redundant_packet,
                                               uint16_t& newer_seq_num)
 {
     // This is blocking until we get a packet...
-    if (receivePacket( reinterpret_cast<char*>(full_redundant_packet), 
-                       full_redundant_packet_size) == 0) {
+    int n_bytes = receivePacket( reinterpret_cast<char*>(full_redundant_packet),
+                                 full_redundant_packet_size);
+    if (0 >= n_bytes) {
         return;
     }
+    // Before the counters, which use up the kernel timestamp
+    int64_t arrival_ns = 0;
+    int64_t kernel_ns = 0;
+    if (NULL != mPacketTrace) {
+        arrival_ns = monotonicNs();
+        kernel_ns = mRxTimestampValid ? mRxNetworkTime : 0;
+    }
 
-    if (0.0 < mSimulatedLossRate || 0.0 < mSimulatedJitterRate) {
-        double x = mUniformDist(mRndEngine);
-        // Drop packets
-        x -= mSimulatedLossRate;
-        if (0 > x) {
-            return;
-        }
-        // Delay packets
-        x -= mSimulatedJitterRate;
-        if (0 > x) {
-            usleep(mUniformDist(mRndEngine) * mSimulatedJitterMaxDelay * 1e6);
-        }
+    if (isDtxPacket(full_redundant_packet, n_bytes)) {
+        receiveDtxPacket(full_redundant_packet, last_seq_num);
+        return;
     }
 
+    typedef PacketHeaderCodec<HeaderType> Codec;
+
     // Get Packet Sequence Number
-    newer_seq_num =
-            mJackTrip->getPeerSequenceNumber(full_redundant_packet);
+    newer_seq_num = Codec::getPeerSequenceNumber(full_redundant_packet);
     current_seq_num = newer_seq_num;
+    if (NULL != mAgeHistogram) {
+        // Only meaningful if the clocks of both ends are synchronized
+        uint64_t sent_us = Codec::getPeerTimeStamp(full_redundant_packet);
+        uint64_t now_us = PacketHeader::usecTime();
+        if (0 != sent_us && now_us >= sent_us) {
+            mAgeHistogram->record(now_us - sent_us);
+        }
+    }
 
     int16_t lost = 0;
-    if (!mInitialState) {
-        lost = newer_seq_num - last_seq_num - 1;
-        if (0 > lost || 1000 < lost) {
-            // Out of order packet, should be ignored
-            ++mOutOfOrderCount;
-            if (5 < ++mLastOutOfOrderCount) {
-                mInitialState = true;
-                mStatCount = 0;
-                mTotCount = 0;
-            }
-            return;
-        }
-        else if (0 != lost) {
-            mLostCount += lost;
-        }
-        mTotCount += 1 + lost;
+    if (!updatePacketCounters(newer_seq_num, last_seq_num, lost)) {
+        // Out of order packet, should be ignored
+        tracePacket(arrival_ns, kernel_ns, newer_seq_num, n_bytes, full_packet_size, 0,
+                    PacketTrace::sOutOfOrder);
+        return;
     }
-    mLastOutOfOrderCount = 0;
-    mInitialState = false;
 
     //cout << current_seq_num << " ";
+    // The peer may change its redundancy at any time, take it from the datagram size
+    int redundancy = qMax(1, n_bytes / full_packet_size);
     int redun_last_index = 0;
-    for (unsigned int i = 1; i<mUdpRedundancyFactor; i++) {
+    for (int i = 1; i<redundancy; i++) {
         // Check if the package we receive is the next one expected, i.e.,
         // current_seq_num == (last_seq_num+1)
         if ( current_seq_num == (last_seq_num+1) ) { break; }
@@ -768,47 +1520,531 @@ void UdpDataProtocol::receivePacketRedundancy(int8_t* full_redundant_packet,
         // or there aren't more available packets
         redun_last_index = i; // index of packet to use in the redundant packet
         current_seq_num =
-                mJackTrip->getPeerSequenceNumber( full_redundant_packet + (i*full_packet_size) );
+                Codec::getPeerSequenceNumber( full_redundant_packet + (i*full_packet_size) );
         //cout << current_seq_num << " ";
     }
-    mRevivedCount += redun_last_index;
+    // The first mAggregation-1 older packets are new, not redundant
+    int aggregated = mAggregation - 1;
+    mRevivedCount += qMax(0, redun_last_index - aggregated);
     //cout << endl;
 
-    int peer_chans = mJackTrip->getPeerNumChannels(full_redundant_packet);
-    int N = mJackTrip->getPeerBufferSize(full_redundant_packet);
+    int N = Codec::getPeerBufferSize(full_redundant_packet);
     int host_buf_size = N * mChans * mSmplSize;
-    int hdr_size = mJackTrip->getHeaderSizeInBytes();
-    int gap_size = mInitialState ? 0 : (lost - redun_last_index) * host_buf_size;
+    int gap_size = mInitialState ? 0 : (lost + aggregated - redun_last_index) * host_buf_size;
 
     last_seq_num = newer_seq_num; // Save last read packet
+    tracePacket(arrival_ns, kernel_ns, newer_seq_num, n_bytes, full_packet_size, redun_last_index, 0);
 
-    if ((int)mBuffer.size() < host_buf_size) {
-        mBuffer.resize(host_buf_size, 0);
-    }
     // Send to audio all available audio packets, in order
     for (int i = redun_last_index; i>=0; i--) {
-        int8_t* src = full_redundant_packet + (i*full_packet_size) + hdr_size;
-        if (1 != mChans) {
-            // Convert packet's non-interleaved layout to interleaved one used internally
-            int8_t* dst = mBuffer.data();
-            int C = qMin(mChans, peer_chans);
-            for (int n=0; n<N; ++n) {
-                for (int c=0; c<C; ++c) {
-                    memcpy(dst + (n*mChans + c)*mSmplSize, src + (n + c*N)*mSmplSize, mSmplSize);
-                }
+        if (!writeAudioPacket<HeaderType>(full_redundant_packet + (i*full_packet_size), gap_size)) {
+            break;
+        }
+        gap_size = 0;
+    }
+}
+
+
+//*******************************************************************************
+template <DataProtocol::packetHeaderTypeT HeaderType>
+void UdpDataProtocol::receivePacketOpus(int8_t* full_packet,
+                                        uint16_t& last_seq_num)
+{
+    // This is blocking until we get a packet...
+    int n_bytes = receivePacket(reinterpret_cast<char*>(mDatagram.data()), mDatagram.size());
+    if (0 >= n_bytes) {
+        return;
+    }
+    const int8_t* packets[OpusCodec::sMaxPackets];
+    int num_packets = OpusCodec::parseDatagram(mDatagram.data(), n_bytes,
+                                               packets, OpusCodec::sMaxPackets);
+    if (1 > num_packets) {
+        return;
+    }
+
+    typedef PacketHeaderCodec<HeaderType> Codec;
+    const int8_t* newest_header = OpusCodec::getPacketHeader(packets[0]);
+    uint16_t newer_seq_num = Codec::getPeerSequenceNumber(newest_header);
+    int16_t lost = 0;
+    if (!updatePacketCounters(newer_seq_num, last_seq_num, lost)) {
+        // Out of order packet, should be ignored
+        return;
+    }
+    last_seq_num = newer_seq_num;
+
+    // Long outages are left to the jitter buffer, the decoder conceals the
+    // packets just before the new one
+    int host_buf_size = Codec::getPeerBufferSize(newest_header) * mChans * mSmplSize;
+    int missing = qMin(static_cast<int>(lost), static_cast<int>(OpusCodec::sMaxConcealed));
+    int gap_size = (lost - missing) * host_buf_size;
+
+    // Decode in sequence order, taking lost packets from the redundant copies
+    // (newest first) when the datagram has them
+    for (int i = missing; i >= 0; --i) {
+        uint16_t seq_num = newer_seq_num - i;
+        const int8_t* packet = NULL;
+        if (i < num_packets
+                && seq_num == Codec::getPeerSequenceNumber(OpusCodec::getPacketHeader(packets[i]))) {
+            packet = packets[i];
+            if (0 < i) {
+                ++mRevivedCount;
             }
-            src = dst;
+        } else {
+            std::memcpy(full_packet, newest_header, Codec::sHeaderSize);
+        }
+        if (!mOpus->decodePacket(packet, full_packet)) {
+            emit signalError("Local and Peer Opus settings are incompatible");
+            cout << "ERROR: Local and Peer Opus settings are incompatible" << endl;
+            mStopped = true;
+            return;
         }
-        if (!mJackTrip->writeAudioBuffer(src, host_buf_size, gap_size)) {
+        if (!writeAudioPacket<HeaderType>(full_packet, gap_size)) {
+            return;
+        }
+        gap_size = 0;
+    }
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::receiveDtxPacket(const int8_t* buf, uint16_t& last_seq_num)
+{
+    DtxPacket packet;
+    std::memcpy(&packet, buf, sizeof(packet));
+    int16_t lost = 0;
+    if (!updatePacketCounters(packet.SeqNumber, last_seq_num, lost)) {
+        // Out of order packet, should be ignored
+        return;
+    }
+    last_seq_num = packet.SeqNumber;
+
+    // Lost packets that the marker says were silent are played as silence too
+    int periods = mAggregation + lost;
+    int silent = qMin(periods, static_cast<int>(packet.SilentCount));
+    mRevivedCount += qMax(0, silent - static_cast<int>(mAggregation));
+    int gap_size = (periods - silent) * mSilentSlotSize;
+    for (int i = 0; i < silent; ++i) {
+        if (!mJackTrip->writeAudioBuffer(NULL, mSilentSlotSize, gap_size)) {
             emit signalError("Local and Peer buffer settings are incompatible");
             cout << "ERROR: Local and Peer buffer settings are incompatible" << endl;
             mStopped = true;
-            break;
+            return;
         }
         gap_size = 0;
     }
 }
 
+
+//*******************************************************************************
+template <DataProtocol::packetHeaderTypeT HeaderType>
+void UdpDataProtocol::receivePacketFec(int8_t* datagram,
+                                       int datagram_size,
+                                       int full_packet_size,
+                                       uint16_t& last_seq_num)
+{
+    // This is blocking until we get a packet...
+    int n_bytes = receivePacket(reinterpret_cast<char*>(datagram), datagram_size);
+    if (0 >= n_bytes) {
+        return;
+    }
+
+    if (mFec->isParityPacket(datagram, n_bytes)) {
+        mFec->storeParityPacket(datagram, n_bytes);
+        return;
+    }
+    if (full_packet_size != n_bytes) {
+        return;
+    }
+
+    typedef PacketHeaderCodec<HeaderType> Codec;
+
+    uint16_t seq_num = Codec::getPeerSequenceNumber(datagram);
+    bool initial_state = mInitialState;
+    int16_t lost = 0;
+    if (!updatePacketCounters(seq_num, last_seq_num, lost)) {
+        // Late, but still in time if its group hasn't been released: keep it
+        // so that the parity isn't spent on reordering
+        if (!initial_state && 0 <= static_cast<int16_t>(seq_num - mFecNextSeq)) {
+            mFec->storeDataPacket(datagram, seq_num);
+        }
+        return;
+    }
+    last_seq_num = seq_num;
+    mFec->storeDataPacket(datagram, seq_num);
+    if (initial_state) {
+        mFecNextSeq = seq_num;
+        mFecPendingGap = 0;
+    }
+
+    // Packets are held back for one group, so that the parity of a lost
+    // packet has arrived by the time it is due.
+    int host_buf_size = Codec::getPeerBufferSize(datagram) * mChans * mSmplSize;
+    uint16_t release_seq = seq_num - mFec->getGroupSize();
+    while (0 <= static_cast<int16_t>(release_seq - mFecNextSeq)) {
+        int8_t* full_packet = mFec->getDataPacket(mFecNextSeq);
+        if (NULL == full_packet) {
+            full_packet = mFec->recoverPacket(mFecNextSeq);
+            if (NULL != full_packet) {
+                ++mRevivedCount;
+            }
+        }
+        ++mFecNextSeq;
+        if (NULL == full_packet) {
+            mFecPendingGap += host_buf_size;
+            continue;
+        }
+        if (!writeAudioPacket<HeaderType>(full_packet, mFecPendingGap)) {
+            return;
+        }
+        mFecPendingGap = 0;
+    }
+}
+
+
+//*******************************************************************************
+template <DataProtocol::packetHeaderTypeT HeaderType>
+void UdpDataProtocol::receivePacketFragments(int8_t* full_redundant_packet,
+                                             int full_redundant_packet_size,
+                                             int full_packet_size,
+                                             uint16_t& current_seq_num,
+                                             uint16_t& last_seq_num,
+                                             uint16_t& newer_seq_num)
+{
+    typedef PacketHeaderCodec<HeaderType> Codec;
+    typedef PacketFragments::FragmentHeader FragmentHeader;
+    const int head_size = sizeof(FragmentHeader) + Codec::sHeaderSize;
+    char head[sizeof(FragmentHeader) + sizeof(DefaultHeaderStruct)];
+
+    // Block until There's something to read
+    while ( !datagramAvailable() && !mStopped ) {
+        waitForDatagram(10000);
+    }
+    if (mStopped) {
+        return;
+    }
+
+    // Peek at the headers to find where the fragment goes
+    bool from_impairment = (NULL != mImpairment);
+    bool from_shm = !from_impairment && (NULL != mShm && mShm->available());
+    bool from_xdp = !from_impairment && !from_shm && (NULL != mXdp && mXdp->available());
+    int n_bytes;
+    if (from_impairment) {
+        NetworkImpairment::Segment peek_segment = {head, static_cast<size_t>(head_size)};
+        n_bytes = mImpairment->receive(&peek_segment, 1, true);
+    } else if (from_shm) {
+        ShmChannel::Segment peek_segment = {head, static_cast<size_t>(head_size)};
+        n_bytes = mShm->receive(&peek_segment, 1, true);
+    } else if (from_xdp) {
+        XdpSocket::Segment peek_segment = {head, static_cast<size_t>(head_size)};
+        n_bytes = mXdp->receive(&peek_segment, 1, true);
+    } else if (NULL != mUring) {
+        IoUringSocket::Segment peek_segment = {head, static_cast<size_t>(head_size)};
+        n_bytes = mUring->receive(&peek_segment, 1, true);
+    } else {
+#if defined (__WIN_32__)
+        WSABUF peek_buffer;
+        peek_buffer.buf = head;
+        peek_buffer.len = head_size;
+        DWORD n_peek = 0;
+        DWORD peek_flags = MSG_PEEK;
+        if (0 != WSARecv(mSocket, &peek_buffer, 1, &n_peek, &peek_flags, NULL, NULL)
+                && WSAEMSGSIZE != WSAGetLastError()) {
+            return;
+        }
+        n_bytes = head_size;
+#else
+        n_bytes = ::recv(mSocket, head, head_size, MSG_PEEK);
+#endif
+    }
+    if (head_size > n_bytes
+            || !PacketFragments::isFragment(reinterpret_cast<int8_t*>(head), n_bytes)) {
+        receivePacketRedundancy<HeaderType>(full_redundant_packet,
+                                            full_redundant_packet_size,
+                                            full_packet_size,
+                                            current_seq_num,
+                                            last_seq_num,
+                                            newer_seq_num);
+        return;
+    }
+
+    FragmentHeader fragment;
+    std::memcpy(&fragment, head, sizeof(fragment));
+    int8_t* packet_header = reinterpret_cast<int8_t*>(head) + sizeof(fragment);
+    uint16_t seq_num = Codec::getPeerSequenceNumber(packet_header);
+    int8_t* dst = mFragments->getFragmentDestination(fragment, seq_num, packet_header);
+
+    // Receive the audio straight into the reassembly buffer
+    if (from_impairment) {
+        NetworkImpairment::Segment segments[2] = {
+            {head, static_cast<size_t>(head_size)},
+            {reinterpret_cast<char*>(dst),
+             (NULL == dst) ? 0 : static_cast<size_t>(mFragments->getFragmentCapacity(fragment))}};
+        n_bytes = mImpairment->receive(segments, 2);
+    } else if (from_shm) {
+        ShmChannel::Segment segments[2] = {
+            {head, static_cast<size_t>(head_size)},
+            {reinterpret_cast<char*>(dst),
+             (NULL == dst) ? 0 : static_cast<size_t>(mFragments->getFragmentCapacity(fragment))}};
+        n_bytes = mShm->receive(segments, 2);
+    } else if (from_xdp) {
+        XdpSocket::Segment segments[2] = {
+            {head, static_cast<size_t>(head_size)},
+            {reinterpret_cast<char*>(dst),
+             (NULL == dst) ? 0 : static_cast<size_t>(mFragments->getFragmentCapacity(fragment))}};
+        n_bytes = mXdp->receive(segments, 2);
+    } else if (NULL != mUring) {
+        IoUringSocket::Segment segments[2] = {
+            {head, static_cast<size_t>(head_size)},
+            {reinterpret_cast<char*>(dst),
+             (NULL == dst) ? 0 : static_cast<size_t>(mFragments->getFragmentCapacity(fragment))}};
+#if defined (__LINUX__)
+        // Same receive timestamps as receiveUring()
+        RxTimestampControl control;
+        IoUringSocket::Segment control_segment = {control.buf, sizeof(control.buf)};
+        n_bytes = mUring->receive(segments, 2, false, mRxTimestamps ? &control_segment : NULL);
+        if (mRxTimestamps && 0 < n_bytes) {
+            struct msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control.buf;
+            msg.msg_controllen = control_segment.size;
+            readRxTimestamps(&msg);
+        }
+#else
+        n_bytes = mUring->receive(segments, 2);
+#endif
+    } else {
+#if defined (__WIN_32__)
+        WSABUF buffers[2];
+        buffers[0].buf = head;
+        buffers[0].len = head_size;
+        buffers[1].buf = reinterpret_cast<char*>(dst);
+        buffers[1].len = (NULL == dst) ? 0 : mFragments->getFragmentCapacity(fragment);
+        DWORD n_received = 0;
+        DWORD flags = 0;
+        if (0 != WSARecv(mSocket, buffers, 2, &n_received, &flags, NULL, NULL)
+                && WSAEMSGSIZE != WSAGetLastError()) {
+            return;
+        }
+        n_bytes = n_received;
+#else
+        struct iovec iov[2];
+        iov[0].iov_base = head;
+        iov[0].iov_len = head_size;
+        iov[1].iov_base = dst;
+        iov[1].iov_len = (NULL == dst) ? 0 : mFragments->getFragmentCapacity(fragment);
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+#if defined (__LINUX__)
+        // Same receive timestamps as receiveTimestamped()
+        RxTimestampControl control;
+        if (mRxTimestamps) {
+            msg.msg_control = control.buf;
+            msg.msg_controllen = sizeof(control.buf);
+        }
+        n_bytes = ::recvmsg(mSocket, &msg, 0);
+        if (mRxTimestamps && 0 < n_bytes) {
+            readRxTimestamps(&msg);
+        }
+#else
+        n_bytes = ::recvmsg(mSocket, &msg, 0);
+#endif
+#endif
+    }
+    int expected = mFragments->getExpectedLength(fragment);
+    if (NULL == dst || head_size >= n_bytes
+            || 0 > expected || (0 < expected && head_size + expected != n_bytes)) {
+        // Duplicate, dropped, too old or truncated; a truncated fragment
+        // stays missing and its channels silent
+        return;
+    }
+    mFragments->addFragment(fragment, seq_num);
+
+    // Play the packets that are due, in order
+    int host_buf_size = Codec::getPeerBufferSize(packet_header) * mChans * mSmplSize;
+    int8_t* full_packet;
+    bool partial;
+    while (mFragments->popPacket(&full_packet, &partial)) {
+        ++mTotCount;
+        ++mNetTotCount;
+        if (NULL == full_packet) {
+            ++mLostCount;
+            ++mNetLostCount;
+            mFragmentPendingGap += host_buf_size;
+            continue;
+        }
+        if (partial) {
+            ++mPartialCount;
+        }
+        if (!writeAudioPacket<HeaderType>(full_packet, mInitialState ? 0 : mFragmentPendingGap)) {
+            return;
+        }
+        mInitialState = false;
+        mFragmentPendingGap = 0;
+        last_seq_num = Codec::getPeerSequenceNumber(full_packet);
+    }
+}
+
+
+//*******************************************************************************
+int UdpDataProtocol::sendFragment(const int8_t* full_packet, int index, int window)
+{
+    PacketFragments::FragmentHeader fragment;
+    std::memset(&fragment, 0, sizeof(fragment));
+    fragment.Magic = PacketFragments::sFragmentMagic;
+    fragment.Offset = mFragments->getFragmentOffset(index);
+    fragment.Index = index;
+    fragment.Count = mFragments->getNumFragments();
+    fragment.Window = qMin(window, 255);
+    int header_size = mJackTrip->getHeaderSizeInBytes();
+    const int8_t* audio = full_packet + header_size + fragment.Offset;
+    int length = mFragments->getFragmentLength(index);
+
+    if (NULL != mShm) {
+        ShmChannel::Segment segments[3] = {
+            {reinterpret_cast<char*>(&fragment), sizeof(fragment)},
+            {reinterpret_cast<char*>(const_cast<int8_t*>(full_packet)), static_cast<size_t>(header_size)},
+            {reinterpret_cast<char*>(const_cast<int8_t*>(audio)), static_cast<size_t>(length)}};
+        int n_bytes = mShm->send(segments, 3);
+        if (0 <= n_bytes) {
+            return n_bytes;
+        }
+    }
+    if (NULL != mXdp) {
+        XdpSocket::Segment segments[3] = {
+            {reinterpret_cast<char*>(&fragment), sizeof(fragment)},
+            {reinterpret_cast<char*>(const_cast<int8_t*>(full_packet)), static_cast<size_t>(header_size)},
+            {reinterpret_cast<char*>(const_cast<int8_t*>(audio)), static_cast<size_t>(length)}};
+        int n_bytes = mXdp->send(segments, 3);
+        if (0 <= n_bytes) {
+            return n_bytes;
+        }
+    }
+#if defined (__LINUX__)
+    if (NULL != mUring) {
+        IoUringSocket::Segment segments[3] = {
+            {reinterpret_cast<char*>(&fragment), sizeof(fragment)},
+            {reinterpret_cast<char*>(const_cast<int8_t*>(full_packet)), static_cast<size_t>(header_size)},
+            {reinterpret_cast<char*>(const_cast<int8_t*>(audio)), static_cast<size_t>(length)}};
+        int n_bytes = sendUring(mUring, segments, 3, mIPv6 ? &mPeerAddr6 : NULL,
+                                (TXTIMEPACING == mPacing) ? mTxTimeNs : -1);
+        if (0 <= n_bytes) {
+            return n_bytes;
+        }
+    }
+#endif
+
+    // Gather the pieces instead of copying them into one buffer
+#if defined (__WIN_32__)
+    WSABUF buffers[3];
+    buffers[0].buf = reinterpret_cast<char*>(&fragment);
+    buffers[0].len = sizeof(fragment);
+    buffers[1].buf = reinterpret_cast<char*>(const_cast<int8_t*>(full_packet));
+    buffers[1].len = header_size;
+    buffers[2].buf = reinterpret_cast<char*>(const_cast<int8_t*>(audio));
+    buffers[2].len = length;
+    DWORD n_bytes = 0;
+    int error;
+    if (mIPv6) {
+        error = WSASendTo(mSocket, buffers, 3, &n_bytes, 0, (struct sockaddr *) &mPeerAddr6, sizeof(mPeerAddr6), 0, 0);
+    } else {
+        error = WSASend(mSocket, buffers, 3, &n_bytes, 0, 0, 0);
+    }
+    return (SOCKET_ERROR == error) ? -1 : (int)n_bytes;
+#else
+    struct iovec iov[3];
+    iov[0].iov_base = &fragment;
+    iov[0].iov_len = sizeof(fragment);
+    iov[1].iov_base = const_cast<int8_t*>(full_packet);
+    iov[1].iov_len = header_size;
+    iov[2].iov_base = const_cast<int8_t*>(audio);
+    iov[2].iov_len = length;
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    if (mIPv6) {
+        msg.msg_name = &mPeerAddr6;
+        msg.msg_namelen = sizeof(mPeerAddr6);
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+#if defined (__LINUX__)
+    TxTimeControl control;
+    if (TXTIMEPACING == mPacing) {
+        addTxTime(&msg, &control, mTxTimeNs);
+    }
+#endif
+    return ::sendmsg(mSocket, &msg, 0);
+#endif
+}
+
+
+//*******************************************************************************
+bool UdpDataProtocol::updatePacketCounters(uint16_t newer_seq_num,
+                                           uint16_t last_seq_num,
+                                           int16_t& lost)
+{
+    lost = 0;
+    if (!mInitialState) {
+        // Consecutive datagrams are mAggregation packets apart
+        lost = newer_seq_num - last_seq_num - mAggregation;
+        if (0 > lost || 1000 < lost) {
+            ++mOutOfOrderCount;
+            ++mNetOutOfOrderCount;
+            if (5 < ++mLastOutOfOrderCount) {
+                mInitialState = true;
+                mStatCount = 0;
+                mTotCount = 0;
+            }
+            return false;
+        }
+        else if (0 != lost) {
+            mLostCount += lost;
+        }
+        mTotCount += mAggregation + lost;
+        mNetLostCount += lost;
+        mNetTotCount += mAggregation + lost;
+    }
+    mLastOutOfOrderCount = 0;
+    mInitialState = false;
+    updateNetworkJitter(newer_seq_num);
+    return true;
+}
+
+
+//*******************************************************************************
+template <DataProtocol::packetHeaderTypeT HeaderType>
+bool UdpDataProtocol::writeAudioPacket(int8_t* full_packet, int gap_size)
+{
+    typedef PacketHeaderCodec<HeaderType> Codec;
+    int peer_chans = Codec::getPeerNumChannels(full_packet);
+    int N = Codec::getPeerBufferSize(full_packet);
+    int host_buf_size = N * mChans * mSmplSize;
+    int8_t* src = full_packet + Codec::sHeaderSize;
+
+    if ((int)mBuffer.size() < host_buf_size) {
+        mBuffer.resize(host_buf_size, 0);
+    }
+    if (1 != mChans) {
+        // Convert packet's non-interleaved layout to interleaved one used internally
+        int8_t* dst = mBuffer.data();
+        int C = qMin(mChans, peer_chans);
+        for (int n=0; n<N; ++n) {
+            for (int c=0; c<C; ++c) {
+                memcpy(dst + (n*mChans + c)*mSmplSize, src + (n + c*N)*mSmplSize, mSmplSize);
+            }
+        }
+        src = dst;
+    }
+    if (!mJackTrip->writeAudioBuffer(src, host_buf_size, gap_size)) {
+        emit signalError("Local and Peer buffer settings are incompatible");
+        cout << "ERROR: Local and Peer buffer settings are incompatible" << endl;
+        mStopped = true;
+        return false;
+    }
+    return true;
+}
+
 //*******************************************************************************
 bool UdpDataProtocol::getStats(DataProtocol::PktStat* stat)
 {
@@ -816,28 +2052,202 @@ bool UdpDataProtocol::getStats(DataProtocol::PktStat* stat)
         mLostCount = 0;
         mOutOfOrderCount = 0;
         mRevivedCount = 0;
+        mPartialCount = 0;
     }
     stat->tot = mTotCount;
     stat->lost = mLostCount;
     stat->outOfOrder = mOutOfOrderCount;
     stat->revived = mRevivedCount;
+    stat->partial = mPartialCount;
     stat->statCount = mStatCount++;
+    stat->rxTimestamps = mRxTimestamps;
+    stat->netJitterUs = mNetJitterUs;
+    uint32_t delay_count = mHostDelayCount.exchange(0);
+    uint64_t delay_sum = mHostDelaySumNs.exchange(0);
+    stat->hostDelayAvgUs = (0 < delay_count) ? delay_sum / delay_count / 1000 : 0;
+    stat->hostDelayMaxUs = mHostDelayMaxNs.exchange(0) / 1000;
+    stat->roundTripUs = mRoundTripUs;
     return true;
 }
 
 //*******************************************************************************
-void UdpDataProtocol::setIssueSimulation(double loss, double jitter, double max_delay)
+void UdpDataProtocol::setIssueSimulation(const NetworkImpairment::Model& model)
+{
+    delete mImpairment;
+    mImpairment = NULL;
+    if (model.isEnabled()) {
+        std::random_device r;
+        mImpairment = new NetworkImpairment(model, r());
+        mImpairmentBuffer.resize(0x10000); // max UDP datagram size
+    }
+}
+
+//*******************************************************************************
+void UdpDataProtocol::setFec(unsigned int group_size, unsigned int parity_count)
+{
+    mFecGroupSize = group_size;
+    mFecParityCount = parity_count;
+}
+
+//*******************************************************************************
+void UdpDataProtocol::setAdaptiveRedundancy(unsigned int max_redundancy)
+{
+    if (0 < mFecGroupSize) {
+        mAdaptiveMin = mFecParityCount;
+        max_redundancy = qMin(max_redundancy, mFecGroupSize);
+    } else {
+        mAdaptiveMin = mUdpRedundancyFactor;
+    }
+    mAdaptiveMax = qMax(max_redundancy, mAdaptiveMin);
+    mAdaptiveRedundancy = mAdaptiveMin;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::setMtu(int mtu)
+{
+    mMtu = mtu;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::setLossless(bool lossless)
+{
+    mLossless = lossless;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::setOpus(int bitrate, int complexity)
+{
+    mOpusBitrate = bitrate;
+    mOpusComplexity = complexity;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::setDtx(double level_db)
+{
+    mDtxThreshold = (0.0 > level_db) ? std::pow(10.0, level_db / 20.0) : -1.0;
+    mDtxSilentCount = 0;
+    mDtxAudioCount = 0;
+    mDtxMarkerCount = 0;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::setPacing(pacingModeT mode)
+{
+    mPacing = mode;
+    mPacingLastNs = 0;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::paceDatagram()
+{
+    // Datagrams go out one audio period apart (a bit less, to catch up after a
+    // burst and to follow a faster audio clock), so a late wakeup or an xrun
+    // reaches the peer spread out instead of overflowing its buffer
+    int64_t now = monotonicNs();
+    int64_t departure = now;
+    if (0 != mPacingLastNs) {
+        departure = mPacingLastNs
+                + static_cast<int64_t>(mPacingIntervalNs * (sPacingCatchUp - 1) / sPacingCatchUp);
+        // Don't add more latency than that, the peer would drop them anyway
+        int64_t max_hold = static_cast<int64_t>(sPacingMaxHold * mPacingIntervalNs);
+        departure = qBound(now, departure, now + max_hold);
+    }
+    mPacingLastNs = departure;
+
+    if (TXTIMEPACING == mPacing) {
+        mTxTimeNs = departure;
+    } else if (now < departure) {
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+                                          std::chrono::nanoseconds(departure)));
+    }
+}
+
+
+//*******************************************************************************
+bool UdpDataProtocol::isControlPacket(const int8_t* buf, int len)
+{
+    if ((int)sizeof(LossFeedbackPacket) != len && (int)sizeof(TimestampEchoPacket) != len) {
+        return false;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, buf, sizeof(magic));
+    return sLossFeedbackMagic == magic || sEchoRequestMagic == magic || sEchoReplyMagic == magic;
+}
+
+
+//*******************************************************************************
+bool UdpDataProtocol::isDtxPacket(const int8_t* buf, int len)
+{
+    if ((int)sizeof(DtxPacket) != len) {
+        return false;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, buf, sizeof(magic));
+    return sDtxMagic == magic;
+}
+
+
+//*******************************************************************************
+bool UdpDataProtocol::isParityDatagram(const int8_t* buf, int len) const
 {
-    mSimulatedLossRate = loss;
-    mSimulatedJitterRate = jitter;
-    mSimulatedJitterMaxDelay = max_delay;
+    if (0 >= mFecGroupSize) {
+        return false;
+    }
+    return (NULL != mFec) ? mFec->isParityPacket(buf, len) : ParityFec::hasParityTrailer(buf, len);
+}
+
 
-    std::random_device r;
-    mRndEngine = std::default_random_engine(r());
-    mUniformDist = std::uniform_real_distribution<double>(0.0, 1.0);
+//*******************************************************************************
+void UdpDataProtocol::setAggregation(unsigned int periods)
+{
+    mAggregation = qMax(1u, periods);
+    mAggregateCount = 0;
+}
 
-    cout << "Simulating network issues: "
-      "loss_rate=" << loss << ", jitter_rate=" << jitter << ", jitter_max_delay=" << max_delay << endl;
+//*******************************************************************************
+bool UdpDataProtocol::getLossFeedback(LossFeedback* feedback)
+{
+    feedback->tot = mNetTotCount;
+    feedback->lost = mNetLostCount;
+    feedback->outOfOrder = mNetOutOfOrderCount;
+    return true;
+}
+
+//*******************************************************************************
+void UdpDataProtocol::setPeerLossFeedback(const LossFeedback& feedback)
+{
+    // Counters wrap around, only the differences matter
+    uint32_t tot = feedback.tot - mLastPeerFeedback.tot;
+    uint32_t lost = (feedback.lost - mLastPeerFeedback.lost)
+            + (feedback.outOfOrder - mLastPeerFeedback.outOfOrder);
+    bool first = !mHavePeerFeedback;
+    mLastPeerFeedback = feedback;
+    mHavePeerFeedback = true;
+    if (first || 0 == tot) {
+        return;
+    }
+
+    // Losses come in bursts: go up as soon as they show, come down slowly
+    unsigned int redundancy = mAdaptiveRedundancy;
+    if (0 < lost) {
+        redundancy += (20*lost > tot) ? 2 : 1; // more than 5% lost
+        mQuietFeedbackCount = 0;
+    } else if (sAdaptiveQuietFeedbacks <= ++mQuietFeedbackCount) {
+        --redundancy;
+        mQuietFeedbackCount = 0;
+    }
+    redundancy = qBound(mAdaptiveMin, redundancy, mAdaptiveMax);
+    if (redundancy != mAdaptiveRedundancy) {
+        mAdaptiveRedundancy = redundancy;
+        cout << ((0 < mFecGroupSize) ? "FEC parity count" : "Redundancy") << " adapted to "
+             << redundancy << " (peer lost " << lost << " of " << tot << " packets)" << endl;
+    }
 }
 
 //*******************************************************************************
@@ -860,22 +2270,96 @@ void UdpDataProtocol::sendPacketRedundancy(int8_t* full_redundant_packet,
     }
     mJackTrip->putHeaderInPacket(mFullPacket, src);
 
+    // Adaptive redundancy only changes how many of the packets are sent
+    unsigned int redundancy = mUdpRedundancyFactor;
+    if (0 < mAdaptiveMax && NULL == mFec) {
+        redundancy = mAdaptiveRedundancy;
+    }
+
     // Move older packets to end of array of redundant packets
     std::memmove(full_redundant_packet+full_packet_size,
                  full_redundant_packet,
-                 full_packet_size*(mUdpRedundancyFactor-1));
+                 full_redundant_packet_size-full_packet_size);
     // Copy new packet to the begining of array
     std::memcpy(full_redundant_packet,
                 mFullPacket, full_packet_size);
 
+    if (0.0 <= mDtxThreshold) {
+        AudioInterface::audioBitResolutionT bit_res =
+                static_cast<AudioInterface::audioBitResolutionT>(mJackTrip->getAudioBitResolution() / 8);
+        if (!isSilentAudio(src, getAudioPacketSizeInBites() / mSmplSize, mSmplSize,
+                           bit_res, mDtxThreshold)) {
+            mDtxSilentCount = 0;
+        } else if (0xffff > mDtxSilentCount) {
+            ++mDtxSilentCount;
+        }
+    }
+
+    // With aggregation only every mAggregation-th period is sent, together
+    // with the periods in between
+    if (mAggregation > ++mAggregateCount) {
+        mJackTrip->increaseSequenceNumber();
+        return;
+    }
+    mAggregateCount = 0;
+    if (NOPACING != mPacing) {
+        paceDatagram();
+    }
+
+    // When all the periods of the datagram are silent, only a keep-alive
+    // marker goes out. The first datagrams, and one about every second, keep
+    // their audio so that a header reaches the peer of a silent session.
+    if (0.0 <= mDtxThreshold) {
+        if (mAggregation <= mDtxSilentCount && sDtxLeadIn <= mDtxAudioCount
+                && mDtxMaxMarkers > mDtxMarkerCount) {
+            DtxPacket packet = {sDtxMagic, mJackTrip->getPeerSequenceNumber(mFullPacket), mDtxSilentCount};
+            sendPacket(reinterpret_cast<const char*>(&packet), sizeof(packet));
+            ++mDtxMarkerCount;
+            mJackTrip->increaseSequenceNumber();
+            return;
+        }
+        mDtxMarkerCount = 0;
+        if (sDtxLeadIn > mDtxAudioCount) {
+            ++mDtxAudioCount;
+        }
+    }
+    int num_packets = redundancy * mAggregation;
+
     // 10% (or other number) packet lost simulation.
     // Uncomment the if to activate
     //---------------------------------------------------------------------------------
     //int random_integer = rand();
     //if ( random_integer > (RAND_MAX/10) )
     //{
-    sendPacket( reinterpret_cast<char*>(full_redundant_packet),
-                full_redundant_packet_size);
+    if (NULL != mFragments) {
+        // Newest first, like the packets in a redundant datagram
+        for (int i = 0; i < num_packets; ++i) {
+            for (int j = 0; j < mFragments->getNumFragments(); ++j) {
+                sendFragment(full_redundant_packet + i*full_packet_size, j, num_packets);
+            }
+        }
+    } else if (mDatagramCodec) {
+        int datagram_size = mJackTrip->encodeDatagram(full_redundant_packet, num_packets,
+                                                      full_packet_size, mDatagram.data());
+        sendPacket( reinterpret_cast<char*>(mDatagram.data()), datagram_size);
+    } else if (NULL != mOpus) {
+        int datagram_size = mOpus->encodeDatagram(full_redundant_packet, num_packets,
+                                                  mDatagram.data());
+        sendPacket( reinterpret_cast<char*>(mDatagram.data()), datagram_size);
+    } else if (NULL != mLosslessCodec) {
+        int datagram_size = mLosslessCodec->encodeDatagram(full_redundant_packet, num_packets,
+                                                           full_packet_size, mDatagram.data());
+        // Noise doesn't compress, the receiver takes datagrams without the magic as they are
+        if (datagram_size < full_packet_size*num_packets) {
+            sendPacket( reinterpret_cast<char*>(mDatagram.data()), datagram_size);
+        } else {
+            sendPacket( reinterpret_cast<char*>(full_redundant_packet),
+                        full_packet_size*num_packets);
+        }
+    } else {
+        sendPacket( reinterpret_cast<char*>(full_redundant_packet),
+                    full_packet_size*num_packets);
+    }
     //}
     //---------------------------------------------------------------------------------
 
@@ -883,6 +2367,65 @@ void UdpDataProtocol::sendPacketRedundancy(int8_t* full_redundant_packet,
 }
 
 
+//*******************************************************************************
+void UdpDataProtocol::sendPacketParity()
+{
+    if (0 < mAdaptiveMax) {
+        mFec->setParityCount(mAdaptiveRedundancy);
+    }
+    // mFullPacket still holds the packet that was just sent
+    if (!mFec->encodePacket(mFullPacket, mJackTrip->getPeerSequenceNumber(mFullPacket))) {
+        return;
+    }
+    for (int i = 0; i < mFec->getParityCount(); ++i) {
+        sendPacket(reinterpret_cast<const char*>(mFec->getParityPacket(i)),
+                   mFec->getParityPacketSize());
+    }
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::sendLossFeedback()
+{
+    LossFeedback feedback;
+    if (!mJackTrip->getLossFeedback(&feedback)) {
+        return;
+    }
+    LossFeedbackPacket packet = {sLossFeedbackMagic, feedback.tot, feedback.lost, feedback.outOfOrder};
+    sendPacket(reinterpret_cast<const char*>(&packet), sizeof(packet));
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::setPeerEchoRequest(uint64_t orig_us, uint64_t rx_us)
+{
+    // The send thread owns the pending request until it has answered it
+    if (0 != mEchoOrigUs || 0 == orig_us) {
+        return;
+    }
+    mEchoRxUs = rx_us;
+    mEchoOrigUs = orig_us;
+}
+
+
+//*******************************************************************************
+void UdpDataProtocol::sendTimestampEcho(bool request)
+{
+    uint64_t orig_us = mEchoOrigUs;
+    if (0 != orig_us) {
+        TimestampEchoPacket packet = {sEchoReplyMagic,
+                                      static_cast<uint32_t>(LatencyHistogram::nowUs() - mEchoRxUs),
+                                      orig_us};
+        sendPacket(reinterpret_cast<const char*>(&packet), sizeof(packet));
+        mEchoOrigUs = 0;
+    }
+    if (request) {
+        TimestampEchoPacket packet = {sEchoRequestMagic, 0, LatencyHistogram::nowUs()};
+        sendPacket(reinterpret_cast<const char*>(&packet), sizeof(packet));
+    }
+}
+
+
 /*
   The Redundancy Algorythmn works as follows. We send a packet that contains
   a mUdpRedundancyFactor number of packets (header+audio). This big packet looks
@@ -919,11 +2462,57 @@ void UdpDataProtocol::sendPacketRedundancy(int8_t* full_redundant_packet,
   otherwise it continure reding the mUdpRedundancyFactor packets until it finds the one that
   should come next (this can better perfected by just jumping until the correct packet).
   If it has more than one packet that it hasn't yet received, it sends it to the soundcard
-  one by one.
+  one by one. The number of packets is taken from the size of each datagram, so the
+  sender is free to change its redundancy factor at any time.
+
+  With --adaptredundancy, each end sends its receive counters back to the peer a few
+  times per second, and the sender raises the redundancy factor (or the FEC parity count,
+  see below) as soon as the peer reports losses, lowering it again after a while
+  without losses.
+
+  Parity FEC (--fec k,m) is a cheaper alternative. Each packet is sent only once, and
+  after every group of k packets the sender sends m parity packets, parity j being the
+  XOR of the packets j, j+m, j+2m... of the group (see ParityFec):
+
+  ----------  ----------  ----------  ----------  ------------------  ------------------
+  | UDP[1] |  | UDP[2] |  | UDP[3] |  | UDP[4] |  | P0=UDP[1]^UDP[3] |  | P1=UDP[2]^UDP[4] |
+  ----------  ----------  ----------  ----------  ------------------  ------------------
+
+  The receiving end holds packets back for k packets, so when a packet is due to be
+  sent to the soundcard, the rest of its group and its parity have arrived. One lost
+  packet per stripe can then be rebuilt by XORing the parity with the other packets.
 */
 
 bool UdpDataProtocol::datagramAvailable()
 {
+    if (NULL != mImpairment) {
+        impairArrivals();
+        return mImpairment->available(monotonicNs());
+    }
+    return transportAvailable();
+}
+
+
+//*******************************************************************************
+bool UdpDataProtocol::transportAvailable()
+{
+    if (NULL != mShm) {
+        if (mShm->available()) {
+            return true;
+        }
+        // The peer writes everything to the ring, the socket only has what was sent
+        // before it attached, so look at it only once the ring has been quiet
+        if (mShm->isAttached() && !mShmIdle) {
+            return false;
+        }
+    }
+    if (NULL != mXdp && mXdp->available()) {
+        return true;
+    }
+    // The multishot receive takes the datagrams out of the socket
+    if (NULL != mUring) {
+        return mUring->available();
+    }
     //Currently using a simplified version of the way QUdpSocket checks for datagrams.
     //TODO: Consider changing to use poll() or select().
     char c;
@@ -950,3 +2539,8 @@ bool UdpDataProtocol::datagramAvailable()
     return (n != -1 || errno == EMSGSIZE);
 #endif
 }
+
+
+// Used by jacktrip-bench and jacktrip-sim, outside of receiveLoop()
+template void UdpDataProtocol::receivePacketRedundancy<DataProtocol::DEFAULT>(
+        int8_t*, int, int, uint16_t&, uint16_t&, uint16_t&);
@@ -50,6 +50,14 @@
 #include "jacktrip_types.h"
 #include "jacktrip_globals.h"
 
+class ParityFec; // forward declaration
+class PacketFragments; // forward declaration
+class LosslessCodec; // forward declaration
+class OpusCodec; // forward declaration
+class IoUringSocket; // forward declaration
+class ShmChannel; // forward declaration
+class PacketTrace; // forward declaration
+
 /** \brief UDP implementation of DataProtocol class
  *
  * The class has a <tt>bind port</tt> and a <tt>peer port</tt>. The meaning of these
@@ -143,7 +151,35 @@ public:
     virtual void run();
 
     virtual bool getStats(PktStat* stat);
-    virtual void setIssueSimulation(double loss, double jitter, double max_delay);
+    virtual void setIssueSimulation(const NetworkImpairment::Model& model);
+    virtual void setFec(unsigned int group_size, unsigned int parity_count);
+    virtual bool getLossFeedback(LossFeedback* feedback);
+    virtual void setPeerLossFeedback(const LossFeedback& feedback);
+    virtual void setAdaptiveRedundancy(unsigned int max_redundancy);
+    virtual void setPeerCapabilities(uint8_t capabilities) { mPeerCapabilities = capabilities; }
+    virtual void setLatencyProbe(bool enable) { mLatencyProbe = enable; }
+    virtual void setPeerEchoRequest(uint64_t orig_us, uint64_t rx_us);
+    virtual void setAggregation(unsigned int periods);
+    virtual void setMtu(int mtu);
+    virtual void setLossless(bool lossless);
+    virtual void setOpus(int bitrate, int complexity);
+    virtual void setDtx(double level_db);
+    virtual void setPacing(pacingModeT mode);
+    /// \brief Sends and receives through xdp when it can, the socket is owned by the caller
+    virtual void setXdpSocket(XdpSocket* xdp) { mXdp = xdp; }
+    /// \brief Receive or send through an io_uring instead of the socket calls (Linux only)
+    virtual void setIoUring(bool enable) { mIoUring = enable; }
+    /// \brief Moves the datagrams through shared memory when the peer is on the same host
+    virtual void setSharedMemory(bool enable) { mSharedMemory = enable; }
+    /// \brief Records every received datagram to a PacketTrace file, empty to disable
+    virtual void setPacketTrace(const QString& path) { mPacketTracePath = path; }
+    virtual void setTimingHistograms(LatencyHistogram* arrival, LatencyHistogram* age)
+    { mArrivalHistogram = arrival; mAgeHistogram = age; }
+
+    /// \brief Checks if a datagram is the keep-alive marker sent instead of silent packets
+    static bool isDtxPacket(const int8_t* buf, int len);
+    /// \brief Checks if a datagram is a loss feedback or timestamp echo packet
+    static bool isControlPacket(const int8_t* buf, int len);
 
 private slots:
     void printUdpWaitedTooLong(int wait_msec);
@@ -177,15 +213,26 @@ protected:
    * otherwise it returns false (if an error occurred or the operation timed out)
    */
     void waitForReady(int timeout_msec);
+    /// \brief Sleeps until a datagram may be available, returns the usecs it may have waited
+    int waitForDatagram(int timeout_usec);
+
+    /** \brief Receiving loop, instantiated for the session header type so that
+     * the per-packet code reads the header fields without virtual calls
+    */
+    template <DataProtocol::packetHeaderTypeT HeaderType>
+    void receiveLoop(int8_t* full_redundant_packet,
+                     int full_redundant_packet_size,
+                     int full_packet_size);
 
     /** \brief Redundancy algorythm at the receiving end
     */
-    virtual void receivePacketRedundancy(int8_t* full_redundant_packet,
-                                         int full_redundant_packet_size,
-                                         int full_packet_size,
-                                         uint16_t& current_seq_num,
-                                         uint16_t& last_seq_num,
-                                         uint16_t& newer_seq_num);
+    template <DataProtocol::packetHeaderTypeT HeaderType>
+    void receivePacketRedundancy(int8_t* full_redundant_packet,
+                                 int full_redundant_packet_size,
+                                 int full_packet_size,
+                                 uint16_t& current_seq_num,
+                                 uint16_t& last_seq_num,
+                                 uint16_t& newer_seq_num);
 
     /** \brief Redundancy algorythm at the sender's end
     */
@@ -193,8 +240,102 @@ protected:
                                       int full_redundant_packet_size,
                                       int full_packet_size);
 
+    /** \brief Reassembly of fragmented packets at the receiving end, falls back
+     * to receivePacketRedundancy() for whole datagrams
+    */
+    template <DataProtocol::packetHeaderTypeT HeaderType>
+    void receivePacketFragments(int8_t* full_redundant_packet,
+                                int full_redundant_packet_size,
+                                int full_packet_size,
+                                uint16_t& current_seq_num,
+                                uint16_t& last_seq_num,
+                                uint16_t& newer_seq_num);
+
+    /** \brief Sends one fragment of a full packet, without copying it
+    */
+    virtual int sendFragment(const int8_t* full_packet, int index, int window);
+
+    /** \brief Parity FEC algorithm at the receiving end
+    */
+    template <DataProtocol::packetHeaderTypeT HeaderType>
+    void receivePacketFec(int8_t* datagram,
+                          int datagram_size,
+                          int full_packet_size,
+                          uint16_t& last_seq_num);
+
+    /** \brief Opus algorithm at the receiving end, decodes the packets in sequence
+     * and conceals the lost ones that no redundant copy brings back
+    */
+    template <DataProtocol::packetHeaderTypeT HeaderType>
+    void receivePacketOpus(int8_t* full_packet,
+                           uint16_t& last_seq_num);
+
+    /** \brief Plays the packets a keep-alive marker stands for as silence, instead
+     * of reporting them lost to the jitter buffer
+    */
+    virtual void receiveDtxPacket(const int8_t* buf, uint16_t& last_seq_num);
+
+    /** \brief Parity FEC algorithm at the sender's end, call after sendPacketRedundancy
+    */
+    virtual void sendPacketParity();
+
+    /** \brief Sends the loss counters of our receiver to the peer, so that it can
+     * adapt its redundancy
+    */
+    virtual void sendLossFeedback();
+
+    /** \brief Sends an echo request with our timestamp, and the answer to the
+     * peer's last request if there is one pending
+    */
+    virtual void sendTimestampEcho(bool request);
+
 private:
+    friend class UdpDataProtocolBench; ///< jacktrip-bench drives the packet assembly without a socket
+    friend class UdpDataProtocolSim; ///< jacktrip-sim feeds it datagrams from a simulated network
+
+    /// \brief Allocates the packet buffers used by run(), returns the size of a full packet
+    int setupPacketBuffers();
+    /// \brief Closes and deletes mUring, on the thread that created it at the start of run()
+    void releaseUring();
+    /// \brief Resets the counters of received, lost and out of order packets
+    void resetPacketCounters();
+    /// \brief True if FEC is on and the datagram is a parity packet; before the
+    /// first audio packet sets its size, only the trailer is checked
+    bool isParityDatagram(const int8_t* buf, int len) const;
+    /// \brief True if a datagram can be received, after the impairments if any
     bool datagramAvailable();
+    /// \brief True if the ring, the XDP socket or the socket has a datagram
+    bool transportAvailable();
+    /// \brief Reads the next datagram from the ring, the XDP socket or the socket
+    int receiveDatagram(char* buf, size_t n);
+    /// \brief Moves what has arrived into mImpairment, control packets are never lost
+    void impairArrivals();
+#if defined (__LINUX__)
+    /// \brief Asks the kernel to timestamp the received datagrams, in hardware if the NIC can
+    void enableRxTimestamps();
+    /// \brief Same as ::recv() but also reads the receive timestamps
+    int receiveTimestamped(char* buf, size_t n);
+    /// \brief Takes the receive timestamps from the ancillary data of a datagram
+    void readRxTimestamps(struct msghdr* msg);
+    /// \brief Same as receiveTimestamped() but from the io_uring
+    int receiveUring(char* buf, size_t n);
+    /// \brief Asks the kernel to send each datagram at its departure time, false if it can't
+    bool enableTxTime();
+    /// \brief Same as ::send() but with the departure time of the datagram
+    int sendTxTime(const char* buf, size_t n);
+#endif
+    /// \brief Waits for (or sets with SO_TXTIME) the departure time of the next datagram
+    void paceDatagram();
+    /// \brief Updates the network jitter with the timestamp of the last datagram
+    void updateNetworkJitter(uint16_t seq_num);
+    /// \brief Writes a received datagram to mPacketTrace, if set
+    void tracePacket(int64_t arrival_ns, int64_t kernel_ns, uint16_t seq_num,
+                     int n_bytes, int full_packet_size, int index, uint8_t flags);
+    /// \brief Updates the packet counters, returns false if the packet is out of order
+    bool updatePacketCounters(uint16_t newer_seq_num, uint16_t last_seq_num, int16_t& lost);
+    /// \brief Sends the audio of a full packet to the jitter buffer
+    template <DataProtocol::packetHeaderTypeT HeaderType>
+    bool writeAudioPacket(int8_t* full_packet, int gap_size);
     
     int mBindPort; ///< Local Port number to Bind
     int mPeerPort; ///< Peer Port number
@@ -219,23 +360,129 @@ private:
     bool mInitialState;
 
     unsigned int mUdpRedundancyFactor; ///< Factor of redundancy
+    unsigned int mFecGroupSize; ///< Parity FEC group size, 0 if FEC is off
+    unsigned int mFecParityCount; ///< Parity packets per FEC group
+    ParityFec* mFec;
+    uint16_t mFecNextSeq; ///< Next packet to send to the jitter buffer
+    int mFecPendingGap; ///< Lost audio bytes not yet reported to the jitter buffer
+    unsigned int mAggregation; ///< Audio periods sent in each datagram
+    unsigned int mAggregateCount; ///< Periods since the last datagram was sent
+    int mMtu; ///< Path MTU, 0 to let IP fragment large datagrams
+    PacketFragments* mFragments;
+    int mFragmentPendingGap; ///< Lost audio bytes not yet reported to the jitter buffer
+    bool mLossless; ///< Compress the audio with LosslessCodec
+    LosslessCodec* mLosslessCodec;
+    int mOpusBitrate; ///< Opus bitrate in bits/s, 0 if Opus is off
+    int mOpusComplexity;
+    OpusCodec* mOpus;
+
+    // Discontinuous transmission
+    struct DtxPacket {
+        uint32_t Magic; ///< Always sDtxMagic
+        uint16_t SeqNumber; ///< Sequence number of the newest silent packet
+        uint16_t SilentCount; ///< Consecutive silent packets up to SeqNumber
+    };
+    static const uint32_t sDtxMagic = 0x5844544a; ///< "JTDX"
+    double mDtxThreshold; ///< Peak amplitude of the silent packets, negative if DTX is off
+    uint16_t mDtxSilentCount; ///< Consecutive silent packets read from the audio
+    // The markers carry no header, the peer (or the hub worker) waits for one
+    static const int sDtxLeadIn = 8; ///< Datagrams sent with their audio at the start
+    int mDtxAudioCount; ///< Datagrams sent with their audio, up to sDtxLeadIn
+    int mDtxMarkerCount; ///< Markers since the last datagram with audio
+    int mDtxMaxMarkers; ///< Markers between datagrams with audio, about a second
+    int mSilentSlotSize; ///< Size of one silent period for the jitter buffer
+
+    // Kernel receive timestamps
+    bool mRxTimestamps; ///< SO_TIMESTAMPING or SO_TIMESTAMPNS is on
+    bool mRxHwTimestamps; ///< The NIC timestamps the datagrams
+    bool mRxTimestampValid; ///< mRxNetworkTime is the arrival of the last datagram
+    int64_t mRxNetworkTime; ///< Hardware timestamp if there is one, software otherwise, in ns
+    double mRxPeriodNs; ///< Duration of one audio period
+    bool mJitterStarted;
+    int64_t mJitterLastTime;
+    uint16_t mJitterLastSeq;
+    double mNetJitterNs; ///< RFC 3550 interarrival jitter estimate
+    std::atomic<uint32_t> mNetJitterUs;
+    // Wakeup and polling delay of the receiving thread, reset by getStats()
+    std::atomic<uint64_t> mHostDelaySumNs;
+    std::atomic<uint32_t> mHostDelayCount;
+    std::atomic<uint32_t> mHostDelayMaxNs;
+
+    // Paced sending
+    static const int sPacingCatchUp = 16; ///< Send 1/sPacingCatchUp faster than the audio to catch up
+    static const int sPacingMaxHold = 8; ///< Periods a datagram can be held back
+    pacingModeT mPacing;
+    double mPacingIntervalNs; ///< Audio duration of one datagram
+    int64_t mPacingLastNs; ///< Departure time of the last datagram, 0 before the first one
+    int64_t mTxTimeNs; ///< Departure time given to SO_TXTIME
+
+    XdpSocket* mXdp; ///< AF_XDP path for the datagrams, NULL to use only the kernel
+    bool mIoUring;
+    IoUringSocket* mUring; ///< Set up by run() with mIoUring, NULL if it isn't used
+    bool mSharedMemory;
+    ShmChannel* mShm; ///< Set up by run() with mSharedMemory when the peer is on this host
+    bool mShmIdle; ///< The ring has been quiet, look at the socket too
+    QString mPacketTracePath;
+    PacketTrace* mPacketTrace; ///< Set up by run() in RECEIVER mode with mPacketTracePath
+    LatencyHistogram* mArrivalHistogram; ///< --iostat histograms, NULL if off
+    LatencyHistogram* mAgeHistogram;
+    uint64_t mLastArrivalUs;
+
+    // Adaptive redundancy
+    struct LossFeedbackPacket {
+        uint32_t Magic; ///< Always sLossFeedbackMagic
+        uint32_t Tot;
+        uint32_t Lost;
+        uint32_t OutOfOrder;
+    };
+    static const uint32_t sLossFeedbackMagic = 0x464c544a; ///< "JTLF"
+    static const int sAdaptiveQuietFeedbacks = 50; ///< Loss free reports before stepping down
+    unsigned int mAdaptiveMin; ///< Redundancy (or parity count) without losses
+    unsigned int mAdaptiveMax; ///< 0 if the redundancy is fixed
+    std::atomic<unsigned int> mAdaptiveRedundancy; ///< Current redundancy (or parity count)
+    LossFeedback mLastPeerFeedback;
+    bool mHavePeerFeedback;
+    int mQuietFeedbackCount;
+    // Counters for the peer, never reset
+    std::atomic<uint32_t>  mNetTotCount;
+    std::atomic<uint32_t>  mNetLostCount;
+    std::atomic<uint32_t>  mNetOutOfOrderCount;
+    /// headerCapabilityT bits of the peer, set by our receiver on its first packet
+    std::atomic<uint8_t> mPeerCapabilities;
+
+    // Round trip time, from echoes of our timestamps. The peer subtracts the
+    // time the request waited for its send thread.
+    struct TimestampEchoPacket {
+        uint32_t Magic; ///< sEchoRequestMagic or sEchoReplyMagic
+        uint32_t HoldUs; ///< Replies only: time from the request arrival to the reply
+        uint64_t OrigUs; ///< LatencyHistogram::nowUs() of the requester, echoed back
+    };
+    static const uint32_t sEchoRequestMagic = 0x5145544a; ///< "JTEQ"
+    static const uint32_t sEchoReplyMagic = 0x5245544a; ///< "JTER"
+    bool mLatencyProbe;
+    // Pending request of the peer, set by its receiver, cleared once answered
+    std::atomic<uint64_t> mEchoOrigUs;
+    std::atomic<uint64_t> mEchoRxUs;
+    std::atomic<uint32_t> mRoundTripUs; ///< Smoothed, 0 until the first echo
     static QMutex sUdpMutex; ///< Mutex to make thread safe the binding process
 
     std::atomic<uint32_t>  mTotCount;
     std::atomic<uint32_t>  mLostCount;
     std::atomic<uint32_t>  mOutOfOrderCount;
     std::atomic<uint32_t>  mRevivedCount;
+    std::atomic<uint32_t>  mPartialCount;
     uint32_t  mStatCount;
 
+    bool mDatagramCodec; ///< True if the header type encodes the datagrams
+    std::vector<int8_t> mDatagram; ///< Encoded datagram, see PacketHeader::encodeDatagram()
+                                   ///< and LosslessCodec::encodeDatagram()
+
     uint8_t mControlPacketSize;
     bool mStopSignalSent;
 
     // packet loss/jitter simulation
-    double mSimulatedLossRate;
-    double mSimulatedJitterRate;
-    double mSimulatedJitterMaxDelay;
-    std::default_random_engine mRndEngine;
-    std::uniform_real_distribution<double> mUniformDist;
+    NetworkImpairment* mImpairment; ///< NULL unless setIssueSimulation() enabled a model
+    std::vector<char> mImpairmentBuffer;
 };
 
 #endif // __UDPDATAPROTOCOL_H__
@@ -44,6 +44,7 @@
 #include <QTcpSocket>
 #include <QStringList>
 #include <QMutexLocker>
+#include <QElapsedTimer>
 
 #include "UdpHubListener.h"
 #include "JackTripWorker.h"
@@ -111,6 +112,24 @@ UdpHubListener::UdpHubListener(int server_port, int server_udp_port) :
     mSimulatedDelayRel = 0.0;
 
     mUseRtUdpPriority = false;
+    mFecGroupSize = 0;
+    mFecParityCount = 0;
+    mAdaptiveRedundancyMax = 0;
+    mCompactHeader = false;
+    mAggregation = 1;
+    mMtu = 0;
+    mLossless = false;
+    mOpusBitrate = 0;
+    mOpusComplexity = 0;
+    mDtxLevel = 0.0;
+    mPacing = DataProtocol::NOPACING;
+    mXdpQueue = 0;
+    mIoUring = false;
+    mSharedMemory = true;
+    mMetricsPort = 0;
+    mMetricsExporter = NULL;
+    mStatsShm = false;
+    mStatsSegment = NULL;
 }
 
 
@@ -123,6 +142,7 @@ UdpHubListener::~UdpHubListener()
     for (int i = 0; i<gMaxThreads; i++) {
         delete mJTWorkers->at(i);
     }
+    delete mStatsSegment; // After the sessions have released their slots
     delete mJTWorkers;
 }
 
@@ -151,6 +171,25 @@ void UdpHubListener::start()
          << " (" << mHubPatchDescriptions.at(mHubPatch).toStdString() << ")" << endl;
     cout << "=======================================================" << endl;
     
+    if (0 < mMetricsPort && NULL == mMetricsExporter) {
+        mMetricsExporter = new MetricsExporter(this);
+        if (!mMetricsExporter->listen(mMetricsPort)) {
+            QString error_message = QString("Metrics server on port %1 ERROR: %2").arg(mMetricsPort).arg(mMetricsExporter->errorString());
+            std::cerr << error_message.toStdString() << endl;
+            emit signalError(error_message);
+            return;
+        }
+        updateHubMetrics(0.0);
+        cout << "JackTrip HUB SERVER: Metrics on http://localhost:" << mMetricsPort << "/metrics" << endl;
+    }
+
+    if (mStatsShm && NULL == mStatsSegment) {
+        mStatsSegment = StatsSegment::create();
+        if (NULL == mStatsSegment) {
+            std::cerr << "WARNING: Couldn't create the shared memory statistics for jacktrip-top" << endl;
+        }
+    }
+
     // Start our monitoring timer
     mStopCheckTimer.setInterval(200);
     connect(&mStopCheckTimer, &QTimer::timeout, this, &UdpHubListener::stopCheck);
@@ -168,6 +207,8 @@ void UdpHubListener::receivedNewConnection()
 
 void UdpHubListener::receivedClientInfo(QTcpSocket *clientConnection)
 {
+    QElapsedTimer admission_timer;
+    admission_timer.start();
     QHostAddress PeerAddress = clientConnection->peerAddress();
     cout << "JackTrip HUB SERVER: Client Connect Received from Address : "
          << PeerAddress.toString().toStdString() << endl;
@@ -240,9 +281,24 @@ void UdpHubListener::receivedClientInfo(QTcpSocket *clientConnection)
     }
     mJTWorkers->at(id)->setBufferStrategy(mBufferStrategy);
     mJTWorkers->at(id)->setNetIssuesSimulation(mSimulatedLossRate,
-    mSimulatedJitterRate, mSimulatedDelayRel);
+    mSimulatedJitterRate, mSimulatedDelayRel, mSimulatedModel);
     mJTWorkers->at(id)->setBroadcast(mBroadcastQueue);
     mJTWorkers->at(id)->setUseRtUdpPriority(mUseRtUdpPriority);
+    mJTWorkers->at(id)->setFec(mFecGroupSize, mFecParityCount);
+    mJTWorkers->at(id)->setAdaptiveRedundancy(mAdaptiveRedundancyMax);
+    mJTWorkers->at(id)->setCompactHeader(mCompactHeader);
+    mJTWorkers->at(id)->setAggregation(mAggregation);
+    mJTWorkers->at(id)->setMtu(mMtu);
+    mJTWorkers->at(id)->setLossless(mLossless);
+    mJTWorkers->at(id)->setOpus(mOpusBitrate, mOpusComplexity);
+    mJTWorkers->at(id)->setDtx(mDtxLevel);
+    mJTWorkers->at(id)->setPacing(mPacing);
+    mJTWorkers->at(id)->setXdp(mXdpInterface, mXdpQueue);
+    mJTWorkers->at(id)->setIoUring(mIoUring);
+    mJTWorkers->at(id)->setSharedMemory(mSharedMemory);
+    mJTWorkers->at(id)->setPacketTrace(mPacketTrace);
+    mJTWorkers->at(id)->setMetricsExporter(mMetricsExporter);
+    mJTWorkers->at(id)->setStatsSegment(mStatsSegment);
     // redirect port and spawn listener
     cout << "JackTrip HUB SERVER: Spawning JackTripWorker..." << endl;
     {
@@ -264,6 +320,7 @@ void UdpHubListener::receivedClientInfo(QTcpSocket *clientConnection)
     while (mJTWorkers->at(id)->isSpawning()) { QThread::msleep(10); }
     //mTotalRunningThreads++;
     cout << "JackTrip HUB SERVER: Total Running Threads:  " << mTotalRunningThreads << endl;
+    updateHubMetrics(admission_timer.nsecsElapsed() / 1e9);
     cout << "===============================================================" << endl;
     QThread::msleep(100);
 #ifdef WAIR // WAIR
@@ -475,6 +532,7 @@ int UdpHubListener::releaseThread(int id)
     mActiveAddress[id].address = "";
     mActiveAddress[id].port = 0;
     mTotalRunningThreads--;
+    updateHubMetrics(-1.0);
 #ifdef WAIR // wair
     if (isWAIR()) connectMesh(false); // invoked with -Sw
 #endif // endwhere
@@ -482,6 +540,15 @@ int UdpHubListener::releaseThread(int id)
     return 0; /// \todo Check if we really need to return an argument here
 }
 
+//*******************************************************************************
+void UdpHubListener::updateHubMetrics(double admission_sec)
+{
+    if (NULL != mMetricsExporter) {
+        mMetricsExporter->setHubGauges(mTotalRunningThreads,
+                                       mThreadPool.activeThreadCount(), admission_sec);
+    }
+}
+
 #ifdef WAIR // wair
 #include "JMess.h"
 //*******************************************************************************
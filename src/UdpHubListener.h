@@ -166,7 +166,30 @@ private:
     double mSimulatedLossRate;
     double mSimulatedJitterRate;
     double mSimulatedDelayRel;
+    QString mSimulatedModel;
     bool mUseRtUdpPriority;
+    unsigned int mFecGroupSize;
+    unsigned int mFecParityCount;
+    unsigned int mAdaptiveRedundancyMax;
+    bool mCompactHeader;
+    unsigned int mAggregation;
+    int mMtu;
+    bool mLossless;
+    int mOpusBitrate;
+    int mOpusComplexity;
+    double mDtxLevel;
+    DataProtocol::pacingModeT mPacing;
+    QString mXdpInterface;
+    int mXdpQueue;
+    bool mIoUring;
+    bool mSharedMemory;
+    QString mPacketTrace;
+    int mMetricsPort; ///< Localhost port of the metrics server, 0 for none
+    MetricsExporter* mMetricsExporter;
+    bool mStatsShm; ///< Publish the sessions for jacktrip-top
+    StatsSegment* mStatsSegment;
+    /// \brief Refreshes the hub gauges, admission_sec < 0 keeps the last admission time
+    void updateHubMetrics(double admission_sec);
     
 #ifdef WAIR // wair
     bool mWAIR;
@@ -189,14 +212,39 @@ public :
     void setIOStatStream(QSharedPointer<std::ofstream> statStream) { mIOStatStream = statStream; }
 
     void setBufferStrategy(int BufferStrategy) { mBufferStrategy = BufferStrategy; }
-    void setNetIssuesSimulation(double loss, double jitter, double delay_rel)
+    void setNetIssuesSimulation(double loss, double jitter, double delay_rel,
+                                const QString& model = QString())
     {
         mSimulatedLossRate = loss;
         mSimulatedJitterRate = jitter;
         mSimulatedDelayRel = delay_rel;
+        mSimulatedModel = model;
     }
     void setBroadcast(int broadcast_queue) {mBroadcastQueue = broadcast_queue;}
     void setUseRtUdpPriority(bool use) {mUseRtUdpPriority = use;}
+    void setFec(unsigned int group_size, unsigned int parity_count)
+    {
+        mFecGroupSize = group_size;
+        mFecParityCount = parity_count;
+    }
+    void setAdaptiveRedundancy(unsigned int max_redundancy) { mAdaptiveRedundancyMax = max_redundancy; }
+    void setCompactHeader(bool compact) { mCompactHeader = compact; }
+    void setAggregation(unsigned int periods) { mAggregation = periods; }
+    void setMtu(int mtu) { mMtu = mtu; }
+    void setLossless(bool lossless) { mLossless = lossless; }
+    void setOpus(int bitrate, int complexity)
+    {
+        mOpusBitrate = bitrate;
+        mOpusComplexity = complexity;
+    }
+    void setDtx(double level_db) { mDtxLevel = level_db; }
+    void setPacing(DataProtocol::pacingModeT mode) { mPacing = mode; }
+    void setXdp(const QString& ifname, int queue) { mXdpInterface = ifname; mXdpQueue = queue; }
+    void setIoUring(bool enable) { mIoUring = enable; }
+    void setSharedMemory(bool enable) { mSharedMemory = enable; }
+    void setPacketTrace(const QString& path) { mPacketTrace = path; }
+    void setMetricsPort(int port) { mMetricsPort = port; }
+    void setStatsShm(bool enable) { mStatsShm = enable; }
 
 };
 
@@ -0,0 +1,729 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file XdpSocket.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#include "XdpSocket.h"
+
+#include <iostream>
+
+using std::cerr; using std::endl;
+
+#if defined (__LINUX__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <dirent.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP // Older C library headers
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace {
+/// \brief XDP program and maps shared by the sockets on one interface
+struct XdpProgram {
+    int ifindex;
+    int users;
+    int ports_fd; ///< UDP port -> queue+1 of the socket that wants it
+    int xsks_fd; ///< Queue -> socket
+    int prog_fd;
+    int link_fd;
+};
+}
+
+static std::mutex sProgramMutex;
+static std::vector<XdpProgram> sPrograms;
+static const int sMaxQueues = 256;
+
+
+//*******************************************************************************
+static inline int bpf(int cmd, union bpf_attr* attr)
+{
+    return ::syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+//*******************************************************************************
+static inline struct bpf_insn bpfInsn(uint8_t code, uint8_t dst, uint8_t src,
+                                      int16_t off, int32_t imm)
+{
+    struct bpf_insn insn;
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+
+//*******************************************************************************
+static int createMap(uint32_t type, uint32_t max_entries)
+{
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = max_entries;
+    return bpf(BPF_MAP_CREATE, &attr);
+}
+
+
+//*******************************************************************************
+static int updateMap(int map_fd, uint32_t key, uint32_t value)
+{
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    attr.value = reinterpret_cast<uint64_t>(&value);
+    attr.flags = BPF_ANY;
+    return bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+
+//*******************************************************************************
+static uint32_t lookupMap(int map_fd, uint32_t key)
+{
+    uint32_t value = 0;
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    attr.value = reinterpret_cast<uint64_t>(&value);
+    bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+    return value;
+}
+
+
+//*******************************************************************************
+static void deleteMapEntry(int map_fd, uint32_t key)
+{
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+
+//*******************************************************************************
+// Redirects the IPv4 UDP datagrams (without IP options or fragments) whose
+// port is in ports_fd, when they arrive on the queue of the socket that
+// wants them. Everything else goes on to the kernel (XDP_PASS).
+static int loadProgram(int ports_fd, int xsks_fd)
+{
+    const uint8_t data = offsetof(struct xdp_md, data);
+    const uint8_t data_end = offsetof(struct xdp_md, data_end);
+    const uint8_t rx_queue_index = offsetof(struct xdp_md, rx_queue_index);
+    std::vector<struct bpf_insn> insns;
+    std::vector<size_t> jumps_to_pass;
+
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, data, 0));
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, data_end, 0));
+    // Ethernet, IPv4 and UDP headers
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 14 + 20 + 8));
+    jumps_to_pass.push_back(insns.size());
+    insns.push_back(bpfInsn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0));
+    // EtherType
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 12, 0));
+    jumps_to_pass.push_back(insns.size());
+    insns.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, htons(0x0800)));
+    // Version and header length
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 14, 0));
+    jumps_to_pass.push_back(insns.size());
+    insns.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, 0x45));
+    // Protocol
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 14 + 9, 0));
+    jumps_to_pass.push_back(insns.size());
+    insns.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, IPPROTO_UDP));
+    // More fragments flag and fragment offset
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 14 + 6, 0));
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, htons(0x3fff)));
+    jumps_to_pass.push_back(insns.size());
+    insns.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, 0));
+    // ports[destination port]
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 14 + 20 + 2, 0));
+    insns.push_back(bpfInsn(BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_5, 0, 0, 16));
+    insns.push_back(bpfInsn(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_5, -4, 0));
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0));
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4));
+    insns.push_back(bpfInsn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, ports_fd));
+    insns.push_back(bpfInsn(0, 0, 0, 0, 0));
+    insns.push_back(bpfInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+    jumps_to_pass.push_back(insns.size());
+    insns.push_back(bpfInsn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, 0));
+    // Only to the socket bound to the queue it arrived on
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_0, 0, 0));
+    insns.push_back(bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, rx_queue_index, 0));
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 1));
+    jumps_to_pass.push_back(insns.size());
+    insns.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_X, BPF_REG_5, BPF_REG_4, 0, 0));
+    // Falls back to XDP_PASS if the socket is gone
+    insns.push_back(bpfInsn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, xsks_fd));
+    insns.push_back(bpfInsn(0, 0, 0, 0, 0));
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS));
+    insns.push_back(bpfInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+    insns.push_back(bpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    // Pass
+    size_t pass = insns.size();
+    insns.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS));
+    insns.push_back(bpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    for (size_t i = 0; i < jumps_to_pass.size(); ++i) {
+        insns[jumps_to_pass[i]].off = pass - jumps_to_pass[i] - 1;
+    }
+
+    static const char license[] = "MIT";
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = insns.size();
+    attr.insns = reinterpret_cast<uint64_t>(insns.data());
+    attr.license = reinterpret_cast<uint64_t>(license);
+    return bpf(BPF_PROG_LOAD, &attr);
+}
+
+
+//*******************************************************************************
+static void closeProgram(const XdpProgram& program)
+{
+    // Closing the link detaches the program
+    int fds[] = {program.link_fd, program.prog_fd, program.xsks_fd, program.ports_fd};
+    for (int fd : fds) {
+        if (0 <= fd) {
+            ::close(fd);
+        }
+    }
+}
+
+
+//*******************************************************************************
+// Attaches the program to the interface on its first use
+static bool acquireProgram(int ifindex, int queue, int xsk_fd, uint16_t port)
+{
+    std::lock_guard<std::mutex> locker(sProgramMutex);
+    std::vector<XdpProgram>::iterator it = sPrograms.begin();
+    while (sPrograms.end() != it && ifindex != it->ifindex) {
+        ++it;
+    }
+    if (sPrograms.end() == it) {
+        XdpProgram program = {ifindex, 0, -1, -1, -1, -1};
+        program.ports_fd = createMap(BPF_MAP_TYPE_ARRAY, 0x10000);
+        program.xsks_fd = createMap(BPF_MAP_TYPE_XSKMAP, sMaxQueues);
+        if (0 > program.ports_fd || 0 > program.xsks_fd) {
+            cerr << "Could not create the XDP maps: " << std::strerror(errno) << endl;
+            closeProgram(program);
+            return false;
+        }
+        program.prog_fd = loadProgram(program.ports_fd, program.xsks_fd);
+        if (0 > program.prog_fd) {
+            cerr << "Could not load the XDP program: " << std::strerror(errno) << endl;
+            closeProgram(program);
+            return false;
+        }
+        union bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = program.prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        program.link_fd = bpf(BPF_LINK_CREATE, &attr);
+        if (0 > program.link_fd) {
+            // e.g., another program is attached, or the kernel is older than 5.9
+            cerr << "Could not attach the XDP program: " << std::strerror(errno) << endl;
+            closeProgram(program);
+            return false;
+        }
+        it = sPrograms.insert(sPrograms.end(), program);
+    }
+    if (0 != updateMap(it->xsks_fd, queue, xsk_fd)
+            || 0 != updateMap(it->ports_fd, port, queue + 1)) {
+        cerr << "Could not register the XDP socket: " << std::strerror(errno) << endl;
+        deleteMapEntry(it->xsks_fd, queue);
+        if (0 == it->users) {
+            closeProgram(*it);
+            sPrograms.erase(it);
+        }
+        return false;
+    }
+    ++it->users;
+    return true;
+}
+
+
+//*******************************************************************************
+static void releaseProgram(int ifindex, int queue, uint16_t port)
+{
+    std::lock_guard<std::mutex> locker(sProgramMutex);
+    for (std::vector<XdpProgram>::iterator it = sPrograms.begin(); sPrograms.end() != it; ++it) {
+        if (ifindex != it->ifindex) {
+            continue;
+        }
+        if (static_cast<uint32_t>(queue + 1) == lookupMap(it->ports_fd, port)) {
+            updateMap(it->ports_fd, port, 0);
+        }
+        deleteMapEntry(it->xsks_fd, queue);
+        if (0 == --it->users) {
+            closeProgram(*it);
+            sPrograms.erase(it);
+        }
+        return;
+    }
+}
+
+
+//*******************************************************************************
+static int countQueues(const std::string& ifname)
+{
+    int count = 0;
+    DIR* dir = ::opendir(("/sys/class/net/" + ifname + "/queues").c_str());
+    if (NULL != dir) {
+        while (struct dirent* entry = ::readdir(dir)) {
+            if (0 == std::strncmp(entry->d_name, "rx-", 3)) {
+                ++count;
+            }
+        }
+        ::closedir(dir);
+    }
+    return std::min(std::max(1, count), sMaxQueues);
+}
+
+
+//*******************************************************************************
+static inline uint32_t addChecksum(uint32_t sum, const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (data[i] << 8) | data[i+1];
+    }
+    if (len & 1) {
+        sum += data[len-1] << 8;
+    }
+    return sum;
+}
+
+
+//*******************************************************************************
+static inline void putChecksum(uint8_t* dst, uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    uint16_t checksum = htons(~sum & 0xffff);
+    std::memcpy(dst, &checksum, sizeof(checksum));
+}
+
+
+//*******************************************************************************
+XdpSocket::XdpSocket() :
+    mFd(-1), mIfIndex(0), mQueue(-1), mZeroCopy(false),
+    mUmem(NULL), mMaxPayload(0),
+    mPeerMac(0),
+    mLocalIp(0), mPeerIp(0), mLocalPort(0), mPeerPort(0), mIpId(0)
+{
+    std::memset(&mFill, 0, sizeof(mFill));
+    std::memset(&mCompletion, 0, sizeof(mCompletion));
+    std::memset(&mRx, 0, sizeof(mRx));
+    std::memset(&mTx, 0, sizeof(mTx));
+    std::memset(mLocalMac, 0, sizeof(mLocalMac));
+}
+
+
+//*******************************************************************************
+XdpSocket* XdpSocket::create(const std::string& ifname, int queue, int udp_socket)
+{
+    struct sockaddr_in local;
+    struct sockaddr_in peer;
+    socklen_t local_len = sizeof(local);
+    socklen_t peer_len = sizeof(peer);
+    if (0 != ::getsockname(udp_socket, reinterpret_cast<struct sockaddr*>(&local), &local_len)
+            || 0 != ::getpeername(udp_socket, reinterpret_cast<struct sockaddr*>(&peer), &peer_len)
+            || AF_INET != local.sin_family || AF_INET != peer.sin_family) {
+        cerr << "AF_XDP needs a connected IPv4 socket, using the kernel UDP path" << endl;
+        return NULL;
+    }
+
+    XdpSocket* xdp = new XdpSocket();
+    xdp->mLocalIp = local.sin_addr.s_addr;
+    xdp->mLocalPort = local.sin_port;
+    xdp->mPeerIp = peer.sin_addr.s_addr;
+    xdp->mPeerPort = peer.sin_port;
+    if (!xdp->open(ifname, queue, udp_socket)) {
+        cerr << "Could not use AF_XDP on " << ifname << ", using the kernel UDP path" << endl;
+        delete xdp;
+        return NULL;
+    }
+    return xdp;
+}
+
+
+//*******************************************************************************
+bool XdpSocket::open(const std::string& ifname, int queue, int udp_socket)
+{
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    std::strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+    mIfIndex = ::if_nametoindex(ifr.ifr_name);
+    if (0 == mIfIndex || 0 != ::ioctl(udp_socket, SIOCGIFHWADDR, &ifr)) {
+        cerr << "No interface " << ifname << endl;
+        return false;
+    }
+    std::memcpy(mLocalMac, ifr.ifr_hwaddr.sa_data, sizeof(mLocalMac));
+    if (0 != ::ioctl(udp_socket, SIOCGIFMTU, &ifr)) {
+        return false;
+    }
+    mMaxPayload = std::min(sFrameSize - sHeadersSize, ifr.ifr_mtu - 20 - 8);
+
+    mFd = ::socket(AF_XDP, SOCK_RAW, 0);
+    if (0 > mFd) {
+        cerr << "Could not create an AF_XDP socket: " << std::strerror(errno) << endl;
+        return false;
+    }
+    void* umem = ::mmap(NULL, sNumFrames * sFrameSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (MAP_FAILED == umem) {
+        return false;
+    }
+    mUmem = static_cast<int8_t*>(umem);
+    struct xdp_umem_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.addr = reinterpret_cast<uint64_t>(mUmem);
+    reg.len = sNumFrames * sFrameSize;
+    reg.chunk_size = sFrameSize;
+    if (0 != ::setsockopt(mFd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))) {
+        cerr << "Could not register the UMEM: " << std::strerror(errno) << endl;
+        return false;
+    }
+
+    // One ring entry per frame, half of them to receive
+    int ring_size = sNumFrames / 2;
+    if (0 != ::setsockopt(mFd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size))
+            || 0 != ::setsockopt(mFd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size))
+            || 0 != ::setsockopt(mFd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size))
+            || 0 != ::setsockopt(mFd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size))) {
+        return false;
+    }
+    struct xdp_mmap_offsets offsets;
+    socklen_t offsets_len = sizeof(offsets);
+    if (0 != ::getsockopt(mFd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_len)
+            || !mapRing(&mFill, offsets.fr, XDP_UMEM_PGOFF_FILL_RING, ring_size, sizeof(uint64_t))
+            || !mapRing(&mCompletion, offsets.cr, XDP_UMEM_PGOFF_COMPLETION_RING, ring_size, sizeof(uint64_t))
+            || !mapRing(&mRx, offsets.rx, XDP_PGOFF_RX_RING, ring_size, sizeof(struct xdp_desc))
+            || !mapRing(&mTx, offsets.tx, XDP_PGOFF_TX_RING, ring_size, sizeof(struct xdp_desc))) {
+        cerr << "Could not map the AF_XDP rings: " << std::strerror(errno) << endl;
+        return false;
+    }
+    for (int i = 0; i < ring_size; ++i) {
+        static_cast<uint64_t*>(mFill.descs)[i] = static_cast<uint64_t>(i) * sFrameSize;
+        mFreeTxFrames.push_back(static_cast<uint64_t>(ring_size + i) * sFrameSize);
+    }
+    mFill.cached = ring_size;
+    __atomic_store_n(mFill.producer, mFill.cached, __ATOMIC_RELEASE);
+
+    // Zero-copy needs driver support, copy mode works everywhere. A queue
+    // already bound by another socket is busy.
+    struct sockaddr_xdp addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = mIfIndex;
+    int num_queues = countQueues(ifname);
+    for (int q = std::max(0, queue); q < num_queues && 0 > mQueue; ++q) {
+        addr.sxdp_queue_id = q;
+        addr.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
+        if (0 != ::bind(mFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) {
+            addr.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+            if (0 != ::bind(mFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) {
+                if (EBUSY == errno) {
+                    continue;
+                }
+                cerr << "Could not bind the AF_XDP socket: " << std::strerror(errno) << endl;
+                return false;
+            }
+        }
+        mQueue = q;
+    }
+    if (0 > mQueue) {
+        cerr << "All the queues of " << ifname << " are taken" << endl;
+        return false;
+    }
+    struct xdp_options options;
+    socklen_t options_len = sizeof(options);
+    mZeroCopy = (0 == ::getsockopt(mFd, SOL_XDP, XDP_OPTIONS, &options, &options_len)
+                 && (options.flags & XDP_OPTIONS_ZEROCOPY));
+
+    if (!acquireProgram(mIfIndex, mQueue, mFd, ntohs(mLocalPort))) {
+        mQueue = -1;
+        return false;
+    }
+    return true;
+}
+
+
+//*******************************************************************************
+bool XdpSocket::mapRing(Ring* ring, const struct xdp_ring_offset& offsets, uint64_t pgoff,
+                        int size, size_t desc_size)
+{
+    ring->map_size = offsets.desc + size * desc_size;
+    ring->map = ::mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, mFd, pgoff);
+    if (MAP_FAILED == ring->map) {
+        ring->map = NULL;
+        return false;
+    }
+    int8_t* base = static_cast<int8_t*>(ring->map);
+    ring->producer = reinterpret_cast<uint32_t*>(base + offsets.producer);
+    ring->consumer = reinterpret_cast<uint32_t*>(base + offsets.consumer);
+    ring->flags = reinterpret_cast<uint32_t*>(base + offsets.flags);
+    ring->descs = base + offsets.desc;
+    ring->mask = size - 1;
+    ring->cached = 0;
+    return true;
+}
+
+
+//*******************************************************************************
+XdpSocket::~XdpSocket()
+{
+    if (0 <= mQueue) {
+        releaseProgram(mIfIndex, mQueue, ntohs(mLocalPort));
+    }
+    Ring* rings[] = {&mFill, &mCompletion, &mRx, &mTx};
+    for (Ring* ring : rings) {
+        if (NULL != ring->map) {
+            ::munmap(ring->map, ring->map_size);
+        }
+    }
+    if (0 <= mFd) {
+        ::close(mFd);
+    }
+    if (NULL != mUmem) {
+        ::munmap(mUmem, sNumFrames * sFrameSize);
+    }
+}
+
+
+//*******************************************************************************
+bool XdpSocket::available()
+{
+    if (__atomic_load_n(mRx.producer, __ATOMIC_ACQUIRE) != mRx.cached) {
+        return true;
+    }
+    // In zero-copy mode the driver may wait for us to refill
+    if (__atomic_load_n(mFill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) {
+        ::recvfrom(mFd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    return false;
+}
+
+
+//*******************************************************************************
+int XdpSocket::receive(const Segment* segments, int count, bool peek)
+{
+    if (__atomic_load_n(mRx.producer, __ATOMIC_ACQUIRE) == mRx.cached) {
+        return -1;
+    }
+    struct xdp_desc desc = static_cast<const struct xdp_desc*>(mRx.descs)[mRx.cached & mRx.mask];
+    const uint8_t* frame = reinterpret_cast<const uint8_t*>(mUmem) + desc.addr;
+
+    // The program only redirects IPv4 without options, UDP to our port; like
+    // the connected kernel socket, take only what the peer sends
+    int n_bytes = -1;
+    uint32_t src_ip;
+    uint16_t src_port;
+    uint16_t udp_len;
+    std::memcpy(&src_ip, frame + 14 + 12, sizeof(src_ip));
+    std::memcpy(&src_port, frame + 14 + 20, sizeof(src_port));
+    std::memcpy(&udp_len, frame + 14 + 20 + 4, sizeof(udp_len));
+    udp_len = ntohs(udp_len);
+    if (static_cast<uint32_t>(sHeadersSize) <= desc.len && mPeerIp == src_ip
+            && mPeerPort == src_port && 8 <= udp_len
+            && desc.len >= static_cast<uint32_t>(sHeadersSize - 8 + udp_len)) {
+        const uint8_t* payload = frame + sHeadersSize;
+        size_t left = udp_len - 8;
+        n_bytes = 0;
+        for (int i = 0; i < count && 0 < left; ++i) {
+            size_t n = std::min(left, segments[i].size);
+            if (0 < n) {
+                std::memcpy(segments[i].data, payload, n);
+            }
+            payload += n;
+            left -= n;
+            n_bytes += n;
+        }
+        // Next hop to the peer, it can change with the route
+        uint64_t mac = 0;
+        for (int i = 0; i < 6; ++i) {
+            mac = (mac << 8) | frame[6 + i];
+        }
+        if (mac != mPeerMac.load(std::memory_order_relaxed)) {
+            mPeerMac.store(mac, std::memory_order_relaxed);
+        }
+    }
+    if (peek && 0 <= n_bytes) {
+        return n_bytes;
+    }
+
+    // Give the frame back to the kernel
+    ++mRx.cached;
+    __atomic_store_n(mRx.consumer, mRx.cached, __ATOMIC_RELEASE);
+    static_cast<uint64_t*>(mFill.descs)[mFill.cached & mFill.mask] =
+            desc.addr & ~static_cast<uint64_t>(sFrameSize - 1);
+    ++mFill.cached;
+    __atomic_store_n(mFill.producer, mFill.cached, __ATOMIC_RELEASE);
+    return n_bytes;
+}
+
+
+//*******************************************************************************
+int XdpSocket::send(const Segment* segments, int count)
+{
+    uint64_t peer_mac = mPeerMac.load(std::memory_order_relaxed);
+    size_t payload_size = 0;
+    for (int i = 0; i < count; ++i) {
+        payload_size += segments[i].size;
+    }
+    if (0 == peer_mac || static_cast<size_t>(mMaxPayload) < payload_size) {
+        return -1;
+    }
+
+    // Frames the driver is done with
+    uint32_t completed = __atomic_load_n(mCompletion.producer, __ATOMIC_ACQUIRE);
+    while (completed != mCompletion.cached) {
+        mFreeTxFrames.push_back(static_cast<uint64_t*>(mCompletion.descs)[mCompletion.cached & mCompletion.mask]);
+        ++mCompletion.cached;
+    }
+    __atomic_store_n(mCompletion.consumer, mCompletion.cached, __ATOMIC_RELEASE);
+    if (mFreeTxFrames.empty()) {
+        kick();
+        return -1;
+    }
+    uint64_t addr = mFreeTxFrames.back();
+    mFreeTxFrames.pop_back();
+    uint8_t* frame = reinterpret_cast<uint8_t*>(mUmem) + addr;
+
+    // Ethernet
+    for (int i = 0; i < 6; ++i) {
+        frame[i] = peer_mac >> (8 * (5 - i));
+    }
+    std::memcpy(frame + 6, mLocalMac, sizeof(mLocalMac));
+    frame[12] = 0x08;
+    frame[13] = 0x00;
+    // IPv4, don't fragment
+    uint8_t* ip = frame + 14;
+    uint16_t ip_len = htons(20 + 8 + payload_size);
+    uint16_t ip_id = htons(mIpId++);
+    uint16_t ip_flags = htons(0x4000);
+    ip[0] = 0x45;
+    ip[1] = 0;
+    std::memcpy(ip + 2, &ip_len, 2);
+    std::memcpy(ip + 4, &ip_id, 2);
+    std::memcpy(ip + 6, &ip_flags, 2);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    std::memset(ip + 10, 0, 2);
+    std::memcpy(ip + 12, &mLocalIp, 4);
+    std::memcpy(ip + 16, &mPeerIp, 4);
+    putChecksum(ip + 10, addChecksum(0, ip, 20));
+    // UDP
+    uint8_t* udp = ip + 20;
+    uint16_t udp_len = htons(8 + payload_size);
+    std::memcpy(udp, &mLocalPort, 2);
+    std::memcpy(udp + 2, &mPeerPort, 2);
+    std::memcpy(udp + 4, &udp_len, 2);
+    std::memset(udp + 6, 0, 2);
+    uint8_t* payload = udp + 8;
+    for (int i = 0; i < count; ++i) {
+        std::memcpy(payload, segments[i].data, segments[i].size);
+        payload += segments[i].size;
+    }
+    // Pseudo header, header and payload
+    uint32_t sum = addChecksum(0, ip + 12, 8) + IPPROTO_UDP + 8 + payload_size;
+    putChecksum(udp + 6, addChecksum(sum, udp, 8 + payload_size));
+    if (0 == udp[6] && 0 == udp[7]) {
+        udp[6] = udp[7] = 0xff;
+    }
+
+    struct xdp_desc& desc = static_cast<struct xdp_desc*>(mTx.descs)[mTx.cached & mTx.mask];
+    desc.addr = addr;
+    desc.len = sHeadersSize + payload_size;
+    desc.options = 0;
+    ++mTx.cached;
+    __atomic_store_n(mTx.producer, mTx.cached, __ATOMIC_RELEASE);
+    kick();
+    return payload_size;
+}
+
+
+//*******************************************************************************
+void XdpSocket::kick()
+{
+    if (__atomic_load_n(mTx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) {
+        ::sendto(mFd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+}
+
+#else // __LINUX__
+
+//*******************************************************************************
+XdpSocket* XdpSocket::create(const std::string& /*ifname*/, int /*queue*/, int /*udp_socket*/)
+{
+    cerr << "AF_XDP is Linux only, using the kernel UDP path" << endl;
+    return NULL;
+}
+
+XdpSocket::~XdpSocket() {}
+bool XdpSocket::available() { return false; }
+int XdpSocket::receive(const Segment* /*segments*/, int /*count*/, bool /*peek*/) { return -1; }
+int XdpSocket::send(const Segment* /*segments*/, int /*count*/) { return -1; }
+
+#endif // __LINUX__
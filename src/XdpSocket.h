@@ -0,0 +1,154 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file XdpSocket.h
+ * \author JackTrip contributors
+ * \date October 2020
+ */
+
+#ifndef __XDPSOCKET_H__
+#define __XDPSOCKET_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct xdp_ring_offset; // see linux/if_xdp.h
+
+/** \brief AF_XDP socket that carries the datagrams of a UDP session past the
+ * kernel network stack (Linux only)
+ *
+ * An XDP program on the interface redirects the IPv4 UDP datagrams that arrive
+ * on our queue for our port into the receive ring of the socket. The frames
+ * live in a UMEM area registered with the socket, which the NIC fills directly
+ * when its driver supports zero-copy, and the kernel copies into otherwise.
+ * Sent datagrams are built in the same area, Ethernet, IP and UDP headers
+ * included, and handed to the driver.
+ *
+ * It works next to the kernel UDP socket of the session, not instead of it:
+ * the kernel still resolves the peer address, does the handshakes, and
+ * carries what doesn't fit a frame or arrives on another queue. The next hop
+ * MAC address is learnt from the first datagram received here, send()
+ * declines until then so that the caller uses the kernel socket.
+ *
+ * A queue can only be bound by one socket, so each session takes a queue of
+ * its own. The NIC has to steer the session port to it (e.g., ethtool -N),
+ * the datagrams it steers elsewhere just take the kernel path.
+ *
+ * The receiving thread calls available() and receive(), the sending thread
+ * send(). Each side has its own rings and frames.
+ */
+class XdpSocket
+{
+public:
+
+    /// \brief Piece of a datagram, to gather or scatter it
+    struct Segment {
+        char* data;
+        size_t size;
+    };
+
+    /** \brief Sets up a socket for the datagrams of a UDP socket
+     * \param ifname Interface the datagrams go through
+     * \param queue First queue to try, the next ones are tried if it is taken
+     * \param udp_socket Bound and connected IPv4 UDP socket
+     * \return NULL if AF_XDP can't be used, the reason is printed
+     */
+    static XdpSocket* create(const std::string& ifname, int queue, int udp_socket);
+    virtual ~XdpSocket();
+
+    /// \brief True if a datagram is waiting in the receive ring
+    bool available();
+    /** \brief Scatters the payload of the next datagram into segments
+     * \param peek Leave the datagram in the ring
+     * \return Bytes copied, -1 if there was no datagram for us
+     */
+    int receive(const Segment* segments, int count, bool peek = false);
+    int receive(char* buf, size_t n)
+    { Segment segment = {buf, n}; return receive(&segment, 1); }
+    /** \brief Gathers segments into a datagram and queues it to the driver
+     * \return Bytes sent, -1 if it has to go through the kernel socket instead
+     */
+    int send(const Segment* segments, int count);
+
+    int getQueue() const { return mQueue; }
+    bool isZeroCopy() const { return mZeroCopy; }
+
+private:
+    /// \brief Producer/consumer ring shared with the kernel
+    struct Ring {
+        uint32_t* producer;
+        uint32_t* consumer;
+        uint32_t* flags;
+        void* descs;
+        uint32_t mask;
+        uint32_t cached; ///< Our own producer or consumer position
+        void* map;
+        size_t map_size;
+    };
+
+    static const int sFrameSize = 4096;
+    static const int sNumFrames = 256; ///< Half to receive, half to send
+    static const int sHeadersSize = 14 + 20 + 8; ///< Ethernet, IPv4, UDP
+
+    XdpSocket();
+    bool open(const std::string& ifname, int queue, int udp_socket);
+    bool mapRing(Ring* ring, const struct xdp_ring_offset& offsets, uint64_t pgoff,
+                 int size, size_t desc_size);
+    void kick();
+
+    int mFd;
+    int mIfIndex;
+    int mQueue;
+    bool mZeroCopy;
+    int8_t* mUmem;
+    Ring mFill;
+    Ring mCompletion;
+    Ring mRx;
+    Ring mTx;
+    std::vector<uint64_t> mFreeTxFrames;
+    int mMaxPayload;
+
+    // Addresses in network byte order
+    uint8_t mLocalMac[6];
+    std::atomic<uint64_t> mPeerMac; ///< Next hop, learnt by the receiving thread, 0 if unknown
+    uint32_t mLocalIp;
+    uint32_t mPeerIp;
+    uint16_t mLocalPort;
+    uint16_t mPeerPort;
+    uint16_t mIpId;
+};
+
+#endif // __XDPSOCKET_H__
@@ -25,6 +25,18 @@ DEFINES += WAIRTOHUB
 nojack {
   DEFINES += __NO_JACK__
 }
+# Opus codec, needs a libopus built with --enable-custom-modes
+opus {
+  DEFINES += __OPUS__
+  LIBS += -lopus
+  INCLUDEPATH += /usr/include/opus /usr/local/include/opus
+}
+# Real-time safety checker for the audio callbacks, see RtCheck.h (Linux only)
+rtcheck {
+  DEFINES += __RTCHECK__
+  LIBS += -ldl
+  QMAKE_LFLAGS += -rdynamic
+}
 
 # for plugins
 INCLUDEPATH += ../faust-src-lair/stk
@@ -141,6 +153,20 @@ HEADERS += DataProtocol.h \
            LoopBack.h \
            NetKS.h \
            PacketHeader.h \
+           PacketHeaderCodec.h \
+           ParityFec.h \
+           PacketFragments.h \
+           LosslessCodec.h \
+           OpusCodec.h \
+           XdpSocket.h \
+           IoUringSocket.h \
+           ShmChannel.h \
+           PacketTrace.h \
+           NetworkImpairment.h \
+           LatencyHistogram.h \
+           MetricsExporter.h \
+           StatsSegment.h \
+           RtCheck.h \
            ProcessPlugin.h \
            RingBuffer.h \
            RingBufferWavetable.h \
@@ -172,6 +198,19 @@ SOURCES += DataProtocol.cpp \
            JitterBuffer.cpp \
            LoopBack.cpp \
            PacketHeader.cpp \
+           ParityFec.cpp \
+           PacketFragments.cpp \
+           LosslessCodec.cpp \
+           OpusCodec.cpp \
+           XdpSocket.cpp \
+           IoUringSocket.cpp \
+           ShmChannel.cpp \
+           PacketTrace.cpp \
+           NetworkImpairment.cpp \
+           LatencyHistogram.cpp \
+           MetricsExporter.cpp \
+           StatsSegment.cpp \
+           RtCheck.cpp \
            ProcessPlugin.cpp \
            RingBuffer.cpp \
            Settings.cpp \
@@ -0,0 +1,539 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file jacktrip_bench.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ *
+ * Microbenchmarks of the audio and network hot paths. Each benchmark runs a
+ * fixed number of operations a few times and reports the nanoseconds per
+ * operation of every repeat, as JSON on stdout, so that releases can be
+ * compared. Progress goes to stderr.
+ */
+
+#include "AudioInterface.h"
+#include "Compressor.h"
+#include "JackTrip.h"
+#include "JitterBuffer.h"
+#include "Limiter.h"
+#include "PacketHeaderCodec.h"
+#include "Reverb.h"
+#include "RingBuffer.h"
+#include "RingBufferWavetable.h"
+#include "UdpDataProtocol.h"
+#include "jacktrip_globals.h"
+
+#include <QCoreApplication>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cout; using std::cerr; using std::endl;
+
+static const int sBufferSize = 128; ///< Frames per period in all the benchmarks
+static const int sNumChans = 2;
+static const int sSampleRate = 48000;
+
+/// \brief Results end up here so that the compiler keeps the work
+static volatile int sSink = 0;
+
+
+//*******************************************************************************
+/// \brief Audio interface without audio, it only gives JackTrip its settings
+class BenchAudioInterface : public AudioInterface
+{
+public:
+    BenchAudioInterface(JackTrip* jacktrip, AudioInterface::audioBitResolutionT bit_res) :
+        AudioInterface(jacktrip, sNumChans, sNumChans, bit_res)
+    {
+        setSampleRate(sSampleRate);
+        setBufferSizeInSamples(sBufferSize);
+    }
+    virtual int startProcess() const { return 0; }
+    virtual int stopProcess() const { return 0; }
+    virtual void connectDefaultPorts() {}
+    virtual void setClientName(QString /*ClientName*/) {}
+};
+
+
+//*******************************************************************************
+/** \brief UdpDataProtocol whose datagrams stay in memory
+ *
+ * The sender keeps its last datagram. The receiver gets that datagram over and
+ * over with the sequence numbers moved on, so both ends go through the real
+ * packet assembly without a socket or a thread.
+ */
+class UdpDataProtocolBench : public UdpDataProtocol
+{
+public:
+    UdpDataProtocolBench(JackTrip* jacktrip, runModeT runmode, unsigned int redundancy) :
+        UdpDataProtocol(jacktrip, runmode, 0, 0, redundancy),
+        mRedundancy(redundancy), mReplaySeq(0),
+        mCurrentSeq(0), mLastSeq(0), mNewerSeq(0)
+    {
+        mSocket = -1;
+        mFullPacketSize = setupPacketBuffers();
+        // Same sizes as run()
+        mRedundantPacket.resize((RECEIVER == runmode) ? 0x10000 : mFullPacketSize * redundancy, 0);
+        resetPacketCounters();
+    }
+    virtual ~UdpDataProtocolBench() {}
+
+    virtual int sendPacket(const char* buf, const size_t n)
+    {
+        mWire.assign(buf, buf + n);
+        return n;
+    }
+    virtual int receivePacket(char* buf, const size_t n)
+    {
+        // The packets of a datagram go from the newest one back
+        ++mReplaySeq;
+        for (unsigned int i = 0; i < mRedundancy; ++i) {
+            DefaultHeaderStruct* header =
+                    reinterpret_cast<DefaultHeaderStruct*>(mWire.data() + i * mFullPacketSize);
+            header->SeqNumber = mReplaySeq - i;
+        }
+        size_t size = std::min(n, mWire.size());
+        std::memcpy(buf, mWire.data(), size);
+        return size;
+    }
+
+    void send()
+    {
+        sendPacketRedundancy(mRedundantPacket.data(), mRedundantPacket.size(), mFullPacketSize);
+    }
+    void receive()
+    {
+        receivePacketRedundancy<DataProtocol::DEFAULT>(mRedundantPacket.data(),
+                                                       mRedundantPacket.size(), mFullPacketSize,
+                                                       mCurrentSeq, mLastSeq, mNewerSeq);
+    }
+    const std::vector<char>& getWire() const { return mWire; }
+    void setWire(const std::vector<char>& wire) { mWire = wire; }
+
+private:
+    unsigned int mRedundancy;
+    int mFullPacketSize;
+    std::vector<int8_t> mRedundantPacket;
+    std::vector<char> mWire;
+    uint16_t mReplaySeq;
+    uint16_t mCurrentSeq;
+    uint16_t mLastSeq;
+    uint16_t mNewerSeq;
+};
+
+
+//*******************************************************************************
+/// \brief Runs the benchmarks and collects their results
+class BenchRunner
+{
+public:
+    BenchRunner(const std::string& filter, int repeats, double scale) :
+        mFilter(filter), mRepeats(repeats), mScale(scale) {}
+
+    /** \brief Times body, which has to do the given number of operations
+     * \param unit What one operation is, e.g., "packet" or "sample"
+     */
+    void run(const std::string& name, const std::string& unit, long operations,
+             const std::function<void(long)>& body)
+    {
+        if (!mFilter.empty() && std::string::npos == name.find(mFilter)) {
+            return;
+        }
+        operations = std::max(1L, static_cast<long>(operations * mScale));
+        body(operations / 10 + 1); // Warm up the caches and the branch predictor
+        Result result = {name, unit, operations, std::vector<double>()};
+        for (int i = 0; i < mRepeats; ++i) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            body(operations);
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            result.ns_per_op.push_back(elapsed.count() / operations);
+        }
+        std::vector<double> sorted = result.ns_per_op;
+        std::sort(sorted.begin(), sorted.end());
+        cerr << name << ": " << sorted[sorted.size() / 2] << " ns/" << unit << endl;
+        mResults.push_back(result);
+    }
+
+    void printJson(std::ostream& out) const
+    {
+        out << "{\n  \"version\": \"" << gVersion << "\",\n"
+            << "  \"buffer_size\": " << sBufferSize << ",\n"
+            << "  \"channels\": " << sNumChans << ",\n"
+            << "  \"sample_rate\": " << sSampleRate << ",\n"
+            << "  \"repeats\": " << mRepeats << ",\n"
+            << "  \"benchmarks\": [";
+        for (size_t i = 0; i < mResults.size(); ++i) {
+            const Result& result = mResults[i];
+            std::vector<double> sorted = result.ns_per_op;
+            std::sort(sorted.begin(), sorted.end());
+            out << ((0 == i) ? "\n" : ",\n")
+                << "    {\"name\": \"" << result.name << "\", \"unit\": \"" << result.unit
+                << "\", \"operations\": " << result.operations
+                << ", \"ns_per_op\": {\"min\": " << sorted.front()
+                << ", \"median\": " << sorted[sorted.size() / 2]
+                << ", \"max\": " << sorted.back() << ", \"runs\": [";
+            for (size_t j = 0; j < result.ns_per_op.size(); ++j) {
+                out << ((0 == j) ? "" : ", ") << result.ns_per_op[j];
+            }
+            out << "]}}";
+        }
+        out << "\n  ]\n}" << endl;
+    }
+
+private:
+    struct Result {
+        std::string name;
+        std::string unit;
+        long operations;
+        std::vector<double> ns_per_op; ///< One per repeat
+    };
+
+    std::string mFilter;
+    int mRepeats;
+    double mScale;
+    std::vector<Result> mResults;
+};
+
+
+//*******************************************************************************
+/// \brief Deterministic test signal, so that every run processes the same audio
+static void fillSignal(std::vector<float>& signal)
+{
+    uint32_t state = 0x12345678;
+    for (size_t i = 0; i < signal.size(); ++i) {
+        state = state * 1664525 + 1013904223;
+        float noise = (static_cast<int32_t>(state) / 2147483648.0f) * 0.1f;
+        signal[i] = 0.5f * std::sin(2.0f * 3.14159265f * 440.0f * i / sSampleRate) + noise;
+    }
+}
+
+
+//*******************************************************************************
+static JackTrip* newJackTrip(AudioInterface::audioBitResolutionT bit_res,
+                             DataProtocol::packetHeaderTypeT header_type,
+                             unsigned int redundancy)
+{
+    JackTrip* jacktrip = new JackTrip(JackTrip::CLIENT, JackTrip::UDP, sNumChans,
+                                      gDefaultQueueLength, redundancy, bit_res, header_type);
+    // JackTrip owns these
+    jacktrip->setAudioInterface(new BenchAudioInterface(jacktrip, bit_res));
+    jacktrip->setSampleRate(sSampleRate);
+    jacktrip->setAudioBufferSizeInSamples(sBufferSize);
+    int slot_size = jacktrip->getRingBuffersSlotSize();
+    jacktrip->setSendRingBuffer(new RingBuffer(slot_size, gDefaultOutputQueueLength));
+    jacktrip->setReceiveRingBuffer(new RingBuffer(slot_size, gDefaultQueueLength));
+    return jacktrip;
+}
+
+
+//*******************************************************************************
+/// \brief One thread inserts while another one reads, as the network and audio threads do
+static void benchRingBuffer(BenchRunner& runner, const std::string& name,
+                            const std::function<RingBuffer*()>& create, int slot_size)
+{
+    std::vector<int8_t> in_slot(slot_size, 1);
+    std::vector<int8_t> out_slot(slot_size, 0);
+
+    runner.run(name + "/insert_read", "slot", 200000, [&](long n) {
+        RingBuffer* buffer = create();
+        for (long i = 0; i < n; ++i) {
+            buffer->insertSlotNonBlocking(in_slot.data(), slot_size, 0);
+            buffer->readSlotNonBlocking(out_slot.data());
+        }
+        sSink += out_slot[0];
+        delete buffer;
+    });
+
+    runner.run(name + "/contended", "slot", 200000, [&](long n) {
+        RingBuffer* buffer = create();
+        std::thread writer([&]() {
+            for (long i = 0; i < n; ++i) {
+                buffer->insertSlotNonBlocking(in_slot.data(), slot_size, 0);
+            }
+        });
+        std::vector<int8_t> reader_slot(slot_size, 0);
+        for (long i = 0; i < n; ++i) {
+            buffer->readSlotNonBlocking(reader_slot.data());
+        }
+        writer.join();
+        sSink += reader_slot[0];
+        delete buffer;
+    });
+}
+
+
+//*******************************************************************************
+static void benchRingBuffers(BenchRunner& runner)
+{
+    const int bit_res = AudioInterface::BIT16;
+    const int slot_size = sBufferSize * sNumChans * AudioInterface::getSampleSize(bit_res);
+    benchRingBuffer(runner, "ringbuffer", [=]() {
+        return new RingBuffer(slot_size, gDefaultQueueLength);
+    }, slot_size);
+    benchRingBuffer(runner, "ringbuffer_wavetable", [=]() {
+        return new RingBufferWavetable(slot_size, gDefaultQueueLength);
+    }, slot_size);
+    benchRingBuffer(runner, "jitterbuffer", [=]() {
+        return new JitterBuffer(sBufferSize, gDefaultQueueLength, sSampleRate, 1, 0,
+                                sNumChans, bit_res);
+    }, slot_size);
+}
+
+
+//*******************************************************************************
+static void benchConversions(BenchRunner& runner)
+{
+    const int num_samples = sBufferSize * sNumChans;
+    std::vector<float> signal(num_samples);
+    fillSignal(signal);
+    std::vector<float> decoded(num_samples);
+    std::vector<int8_t> encoded(num_samples * sizeof(float));
+
+    struct Resolution {
+        const char* name;
+        AudioInterface::audioBitResolutionT bit_res;
+    };
+    const Resolution resolutions[] = {
+        {"8", AudioInterface::BIT8}, {"16", AudioInterface::BIT16},
+        {"24", AudioInterface::BIT24}, {"32", AudioInterface::BIT32},
+        {"16f", AudioInterface::FLOAT16}};
+
+    for (const Resolution& resolution : resolutions) {
+        const int sample_size = AudioInterface::getSampleSize(resolution.bit_res);
+        runner.run(std::string("conversion/to_bits/") + resolution.name, "sample", 20000000,
+                   [&](long n) {
+            for (long i = 0; i < n; ++i) {
+                int s = i % num_samples;
+                AudioInterface::fromSampleToBitConversion(&signal[s], &encoded[s * sample_size],
+                                                          resolution.bit_res);
+            }
+            sSink += encoded[0];
+        });
+        runner.run(std::string("conversion/to_sample/") + resolution.name, "sample", 20000000,
+                   [&](long n) {
+            for (long i = 0; i < n; ++i) {
+                int s = i % num_samples;
+                AudioInterface::fromBitToSampleConversion(&encoded[s * sample_size], &decoded[s],
+                                                          resolution.bit_res);
+            }
+            sSink += static_cast<int>(decoded[0]);
+        });
+    }
+}
+
+
+//*******************************************************************************
+static void benchHeaders(BenchRunner& runner)
+{
+    JackTrip* jacktrip = newJackTrip(AudioInterface::BIT16, DataProtocol::DEFAULT, 1);
+    int full_packet_size = jacktrip->getPacketSizeInBytes();
+    std::vector<int8_t> audio(jacktrip->getRingBuffersSlotSize(), 0);
+    std::vector<int8_t> packet(full_packet_size, 0);
+
+    runner.run("header/default/encode", "packet", 2000000, [&](long n) {
+        for (long i = 0; i < n; ++i) {
+            jacktrip->putHeaderInPacket(packet.data(), audio.data());
+            jacktrip->increaseSequenceNumber();
+        }
+        sSink += packet[0];
+    });
+    runner.run("header/default/decode_mediator", "packet", 20000000, [&](long n) {
+        int sum = 0;
+        for (long i = 0; i < n; ++i) {
+            sum += jacktrip->getPeerSequenceNumber(packet.data())
+                    + jacktrip->getPeerBufferSize(packet.data());
+        }
+        sSink += sum;
+    });
+    runner.run("header/default/decode_codec", "packet", 20000000, [&](long n) {
+        typedef PacketHeaderCodec<DataProtocol::DEFAULT> Codec;
+        int sum = 0;
+        for (long i = 0; i < n; ++i) {
+            sum += Codec::getPeerSequenceNumber(packet.data())
+                    + Codec::getPeerBufferSize(packet.data());
+        }
+        sSink += sum;
+    });
+    delete jacktrip;
+
+    // Compact headers are encoded per datagram
+    const unsigned int redundancy = 2;
+    jacktrip = newJackTrip(AudioInterface::BIT16, DataProtocol::COMPACT, redundancy);
+    full_packet_size = jacktrip->getPacketSizeInBytes();
+    std::vector<int8_t> packets(full_packet_size * redundancy, 0);
+    for (unsigned int i = 0; i < redundancy; ++i) {
+        jacktrip->putHeaderInPacket(packets.data() + i * full_packet_size, audio.data());
+        jacktrip->increaseSequenceNumber();
+    }
+    std::vector<int8_t> datagram(jacktrip->getMaxDatagramSize(redundancy, full_packet_size));
+    std::vector<int8_t> decoded(packets.size());
+    // Our own plain packets advertise the compact header, as a peer's would
+    jacktrip->decodeDatagram(packets.data(), packets.size(), decoded.data(), decoded.size());
+    int datagram_size = 0;
+    runner.run("header/compact/encode", "datagram", 2000000, [&](long n) {
+        for (long i = 0; i < n; ++i) {
+            datagram_size = jacktrip->encodeDatagram(packets.data(), redundancy, full_packet_size,
+                                                     datagram.data());
+        }
+        sSink += datagram_size;
+    });
+    runner.run("header/compact/decode", "datagram", 2000000, [&](long n) {
+        int size = 0;
+        for (long i = 0; i < n; ++i) {
+            size = jacktrip->decodeDatagram(datagram.data(), datagram_size, decoded.data(),
+                                            decoded.size());
+        }
+        sSink += size;
+    });
+    delete jacktrip;
+}
+
+
+//*******************************************************************************
+static void benchRedundancy(BenchRunner& runner)
+{
+    for (unsigned int redundancy = 1; redundancy <= 3; ++redundancy) {
+        std::string suffix = "/r" + std::to_string(redundancy);
+        JackTrip* jacktrip = newJackTrip(AudioInterface::BIT16, DataProtocol::DEFAULT, redundancy);
+        std::vector<int8_t> slot(jacktrip->getRingBuffersSlotSize(), 1);
+
+        // Includes taking the audio from the send ring buffer, as run() does
+        UdpDataProtocolBench sender(jacktrip, DataProtocol::SENDER, redundancy);
+        runner.run("redundancy/send" + suffix, "datagram", 1000000, [&](long n) {
+            for (long i = 0; i < n; ++i) {
+                jacktrip->sendNetworkPacket(slot.data());
+                sender.send();
+            }
+            sSink += sender.getWire().size();
+        });
+
+        // Includes writing the audio to the receive ring buffer, and reading it back
+        UdpDataProtocolBench receiver(jacktrip, DataProtocol::RECEIVER, redundancy);
+        receiver.setWire(sender.getWire());
+        runner.run("redundancy/receive" + suffix, "datagram", 1000000, [&](long n) {
+            for (long i = 0; i < n; ++i) {
+                receiver.receive();
+                jacktrip->receiveNetworkPacket(slot.data());
+            }
+            sSink += slot[0];
+        });
+        delete jacktrip;
+    }
+}
+
+
+//*******************************************************************************
+static void benchPlugin(BenchRunner& runner, const std::string& name, ProcessPlugin* plugin)
+{
+    plugin->init(sSampleRate);
+    std::vector<float> signal(sBufferSize * sNumChans);
+    fillSignal(signal);
+    std::vector<float> output(signal.size());
+    float* inputs[sNumChans];
+    float* outputs[sNumChans];
+    for (int c = 0; c < sNumChans; ++c) {
+        inputs[c] = signal.data() + c * sBufferSize;
+        outputs[c] = output.data() + c * sBufferSize;
+    }
+    runner.run("plugin/" + name, "period", 20000, [&](long n) {
+        for (long i = 0; i < n; ++i) {
+            plugin->compute(sBufferSize, inputs, outputs);
+        }
+        sSink += static_cast<int>(output[0]);
+    });
+    delete plugin;
+}
+
+
+//*******************************************************************************
+static void benchPlugins(BenchRunner& runner)
+{
+    benchPlugin(runner, "limiter", new Limiter(sNumChans, 1));
+    benchPlugin(runner, "compressor", new Compressor(sNumChans, false, CompressorPresets::voice));
+    benchPlugin(runner, "reverb_freeverb", new Reverb(sNumChans, sNumChans, 0.5));
+    benchPlugin(runner, "reverb_zitarev", new Reverb(sNumChans, sNumChans, 1.5));
+}
+
+
+//*******************************************************************************
+static void printUsage()
+{
+    cerr << "Usage: jacktrip-bench [options] > results.json" << endl;
+    cerr << " --filter <text>   Only run the benchmarks whose name contains text, e.g. redundancy/" << endl;
+    cerr << " --repeats <n>     Times each benchmark is run (default: 5)" << endl;
+    cerr << " --scale <x>       Multiply the number of operations, e.g. 0.1 for a quick run" << endl;
+}
+
+
+//*******************************************************************************
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    std::string filter;
+    int repeats = 5;
+    double scale = 1.0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ("--filter" == arg && i + 1 < argc) {
+            filter = argv[++i];
+        } else if ("--repeats" == arg && i + 1 < argc) {
+            repeats = std::atoi(argv[++i]);
+        } else if ("--scale" == arg && i + 1 < argc) {
+            scale = std::atof(argv[++i]);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (1 > repeats || 0.0 >= scale) {
+        printUsage();
+        return 1;
+    }
+
+    BenchRunner runner(filter, repeats, scale);
+    benchRingBuffers(runner);
+    benchConversions(runner);
+    benchHeaders(runner);
+    benchRedundancy(runner);
+    benchPlugins(runner);
+    runner.printJson(cout);
+    return 0;
+}
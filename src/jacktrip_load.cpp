@@ -0,0 +1,646 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file jacktrip_load.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ *
+ * Hub load generator. It connects N synthetic clients to a hub, through the
+ * same handshake and UdpDataProtocol threads as a real client, with generated
+ * audio instead of JACK. The clients are added step by step until the loss,
+ * the jitter buffer corrections or the latency of the worst client go over
+ * the thresholds. Run the hub on the same host, see scripts/test/hub_load.sh.
+ */
+
+#include "AudioInterface.h"
+#include "JackTrip.h"
+#include "RingBuffer.h"
+#include "jacktrip_globals.h"
+
+#include <QCoreApplication>
+#include <QTimer>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using std::cout; using std::cerr; using std::endl;
+
+static const float sToneLevel = 0.1f;
+static const float sMarkerLevel = 0.9f; ///< Anything above half of it on the way back is the marker
+
+
+//*******************************************************************************
+/// \brief CPU seconds used by a process so far, or -1 if it can't be read
+static double cpuSeconds(int pid)
+{
+#if defined (__LINUX__)
+    std::string path = (0 == pid) ? "/proc/self/stat" : "/proc/" + std::to_string(pid) + "/stat";
+    std::ifstream stat_file(path.c_str());
+    std::string stat;
+    if (!std::getline(stat_file, stat)) {
+        return -1.0;
+    }
+    // The name in parentheses may have spaces, the fields after it don't
+    size_t pos = stat.rfind(')');
+    if (std::string::npos == pos) {
+        return -1.0;
+    }
+    unsigned long utime = 0, stime = 0;
+    if (2 != std::sscanf(stat.c_str() + pos + 1,
+                         " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                         &utime, &stime)) {
+        return -1.0;
+    }
+    return double(utime + stime) / ::sysconf(_SC_CLK_TCK);
+#else // __LINUX__
+    (void)pid;
+    return -1.0;
+#endif // __LINUX__
+}
+
+
+class LoadAudioInterface;
+
+//*******************************************************************************
+/** \brief Period clock shared by all the synthetic clients
+ *
+ * One thread runs the audio callback of every client back to back, like a
+ * JACK server does for its clients, so N clients don't need N audio threads.
+ */
+class LoadClock
+{
+public:
+    LoadClock(uint32_t sample_rate, uint32_t buffer_size) :
+        mSampleRate(sample_rate), mBufferSize(buffer_size),
+        mStop(false), mLateCount(0) {}
+    ~LoadClock() { stop(); }
+
+    void start() { mThread = std::thread(&LoadClock::run, this); }
+    void stop()
+    {
+        mStop = true;
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+    /// \brief Once this returns, the clock doesn't run the callback of interface anymore
+    void add(LoadAudioInterface* interface)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mInterfaces.push_back(interface);
+    }
+    void remove(LoadAudioInterface* interface)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mInterfaces.erase(std::remove(mInterfaces.begin(), mInterfaces.end(), interface),
+                          mInterfaces.end());
+    }
+    /// \brief Periods that started late because the callbacks took too long
+    uint32_t getLateCount() const { return mLateCount; }
+
+private:
+    void run();
+
+    uint32_t mSampleRate;
+    uint32_t mBufferSize;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::vector<LoadAudioInterface*> mInterfaces;
+    std::atomic<bool> mStop;
+    std::atomic<uint32_t> mLateCount;
+};
+
+
+//*******************************************************************************
+/** \brief Audio interface of a synthetic client
+ *
+ * Sends a tone on every channel, with a one sample marker on the first channel
+ * about once a second. With the hub patched in client echo mode (-p 1) the
+ * marker comes back, which gives the round trip latency through the hub.
+ */
+class LoadAudioInterface : public AudioInterface
+{
+public:
+    LoadAudioInterface(JackTrip* jacktrip, LoadClock* clock, int num_chans,
+                       AudioInterface::audioBitResolutionT bit_res, uint32_t sample_rate,
+                       uint32_t buffer_size, int index) :
+        AudioInterface(jacktrip, num_chans, num_chans, bit_res),
+        mClock(clock), mInBuffer(num_chans), mOutBuffer(num_chans),
+        mMarkerFrame(0), mMarkerPending(false), mPeriod(0),
+        mLatencySumFrames(0), mLatencyCount(0), mLatencyMaxFrames(0)
+    {
+        setSampleRate(sample_rate);
+        setBufferSizeInSamples(buffer_size);
+        mInData.resize(num_chans * buffer_size, 0.0f);
+        mOutData.resize(num_chans * buffer_size, 0.0f);
+        for (int c = 0; c < num_chans; ++c) {
+            mInBuffer[c] = mInData.data() + c * buffer_size;
+            mOutBuffer[c] = mOutData.data() + c * buffer_size;
+        }
+        // A different tone for each client, so the hub mixes something real
+        mPhaseStep = 2.0 * 3.14159265358979 * (220.0 + 20.0 * (index % 40)) / sample_rate;
+        mMarkerPeriods = std::max(1u, sample_rate / buffer_size);
+    }
+    virtual ~LoadAudioInterface() { stopProcess(); }
+
+    virtual int startProcess() const { mClock->add(const_cast<LoadAudioInterface*>(this)); return 0; }
+    virtual int stopProcess() const { mClock->remove(const_cast<LoadAudioInterface*>(this)); return 0; }
+    virtual void connectDefaultPorts() {}
+    virtual void setClientName(QString /*ClientName*/) {}
+
+    /// \brief Runs one period, from the clock thread
+    void process(uint64_t frame)
+    {
+        unsigned int n_frames = getBufferSizeInSamples();
+        for (unsigned int i = 0; i < n_frames; ++i) {
+            float sample = sToneLevel * std::sin(mPhaseStep * (frame + i));
+            for (int c = 0; c < mInBuffer.size(); ++c) {
+                mInBuffer[c][i] = sample;
+            }
+        }
+        if (0 == mPeriod++ % mMarkerPeriods) {
+            mInBuffer[0][0] = sMarkerLevel;
+            mMarkerFrame = frame;
+            mMarkerPending = true;
+        }
+
+        callback(mInBuffer, mOutBuffer, n_frames);
+
+        for (unsigned int i = 0; mMarkerPending && i < n_frames; ++i) {
+            if (0.5f * sMarkerLevel < std::fabs(mOutBuffer[0][i])) {
+                // Only the first one, repeated packets bring the marker back again
+                mMarkerPending = false;
+                uint32_t latency = frame + i - mMarkerFrame;
+                mLatencySumFrames += latency;
+                ++mLatencyCount;
+                if (mLatencyMaxFrames < latency) {
+                    mLatencyMaxFrames = latency;
+                }
+            }
+        }
+    }
+
+    /// \brief Round trip latency since the last call, in frames, -1 if no marker came back
+    void takeLatency(double* avg_frames, double* max_frames)
+    {
+        uint64_t sum = mLatencySumFrames.exchange(0);
+        uint32_t count = mLatencyCount.exchange(0);
+        uint32_t max = mLatencyMaxFrames.exchange(0);
+        *avg_frames = (0 < count) ? double(sum) / count : -1.0;
+        *max_frames = (0 < count) ? double(max) : -1.0;
+    }
+
+private:
+    LoadClock* mClock;
+    std::vector<sample_t> mInData;
+    std::vector<sample_t> mOutData;
+    QVarLengthArray<sample_t*> mInBuffer;
+    QVarLengthArray<sample_t*> mOutBuffer;
+    double mPhaseStep;
+    uint32_t mMarkerPeriods;
+    uint64_t mMarkerFrame;
+    bool mMarkerPending;
+    uint64_t mPeriod;
+    std::atomic<uint64_t> mLatencySumFrames;
+    std::atomic<uint32_t> mLatencyCount;
+    std::atomic<uint32_t> mLatencyMaxFrames; ///< Only written by the clock thread
+};
+
+
+//*******************************************************************************
+void LoadClock::run()
+{
+    const std::chrono::nanoseconds period(uint64_t(1e9) * mBufferSize / mSampleRate);
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    uint64_t frame = 0;
+    while (!mStop) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (size_t i = 0; i < mInterfaces.size(); ++i) {
+                mInterfaces[i]->process(frame);
+            }
+        }
+        frame += mBufferSize;
+        next += period;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now > next + 4 * period) {
+            // Don't try to catch up, that would burst packets at the hub
+            ++mLateCount;
+            next = now;
+        }
+        std::this_thread::sleep_until(next);
+    }
+}
+
+
+//*******************************************************************************
+/// \brief JackTrip hub client with a LoadAudioInterface instead of JACK
+class LoadClient : public JackTrip
+{
+public:
+    LoadClient(LoadClock* clock, int index, int num_chans, int queue_length,
+               unsigned int redundancy, dataProtocolT data_protocol, int bind_port,
+               int tcp_port, uint32_t sample_rate, uint32_t buffer_size) :
+        JackTrip(CLIENTTOPINGSERVER, data_protocol, num_chans, queue_length, redundancy,
+                 AudioInterface::BIT16, DataProtocol::DEFAULT, WAVETABLE,
+                 bind_port, bind_port, gDefaultPort, gDefaultPort, tcp_port),
+        mClock(clock), mIndex(index), mLoadAudio(NULL),
+        mConnected(false), mStopped(false)
+    {
+        setSampleRate(sample_rate);
+        setAudioBufferSizeInSamples(buffer_size);
+        setRemoteClientName(QString("load%1").arg(index));
+        setConnectDefaultAudioPorts(false);
+        connect(this, &JackTrip::signalReceivedConnectionFromPeer, [this]() { mConnected = true; });
+        connect(this, &JackTrip::signalProcessesStopped, [this]() { mStopped = true; });
+        connect(this, &JackTrip::signalError, [this](const QString& message) {
+            cerr << "Client " << mIndex << ": " << message.toStdString() << endl;
+            mStopped = true;
+        });
+    }
+
+    virtual void setupAudio(
+        #ifdef WAIRTOHUB // WAIR
+            int /*ID*/
+        #endif // endwhere
+            )
+    {
+        mLoadAudio = new LoadAudioInterface(this, mClock, getNumInputChannels(),
+                                            AudioInterface::BIT16, getSampleRate(),
+                                            getBufferSizeInSamples(), mIndex);
+        mLoadAudio->setup();
+        setAudioInterface(mLoadAudio);
+    }
+
+    /// \brief Connected to the hub and not stopped since
+    bool isActive() const { return mConnected && !mStopped; }
+    bool hasStopped() const { return mStopped; }
+    /// \brief Only valid while the client is active, JackTrip deletes it on stop
+    LoadAudioInterface* getLoadAudio() const { return mLoadAudio; }
+
+private:
+    LoadClock* mClock;
+    int mIndex;
+    LoadAudioInterface* mLoadAudio;
+    bool mConnected;
+    bool mStopped;
+};
+
+
+//*******************************************************************************
+/// \brief Counters of a client at the start of a measurement
+struct ClientSnapshot {
+    uint32_t tot;
+    uint32_t lost;
+    uint32_t corrections; ///< Underruns, overflows and jitter buffer size changes
+};
+
+
+//*******************************************************************************
+static bool takeSnapshot(LoadClient* client, ClientSnapshot* snapshot)
+{
+    DataProtocol::PktStat pkt_stat;
+    RingBuffer::IOStat io_stat;
+    if (!client->getDataProtocolReceiver()->getStats(&pkt_stat)
+            || !client->getReceiveRingBuffer()->getStats(&io_stat, false)) {
+        return false;
+    }
+    snapshot->tot = pkt_stat.tot;
+    snapshot->lost = pkt_stat.lost;
+    snapshot->corrections = io_stat.underruns + io_stat.overflows
+            + io_stat.buf_inc_underrun + io_stat.buf_inc_compensate
+            + io_stat.buf_dec_overflows + io_stat.buf_dec_pktloss;
+    return true;
+}
+
+
+//*******************************************************************************
+/// \brief Settings of a load run, see printUsage()
+struct LoadSettings {
+    QString peer = "127.0.0.1";
+    int tcpPort = gDefaultPort;
+    int bindPort = gDefaultPort + 10000;
+    int numChans = gDefaultNumInChannels;
+    int queueLength = gDefaultQueueLength;
+    int bufferStrategy = 1;
+    unsigned int redundancy = 1;
+    bool sharedMemory = false;
+    uint32_t sampleRate = gDefaultSampleRate;
+    uint32_t bufferSize = gDefaultBufferSizeInSamples;
+    int startClients = 1;
+    int stepClients = 1;
+    int maxClients = 64;
+    int settleSec = 3;
+    int durationSec = 10;
+    double maxLossPercent = 1.0;
+    double maxCorrectionsPerSec = 1.0;
+    double maxLatencyMs = 0.0; ///< 0 doesn't check the latency
+    int hubPid = 0; ///< 0 doesn't measure the hub
+};
+
+
+//*******************************************************************************
+/** \brief Adds clients step by step and measures each step
+ *
+ * Each step adds clients, waits for them to settle, then measures all the
+ * clients over the step duration. The first step where the worst client
+ * goes over a threshold ends the run.
+ */
+class LoadGenerator
+{
+public:
+    LoadGenerator(const LoadSettings& settings) :
+        mSettings(settings), mClock(settings.sampleRate, settings.bufferSize),
+        mLastGood(0), mHubCpu0(0.0), mOwnCpu0(0.0), mLate0(0) {}
+    ~LoadGenerator()
+    {
+        for (LoadClient* client : mClients) {
+            client->stop();
+            delete client;
+        }
+    }
+
+    void start()
+    {
+        mClock.start();
+        cout << "clients  loss%max  corr/s max  latency ms avg/max  hub cpu%  load cpu%  late" << endl;
+        step(mSettings.startClients);
+    }
+
+private:
+    void step(int num_clients)
+    {
+        while (int(mClients.size()) < num_clients) {
+            int index = mClients.size();
+            LoadClient* client = new LoadClient(
+                        &mClock, index, mSettings.numChans, mSettings.queueLength,
+                        mSettings.redundancy,
+                        mSettings.sharedMemory ? JackTrip::SHM : JackTrip::UDP,
+                        mSettings.bindPort + index, mSettings.tcpPort,
+                        mSettings.sampleRate, mSettings.bufferSize);
+            client->setPeerAddress(mSettings.peer);
+            client->setBufferStrategy(mSettings.bufferStrategy);
+            mClients.push_back(client);
+            try {
+                client->startProcess(
+                        #ifdef WAIRTOHUB // WAIR
+                            index
+                        #endif // endwhere
+                            );
+            } catch (const std::exception& e) {
+                cerr << "Client " << index << ": " << e.what() << endl;
+                mClients.pop_back();
+                delete client;
+                finish("a client could not start");
+                return;
+            }
+        }
+        QTimer::singleShot(mSettings.settleSec * 1000, [this]() { beginMeasure(); });
+    }
+
+    void beginMeasure()
+    {
+        mSnapshots.assign(mClients.size(), ClientSnapshot());
+        for (size_t i = 0; i < mClients.size(); ++i) {
+            if (!mClients[i]->isActive() || !takeSnapshot(mClients[i], &mSnapshots[i])) {
+                finish("client " + std::to_string(i) + " did not connect");
+                return;
+            }
+            double avg, max;
+            mClients[i]->getLoadAudio()->takeLatency(&avg, &max);
+        }
+        mHubCpu0 = (0 < mSettings.hubPid) ? cpuSeconds(mSettings.hubPid) : -1.0;
+        mOwnCpu0 = cpuSeconds(0);
+        mLate0 = mClock.getLateCount();
+        mMeasureStart = std::chrono::steady_clock::now();
+        QTimer::singleShot(mSettings.durationSec * 1000, [this]() { endMeasure(); });
+    }
+
+    void endMeasure()
+    {
+        double seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - mMeasureStart).count();
+        double worst_loss = 0.0;
+        double worst_corrections = 0.0;
+        double latency_sum = 0.0;
+        int latency_count = 0;
+        double worst_latency = -1.0;
+        double ms_per_frame = 1000.0 / mSettings.sampleRate;
+        for (size_t i = 0; i < mClients.size(); ++i) {
+            ClientSnapshot end;
+            if (!mClients[i]->isActive() || !takeSnapshot(mClients[i], &end)) {
+                finish("client " + std::to_string(i) + " stopped");
+                return;
+            }
+            const ClientSnapshot& begin = mSnapshots[i];
+            uint32_t tot = end.tot - begin.tot;
+            double loss = (0 < tot) ? 100.0 * (end.lost - begin.lost) / tot : 100.0;
+            worst_loss = std::max(worst_loss, loss);
+            worst_corrections = std::max(worst_corrections,
+                                         (end.corrections - begin.corrections) / seconds);
+            double avg, max;
+            mClients[i]->getLoadAudio()->takeLatency(&avg, &max);
+            if (0.0 <= avg) {
+                latency_sum += avg * ms_per_frame;
+                ++latency_count;
+                worst_latency = std::max(worst_latency, max * ms_per_frame);
+            }
+        }
+        double hub_cpu = (0.0 <= mHubCpu0) ? cpuSeconds(mSettings.hubPid) : -1.0;
+        double hub_percent = (0.0 <= hub_cpu) ? 100.0 * (hub_cpu - mHubCpu0) / seconds : -1.0;
+        double own_percent = 100.0 * (cpuSeconds(0) - mOwnCpu0) / seconds;
+        double avg_latency = (0 < latency_count) ? latency_sum / latency_count : -1.0;
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "%7zu  %8.2f  %10.2f  %8.1f / %6.1f  %8.1f  %9.1f  %4u",
+                      mClients.size(), worst_loss, worst_corrections, avg_latency, worst_latency,
+                      hub_percent, own_percent, mClock.getLateCount() - mLate0);
+        cout << line << endl;
+
+        if (mSettings.maxLossPercent < worst_loss) {
+            finish("loss over " + std::to_string(mSettings.maxLossPercent) + "%");
+        } else if (mSettings.maxCorrectionsPerSec < worst_corrections) {
+            finish("jitter buffer corrections over "
+                   + std::to_string(mSettings.maxCorrectionsPerSec) + "/s");
+        } else if (0.0 < mSettings.maxLatencyMs
+                   && (0 == latency_count || mSettings.maxLatencyMs < worst_latency)) {
+            finish("latency over " + std::to_string(mSettings.maxLatencyMs) + " ms");
+        } else {
+            mLastGood = mClients.size();
+            if (mSettings.maxClients <= int(mClients.size())) {
+                finish("reached --max clients");
+            } else {
+                step(std::min(mSettings.maxClients,
+                              int(mClients.size()) + mSettings.stepClients));
+            }
+        }
+    }
+
+    void finish(const std::string& reason)
+    {
+        if (mClock.getLateCount() != mLate0) {
+            cout << "Warning: the load generator itself fell behind, "
+                    "run it on another core than the hub" << endl;
+        }
+        cout << "Stopped at " << mClients.size() << " clients: " << reason << endl;
+        cout << "Last step within the thresholds: " << mLastGood << " clients" << endl;
+        // The senders wait for audio, so the clock has to run until they stop
+        for (LoadClient* client : mClients) {
+            client->stop();
+        }
+        mClock.stop();
+        QCoreApplication::exit(0 < mLastGood ? 0 : 1);
+    }
+
+    LoadSettings mSettings;
+    LoadClock mClock;
+    std::vector<LoadClient*> mClients;
+    std::vector<ClientSnapshot> mSnapshots;
+    size_t mLastGood;
+    double mHubCpu0;
+    double mOwnCpu0;
+    uint32_t mLate0;
+    std::chrono::steady_clock::time_point mMeasureStart;
+};
+
+
+//*******************************************************************************
+static void printUsage()
+{
+    cerr << "Usage: jacktrip-load [options]" << endl;
+    cerr << "Connects synthetic clients to a hub until a threshold breaks. Start the hub" << endl;
+    cerr << "with -p 1 (client echo) to measure the round trip latency." << endl;
+    cerr << " --peer <host>            Hub address (default: 127.0.0.1)" << endl;
+    cerr << " --port <n>               Hub TCP port (default: " << gDefaultPort << ")" << endl;
+    cerr << " --bindport <n>           UDP port of the first client, the next ones count up (default: " << gDefaultPort + 10000 << ")" << endl;
+    cerr << " --channels <n>           Channels per client (default: " << gDefaultNumInChannels << ")" << endl;
+    cerr << " --queue <n>              Queue length of the clients (default: " << gDefaultQueueLength << ")" << endl;
+    cerr << " --bufstrategy <n>        Jitter buffer strategy of the clients (default: 1)" << endl;
+    cerr << " --redundancy <n>         Redundancy of the clients (default: 1)" << endl;
+    cerr << " --shm                    Let the clients use shared memory, instead of UDP as remote clients do" << endl;
+    cerr << " --srate <n>              Sample rate, same as the hub's JACK (default: " << gDefaultSampleRate << ")" << endl;
+    cerr << " --bufsize <n>            Period in frames, same as the hub's JACK (default: " << gDefaultBufferSizeInSamples << ")" << endl;
+    cerr << " --start <n>              Clients in the first step (default: 1)" << endl;
+    cerr << " --step <n>               Clients added at each step (default: 1)" << endl;
+    cerr << " --max <n>                Stop after this many clients (default: 64)" << endl;
+    cerr << " --settle <seconds>       Wait after adding clients, before measuring (default: 3)" << endl;
+    cerr << " --duration <seconds>     Measurement of each step (default: 10)" << endl;
+    cerr << " --max-loss <percent>     Packet loss threshold of the worst client (default: 1)" << endl;
+    cerr << " --max-corrections <n>    Jitter buffer corrections per second threshold (default: 1)" << endl;
+    cerr << " --max-latency <ms>       Round trip latency threshold, needs -p 1 on the hub (default: off)" << endl;
+    cerr << " --hub-pid <pid>          Measure the CPU of the hub process" << endl;
+}
+
+
+//*******************************************************************************
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    LoadSettings settings;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ("--shm" == arg) {
+            settings.sharedMemory = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printUsage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        if ("--peer" == arg) {
+            settings.peer = value;
+        } else if ("--port" == arg) {
+            settings.tcpPort = std::atoi(value);
+        } else if ("--bindport" == arg) {
+            settings.bindPort = std::atoi(value);
+        } else if ("--channels" == arg) {
+            settings.numChans = std::atoi(value);
+        } else if ("--queue" == arg) {
+            settings.queueLength = std::atoi(value);
+        } else if ("--bufstrategy" == arg) {
+            settings.bufferStrategy = std::atoi(value);
+        } else if ("--redundancy" == arg) {
+            settings.redundancy = std::atoi(value);
+        } else if ("--srate" == arg) {
+            settings.sampleRate = std::atoi(value);
+        } else if ("--bufsize" == arg) {
+            settings.bufferSize = std::atoi(value);
+        } else if ("--start" == arg) {
+            settings.startClients = std::atoi(value);
+        } else if ("--step" == arg) {
+            settings.stepClients = std::atoi(value);
+        } else if ("--max" == arg) {
+            settings.maxClients = std::atoi(value);
+        } else if ("--settle" == arg) {
+            settings.settleSec = std::atoi(value);
+        } else if ("--duration" == arg) {
+            settings.durationSec = std::atoi(value);
+        } else if ("--max-loss" == arg) {
+            settings.maxLossPercent = std::atof(value);
+        } else if ("--max-corrections" == arg) {
+            settings.maxCorrectionsPerSec = std::atof(value);
+        } else if ("--max-latency" == arg) {
+            settings.maxLatencyMs = std::atof(value);
+        } else if ("--hub-pid" == arg) {
+            settings.hubPid = std::atoi(value);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (1 > settings.numChans || 1 > settings.queueLength || 1 > settings.redundancy
+            || 0 == settings.sampleRate || 0 == settings.bufferSize
+            || 1 > settings.startClients || 1 > settings.stepClients
+            || settings.startClients > settings.maxClients
+            || 0 > settings.settleSec || 1 > settings.durationSec
+            || 65535 < settings.bindPort + settings.maxClients) {
+        printUsage();
+        return 1;
+    }
+
+    LoadGenerator generator(settings);
+    QTimer::singleShot(0, [&generator]() { generator.start(); });
+    return app.exec();
+}
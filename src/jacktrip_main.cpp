@@ -44,6 +44,7 @@
 #include "jacktrip_globals.h"
 #include "Settings.h"
 #include "UdpHubListener.h"
+#include "RtCheck.h"
 #include <QLoggingCategory>
 
 void qtMessageHandler(__attribute__((unused)) QtMsgType type, __attribute__((unused)) const QMessageLogContext &context, const QString &msg)
@@ -93,6 +94,9 @@ BOOL WINAPI windowsCtrlHandler(DWORD fdwCtrlType)
 
 int main(int argc, char *argv[])
 {
+#ifdef __RTCHECK__
+    RtCheck::install();
+#endif
     QCoreApplication app(argc, argv);
     QScopedPointer<JackTrip> jackTrip;
     QScopedPointer<UdpHubListener> udpHub;
@@ -0,0 +1,687 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+/**
+ * \file jacktrip_sim.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ *
+ * Offline simulation of the jitter buffer strategies. A sender and a receiver,
+ * each a JackTrip with a FileAudioInterface, are connected through a simulated
+ * network on a virtual clock, so a run takes as long as the CPU needs and not
+ * as long as the audio. The network is the NetworkImpairment of jacktrip's
+ * --simloss/--simjitter/--simnet, run on the virtual clock, optionally with
+ * per packet delays from a trace file.
+ * With --replay, the arrivals recorded by --packettrace replace the network:
+ * every recorded datagram reaches the receiver with its recorded spacing.
+ * Each strategy and queue length of the sweep reports its underruns,
+ * overflows and corrections, and the segmental SNR of the received audio
+ * against the sent one.
+ */
+
+#include "FileAudioInterface.h"
+#include "JackTrip.h"
+#include "NetworkImpairment.h"
+#include "PacketTrace.h"
+#include "RingBuffer.h"
+#include "RtCheck.h"
+#include "UdpDataProtocol.h"
+#include "jacktrip_globals.h"
+
+#include <QCoreApplication>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::cout; using std::cerr; using std::endl;
+
+static const double sMinSnrDb = -10.0; ///< Segmental SNR limits, as usual for this metric
+static const double sMaxSnrDb = 35.0;
+static const double sGlitchSnrDb = 10.0; ///< Blocks below this are counted as glitches
+static const double sSilenceEnergy = 1e-6; ///< Mean square of a block under -60 dBFS
+static const double sTailSec = 1.0; ///< Time the receiver keeps running after the last packet is sent
+
+
+//*******************************************************************************
+/// \brief Settings of a simulation, see printUsage()
+struct SimSettings {
+    std::string input;
+    std::string outputPrefix;
+    std::vector<int> strategies = {-1, 0, 1, 2};
+    std::vector<int> queues = {gDefaultQueueLength};
+    int bufferSize = gDefaultBufferSizeInSamples;
+    int numChans = gDefaultNumInChannels;
+    unsigned int redundancy = 1;
+    double lossRate = 0.0;
+    double jitterRate = 0.0;
+    double jitterDelayRel = 1.0; ///< Maximum delay in periods, as in --simjitter
+    std::string tracePath;
+    std::string simnet;
+    std::string replayPath;
+    double skewPpm = 0.0;
+    unsigned int seed = 1;
+    double maxLagMs = 500.0;
+};
+
+
+//*******************************************************************************
+/// \brief UdpDataProtocol whose datagrams come from and go to the simulated network
+class UdpDataProtocolSim : public UdpDataProtocol
+{
+public:
+    UdpDataProtocolSim(JackTrip* jacktrip, runModeT runmode, unsigned int redundancy) :
+        UdpDataProtocol(jacktrip, runmode, 0, 0, redundancy),
+        mCurrentSeq(0), mLastSeq(0), mNewerSeq(0)
+    {
+        mSocket = -1;
+        mFullPacketSize = setupPacketBuffers();
+        // Same sizes as run()
+        mRedundantPacket.resize((RECEIVER == runmode) ? 0x10000 : mFullPacketSize * redundancy, 0);
+        resetPacketCounters();
+    }
+    virtual ~UdpDataProtocolSim() {}
+
+    virtual int sendPacket(const char* buf, const size_t n)
+    {
+        mDatagram.assign(buf, buf + n);
+        return n;
+    }
+    virtual int receivePacket(char* buf, const size_t n)
+    {
+        size_t size = std::min(n, mDatagram.size());
+        std::memcpy(buf, mDatagram.data(), size);
+        return size;
+    }
+
+    /// \brief Takes a period from the send ring buffer, returns the datagram
+    const std::vector<char>& send()
+    {
+        sendPacketRedundancy(mRedundantPacket.data(), mRedundantPacket.size(), mFullPacketSize);
+        return mDatagram;
+    }
+    /// \brief Hands a datagram over to the receive ring buffer
+    void receive(const std::vector<char>& datagram)
+    {
+        mDatagram = datagram;
+        receivePacketRedundancy<DataProtocol::DEFAULT>(mRedundantPacket.data(),
+                                                       mRedundantPacket.size(), mFullPacketSize,
+                                                       mCurrentSeq, mLastSeq, mNewerSeq);
+    }
+
+private:
+    int mFullPacketSize;
+    std::vector<int8_t> mRedundantPacket;
+    std::vector<char> mDatagram;
+    uint16_t mCurrentSeq;
+    uint16_t mLastSeq;
+    uint16_t mNewerSeq;
+};
+
+
+//*******************************************************************************
+/// \brief A datagram of a --packettrace file, relative to the simulated sender
+struct ReplayPacket {
+    int64_t index; ///< Sender packet number of the newest packet in it
+    double delay; ///< Arrival after the send time, in seconds, the smallest is 0
+    int redundancy; ///< Packets in the datagram
+    uint64_t order; ///< Arrival order in the trace
+};
+
+
+//*******************************************************************************
+/** \brief Segmental SNR of the received audio against the sent audio
+ *
+ * Every output block is aligned to the reference with the lag that fits it
+ * best, searched around the previous lag, and over the whole range when that
+ * doesn't fit anymore. So the latency changes of the jitter buffer only count
+ * where they break the audio, not for the whole block after them. The output
+ * before the first sound and the silent reference blocks are not measured.
+ */
+class QualityMeter
+{
+public:
+    QualityMeter(const std::vector<float>& reference, int block_size, int max_lag) :
+        mReference(reference), mBlockSize(block_size), mMaxLag(max_lag),
+        mLag(-1), mStarted(false), mSnrSum(0.0), mLagSum(0.0),
+        mMeasuredBlocks(0), mAlignedBlocks(0), mGlitchBlocks(0) {}
+
+    void addBlock(size_t position, const float* output)
+    {
+        if (!mStarted) {
+            double energy = 0.0;
+            for (int i = 0; i < mBlockSize; ++i) {
+                energy += output[i] * output[i];
+            }
+            // The first block with sound is only partly sound
+            mStarted = (sSilenceEnergy <= energy / mBlockSize);
+            return;
+        }
+        if (0 <= mLag && position - mLag + mBlockSize > mReference.size()) {
+            return; // The reference has ended, what comes now is the tail of the run
+        }
+
+        double snr = -1e9;
+        double ref_energy = 0.0;
+        int lag = -1;
+        if (0 <= mLag) {
+            search(position, output, mLag - mBlockSize, mLag + mBlockSize, &lag, &snr, &ref_energy);
+        }
+        if (sGlitchSnrDb > snr) {
+            int full_lag = -1;
+            double full_snr = -1e9;
+            double full_energy = 0.0;
+            search(position, output, 0, mMaxLag, &full_lag, &full_snr, &full_energy);
+            if (full_snr > snr) {
+                lag = full_lag;
+                snr = full_snr;
+                ref_energy = full_energy;
+            }
+        }
+        if (0 > lag) {
+            return; // Past the end of the reference
+        }
+        if (sSilenceEnergy > ref_energy / mBlockSize) {
+            return;
+        }
+        snr = std::max(sMinSnrDb, std::min(sMaxSnrDb, snr));
+        mSnrSum += snr;
+        ++mMeasuredBlocks;
+        if (sGlitchSnrDb > snr) {
+            // The lag of a broken block means nothing, keep the last good one
+            ++mGlitchBlocks;
+        } else {
+            mLag = lag;
+            mLagSum += lag;
+            ++mAlignedBlocks;
+        }
+    }
+
+    double getSegmentalSnr() const { return (0 < mMeasuredBlocks) ? mSnrSum / mMeasuredBlocks : 0.0; }
+    double getMeanLag() const { return (0 < mAlignedBlocks) ? mLagSum / mAlignedBlocks : -1.0; }
+    uint64_t getGlitchBlocks() const { return mGlitchBlocks; }
+    uint64_t getMeasuredBlocks() const { return mMeasuredBlocks; }
+
+private:
+    void search(size_t position, const float* output, int min_lag, int max_lag,
+                int* best_lag, double* best_snr, double* best_ref_energy) const
+    {
+        min_lag = std::max(0, min_lag);
+        max_lag = std::min<int>(max_lag, position);
+        for (int lag = min_lag; lag <= max_lag; ++lag) {
+            size_t start = position - lag;
+            if (start + mBlockSize > mReference.size()) {
+                continue;
+            }
+            const float* ref = mReference.data() + start;
+            double ref_energy = 0.0;
+            double error = 0.0;
+            for (int i = 0; i < mBlockSize; ++i) {
+                double diff = output[i] - ref[i];
+                ref_energy += ref[i] * ref[i];
+                error += diff * diff;
+            }
+            double snr = 10.0 * std::log10((ref_energy + 1e-20) / (error + 1e-20));
+            if (snr > *best_snr) {
+                *best_snr = snr;
+                *best_lag = lag;
+                *best_ref_energy = ref_energy;
+            }
+        }
+    }
+
+    const std::vector<float>& mReference;
+    int mBlockSize;
+    int mMaxLag;
+    int mLag; ///< -1 until the first block is aligned
+    bool mStarted;
+    double mSnrSum;
+    double mLagSum;
+    uint64_t mMeasuredBlocks;
+    uint64_t mAlignedBlocks; ///< Measured blocks that are not glitches
+    uint64_t mGlitchBlocks;
+};
+
+
+//*******************************************************************************
+struct SimResult {
+    int strategy;
+    int queue;
+    bool valid;
+    uint32_t underruns;
+    uint32_t overflows;
+    uint32_t corrections; ///< Jitter buffer size changes
+    uint32_t lost;
+    uint32_t revived;
+    double segSnrDb;
+    double glitchesPerMin;
+    double latencyMs;
+    double speed; ///< Audio seconds simulated per second of CPU
+};
+
+
+//*******************************************************************************
+/// \brief One end of the link, with the FileAudioInterface owned by the JackTrip
+static JackTrip* newJackTrip(const SimSettings& settings, int strategy, int queue,
+                             uint32_t sample_rate, const std::string& input,
+                             FileAudioInterface** audio)
+{
+    JackTrip* jacktrip = new JackTrip(JackTrip::CLIENT, JackTrip::UDP, settings.numChans,
+                                      queue, settings.redundancy, AudioInterface::BIT16);
+    *audio = new FileAudioInterface(jacktrip, settings.numChans, AudioInterface::BIT16);
+    jacktrip->setAudioInterface(*audio);
+    if (!input.empty()) {
+        (*audio)->openInput(input);
+        sample_rate = (*audio)->getSampleRate();
+    }
+    (*audio)->setSampleRate(sample_rate);
+    (*audio)->setBufferSizeInSamples(settings.bufferSize);
+    (*audio)->setup();
+    jacktrip->setSampleRate(sample_rate);
+    jacktrip->setAudioBufferSizeInSamples(settings.bufferSize);
+    jacktrip->setBufferStrategy(strategy);
+    jacktrip->setupRingBuffers();
+    return jacktrip;
+}
+
+
+//*******************************************************************************
+static SimResult runSimulation(const SimSettings& settings, const NetworkImpairment::Model& model,
+                               const std::vector<ReplayPacket>& replay, int strategy, int queue)
+{
+    SimResult result;
+    std::memset(&result, 0, sizeof(result));
+    result.strategy = strategy;
+    result.queue = queue;
+
+    FileAudioInterface* tx_audio = NULL;
+    FileAudioInterface* rx_audio = NULL;
+    JackTrip* tx = newJackTrip(settings, -1, gDefaultQueueLength, 0, settings.input, &tx_audio);
+    uint32_t sample_rate = tx_audio->getSampleRate();
+    JackTrip* rx = NULL;
+    try {
+        rx = newJackTrip(settings, strategy, queue, sample_rate, "", &rx_audio);
+    } catch (const std::invalid_argument& e) {
+        // E.g., auto queue with the plain ring buffer
+        cerr << "Strategy " << strategy << " queue " << queue << ": " << e.what() << endl;
+        delete tx;
+        return result;
+    }
+    rx_audio->setRecordOutput(!settings.outputPrefix.empty());
+
+    UdpDataProtocolSim sender(tx, DataProtocol::SENDER, settings.redundancy);
+    UdpDataProtocolSim receiver(rx, DataProtocol::RECEIVER, settings.redundancy);
+    const double tx_period = double(settings.bufferSize) / sample_rate;
+    const double rx_period = tx_period * (1.0 + settings.skewPpm * 1e-6);
+    NetworkImpairment::Model link_model = model;
+    link_model.jitterMaxDelaySec = settings.jitterDelayRel * tx_period;
+    NetworkImpairment network(link_model, settings.seed);
+    std::vector<float> reference = tx_audio->getInputMono();
+    QualityMeter meter(reference, settings.bufferSize,
+                       std::lround(settings.maxLagMs * 1e-3 * sample_rate));
+
+    struct Arrival {
+        double time;
+        uint64_t order;
+        std::vector<char> datagram;
+        bool operator<(const Arrival& other) const
+        { return time > other.time || (time == other.time && order > other.order); }
+    };
+    std::priority_queue<Arrival> in_flight;
+    std::vector<char> arrival(0x10000);
+    std::vector<int8_t> slot(rx->getRingBuffersSlotSize());
+    std::vector<float> mono(settings.bufferSize);
+    bool sending = true;
+    bool received = false;
+    double end_time = 0.0;
+    uint64_t tx_count = 0;
+    uint64_t rx_count = 0;
+    size_t replay_index = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (;;) {
+        double tx_time = tx_count * tx_period;
+        // Half a period apart, so the order of the two ends doesn't depend on rounding
+        double rx_time = (rx_count + 0.5) * rx_period;
+        if (sending && tx_time <= rx_time) {
+            sending = tx_audio->processPeriod();
+            const std::vector<char>& datagram = sender.send();
+            if (!replay.empty()) {
+                // Sorted by index, a packet can arrive more than once or never
+                for (; replay_index < replay.size() && (int64_t)tx_count == replay[replay_index].index;
+                     ++replay_index) {
+                    const ReplayPacket& packet = replay[replay_index];
+                    // The sender sends the largest redundancy of the trace, newest packet first
+                    size_t size = std::min(datagram.size(),
+                                           datagram.size() / settings.redundancy * packet.redundancy);
+                    in_flight.push(Arrival{tx_time + packet.delay, packet.order,
+                                           std::vector<char>(datagram.begin(), datagram.begin() + size)});
+                }
+                sending = sending && replay_index < replay.size();
+            } else {
+                network.push(datagram.data(), datagram.size(), std::llround(tx_time * 1e9));
+            }
+            ++tx_count;
+            if (!sending) {
+                end_time = tx_time + sTailSec;
+            }
+            continue;
+        }
+        if (!sending && rx_time > end_time) {
+            break;
+        }
+        while (network.available(std::llround(rx_time * 1e9))) {
+            double release_time = network.getReleaseNs() * 1e-9;
+            arrival.resize(arrival.capacity());
+            arrival.resize(network.receive(arrival.data(), arrival.size()));
+            in_flight.push(Arrival{release_time, tx_count, arrival});
+        }
+        while (!in_flight.empty() && in_flight.top().time <= rx_time) {
+            if (!received) {
+                // Count from the first packet on, not the wait for it
+                DataProtocol::PktStat pkt_stat;
+                RingBuffer::IOStat io_stat;
+                receiver.getStats(&pkt_stat);
+                rx->getReceiveRingBuffer()->getStats(&io_stat, true);
+                received = true;
+            }
+            receiver.receive(in_flight.top().datagram);
+            in_flight.pop();
+        }
+        rx_audio->processPeriod();
+        // The receiver doesn't send, keep its send ring buffer from overflowing
+        rx->getSendRingBuffer()->readSlotNonBlocking(slot.data());
+        const QVarLengthArray<sample_t*>& output = rx_audio->getOutputBuffer();
+        for (int i = 0; i < settings.bufferSize; ++i) {
+            float sum = 0.0f;
+            for (int c = 0; c < settings.numChans; ++c) {
+                sum += output[c][i];
+            }
+            mono[i] = sum / settings.numChans;
+        }
+        meter.addBlock(rx_count * settings.bufferSize, mono.data());
+        ++rx_count;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    DataProtocol::PktStat pkt_stat;
+    RingBuffer::IOStat io_stat;
+    receiver.getStats(&pkt_stat);
+    rx->getReceiveRingBuffer()->getStats(&io_stat, false);
+    result.valid = true;
+    result.underruns = io_stat.underruns;
+    result.overflows = io_stat.overflows;
+    result.corrections = io_stat.buf_inc_underrun + io_stat.buf_inc_compensate
+            + io_stat.buf_dec_overflows + io_stat.buf_dec_pktloss;
+    result.lost = pkt_stat.lost;
+    result.revived = pkt_stat.revived;
+    result.segSnrDb = meter.getSegmentalSnr();
+    double measured_min = meter.getMeasuredBlocks() * tx_period / 60.0;
+    result.glitchesPerMin = (0.0 < measured_min) ? meter.getGlitchBlocks() / measured_min : 0.0;
+    result.latencyMs = (0.0 <= meter.getMeanLag()) ? 1000.0 * meter.getMeanLag() / sample_rate : -1.0;
+    result.speed = rx_count * rx_period / std::max(elapsed, 1e-9);
+
+    if (!settings.outputPrefix.empty()) {
+        rx_audio->writeOutput(settings.outputPrefix + "_s" + std::to_string(strategy)
+                              + "_q" + std::to_string(queue) + ".wav");
+    }
+    delete rx;
+    delete tx;
+    return result;
+}
+
+
+//*******************************************************************************
+/** \brief Reads a --packettrace file and takes the period, channels and
+ * redundancy of the sender from it
+ *
+ * The kernel timestamps are used when every record has one from the same
+ * clock, the receive thread times otherwise. The delays keep the recorded
+ * spacing of the arrivals against the sender period, shifted so the fastest
+ * datagram takes no time.
+ */
+static std::vector<ReplayPacket> readReplay(const std::string& path, SimSettings* settings)
+{
+    PacketTrace::FileHeader header;
+    std::vector<PacketTrace::Record> records;
+    PacketTrace::read(path, &header, &records);
+    if (records.empty() || 0 == header.SampleRate || 0 == header.BufferSize) {
+        throw std::runtime_error("Empty trace " + path);
+    }
+    if (DataProtocol::DEFAULT != header.HeaderType || 1 != header.Aggregation) {
+        cerr << "WARNING: " << path << " was recorded with another packet header or aggregation, "
+             << "only the arrival times are replayed" << endl;
+    }
+    bool kernel_clock = true;
+    for (const PacketTrace::Record& record : records) {
+        if (0 == record.KernelNs
+                || (record.Flags & PacketTrace::sHardwareTimestamp)
+                != (records[0].Flags & PacketTrace::sHardwareTimestamp)) {
+            kernel_clock = false;
+            break;
+        }
+    }
+    settings->bufferSize = header.BufferSize * std::max<int>(1, header.Aggregation);
+    settings->numChans = header.NumChannels;
+    settings->redundancy = 1;
+    const double period = double(settings->bufferSize) / header.SampleRate;
+
+    // Unwrap the sequence numbers in arrival order
+    std::vector<ReplayPacket> replay(records.size());
+    int64_t index = 0;
+    int64_t first_index = 0;
+    double min_delay = 0.0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const PacketTrace::Record& record = records[i];
+        if (0 < i) {
+            index += (int16_t)(record.SeqNumber - records[i-1].SeqNumber);
+        }
+        int64_t time_ns = kernel_clock ? record.KernelNs - records[0].KernelNs
+                                       : record.MonotonicNs - records[0].MonotonicNs;
+        replay[i].index = index;
+        replay[i].delay = time_ns * 1e-9 - index * period;
+        replay[i].redundancy = std::max<int>(1, record.Redundancy);
+        replay[i].order = i;
+        first_index = std::min(first_index, index);
+        min_delay = (0 == i) ? replay[i].delay : std::min(min_delay, replay[i].delay);
+        settings->redundancy = std::max<unsigned int>(settings->redundancy, replay[i].redundancy);
+    }
+    for (ReplayPacket& packet : replay) {
+        packet.delay -= min_delay;
+        packet.index -= first_index;
+    }
+    std::stable_sort(replay.begin(), replay.end(), [](const ReplayPacket& a, const ReplayPacket& b) {
+        return a.index < b.index;
+    });
+    cout << "Replaying " << records.size() << " datagrams of " << path << " ("
+         << (kernel_clock ? "kernel" : "receive thread") << " timestamps, "
+         << header.SampleRate << " Hz, " << settings->bufferSize << " frames, redundancy "
+         << settings->redundancy << ")" << endl;
+    return replay;
+}
+
+
+//*******************************************************************************
+static std::vector<int> parseList(const char* text)
+{
+    std::vector<int> values;
+    std::istringstream fields(text);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        values.push_back(std::atoi(field.c_str()));
+    }
+    return values;
+}
+
+
+//*******************************************************************************
+static void printUsage()
+{
+    cerr << "Usage: jacktrip-sim --input <file.wav> [options]" << endl;
+    cerr << " --input <file.wav>         Audio sent through the simulated link" << endl;
+    cerr << " --output <prefix>          Write the received audio to <prefix>_s<strategy>_q<queue>.wav" << endl;
+    cerr << " --bufstrategies <list>     Strategies to compare, -1 is the plain ring buffer (default: -1,0,1,2)" << endl;
+    cerr << " --queues <list>            Queue lengths, negative for AutoQueue (default: " << gDefaultQueueLength << ")" << endl;
+    cerr << " --bufsize <n>              Period in frames (default: " << gDefaultBufferSizeInSamples << ")" << endl;
+    cerr << " --channels <n>             Channels (default: " << gDefaultNumInChannels << ")" << endl;
+    cerr << " --redundancy <n>           Redundancy (default: 1)" << endl;
+    cerr << " --simloss <rate>           Packet loss, as in jacktrip" << endl;
+    cerr << " --simjitter <rate>,<d>     Jitter, d is the max delay in packets, as in jacktrip" << endl;
+    cerr << " --simnet <list>            Bursty loss, Pareto delay, reordering..., as in jacktrip" << endl;
+    cerr << " --trace <file>             One way delay in ms per packet, '-' if lost, looped" << endl;
+    cerr << " --replay <file>            Arrivals recorded with jacktrip --packettrace instead of the network," << endl;
+    cerr << "                            also sets --bufsize, --channels and --redundancy" << endl;
+    cerr << " --skew <ppm>               Receiver clock skew against the sender (default: 0)" << endl;
+    cerr << " --seed <n>                 Seed of the loss and jitter (default: 1)" << endl;
+    cerr << " --max-lag <ms>             Longest latency the quality meter looks for (default: 500)" << endl;
+}
+
+
+//*******************************************************************************
+int main(int argc, char* argv[])
+{
+#ifdef __RTCHECK__
+    RtCheck::install();
+#endif
+    QCoreApplication app(argc, argv);
+    SimSettings settings;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            printUsage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        if ("--input" == arg) {
+            settings.input = value;
+        } else if ("--output" == arg) {
+            settings.outputPrefix = value;
+        } else if ("--bufstrategies" == arg) {
+            settings.strategies = parseList(value);
+        } else if ("--queues" == arg) {
+            settings.queues = parseList(value);
+        } else if ("--bufsize" == arg) {
+            settings.bufferSize = std::atoi(value);
+        } else if ("--channels" == arg) {
+            settings.numChans = std::atoi(value);
+        } else if ("--redundancy" == arg) {
+            settings.redundancy = std::atoi(value);
+        } else if ("--simloss" == arg) {
+            settings.lossRate = std::atof(value);
+        } else if ("--simjitter" == arg) {
+            char* endp;
+            settings.jitterRate = std::strtod(value, &endp);
+            settings.jitterDelayRel = (0 == *endp) ? 1.0 : std::atof(endp + 1);
+        } else if ("--simnet" == arg) {
+            settings.simnet = value;
+        } else if ("--trace" == arg) {
+            settings.tracePath = value;
+        } else if ("--replay" == arg) {
+            settings.replayPath = value;
+        } else if ("--skew" == arg) {
+            settings.skewPpm = std::atof(value);
+        } else if ("--seed" == arg) {
+            settings.seed = std::atoi(value);
+        } else if ("--max-lag" == arg) {
+            settings.maxLagMs = std::atof(value);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (settings.input.empty() || settings.strategies.empty() || settings.queues.empty()
+            || 1 > settings.bufferSize || 1 > settings.numChans || 1 > settings.redundancy) {
+        printUsage();
+        return 1;
+    }
+    if (!settings.replayPath.empty()
+            && (!settings.tracePath.empty() || !settings.simnet.empty()
+                || 0.0 < settings.lossRate || 0.0 < settings.jitterRate)) {
+        cerr << "--replay replaces --trace, --simloss, --simjitter and --simnet" << endl;
+        return 1;
+    }
+    for (int strategy : settings.strategies) {
+        if (-1 > strategy || 2 < strategy) {
+            cerr << "Unsupported buffer strategy " << strategy << endl;
+            return 1;
+        }
+    }
+
+    std::vector<SimResult> results;
+    try {
+        NetworkImpairment::Model model;
+        NetworkImpairment::parseModel(settings.simnet, &model);
+        if (!settings.tracePath.empty()) {
+            model.traceDelaysSec = NetworkImpairment::readDelayTrace(settings.tracePath);
+        }
+        model.lossRate = settings.lossRate;
+        model.jitterRate = settings.jitterRate;
+        std::vector<ReplayPacket> replay;
+        if (!settings.replayPath.empty()) {
+            replay = readReplay(settings.replayPath, &settings);
+        }
+        for (int queue : settings.queues) {
+            for (int strategy : settings.strategies) {
+                results.push_back(runSimulation(settings, model, replay, strategy, queue));
+            }
+        }
+    } catch (const std::exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return 1;
+    }
+
+    // After the runs, which print their own setup messages
+    cout << gPrintSeparator << endl;
+    cout << "strategy  queue  underruns  overflows  corrections   lost  revived  segSNR dB  glitch/min  latency ms   speed" << endl;
+    for (const SimResult& result : results) {
+        char line[160];
+        if (!result.valid) {
+            std::snprintf(line, sizeof(line), "%8d  %5d  not supported", result.strategy, result.queue);
+        } else {
+            std::snprintf(line, sizeof(line),
+                          "%8d  %5d  %9u  %9u  %11u  %5u  %7u  %9.2f  %10.1f  %10.1f  %6.0fx",
+                          result.strategy, result.queue, result.underruns, result.overflows,
+                          result.corrections, result.lost, result.revived, result.segSnrDb,
+                          result.glitchesPerMin, result.latencyMs, result.speed);
+        }
+        cout << line << endl;
+    }
+    return 0;
+}
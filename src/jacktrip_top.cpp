@@ -0,0 +1,227 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+
+/**
+ * \file jacktrip_top.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ *
+ * Live view of the sessions of the JackTrip processes on this host that run
+ * with --statsshm. It only maps their StatsSegment read-only, the processes
+ * don't know they are observed.
+ */
+
+#include "StatsSegment.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+
+using std::cout; using std::cerr; using std::endl;
+
+namespace {
+
+struct Row {
+    int pid;
+    StatsSegment::SessionStats stats;
+};
+
+enum SortKey { SORT_SESSION, SORT_LOSS, SORT_UNDERRUNS, SORT_LEVEL };
+
+//*******************************************************************************
+double lossRate(const StatsSegment::SessionStats& stats)
+{
+    uint64_t expected = stats.packets + stats.lost;
+    return (0 < expected) ? static_cast<double>(stats.lost) / expected : 0.0;
+}
+
+
+//*******************************************************************************
+uint64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+//*******************************************************************************
+std::vector<Row> collect(int only_pid)
+{
+    std::vector<Row> rows;
+    std::vector<int> pids = StatsSegment::list();
+    for (size_t p = 0; p < pids.size(); ++p) {
+        // Skip the segments left over by crashed processes
+        if ((0 != only_pid && only_pid != pids[p]) || 0 != ::kill(pids[p], 0)) {
+            continue;
+        }
+        std::unique_ptr<StatsSegment> segment(StatsSegment::open(pids[p]));
+        if (!segment) {
+            continue;
+        }
+        for (int i = 0; i < StatsSegment::sMaxSessions; ++i) {
+            Row row;
+            row.pid = pids[p];
+            if (segment->read(i, &row.stats)) {
+                row.stats.session[sizeof(row.stats.session) - 1] = '\0';
+                row.stats.peer[sizeof(row.stats.peer) - 1] = '\0';
+                row.stats.client[sizeof(row.stats.client) - 1] = '\0';
+                rows.push_back(row);
+            }
+        }
+    }
+    return rows;
+}
+
+
+//*******************************************************************************
+void sortRows(std::vector<Row>& rows, SortKey key)
+{
+    std::stable_sort(rows.begin(), rows.end(), [key](const Row& a, const Row& b) {
+        switch (key) {
+        case SORT_LOSS:
+            return lossRate(a.stats) > lossRate(b.stats);
+        case SORT_UNDERRUNS:
+            return a.stats.underruns > b.stats.underruns;
+        case SORT_LEVEL:
+            return a.stats.queueLevel > b.stats.queueLevel;
+        default:
+            if (a.pid != b.pid) {
+                return a.pid < b.pid;
+            }
+            return std::atoi(a.stats.session) < std::atoi(b.stats.session);
+        }
+    });
+}
+
+
+//*******************************************************************************
+void printRows(const std::vector<Row>& rows)
+{
+    uint64_t now_us = nowUs();
+    std::printf("%-7s %-4s %-22s %-16s %10s %6s %7s %7s %7s %5s %5s %11s %11s %11s %4s\n",
+                "PID", "SES", "PEER", "CLIENT", "PACKETS", "LOSS%", "REVIVED",
+                "UNDERR", "OVERFL", "LEVEL", "SKEW", "CB99/MAX", "ARR99/MAX", "AGE99/MAX", "UPD");
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const StatsSegment::SessionStats& s = rows[i].stats;
+        char cb[32], arrival[32], age[32];
+        std::snprintf(cb, sizeof(cb), "%llu/%llu",
+                      (unsigned long long)s.callback.p99, (unsigned long long)s.callback.max);
+        std::snprintf(arrival, sizeof(arrival), "%llu/%llu",
+                      (unsigned long long)s.arrival.p99, (unsigned long long)s.arrival.max);
+        std::snprintf(age, sizeof(age), "%llu/%llu",
+                      (unsigned long long)s.age.p99, (unsigned long long)s.age.max);
+        unsigned long long updated = (now_us > s.updatedUs) ? (now_us - s.updatedUs) / 1000000 : 0;
+        std::printf("%-7d %-4s %-22.22s %-16.16s %10llu %6.2f %7llu %7llu %7llu %5lld %5lld %11s %11s %11s %3llus\n",
+                    rows[i].pid, s.session, s.peer, s.client,
+                    (unsigned long long)s.packets, 100.0 * lossRate(s),
+                    (unsigned long long)s.revived, (unsigned long long)s.underruns,
+                    (unsigned long long)s.overflows, (long long)s.queueLevel,
+                    (long long)s.skew, cb, arrival, age, updated);
+    }
+    if (rows.empty()) {
+        std::printf("No sessions, is jacktrip running with --statsshm?\n");
+    }
+    std::fflush(stdout);
+}
+
+
+//*******************************************************************************
+void printUsage()
+{
+    cerr << "Usage: jacktrip-top [options]" << endl;
+    cerr << " -s session|loss|underruns|level   Sort key (default: session)" << endl;
+    cerr << " -d <seconds>                      Refresh interval (default: 1)" << endl;
+    cerr << " -p <pid>                          Only this process" << endl;
+    cerr << " -1                                Print once and exit" << endl;
+    cerr << "Latencies are in microseconds, see --iostat in jacktrip -h." << endl;
+}
+
+} // namespace
+
+
+//*******************************************************************************
+int main(int argc, char* argv[])
+{
+    SortKey key = SORT_SESSION;
+    double interval = 1.0;
+    int only_pid = 0;
+    bool once = false;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == std::strcmp(argv[i], "-1")) {
+            once = true;
+        } else if (0 == std::strcmp(argv[i], "-s") && i + 1 < argc) {
+            std::string name = argv[++i];
+            if ("session" == name) {
+                key = SORT_SESSION;
+            } else if ("loss" == name) {
+                key = SORT_LOSS;
+            } else if ("underruns" == name) {
+                key = SORT_UNDERRUNS;
+            } else if ("level" == name) {
+                key = SORT_LEVEL;
+            } else {
+                printUsage();
+                return 1;
+            }
+        } else if (0 == std::strcmp(argv[i], "-d") && i + 1 < argc) {
+            interval = std::max(0.1, std::atof(argv[++i]));
+        } else if (0 == std::strcmp(argv[i], "-p") && i + 1 < argc) {
+            only_pid = std::atoi(argv[++i]);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    for (;;) {
+        std::vector<Row> rows = collect(only_pid);
+        sortRows(rows, key);
+        if (!once) {
+            // Home and clear the screen
+            std::printf("\033[H\033[2J");
+        }
+        printRows(rows);
+        if (once) {
+            return 0;
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+    }
+}
@@ -0,0 +1,233 @@
+//*****************************************************************
+/*
+  JackTrip: A System for High-Quality Audio Network Performance
+  over the Internet
+
+  Copyright (c) 2020 Juan-Pablo Caceres, Chris Chafe.
+  SoundWIRE group at CCRMA, Stanford University.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use,
+  copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following
+  conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+  OTHER DEALINGS IN THE SOFTWARE.
+*/
+//*****************************************************************
+
+
+/**
+ * \file jacktrip_xdp_bench.cpp
+ * \author JackTrip contributors
+ * \date October 2020
+ *
+ * Datagrams per second (and per CPU second) through AF_XDP against the kernel
+ * UDP path. Run a receiver and a sender on the two ends of a link, see
+ * scripts/test/xdp_veth_bench.sh for a veth pair between network namespaces.
+ */
+
+#include "XdpSocket.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+using std::cout; using std::cerr; using std::endl;
+
+//*******************************************************************************
+static double cpuSeconds()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+
+//*******************************************************************************
+static double now()
+{
+    return std::chrono::duration<double>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//*******************************************************************************
+static void printUsage()
+{
+    cerr << "Usage: jacktrip-xdp-bench send|recv <local_ip> <peer_ip> [options]" << endl;
+    cerr << " -i <interface>   Use AF_XDP on the interface, the kernel UDP path otherwise" << endl;
+    cerr << " -q <queue>       First queue to bind (default: 0)" << endl;
+    cerr << " -s <bytes>       Datagram size (default: 528, 128 16-bit stereo samples and a header)" << endl;
+    cerr << " -t <seconds>     Duration (default: 5)" << endl;
+    cerr << " -p <port>        UDP port on both ends (default: 4464)" << endl;
+}
+
+
+//*******************************************************************************
+int main(int argc, char* argv[])
+{
+    if (4 > argc || (0 != std::strcmp(argv[1], "send") && 0 != std::strcmp(argv[1], "recv"))) {
+        printUsage();
+        return 1;
+    }
+    bool sender = (0 == std::strcmp(argv[1], "send"));
+    std::string ifname;
+    int queue = 0;
+    size_t size = 528;
+    double duration = 5.0;
+    int port = 4464;
+    for (int i = 4; i + 1 < argc; i += 2) {
+        if (0 == std::strcmp(argv[i], "-i")) {
+            ifname = argv[i+1];
+        } else if (0 == std::strcmp(argv[i], "-q")) {
+            queue = std::atoi(argv[i+1]);
+        } else if (0 == std::strcmp(argv[i], "-s")) {
+            size = std::max(4, std::atoi(argv[i+1]));
+        } else if (0 == std::strcmp(argv[i], "-t")) {
+            duration = std::atof(argv[i+1]);
+        } else if (0 == std::strcmp(argv[i], "-p")) {
+            port = std::atoi(argv[i+1]);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    // Same setup as UdpDataProtocol: a bound and connected socket
+    struct sockaddr_in local;
+    struct sockaddr_in peer;
+    std::memset(&local, 0, sizeof(local));
+    std::memset(&peer, 0, sizeof(peer));
+    local.sin_family = peer.sin_family = AF_INET;
+    local.sin_port = peer.sin_port = htons(port);
+    if (1 != ::inet_pton(AF_INET, argv[2], &local.sin_addr)
+            || 1 != ::inet_pton(AF_INET, argv[3], &peer.sin_addr)) {
+        printUsage();
+        return 1;
+    }
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (0 != ::bind(fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local))
+            || 0 != ::connect(fd, reinterpret_cast<struct sockaddr*>(&peer), sizeof(peer))) {
+        cerr << "Could not bind and connect the UDP socket" << endl;
+        return 1;
+    }
+    XdpSocket* xdp = NULL;
+    if (!ifname.empty()) {
+        xdp = XdpSocket::create(ifname, queue, fd);
+        if (NULL == xdp) {
+            return 1;
+        }
+        cout << "AF_XDP on " << ifname << " queue " << xdp->getQueue()
+             << (xdp->isZeroCopy() ? " (zero-copy)" : " (copy mode)") << endl;
+    }
+
+    std::vector<char> buf(0x10000, 0);
+    XdpSocket::Segment segment = {buf.data(), buf.size()};
+    uint32_t seq = 0;
+    uint64_t count = 0;
+    uint64_t xdp_count = 0;
+    uint32_t max_seq = 0;
+    double start = 0.0;
+    double cpu_start = 0.0;
+
+    if (sender) {
+        // The receiver greets first, so that the AF_XDP socket learns the next hop
+        while (NULL != xdp ? 0 > xdp->receive(buf.data(), buf.size())
+                           : 0 >= ::recv(fd, buf.data(), buf.size(), MSG_DONTWAIT)) {
+            ::usleep(1000);
+        }
+        segment.size = size;
+        start = now();
+        cpu_start = cpuSeconds();
+        while (duration + 1.0 > now() - start) {
+            std::memcpy(buf.data(), &seq, sizeof(seq));
+            if (NULL != xdp && 0 <= xdp->send(&segment, 1)) {
+                ++xdp_count;
+            } else if (0 > ::send(fd, buf.data(), size, 0)) {
+                continue;
+            }
+            ++seq;
+            ++count;
+        }
+    } else {
+        // Greet until the first datagram, then count for the duration
+        double last_hello = 0.0;
+        while (0 == count) {
+            int n = -1;
+            if (NULL != xdp && xdp->available()) {
+                n = xdp->receive(buf.data(), buf.size());
+            } else {
+                n = ::recv(fd, buf.data(), buf.size(), MSG_DONTWAIT);
+            }
+            if (4 <= n) {
+                count = 1;
+            } else if (0.1 < now() - last_hello) {
+                ::send(fd, "hello", 5, 0);
+                last_hello = now();
+            }
+        }
+        start = now();
+        cpu_start = cpuSeconds();
+        while (duration > now() - start) {
+            int n;
+            bool from_xdp = (NULL != xdp && xdp->available());
+            if (from_xdp) {
+                n = xdp->receive(buf.data(), buf.size());
+            } else {
+                n = ::recv(fd, buf.data(), buf.size(), MSG_DONTWAIT);
+            }
+            if (4 > n) {
+                continue;
+            }
+            std::memcpy(&seq, buf.data(), sizeof(seq));
+            max_seq = std::max(max_seq, seq);
+            ++count;
+            if (from_xdp) {
+                ++xdp_count;
+            }
+        }
+    }
+    double elapsed = now() - start;
+    double cpu = cpuSeconds() - cpu_start;
+
+    // One line of JSON, easy to collect from the script
+    cout << "{\"mode\": \"" << argv[1] << "\", \"path\": \"" << (NULL == xdp ? "socket" : "xdp")
+         << "\", \"size\": " << size << ", \"datagrams\": " << count
+         << ", \"xdp_datagrams\": " << xdp_count
+         << ", \"seconds\": " << elapsed << ", \"cpu_seconds\": " << cpu
+         << ", \"datagrams_per_second\": " << static_cast<uint64_t>(count / elapsed)
+         << ", \"datagrams_per_cpu_second\": " << static_cast<uint64_t>(0.0 < cpu ? count / cpu : 0);
+    if (!sender) {
+        cout << ", \"lost\": " << (max_seq + 1 > count ? max_seq + 1 - count : 0);
+    }
+    cout << "}" << endl;
+
+    delete xdp;
+    ::close(fd);
+    return 0;
+}